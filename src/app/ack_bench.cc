@@ -0,0 +1,246 @@
+#include <getopt.h>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <variant>
+#include <algorithm>
+
+#include "protocol.hh"
+#include "serialization.hh"
+#include "conversion.hh"
+
+using namespace std;
+using namespace chrono;
+
+void print_usage(const string & program_name)
+{
+  cerr <<
+  "Usage: " << program_name << " [options]\n\n"
+  "Reports the throughput of parsing serialized feedback messages and\n"
+  "dispatching them on the message type: by value with parse_msg() and\n"
+  "std::visit(), and with a heap-allocated message per feedback downcast with\n"
+  "dynamic_pointer_cast (as the virtual Msg hierarchy did before).\n\n"
+  "Options:\n"
+  "--msgs <N>           distinct feedback messages to parse in a round\n"
+  "                     (default: 1024)\n"
+  "--receipts <N>       receipts per feedback message (default: 16)\n"
+  "--rounds <N>         rounds of parsing all the messages (default: 10000)"
+  << endl;
+}
+
+// the previous dispatch: a virtual message hierarchy, allocated per message
+namespace legacy {
+  struct Msg
+  {
+    MsgType type {MsgType::INVALID};
+
+    Msg(const MsgType _type) : type(_type) {}
+    virtual ~Msg() {}
+  };
+
+  struct FeedbackMsg : Msg
+  {
+    FeedbackMsg() : Msg(MsgType::FEEDBACK) {}
+    ::FeedbackMsg feedback {};
+  };
+
+  struct ConfigMsg : Msg
+  {
+    ConfigMsg() : Msg(MsgType::CONFIG) {}
+    ::ConfigMsg config {};
+  };
+
+  shared_ptr<Msg> parse_from_string(const string_view binary)
+  {
+    if (binary.size() < sizeof(MsgType)) {
+      return nullptr;
+    }
+
+    WireParser parser(binary);
+    const auto type = static_cast<MsgType>(parser.read_uint8());
+
+    if (type == MsgType::FEEDBACK) {
+      auto ret = make_shared<FeedbackMsg>();
+      auto & feedback = ret->feedback;
+      feedback.stream_id = parser.read_uint8();
+      feedback.cum_seq_num = parser.read_uint32();
+      feedback.highest_seq_num = parser.read_uint32();
+      feedback.sack_bitmap = parser.read_uint64();
+      feedback.feedback_ts = parser.read_uint64();
+      feedback.ref_frame_id = parser.read_uint32();
+      feedback.num_receipts = parser.read_uint8();
+
+      if (feedback.num_receipts > ::FeedbackMsg::MAX_RECEIPTS) {
+        return nullptr;
+      }
+
+      for (size_t i = 0; i < feedback.num_receipts; i++) {
+        feedback.receipts[i].seq_num = parser.read_uint32();
+        feedback.receipts[i].send_ts = parser.read_uint64();
+        feedback.receipts[i].recv_ts = parser.read_uint64();
+      }
+      return ret;
+    }
+    else if (type == MsgType::CONFIG) {
+      auto ret = make_shared<ConfigMsg>();
+      ret->config.width = parser.read_uint16();
+      ret->config.height = parser.read_uint16();
+      ret->config.frame_rate = parser.read_uint16();
+      ret->config.target_bitrate = parser.read_uint32();
+      return ret;
+    }
+
+    return nullptr;
+  }
+}
+
+// stand-in for Encoder::handle_feedback() that the compiler cannot optimize
+// away: touches every receipt
+uint64_t handle_feedback(const FeedbackMsg & feedback)
+{
+  uint64_t sum = feedback.cum_seq_num + feedback.highest_seq_num
+                 + feedback.sack_bitmap + feedback.feedback_ts;
+
+  for (size_t i = 0; i < feedback.num_receipts; i++) {
+    const auto & receipt = feedback.receipts[i];
+    sum += receipt.seq_num + receipt.send_ts + receipt.recv_ts;
+  }
+
+  return sum;
+}
+
+// messages dispatched per second with 'dispatch' called on each message
+template<typename F>
+double msgs_per_second(const vector<string> & msgs, const unsigned int num_rounds,
+                       const F & dispatch)
+{
+  uint64_t sum = 0;
+
+  const auto start = steady_clock::now();
+  for (unsigned int round = 0; round < num_rounds; round++) {
+    for (const auto & msg : msgs) {
+      sum += dispatch(msg);
+    }
+  }
+  const auto end = steady_clock::now();
+
+  // never true, but the compiler can't tell
+  if (sum == 42) {
+    cerr << "";
+  }
+
+  return 1.0 * msgs.size() * num_rounds / duration<double>(end - start).count();
+}
+
+int main(int argc, char * argv[])
+{
+  size_t num_msgs = 1024;
+  size_t num_receipts = 16;
+  unsigned int num_rounds = 10000;
+
+  const option cmd_line_opts[] = {
+    {"msgs",     required_argument, nullptr, 'M'},
+    {"receipts", required_argument, nullptr, 'R'},
+    {"rounds",   required_argument, nullptr, 'N'},
+    { nullptr,   0,                 nullptr,  0 },
+  };
+
+  while (true) {
+    const int opt = getopt_long(argc, argv, "", cmd_line_opts, nullptr);
+    if (opt == -1) {
+      break;
+    }
+
+    switch (opt) {
+      case 'M':
+        num_msgs = strict_stoi(optarg);
+        break;
+      case 'R':
+        num_receipts = strict_stoi(optarg);
+        break;
+      case 'N':
+        num_rounds = strict_stoi(optarg);
+        break;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (optind != argc or num_msgs == 0 or num_rounds == 0
+      or num_receipts > FeedbackMsg::MAX_RECEIPTS) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // serialized feedback messages as received on the sender, each acking the
+  // next 'num_receipts' datagrams
+  vector<string> msgs;
+  for (size_t i = 0; i < num_msgs; i++) {
+    FeedbackMsg feedback;
+    feedback.cum_seq_num = (i + 1) * num_receipts;
+    feedback.highest_seq_num = feedback.cum_seq_num - 1;
+    feedback.sack_bitmap = UINT64_MAX;
+    feedback.num_receipts = num_receipts;
+
+    for (size_t j = 0; j < num_receipts; j++) {
+      auto & receipt = feedback.receipts[j];
+      receipt.seq_num = i * num_receipts + j;
+      receipt.send_ts = 1000000 + receipt.seq_num * 100;
+      receipt.recv_ts = receipt.send_ts + 5000;
+    }
+
+    feedback.feedback_ts = 1000000 + feedback.cum_seq_num * 100 + 5000;
+    msgs.emplace_back(feedback.serialize_to_string());
+  }
+
+  const double variant_rate = msgs_per_second(msgs, num_rounds,
+    [](const string_view binary) -> uint64_t
+    {
+      const auto msg = parse_msg(binary);
+      if (not msg) {
+        return 0;
+      }
+
+      return visit(MsgVisitor {
+        [](const FeedbackMsg & feedback) { return handle_feedback(feedback); },
+        [](const auto &) { return uint64_t {0}; } // other messages
+      }, *msg);
+    }
+  );
+
+  const double legacy_rate = msgs_per_second(msgs, num_rounds,
+    [](const string_view binary) -> uint64_t
+    {
+      const shared_ptr<legacy::Msg> msg = legacy::parse_from_string(binary);
+      if (msg == nullptr or msg->type != MsgType::FEEDBACK) {
+        return 0;
+      }
+
+      return handle_feedback(
+        dynamic_pointer_cast<legacy::FeedbackMsg>(msg)->feedback);
+    }
+  );
+
+  // datagrams acked per message (at least one through the cumulative point)
+  const double acks_per_msg = max<size_t>(num_receipts, 1);
+
+  cerr << "Feedback messages: " << num_msgs << " x " << num_rounds
+       << " rounds, " << num_receipts << " receipts each\n"
+       << "Feedback messages parsed and dispatched per second:\n"
+       << "  - parse_msg() + std::visit(): "
+       << double_to_string(variant_rate / 1e6) << " M ("
+       << double_to_string(1e9 / variant_rate) << " ns per message, "
+       << double_to_string(1e9 / variant_rate / acks_per_msg)
+       << " ns per acked datagram)\n"
+       << "  - shared_ptr<Msg> + dynamic_pointer_cast: "
+       << double_to_string(legacy_rate / 1e6) << " M ("
+       << double_to_string(1e9 / legacy_rate) << " ns per message, "
+       << double_to_string(1e9 / legacy_rate / acks_per_msg)
+       << " ns per acked datagram)" << endl;
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,136 @@
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+#include "aimd_rate_control.hh"
+
+using namespace std;
+
+AimdRateControl::AimdRateControl(const unsigned int start_bitrate_kbps,
+                                 const unsigned int min_bitrate_kbps,
+                                 const unsigned int max_bitrate_kbps)
+  : min_bitrate_kbps_(min_bitrate_kbps), max_bitrate_kbps_(max_bitrate_kbps),
+    bitrate_kbps_(start_bitrate_kbps)
+{
+  if (min_bitrate_kbps == 0 or min_bitrate_kbps > start_bitrate_kbps or
+      start_bitrate_kbps > max_bitrate_kbps) {
+    throw runtime_error("AimdRateControl: invalid bitrates");
+  }
+}
+
+double AimdRateControl::link_capacity_std() const
+{
+  return link_capacity_kbps_ ? sqrt(link_capacity_var_ * *link_capacity_kbps_)
+                             : 0;
+}
+
+void AimdRateControl::update(const OveruseDetector::Usage usage,
+                             const optional<double> & throughput_kbps,
+                             const uint64_t curr_ts)
+{
+  using Usage = OveruseDetector::Usage;
+
+  // state transitions on the detector's signal
+  switch (usage) {
+    case Usage::OVERUSING:
+      state_ = State::DECREASE;
+      break;
+    case Usage::NORMAL:
+      if (state_ == State::HOLD) {
+        state_ = State::INCREASE;
+      }
+      break;
+    case Usage::UNDERUSING:
+      state_ = State::HOLD;
+      break;
+  }
+
+  const double dt_s = last_update_ts_ and curr_ts > *last_update_ts_ ?
+      min((curr_ts - *last_update_ts_) / 1e6, 1.0) : 0;
+  last_update_ts_ = curr_ts;
+
+  const double rtt_ms = rtt_us_ ? *rtt_us_ / 1000.0 : DEFAULT_RTT_MS;
+
+  if (state_ == State::INCREASE) {
+    // the link capacity grew past the estimate
+    if (throughput_kbps and link_capacity_kbps_ and
+        *throughput_kbps > *link_capacity_kbps_ + 3 * link_capacity_std()) {
+      link_capacity_kbps_.reset();
+    }
+
+    double increased = bitrate_kbps_;
+
+    if (link_capacity_kbps_) {
+      // close to the capacity: about a datagram more per response time
+      const double response_time_s = (rtt_ms + 100) / 1000;
+      const double packet_bits = min(PACKET_BITS, bitrate_kbps_ * 1000 / 30);
+      increased += max(4.0, packet_bits / response_time_s / 1000) * dt_s;
+    } else {
+      increased += max(bitrate_kbps_ * (pow(INCREASE_PER_SEC, dt_s) - 1),
+                       dt_s);
+    }
+
+    // not (much) more than gets through, e.g., if the encoder undershoots
+    if (throughput_kbps) {
+      const double max_kbps = 1.5 * *throughput_kbps + 10;
+      if (bitrate_kbps_ < max_kbps) {
+        bitrate_kbps_ = min(increased, max_kbps);
+      }
+    } else {
+      bitrate_kbps_ = increased;
+    }
+  } else if (state_ == State::DECREASE) {
+    const uint64_t interval_us = clamp(rtt_ms, 10.0, 200.0) * 1000;
+
+    if (not last_decrease_ts_ or curr_ts >= *last_decrease_ts_ + interval_us) {
+      double decreased = BETA * bitrate_kbps_;
+
+      if (throughput_kbps) {
+        decreased = BETA * *throughput_kbps;
+
+        // the datagrams through might have been sent at a higher rate
+        if (decreased > bitrate_kbps_ and link_capacity_kbps_) {
+          decreased = BETA * *link_capacity_kbps_;
+        }
+
+        update_link_capacity(*throughput_kbps);
+      }
+
+      // never increase on overuse
+      bitrate_kbps_ = min(bitrate_kbps_, decreased);
+      last_decrease_ts_ = curr_ts;
+    }
+
+    state_ = State::HOLD;
+  }
+
+  bitrate_kbps_ = clamp(bitrate_kbps_, static_cast<double>(min_bitrate_kbps_),
+                        static_cast<double>(max_bitrate_kbps_));
+}
+
+void AimdRateControl::update_link_capacity(const double throughput_kbps)
+{
+  // the link capacity dropped below the estimate
+  if (link_capacity_kbps_ and
+      throughput_kbps < *link_capacity_kbps_ - 3 * link_capacity_std()) {
+    link_capacity_kbps_.reset();
+  }
+
+  if (not link_capacity_kbps_) {
+    link_capacity_kbps_ = throughput_kbps;
+  } else {
+    *link_capacity_kbps_ = 0.95 * *link_capacity_kbps_
+                           + 0.05 * throughput_kbps;
+  }
+
+  const double error = *link_capacity_kbps_ - throughput_kbps;
+  link_capacity_var_ = 0.95 * link_capacity_var_ + 0.05 * error * error
+                       / max(*link_capacity_kbps_, 1.0);
+  link_capacity_var_ = clamp(link_capacity_var_, 0.4, 2.5);
+}
+
+void AimdRateControl::set_max_bitrate(const unsigned int bitrate_kbps)
+{
+  max_bitrate_kbps_ = max(bitrate_kbps, min_bitrate_kbps_);
+  bitrate_kbps_ = min<double>(bitrate_kbps_, max_bitrate_kbps_);
+}
@@ -0,0 +1,67 @@
+#ifndef AIMD_RATE_CONTROL_HH
+#define AIMD_RATE_CONTROL_HH
+
+#include <cstdint>
+#include <optional>
+
+#include "overuse_detector.hh"
+
+// GCC's AIMD rate control (draft-ietf-rmcat-gcc) driven by an overuse
+// detector: hold on underuse (while the queues drain), back off once on
+// overuse to BETA times the bitrate that got through the bottleneck, and
+// increase otherwise: multiplicatively, or additively near the link
+// capacity estimated from the bitrates at the back-offs
+class AimdRateControl
+{
+public:
+  AimdRateControl(const unsigned int start_bitrate_kbps,
+                  const unsigned int min_bitrate_kbps,
+                  const unsigned int max_bitrate_kbps);
+
+  // update the bitrate at 'curr_ts' (us) on the detector's signal, given the
+  // bitrate (kbps) that recently got through the bottleneck, if known
+  void update(const OveruseDetector::Usage usage,
+              const std::optional<double> & throughput_kbps,
+              const uint64_t curr_ts);
+
+  // an RTT sample (us); a default RTT is assumed until one is known
+  void set_rtt(const unsigned int rtt_us) { rtt_us_ = rtt_us; }
+
+  // never exceed 'bitrate_kbps' from now on
+  void set_max_bitrate(const unsigned int bitrate_kbps);
+
+  double bitrate() const { return bitrate_kbps_; }
+  unsigned int min_bitrate() const { return min_bitrate_kbps_; }
+  unsigned int max_bitrate() const { return max_bitrate_kbps_; }
+
+private:
+  unsigned int min_bitrate_kbps_;
+  unsigned int max_bitrate_kbps_;
+  double bitrate_kbps_;
+
+  enum class State { HOLD, INCREASE, DECREASE };
+  State state_ {State::INCREASE};
+  std::optional<uint64_t> last_update_ts_ {};
+  std::optional<unsigned int> rtt_us_ {};
+
+  // back off at most once per RTT (clamped) so that the queue can drain
+  std::optional<uint64_t> last_decrease_ts_ {};
+
+  // link capacity estimated from the bitrates at the back-offs, and its
+  // variance (normalized by the capacity)
+  std::optional<double> link_capacity_kbps_ {};
+  double link_capacity_var_ {0.4};
+
+  static constexpr double BETA = 0.85;
+  static constexpr double INCREASE_PER_SEC = 1.08;
+  static constexpr double PACKET_BITS = 1200 * 8;
+  static constexpr double DEFAULT_RTT_MS = 100;
+
+  // standard deviation of the link capacity (kbps)
+  double link_capacity_std() const;
+
+  // average the bitrate at a back-off into the link capacity
+  void update_link_capacity(const double throughput_kbps);
+};
+
+#endif /* AIMD_RATE_CONTROL_HH */
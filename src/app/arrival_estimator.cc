@@ -0,0 +1,158 @@
+#include <cmath>
+#include <algorithm>
+
+#include "arrival_estimator.hh"
+
+using namespace std;
+
+void ArrivalEstimator::add(const uint64_t send_ts, const uint64_t recv_ts,
+                           const size_t size)
+{
+  // bitrate received over the last window (once a window has elapsed)
+  if (not first_recv_ts_) {
+    first_recv_ts_ = recv_ts;
+  }
+
+  incoming_.emplace_back(recv_ts, size);
+  incoming_bytes_ += size;
+
+  while (incoming_.front().first + INCOMING_WINDOW_US < recv_ts) {
+    incoming_bytes_ -= incoming_.front().second;
+    incoming_.pop_front();
+  }
+
+  if (recv_ts >= *first_recv_ts_ + INCOMING_WINDOW_US) {
+    incoming_kbps_ = incoming_bytes_ * 8.0 * 1000 / INCOMING_WINDOW_US;
+  }
+
+  // group the datagrams sent in a burst (e.g., the fragments of a frame)
+  if (not curr_group_) {
+    curr_group_ = {send_ts, send_ts, recv_ts, size};
+    return;
+  }
+
+  // sent before the current group (reordered or retransmitted)
+  if (send_ts < curr_group_->first_send_ts) {
+    return;
+  }
+
+  if (send_ts - curr_group_->first_send_ts <= BURST_US) {
+    curr_group_->last_send_ts = max(curr_group_->last_send_ts, send_ts);
+    curr_group_->last_recv_ts = max(curr_group_->last_recv_ts, recv_ts);
+    curr_group_->size += size;
+    return;
+  }
+
+  // a datagram of the next group completes the current one: compare the
+  // delays of the last two groups
+  if (prev_group_) {
+    const int64_t send_delta = curr_group_->last_send_ts
+                               - prev_group_->last_send_ts;
+    const int64_t recv_delta = curr_group_->last_recv_ts
+                               - prev_group_->last_recv_ts;
+    const double size_delta = static_cast<double>(curr_group_->size)
+                              - static_cast<double>(prev_group_->size);
+    add_delta(send_delta / 1000.0, recv_delta / 1000.0, size_delta,
+              curr_group_->last_recv_ts);
+  }
+
+  prev_group_ = curr_group_;
+  curr_group_ = {send_ts, send_ts, recv_ts, size};
+
+  // AIMD on each group, starting from the incoming bitrate
+  if (incoming_kbps_) {
+    if (not rate_control_) {
+      const unsigned int start = clamp<unsigned int>(lrint(*incoming_kbps_),
+                                                     MIN_BITRATE, MAX_BITRATE);
+      rate_control_.emplace(start, MIN_BITRATE, MAX_BITRATE);
+    }
+
+    rate_control_->update(detector_.usage(), incoming_kbps_, recv_ts);
+  }
+}
+
+void ArrivalEstimator::add_delta(const double send_delta_ms,
+                                 const double recv_delta_ms,
+                                 const double size_delta,
+                                 const uint64_t arrival_ts)
+{
+  using Usage = OveruseDetector::Usage;
+
+  const double delay_delta_ms = recv_delta_ms - send_delta_ms;
+  num_deltas_ = min(num_deltas_ + 1, MAX_NOISE_DELTAS);
+
+  // predict: the state drifts with the process noise, faster if the offset
+  // goes against what the detector signals
+  e_[0][0] += PROCESS_NOISE[0];
+  e_[1][1] += PROCESS_NOISE[1];
+
+  const Usage usage = detector_.usage();
+  if ((usage == Usage::OVERUSING and offset_ < prev_offset_) or
+      (usage == Usage::UNDERUSING and offset_ > prev_offset_)) {
+    e_[1][1] += 10 * PROCESS_NOISE[1];
+  }
+
+  const double h[2] {size_delta, 1.0};
+  const double eh[2] {e_[0][0] * h[0] + e_[0][1] * h[1],
+                      e_[1][0] * h[0] + e_[1][1] * h[1]};
+  const double residual = delay_delta_ms - slope_ * h[0] - offset_;
+
+  // the noise is estimated while stable, with the outliers (e.g., the
+  // periodic key frames) clipped
+  if (usage == Usage::NORMAL) {
+    const double max_residual = 3 * sqrt(var_noise_);
+    update_noise(clamp(residual, -max_residual, max_residual), send_delta_ms);
+  }
+
+  // update with the Kalman gain
+  const double denom = var_noise_ + h[0] * eh[0] + h[1] * eh[1];
+  const double k[2] {eh[0] / denom, eh[1] / denom};
+  const double ikh[2][2] {{1 - k[0] * h[0], -k[0] * h[1]},
+                          {-k[1] * h[0], 1 - k[1] * h[1]}};
+  const double e00 = e_[0][0];
+  const double e01 = e_[0][1];
+
+  e_[0][0] = e00 * ikh[0][0] + e_[1][0] * ikh[0][1];
+  e_[0][1] = e01 * ikh[0][0] + e_[1][1] * ikh[0][1];
+  e_[1][0] = e00 * ikh[1][0] + e_[1][0] * ikh[1][1];
+  e_[1][1] = e01 * ikh[1][0] + e_[1][1] * ikh[1][1];
+
+  // the covariance must remain positive semi-definite (start over if not)
+  if (e_[0][0] < 0 or e_[1][1] < 0 or
+      e_[0][0] * e_[1][1] - e_[0][1] * e_[1][0] < 0) {
+    e_[0][0] = 100;
+    e_[0][1] = e_[1][0] = 0;
+    e_[1][1] = 1e-1;
+  }
+
+  slope_ += k[0] * residual;
+  prev_offset_ = offset_;
+  offset_ += k[1] * residual;
+
+  // the offset (ms) scaled to be compared with the threshold
+  detector_.detect(min(num_deltas_, MAX_NUM_DELTAS) * offset_, send_delta_ms,
+                   arrival_ts);
+}
+
+void ArrivalEstimator::update_noise(const double residual,
+                                    const double send_delta_ms)
+{
+  // faster at the start to adapt to the jitter of the path; the smoothing
+  // is per frame at 30 FPS, scaled to the time between groups
+  const double alpha = num_deltas_ > 10 * 30 ? 0.002 : 0.01;
+  const double beta = pow(1 - alpha, send_delta_ms * 30 / 1000);
+
+  avg_noise_ = beta * avg_noise_ + (1 - beta) * residual;
+  var_noise_ = beta * var_noise_ + (1 - beta) * (avg_noise_ - residual)
+                                             * (avg_noise_ - residual);
+  var_noise_ = max(var_noise_, 1.0);
+}
+
+optional<unsigned int> ArrivalEstimator::estimate() const
+{
+  if (not rate_control_) {
+    return nullopt;
+  }
+
+  return lrint(rate_control_->bitrate());
+}
@@ -0,0 +1,89 @@
+#ifndef ARRIVAL_ESTIMATOR_HH
+#define ARRIVAL_ESTIMATOR_HH
+
+#include <deque>
+#include <cstdint>
+#include <optional>
+#include <utility>
+
+#include "overuse_detector.hh"
+#include "aimd_rate_control.hh"
+
+// receiver-side bandwidth estimation from the arrival times of the datagrams
+// (as GCC's receiver-side variant): datagrams sent within BURST_US form
+// groups, and a Kalman filter estimates the queuing delay gradient (offset)
+// from the delay variation between groups, given their size difference (for
+// the serialization at the bottleneck). The offset drives an overuse
+// detector, and AIMD over the incoming bitrate then yields the estimate
+class ArrivalEstimator
+{
+public:
+  // datagram of 'size' bytes sent at 'send_ts' (sender's clock, us) arrived
+  // at 'recv_ts' (us)
+  void add(const uint64_t send_ts, const uint64_t recv_ts, const size_t size);
+
+  // the bitrate (kbps) estimated to get through, once the incoming bitrate
+  // is known
+  std::optional<unsigned int> estimate() const;
+
+  // bitrate (kbps) received over the last INCOMING_WINDOW_US, if elapsed
+  std::optional<double> incoming_bitrate() const { return incoming_kbps_; }
+
+  // what the delay gradient signals about the bottleneck
+  OveruseDetector::Usage usage() const { return detector_.usage(); }
+
+private:
+  // datagrams sent within BURST_US of the first of a group form a group,
+  // whose delay is that of its last datagram
+  struct PacketGroup
+  {
+    uint64_t first_send_ts {0};
+    uint64_t last_send_ts {0};
+    uint64_t last_recv_ts {0};
+    size_t size {0};
+  };
+
+  std::optional<PacketGroup> curr_group_ {};
+  std::optional<PacketGroup> prev_group_ {};
+  static constexpr uint64_t BURST_US = 5000;
+
+  // Kalman filter of the state (slope: ms of delay per byte of size
+  // difference, offset: ms of delay variation), with the error covariance
+  // 'e_', the process noise, and the measurement noise estimated from the
+  // residuals (while not overusing)
+  double slope_ {8.0 / 512};
+  double offset_ {0};
+  double prev_offset_ {0};
+  double e_[2][2] {{100, 0}, {0, 1e-1}};
+  double avg_noise_ {0};
+  double var_noise_ {50};
+  unsigned int num_deltas_ {0};
+
+  static constexpr double PROCESS_NOISE[2] {1e-13, 1e-3};
+  static constexpr unsigned int MAX_NUM_DELTAS = 60;
+  static constexpr unsigned int MAX_NOISE_DELTAS = 1000;
+
+  // overuse detection on the offset, and AIMD on the incoming bitrate
+  // (started from it as soon as it is known)
+  OveruseDetector detector_ {};
+  std::optional<AimdRateControl> rate_control_ {};
+  static constexpr unsigned int MIN_BITRATE = 10; // kbps
+  static constexpr unsigned int MAX_BITRATE = 100 * 1000;
+
+  // bitrate received over the last INCOMING_WINDOW_US (by arrival time)
+  std::deque<std::pair<uint64_t, size_t>> incoming_ {};
+  size_t incoming_bytes_ {0};
+  std::optional<uint64_t> first_recv_ts_ {};
+  std::optional<double> incoming_kbps_ {};
+  static constexpr uint64_t INCOMING_WINDOW_US = 500 * 1000;
+
+  // filter the delay variation between the last two groups, and feed the
+  // offset to the overuse detector
+  void add_delta(const double send_delta_ms, const double recv_delta_ms,
+                 const double size_delta, const uint64_t arrival_ts);
+
+  // update the measurement noise with the 'residual' of a delta
+  void update_noise(const double residual, const double send_delta_ms);
+};
+
+#endif /* ARRIVAL_ESTIMATOR_HH */
@@ -0,0 +1,311 @@
+#include <getopt.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <random>
+#include <algorithm>
+
+#include "gcc_controller.hh"
+#include "conversion.hh"
+
+using namespace std;
+
+void print_usage(const string & program_name)
+{
+  cerr <<
+  "Usage: " << program_name << " [options]\n\n"
+  "Simulates a video stream through an emulated bottleneck (a drop-tail\n"
+  "queue draining at the link rate, plus propagation delay) with feedback\n"
+  "on every datagram as receiver sends it, and reports, for a constant\n"
+  "bitrate (video_sender --cc none) and the delay-based congestion control\n"
+  "(--cc gcc) at a range of link rates, the link utilization, the queueing\n"
+  "delay and the losses after a warm-up (as congestion control ramps up\n"
+  "from its start bitrate).\n\n"
+  "Options:\n"
+  "--bitrate <kbps>     bitrate receiver requests (default: 2000)\n"
+  "--delay <ms>         one-way propagation delay (default: 20)\n"
+  "--buffer <ms>        bottleneck buffer, in ms at the link rate\n"
+  "                     (default: 500)\n"
+  "--duration <s>       simulated time per run (default: 60)\n"
+  "--warmup <s>         time excluded from the results (default: 20)\n"
+  "--step               halve the link rate for the middle third of the run\n"
+  "--fps <FPS>          frame rate (default: 30)\n"
+  "--seed <S>           seed of the frame sizes (default: 0)"
+  << endl;
+}
+
+namespace {
+  constexpr size_t MAX_DATAGRAM_SIZE = 1400;
+  constexpr unsigned int KEY_FRAME_INTERVAL = 150;
+  constexpr unsigned int KEY_FRAME_SCALE = 4; // key frame size over average
+  constexpr uint64_t FEEDBACK_INTERVAL_US = 10 * 1000;
+  constexpr unsigned int START_BITRATE = 300; // kbps, as video_sender
+  constexpr unsigned int MIN_BITRATE = 50;
+  const vector<unsigned int> LINK_RATES {250, 500, 1000, 1500, 3000}; // kbps
+
+  struct Config
+  {
+    unsigned int bitrate {2000};
+    uint64_t delay_us {20 * 1000};
+    uint64_t buffer_us {500 * 1000};
+    uint64_t duration_us {60 * 1000 * 1000};
+    uint64_t warmup_us {20 * 1000 * 1000};
+    bool step {false};
+    unsigned int fps {30};
+    unsigned int seed {0};
+  };
+
+  // results from the end of the warm-up until the end of the run
+  struct Result
+  {
+    uint64_t delivered_bits {0};
+    double capacity_bits {0};  // what the link could have delivered
+    vector<double> queueing_delays_ms {}; // of the datagrams delivered
+    unsigned int num_sent {0};
+    unsigned int num_lost {0};
+    double total_bitrate {0};   // target bitrate summed over frames
+    unsigned int num_frames {0};
+  };
+
+  // a datagram's arrival as reported in the feedback
+  struct Receipt
+  {
+    SeqNum seq_num {0};
+    uint64_t send_ts {0};
+    uint64_t recv_ts {0};
+  };
+
+  // link rate (kbps) at 't' (us)
+  double link_rate(const Config & config, const unsigned int rate,
+                   const uint64_t t)
+  {
+    if (config.step and t >= config.duration_us / 3 and
+        t < config.duration_us * 2 / 3) {
+      return rate / 2.0;
+    }
+
+    return rate;
+  }
+
+  // run the stream through the bottleneck of 'rate' (kbps) with 'cc' setting
+  // the target bitrate (a constant bitrate if nullptr)
+  Result simulate(const Config & config, const unsigned int rate,
+                  unique_ptr<CongestionController> cc)
+  {
+    Result result;
+    mt19937 prng(config.seed);
+    uniform_real_distribution<double> frame_scale(0.5, 1.5);
+
+    const uint64_t frame_interval_us = 1000 * 1000 / config.fps;
+
+    // feedback arriving at the sender by time, and the datagrams lost (which
+    // sender learns about along with the first receipt after them)
+    map<uint64_t, vector<Receipt>> feedback;
+    vector<SeqNum> lost;
+    size_t next_lost = 0;
+
+    SeqNum seq_num = 0;
+    double link_free_ts = 0; // when the queue is drained
+    uint64_t next_frame_ts = 0;
+    unsigned int frame_id = 0;
+
+    while (next_frame_ts < config.duration_us) {
+      // deliver the feedback that arrives before the next frame is sent
+      while (not feedback.empty() and
+             feedback.begin()->first <= next_frame_ts) {
+        const auto & [feedback_ts, receipts] = *feedback.begin();
+
+        if (cc) {
+          for (const auto & receipt : receipts) {
+            for (; next_lost < lost.size() and
+                   lost[next_lost] < receipt.seq_num; next_lost++) {
+              cc->on_loss();
+            }
+
+            cc->on_receipt(receipt.seq_num, receipt.send_ts, receipt.recv_ts);
+
+            // the time until the feedback departed is excluded, as in Encoder
+            const uint64_t ack_delay_us =
+                feedback_ts - config.delay_us - receipt.recv_ts;
+            cc->on_rtt_sample(feedback_ts - receipt.send_ts - ack_delay_us);
+          }
+
+          cc->on_feedback(feedback_ts);
+        }
+
+        feedback.erase(feedback.begin());
+      }
+
+      // a frame at the target bitrate, sent at once in datagrams
+      const uint64_t send_ts = next_frame_ts;
+      const unsigned int bitrate = cc ? cc->target_bitrate() : config.bitrate;
+
+      double frame_size = bitrate * 1000.0 / 8 / config.fps
+                          * frame_scale(prng);
+      if (frame_id % KEY_FRAME_INTERVAL == 0) {
+        frame_size *= KEY_FRAME_SCALE;
+      }
+
+      const bool counted = send_ts >= config.warmup_us;
+      if (counted) {
+        result.total_bitrate += bitrate;
+        result.num_frames++;
+      }
+
+      for (size_t left = max<size_t>(frame_size, 1); left > 0;) {
+        const size_t size = min(left, MAX_DATAGRAM_SIZE);
+        left -= size;
+
+        if (cc) {
+          cc->on_sent(seq_num, size);
+        }
+        result.num_sent += counted;
+
+        // drop-tail: dropped if the queue holds more than the buffer
+        const double queueing_delay_us = max(link_free_ts - send_ts, 0.0);
+        if (queueing_delay_us > config.buffer_us) {
+          lost.emplace_back(seq_num++);
+          result.num_lost += counted;
+          continue;
+        }
+
+        const double rate_kbps = link_rate(config, rate, send_ts);
+        link_free_ts = max(link_free_ts, static_cast<double>(send_ts))
+                       + size * 8 * 1000 / rate_kbps;
+
+        const uint64_t recv_ts = link_free_ts + config.delay_us;
+        if (counted) {
+          result.queueing_delays_ms.emplace_back(queueing_delay_us / 1000);
+        }
+
+        // utilization of the link while measured
+        if (link_free_ts >= config.warmup_us and
+            link_free_ts < config.duration_us) {
+          result.delivered_bits += size * 8;
+        }
+
+        // reported in the next feedback, which takes the propagation delay
+        const uint64_t feedback_ts = (recv_ts / FEEDBACK_INTERVAL_US + 1)
+                                     * FEEDBACK_INTERVAL_US + config.delay_us;
+        feedback[feedback_ts].push_back({seq_num++, send_ts, recv_ts});
+      }
+
+      frame_id++;
+      next_frame_ts += frame_interval_us;
+    }
+
+    // what the link could have delivered, at 1 ms granularity
+    for (uint64_t t = config.warmup_us; t < config.duration_us; t += 1000) {
+      result.capacity_bits += link_rate(config, rate, t);
+    }
+
+    return result;
+  }
+}
+
+int main(int argc, char * argv[])
+{
+  Config config;
+
+  const option cmd_line_opts[] = {
+    {"bitrate",  required_argument, nullptr, 'B'},
+    {"delay",    required_argument, nullptr, 'D'},
+    {"buffer",   required_argument, nullptr, 'Q'},
+    {"duration", required_argument, nullptr, 'T'},
+    {"warmup",   required_argument, nullptr, 'W'},
+    {"step",     no_argument,       nullptr, 'P'},
+    {"fps",      required_argument, nullptr, 'R'},
+    {"seed",     required_argument, nullptr, 'S'},
+    { nullptr,   0,                 nullptr,  0 },
+  };
+
+  while (true) {
+    const int opt = getopt_long(argc, argv, "", cmd_line_opts, nullptr);
+    if (opt == -1) {
+      break;
+    }
+
+    switch (opt) {
+      case 'B':
+        config.bitrate = strict_stoi(optarg);
+        break;
+      case 'D':
+        config.delay_us = strict_stoi(optarg) * 1000ULL;
+        break;
+      case 'Q':
+        config.buffer_us = strict_stoi(optarg) * 1000ULL;
+        break;
+      case 'T':
+        config.duration_us = strict_stoi(optarg) * 1000ULL * 1000;
+        break;
+      case 'W':
+        config.warmup_us = strict_stoi(optarg) * 1000ULL * 1000;
+        break;
+      case 'P':
+        config.step = true;
+        break;
+      case 'R':
+        config.fps = strict_stoi(optarg);
+        break;
+      case 'S':
+        config.seed = strict_stoi(optarg);
+        break;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (optind != argc or config.bitrate < MIN_BITRATE or config.fps == 0 or
+      config.warmup_us >= config.duration_us) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  cerr << "Receiver's bitrate " << config.bitrate << " kbps, one-way delay "
+       << config.delay_us / 1000 << " ms, buffer " << config.buffer_us / 1000
+       << " ms" << (config.step ? ", link rate halved in the middle third" : "")
+       << ", after " << config.warmup_us / 1000 / 1000 << " s\n"
+       << "link (kbps)\tcc\tutilization (%)\tqueueing delay (ms) "
+       << "avg/95th/max\tloss (%)\tavg bitrate (kbps)" << endl;
+
+  for (const unsigned int rate : LINK_RATES) {
+    for (const bool gcc : {false, true}) {
+      unique_ptr<CongestionController> cc;
+      if (gcc) {
+        cc = make_unique<GCCController>(min(config.bitrate, START_BITRATE),
+                                        MIN_BITRATE, config.bitrate);
+      }
+
+      Result r = simulate(config, rate, move(cc));
+
+      auto & delays = r.queueing_delays_ms;
+      double avg_delay = 0, p95_delay = 0, max_delay = 0;
+      if (not delays.empty()) {
+        for (const double d : delays) {
+          avg_delay += d;
+        }
+        avg_delay /= delays.size();
+
+        const size_t k = delays.size() * 95 / 100;
+        nth_element(delays.begin(), delays.begin() + k, delays.end());
+        p95_delay = delays[k];
+        max_delay = *max_element(delays.begin(), delays.end());
+      }
+
+      cerr << rate << "\t\t" << (gcc ? "gcc" : "none") << "\t"
+           << double_to_string(100 * r.delivered_bits / r.capacity_bits)
+           << "\t\t" << double_to_string(avg_delay) << "/"
+           << double_to_string(p95_delay) << "/"
+           << double_to_string(max_delay) << "\t\t"
+           << double_to_string(r.num_sent ? 100.0 * r.num_lost / r.num_sent
+                                          : 0) << "\t\t"
+           << double_to_string(r.num_frames ? r.total_bitrate / r.num_frames
+                                            : 0) << endl;
+    }
+  }
+
+  return EXIT_SUCCESS;
+}
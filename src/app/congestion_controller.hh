@@ -0,0 +1,49 @@
+#ifndef CONGESTION_CONTROLLER_HH
+#define CONGESTION_CONTROLLER_HH
+
+#include <cstdint>
+#include <cstddef>
+
+#include "protocol.hh"
+
+// sender-side congestion control that sets the target bitrate of an Encoder
+// from the feedback on the datagrams it sent (see Encoder::handle_feedback);
+// send timestamps are on the sender's mono_us() clock and arrival timestamps
+// on the receiver's clock, so only their differences are comparable
+class CongestionController
+{
+public:
+  CongestionController() {}
+  virtual ~CongestionController() {}
+
+  // datagram 'seq_num' of 'size' bytes was sent for the first time
+  virtual void on_sent(const SeqNum seq_num, const size_t size) = 0;
+
+  // a transmission of datagram 'seq_num' sent at 'send_ts' arrived at
+  // 'recv_ts' (even if the datagram was acked or abandoned since)
+  virtual void on_receipt(const SeqNum seq_num, const uint64_t send_ts,
+                          const uint64_t recv_ts) = 0;
+
+  // a transmission was deemed lost (by loss detection or NACK)
+  virtual void on_loss() = 0;
+
+  // an RTT sample (us)
+  virtual void on_rtt_sample(const unsigned int rtt_us) = 0;
+
+  // the receipts and losses of a feedback message were all reported
+  virtual void on_feedback(const uint64_t curr_ts) = 0;
+
+  // receiver estimated the bitrate that gets through (see ReportMsg)
+  virtual void on_receiver_estimate(const unsigned int bitrate_kbps) = 0;
+
+  // bitrate (kbps) that the encoder should target
+  virtual unsigned int target_bitrate() const = 0;
+
+  // never target more than 'bitrate_kbps' (e.g., as requested by receiver)
+  virtual void set_max_bitrate(const unsigned int bitrate_kbps) = 0;
+
+  // output stats every second and reset some of them
+  virtual void output_periodic_stats() {}
+};
+
+#endif /* CONGESTION_CONTROLLER_HH */
@@ -3,39 +3,83 @@
 #include <iostream>
 #include <stdexcept>
 #include <algorithm>
+#include <cstring>
 
 #include "decoder.hh"
 #include "exception.hh"
 #include "conversion.hh"
 #include "image.hh"
 #include "timestamp.hh"
+#include "mono_clock.hh"
+#include "reed_solomon.hh"
 
 using namespace std;
 using namespace chrono;
 
 Frame::Frame(const uint32_t frame_id,
              const FrameType frame_type,
-             const uint16_t frag_cnt)
-  : id_(frame_id), type_(frame_type), frags_(frag_cnt), null_frags_(frag_cnt)
+             const uint8_t temporal_id,
+             const RefFrames ref_frames,
+             const uint16_t frag_cnt,
+             const uint16_t parity_cnt,
+             const SeqNum first_seq_num)
+  : id_(), type_(), temporal_id_(), ref_frames_(), first_seq_num_()
+{
+  reset(frame_id, frame_type, temporal_id, ref_frames, frag_cnt, parity_cnt,
+        first_seq_num);
+}
+
+void Frame::reset(const uint32_t frame_id,
+                  const FrameType frame_type,
+                  const uint8_t temporal_id,
+                  const RefFrames ref_frames,
+                  const uint16_t frag_cnt,
+                  const uint16_t parity_cnt,
+                  const SeqNum first_seq_num)
 {
   if (frag_cnt == 0) {
     throw runtime_error("frame cannot have zero fragments");
   }
-}
 
-bool Frame::has_frag(const uint16_t frag_id) const
-{
-  return frags_.at(frag_id).has_value();
+  // validate before sizing the buffers by the counts
+  if (frag_cnt > MAX_FRAG_CNT) {
+    throw runtime_error("frame has too many fragments");
+  }
+
+  id_ = frame_id;
+  type_ = frame_type;
+  temporal_id_ = temporal_id;
+  ref_frames_ = ref_frames;
+  first_seq_num_ = first_seq_num;
+
+  // never shrink the buffers, so a reused frame rarely needs to allocate
+  const size_t num_slots = frag_cnt + parity_cnt <= MAX_CODED_FRAGS ?
+                           frag_cnt + parity_cnt : frag_cnt;
+  const size_t payloads_size = num_slots * Datagram::MAX_PAYLOAD;
+  if (payloads_.size() < payloads_size) {
+    payloads_.resize(payloads_size);
+  }
+
+  frag_sizes_.assign(frag_cnt, nullopt);
+  null_frags_ = frag_cnt;
+  frame_size_ = 0;
+
+  has_parity_.assign(parity_cnt, false);
+  num_parity_ = 0;
+  fec_frame_size_ = 0;
+  shard_size_ = 0;
+  num_recovered_ = 0;
 }
 
-Datagram & Frame::get_frag(const uint16_t frag_id)
+bool Frame::has_frag(const uint16_t frag_id) const
 {
-  return frags_.at(frag_id).value();
+  return frag_sizes_.at(frag_id).has_value();
 }
 
-const Datagram & Frame::get_frag(const uint16_t frag_id) const
+string_view Frame::get_frag(const uint16_t frag_id) const
 {
-  return frags_.at(frag_id).value();
+  return {payloads_.data() + frag_id * Datagram::MAX_PAYLOAD,
+          frag_sizes_.at(frag_id).value()};
 }
 
 optional<size_t> Frame::frame_size() const
@@ -47,38 +91,131 @@ optional<size_t> Frame::frame_size() const
   return frame_size_;
 }
 
-void Frame::validate_datagram(const Datagram & datagram) const
+void Frame::validate_datagram(const DatagramView & datagram) const
 {
   if (datagram.frame_id != id_ or
       datagram.frame_type != type_ or
-      datagram.frag_id >= frags_.size() or
-      datagram.frag_cnt != frags_.size()) {
+      datagram.temporal_id != temporal_id_ or
+      datagram.ref_frames != ref_frames_ or
+      datagram.frag_id >= frag_sizes_.size() + has_parity_.size() or
+      datagram.frag_cnt != frag_sizes_.size() or
+      datagram.parity_cnt != has_parity_.size() or
+      datagram.seq_num - datagram.frag_id != first_seq_num_ or
+      datagram.payload.size() > Datagram::MAX_PAYLOAD) {
     throw runtime_error("unable to insert an incompatible datagram");
   }
 }
 
-void Frame::insert_frag(const Datagram & datagram)
+void Frame::insert_frag(const DatagramView & datagram)
 {
   validate_datagram(datagram);
 
-  // insert only if the datagram does not exist yet
-  if (not frags_[datagram.frag_id]) {
-    frame_size_ += datagram.payload.size();
-    null_frags_--;
-    frags_[datagram.frag_id] = datagram;
+  if (datagram.is_parity()) {
+    insert_parity(datagram);
+  } else {
+    // insert only if the datagram does not exist yet
+    auto & frag_size = frag_sizes_[datagram.frag_id];
+    if (not frag_size) {
+      memcpy(payloads_.data() + datagram.frag_id * Datagram::MAX_PAYLOAD,
+             datagram.payload.data(), datagram.payload.size());
+
+      frag_size = datagram.payload.size();
+      frame_size_ += datagram.payload.size();
+      null_frags_--;
+    }
+  }
+
+  // any data fragments missing can be recovered
+  if (not complete() and num_parity_ > 0 and num_parity_ >= null_frags_) {
+    recover_frags();
   }
 }
 
-void Frame::insert_frag(Datagram && datagram)
+void Frame::insert_parity(const DatagramView & datagram)
 {
-  validate_datagram(datagram);
+  if (frag_sizes_.size() + has_parity_.size() > MAX_CODED_FRAGS) {
+    throw runtime_error("parity fragment of a frame too large to code");
+  }
+
+  const size_t parity_id = datagram.frag_id - frag_sizes_.size();
+  if (has_parity_[parity_id]) {
+    return;
+  }
+
+  const string_view payload = datagram.payload;
+  if (payload.size() <= Datagram::PARITY_HEADER_SIZE) {
+    throw runtime_error("parity fragment is too small");
+  }
+
+  const size_t frame_size = get_uint32(payload.data());
+  const size_t shard_size = payload.size() - Datagram::PARITY_HEADER_SIZE;
 
-  // insert only if the datagram does not exist yet
-  if (not frags_[datagram.frag_id]) {
-    frame_size_ += datagram.payload.size();
-    null_frags_--;
-    frags_[datagram.frag_id] = move(datagram);
+  // every parity fragment of a frame carries the same sizes
+  if (num_parity_ > 0 and
+      (frame_size != fec_frame_size_ or shard_size != shard_size_)) {
+    throw runtime_error("inconsistent parity fragments");
   }
+
+  // all data fragments are 'shard_size' bytes but the last one
+  const size_t frag_cnt = frag_sizes_.size();
+  if (frame_size <= (frag_cnt - 1) * shard_size or
+      frame_size > frag_cnt * shard_size) {
+    throw runtime_error("parity fragment does not match the frame size");
+  }
+
+  memcpy(payloads_.data() + datagram.frag_id * Datagram::MAX_PAYLOAD,
+         payload.data() + Datagram::PARITY_HEADER_SIZE, shard_size);
+
+  fec_frame_size_ = frame_size;
+  shard_size_ = shard_size;
+  has_parity_[parity_id] = true;
+  num_parity_++;
+}
+
+void Frame::recover_frags()
+{
+  const size_t frag_cnt = frag_sizes_.size();
+  const size_t last_frag_size = fec_frame_size_ - (frag_cnt - 1) * shard_size_;
+
+  vector<uint8_t *> shards(frag_cnt + has_parity_.size());
+  vector<bool> present(shards.size());
+
+  for (size_t i = 0; i < shards.size(); i++) {
+    shards[i] = reinterpret_cast<uint8_t *>(payloads_.data()
+                                            + i * Datagram::MAX_PAYLOAD);
+    present[i] = i < frag_cnt ? frag_sizes_[i].has_value()
+                              : has_parity_[i - frag_cnt];
+
+    if (i < frag_cnt and present[i]) {
+      const size_t expected_size = (i < frag_cnt - 1) ? shard_size_
+                                                      : last_frag_size;
+      if (*frag_sizes_[i] != expected_size) {
+        throw runtime_error("fragment size does not match the parity");
+      }
+
+      // the last fragment is coded with zero padding
+      memset(shards[i] + expected_size, 0, shard_size_ - expected_size);
+    }
+  }
+
+  if (not ReedSolomon(frag_cnt, has_parity_.size()).reconstruct(
+        shards, present, shard_size_)) {
+    return;
+  }
+
+  for (size_t i = 0; i < frag_cnt; i++) {
+    if (not present[i]) {
+      frag_sizes_[i] = (i < frag_cnt - 1) ? shard_size_ : last_frag_size;
+      frame_size_ += *frag_sizes_[i];
+      num_recovered_++;
+    }
+  }
+
+  null_frags_ = 0;
+
+  // the parity fragments present were overwritten in recovery, and the rest
+  // are no longer needed
+  has_parity_.assign(has_parity_.size(), true);
 }
 
 Decoder::Decoder(const uint16_t display_width,
@@ -110,80 +247,305 @@ Decoder::Decoder(const uint16_t display_width,
   }
 }
 
-bool Decoder::add_datagram_common(const Datagram & datagram)
+void Decoder::add_datagram(const DatagramView & datagram)
 {
   const auto frame_id = datagram.frame_id;
-  const auto frame_type = datagram.frame_type;
-  const auto frag_cnt = datagram.frag_cnt;
+  const auto seq_num = datagram.seq_num;
+
+  if (max_nacks_ > 0) {
+    // a datagram beyond the highest received might reveal new gaps
+    if (not highest_seq_num_ or seq_num > *highest_seq_num_) {
+      highest_seq_num_ = seq_num;
+      new_gaps_ = true;
+    }
+
+    const auto missing_it = missing_.find(seq_num);
+    if (missing_it != missing_.end()) {
+      const auto & missing = missing_it->second;
+
+      // RTT sample if NACKed only once (so it's clear which NACK it answers)
+      if (missing.num_nacks == 1) {
+        const double rtt_us = mono_us() - missing.last_nack_ts;
+        ewma_nack_rtt_us_ = ewma_nack_rtt_us_ ?
+            ALPHA * rtt_us + (1 - ALPHA) * (*ewma_nack_rtt_us_) : rtt_us;
+      }
+
+      if (verbose_) {
+        cerr << "Received missing datagram: seq_num=" << seq_num
+             << " nacks=" << missing.num_nacks << endl;
+      }
+
+      missing_.erase(missing_it);
+    }
+  }
+
+  // the streaming FEC needs the data fragments (even of the old frames) to
+  // recover the ones missing
+  if (stream_fec_ and not datagram.is_parity()) {
+    stream_fec_->add_source(seq_num, datagram.payload);
+  }
 
   // ignore any datagrams from the old frames
   if (frame_id < next_frame_) {
-    return false;
+    return;
   }
 
-  if (not frame_buf_.count(frame_id)) {
-    // initialize a Frame instance for frame 'frame_id'
-    frame_buf_.emplace(piecewise_construct,
-                       forward_as_tuple(frame_id),
-                       forward_as_tuple(frame_id, frame_type, frag_cnt));
+  if (datagram.frame_type == FrameType::PARITY) {
+    add_stream_parity(datagram);
+    return;
   }
 
-  return true;
+  // copy the fragment into the frame
+  Frame & frame = get_frame(datagram);
+  const unsigned int num_recovered = frame.num_recovered();
+  frame.insert_frag(datagram);
+
+  // FEC within the frame recovered the data fragments missing, so none of
+  // the frame's datagrams need to arrive anymore
+  if (frame.num_recovered() > num_recovered) {
+    const SeqNum first = frame.first_seq_num();
+    add_recovered(first, first + frame.frag_cnt() + frame.parity_cnt());
+  }
 }
 
-void Decoder::add_datagram(const Datagram & datagram)
+void Decoder::add_recovered(const SeqNum first, const SeqNum end)
 {
-  if (not add_datagram_common(datagram)) {
-    return;
+  for (SeqNum seq_num = first; seq_num < end; seq_num++) {
+    recovered_seq_nums_.emplace_back(seq_num);
   }
+}
 
-  // copy the fragment into the frame
-  frame_buf_.at(datagram.frame_id).insert_frag(datagram);
+Frame & Decoder::get_frame(const DatagramView & datagram)
+{
+  const auto frame_id = datagram.frame_id;
+
+  auto it = frame_buf_.find(frame_id);
+  if (it == frame_buf_.end()) {
+    const SeqNum first_seq_num = datagram.seq_num - datagram.frag_id;
+
+    if (spare_frames_.empty()) {
+      // initialize a Frame instance for frame 'frame_id'
+      it = frame_buf_.emplace(piecewise_construct,
+                              forward_as_tuple(frame_id),
+                              forward_as_tuple(frame_id, datagram.frame_type,
+                                               datagram.temporal_id,
+                                               datagram.ref_frames,
+                                               datagram.frag_cnt,
+                                               datagram.parity_cnt,
+                                               first_seq_num)).first;
+    } else {
+      // reuse the node (and the frame in it) of a frame cleaned up
+      auto node = move(spare_frames_.back());
+      spare_frames_.pop_back();
+
+      node.key() = frame_id;
+      node.mapped().reset(frame_id, datagram.frame_type, datagram.temporal_id,
+                          datagram.ref_frames, datagram.frag_cnt,
+                          datagram.parity_cnt, first_seq_num);
+      it = frame_buf_.insert(move(node)).position;
+    }
+  }
+
+  return it->second;
 }
 
-void Decoder::add_datagram(Datagram && datagram)
+void Decoder::add_stream_parity(const DatagramView & datagram)
 {
-  if (not add_datagram_common(datagram)) {
+  StreamParityHeader header;
+  const auto symbol = header.parse_from_string(datagram.payload);
+  if (not symbol) {
+    throw runtime_error("failed to parse a parity datagram");
+  }
+
+  // the frames covered end with the datagram's own
+  const auto & own = header.frames[header.num_frames - 1];
+  if (own.frag_cnt != datagram.frag_cnt or
+      own.parity_cnt != datagram.parity_cnt or
+      datagram.frame_id < header.num_frames - 1u) {
+    throw runtime_error("parity datagram covers inconsistent frames");
+  }
+
+  // data fragments are stored from now on (so the first parity datagrams
+  // might be of no use)
+  if (not stream_fec_) {
+    stream_fec_.emplace(STREAM_FEC_CAPACITY, Datagram::MAX_PAYLOAD);
+  }
+
+  // the frames covered are numbered consecutively up to the datagram's own
+  SeqNum first = datagram.seq_num - datagram.frag_id;
+  for (size_t i = 0; i < header.num_frames - 1u; i++) {
+    first -= header.frames[i].frag_cnt + header.frames[i].parity_cnt;
+  }
+
+  stream_source_ids_.clear();
+
+  for (size_t i = 0; i < header.num_frames; i++) {
+    const auto & covered = header.frames[i];
+    const uint32_t frame_id = datagram.frame_id - (header.num_frames - 1 - i);
+
+    if (not stream_frames_.count(first)) {
+      if (spare_stream_frames_.empty()) {
+        stream_frames_.emplace(first, StreamFrame {frame_id, covered});
+      } else {
+        // reuse the node of a frame cleaned up
+        auto node = move(spare_stream_frames_.back());
+        spare_stream_frames_.pop_back();
+
+        node.key() = first;
+        node.mapped() = {frame_id, covered};
+        stream_frames_.insert(move(node));
+      }
+    }
+
+    for (uint16_t frag_id = 0; frag_id < covered.frag_cnt; frag_id++) {
+      stream_source_ids_.emplace_back(first + frag_id);
+    }
+
+    first += covered.frag_cnt + covered.parity_cnt;
+  }
+
+  stream_fec_->add_repair(datagram.seq_num, stream_source_ids_, *symbol);
+}
+
+void Decoder::recover_stream_frags()
+{
+  if (not stream_fec_) {
     return;
   }
 
-  // move the fragment into the frame
-  frame_buf_.at(datagram.frame_id).insert_frag(move(datagram));
+  for (const auto & [seq_num, payload] : stream_fec_->recover()) {
+    // the frame of the data fragment recovered
+    auto it = stream_frames_.upper_bound(seq_num);
+    if (it == stream_frames_.begin()) {
+      continue;
+    }
+    it--;
+
+    const SeqNum first = it->first;
+    const auto & [frame_id, covered] = it->second;
+    if (seq_num - first >= covered.frag_cnt or frame_id < next_frame_) {
+      continue;
+    }
+
+    if (verbose_) {
+      cerr << "Recovered datagram with FEC: frame_id=" << frame_id
+           << " frag_id=" << seq_num - first
+           << " seq_num=" << seq_num << endl;
+    }
+
+    // insert it as if received
+    DatagramView datagram;
+    datagram.frame_id = frame_id;
+    datagram.frame_type = covered.frame_type;
+    datagram.temporal_id = covered.temporal_id;
+    datagram.ref_frames = covered.ref_frames;
+    datagram.frag_id = seq_num - first;
+    datagram.frag_cnt = covered.frag_cnt;
+    datagram.parity_cnt = covered.parity_cnt;
+    datagram.seq_num = seq_num;
+    datagram.payload = payload;
+
+    get_frame(datagram).insert_frag(datagram);
+
+    missing_.erase(seq_num);
+    recovered_seq_nums_.emplace_back(seq_num);
+    num_recovered_frags_++;
+  }
 }
 
 bool Decoder::next_frame_complete()
 {
+  // fill in what the streaming FEC recovers (of this frame or later ones)
+  recover_stream_frags();
+
   {
-    // check if the next frame to expect is complete
+    // check if the next frame to expect is complete and decodable
     auto it = as_const(frame_buf_).find(next_frame_);
-    if (it != frame_buf_.end() and it->second.complete()) {
+    if (it != frame_buf_.end() and it->second.complete() and
+        refs_decoded(it->second)) {
       return true;
     }
   }
 
-  // seek forward if a key frame in the future is already complete
+  // seek forward if a key frame in the future is already complete, or a
+  // recovery frame (which predicts only from a reference frame reported as
+  // decoded, so the frames skipped are not needed)
   for (auto it = frame_buf_.rbegin(); it != frame_buf_.rend(); it++) {
     const auto frame_id = it->first;
     const auto & frame = it->second;
 
-    // found a complete key frame ahead of next_frame_
-    if (frame.type() == FrameType::KEY and frame.complete()) {
+    // found a complete key or recovery frame ahead of next_frame_
+    if ((frame.type() == FrameType::KEY or
+         frame.type() == FrameType::RECOVERY) and frame.complete()) {
       assert(frame_id > next_frame_);
 
-      // set next_frame_ to frame_id and clean up old frames
+      // set next_frame_ to frame_id and clean up old frames; the datagrams
+      // of the frames skipped need not arrive anymore
       const auto frame_diff = frame_id - next_frame_;
+      add_recovered(next_seq_num_, frame.first_seq_num());
+      next_seq_num_ = frame.first_seq_num();
       advance_next_frame(frame_diff);
 
-      cerr << "* Recovery: skipped " << frame_diff
-           << " frames ahead to key frame " << frame_id << endl;
+      cerr << "* Recovery: skipped " << frame_diff << " frames ahead to "
+           << (frame.type() == FrameType::KEY ? "key" : "recovery")
+           << " frame " << frame_id;
+      if (last_consumed_time_) {
+        cerr << " (frozen for " << double_to_string(duration<double, milli>(
+                steady_clock::now() - *last_consumed_time_).count()) << " ms)";
+      }
+      cerr << endl;
 
       return true;
     }
   }
 
+  // otherwise seek forward to the first complete frame that predicts only
+  // from frames decoded: the frames skipped are not needed by it (nor by
+  // the frames after, which predict from it or the frames before it)
+  for (const auto & [frame_id, frame] : as_const(frame_buf_)) {
+    if (frame_id == next_frame_ or not frame.complete() or
+        not refs_decoded(frame)) {
+      continue;
+    }
+
+    // the datagrams of the frames skipped need not arrive anymore, and some
+    // never will (e.g., those the sender dropped unsent past their deadline)
+    const auto frame_diff = frame_id - next_frame_;
+    add_recovered(next_seq_num_, frame.first_seq_num());
+    next_seq_num_ = frame.first_seq_num();
+    advance_next_frame(frame_diff);
+    num_skipped_frames_ += frame_diff;
+
+    if (verbose_) {
+      cerr << "Skipped " << frame_diff << " frames ahead to frame "
+           << frame_id << " (temporal layer "
+           << static_cast<int>(frame.temporal_id()) << ")" << endl;
+    }
+
+    return true;
+  }
+
   return false;
 }
 
+bool Decoder::refs_decoded(const Frame & frame) const
+{
+  for (uint32_t i = 0; i < Datagram::MAX_REF_DISTANCE; i++) {
+    if (not (frame.ref_frames() & (1 << i))) {
+      continue;
+    }
+
+    // frame 'ref' must be decoded already
+    const uint32_t ref = frame.id() - 1 - i;
+    if (ref >= next_frame_ or next_frame_ - 1 - ref >= 64 or
+        not (decoded_frames_ & (1ULL << (next_frame_ - 1 - ref)))) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
 void Decoder::consume_next_frame()
 {
   Frame & frame = frame_buf_.at(next_frame_);
@@ -196,10 +558,41 @@ void Decoder::consume_next_frame()
   const size_t frame_size = frame.frame_size().value();
   total_decodable_frame_size_ += frame_size;
 
+  next_seq_num_ = frame.first_seq_num() + frame.frag_cnt() + frame.parity_cnt();
+
+  // the frame's parity datagrams lost (e.g., of the streaming FEC) are never
+  // retransmitted, so acknowledge them lest they hold the cumulative ack back
+  add_recovered(frame.first_seq_num() + frame.frag_cnt(), next_seq_num_);
+  num_recovered_frags_ += frame.num_recovered();
+
+  if (frame.type() == FrameType::KEY or frame.type() == FrameType::REF) {
+    last_ref_frame_ = frame.id();
+  }
+
   const auto stats_now = steady_clock::now();
+  if (last_consumed_time_) {
+    max_freeze_ms_ = max(max_freeze_ms_, duration<double, milli>(
+                         stats_now - *last_consumed_time_).count());
+  }
+  last_consumed_time_ = stats_now;
+
   while (stats_now >= last_stats_time_ + 1s) {
-    cerr << "Decodable frames in the last ~1s: "
-         << num_decodable_frames_ << endl;
+    cerr << "Decodable frames"
+         << (stream_id_ > 0 ? " of stream " + to_string(stream_id_) : "")
+         << " in the last ~1s: " << num_decodable_frames_ << endl;
+
+    cerr << "  - Longest freeze between frames (ms): "
+         << double_to_string(max_freeze_ms_) << endl;
+
+    if (num_recovered_frags_ > 0) {
+      cerr << "  - Fragments recovered by FEC: " << num_recovered_frags_
+           << endl;
+    }
+
+    if (num_skipped_frames_ > 0) {
+      cerr << "  - Frames skipped (not needed by the frames after): "
+           << num_skipped_frames_ << endl;
+    }
 
     const double diff_ms = duration<double, milli>(
                            stats_now - last_stats_time_).count();
@@ -211,7 +604,10 @@ void Decoder::consume_next_frame()
 
     // reset stats
     num_decodable_frames_ = 0;
+    num_recovered_frags_ = 0;
+    num_skipped_frames_ = 0;
     total_decodable_frame_size_ = 0;
+    max_freeze_ms_ = 0.0;
     last_stats_time_ += 1s;
   }
 
@@ -220,6 +616,13 @@ void Decoder::consume_next_frame()
     {
       lock_guard<mutex> lock(mtx_);
       shared_queue_.emplace_back(move(frame));
+
+      // leave a frame the worker has decoded in its place (to be reused
+      // along with its node of frame_buf_)
+      if (not returned_frames_.empty()) {
+        frame = move(returned_frames_.back());
+        returned_frames_.pop_back();
+      }
     } // release the lock before notifying the worker thread
 
     // notify worker thread
@@ -237,14 +640,131 @@ void Decoder::consume_next_frame()
 
   // move onto the next frame
   advance_next_frame();
+  decoded_frames_ |= 1;
 }
 
 void Decoder::advance_next_frame(const unsigned int n)
 {
   next_frame_ += n;
+  decoded_frames_ = n < 64 ? decoded_frames_ << n : 0;
 
   // clean up state up to next_frame_
   clean_up_to(next_frame_);
+
+  // stop NACKing the datagrams of the frames skipped
+  missing_.erase(missing_.begin(), missing_.lower_bound(next_seq_num_));
+
+  // nor recovering them
+  while (not stream_frames_.empty() and
+         stream_frames_.begin()->first < next_seq_num_) {
+    if (spare_stream_frames_.size() < MAX_SPARE_FRAMES) {
+      spare_stream_frames_.emplace_back(
+          stream_frames_.extract(stream_frames_.begin()));
+    } else {
+      stream_frames_.erase(stream_frames_.begin());
+    }
+  }
+}
+
+void Decoder::enable_nacks(const unsigned int max_nacks)
+{
+  if (max_nacks == 0) {
+    throw runtime_error("Decoder: max NACKs per datagram must be positive");
+  }
+
+  max_nacks_ = max_nacks;
+}
+
+void Decoder::find_missing(const uint64_t now)
+{
+  if (not highest_seq_num_) {
+    return;
+  }
+
+  const SeqNum highest = *highest_seq_num_;
+
+  const auto add_missing = [&](const SeqNum seq_num)
+  {
+    if (missing_.size() < MAX_MISSING) {
+      missing_.emplace(seq_num, MissingDatagram {now});
+    }
+  };
+
+  // the next datagram expected if no frames were missing
+  SeqNum expected = next_seq_num_;
+
+  for (const auto & [frame_id, frame] : frame_buf_) {
+    const SeqNum first = frame.first_seq_num();
+
+    // the frames between 'expected' and this one are missing entirely (only
+    // the last MAX_MISSING datagrams of them are tracked)
+    if (first > expected) {
+      const SeqNum from = first - expected > MAX_MISSING ?
+                          first - MAX_MISSING : expected;
+      for (SeqNum seq_num = from; seq_num < first; seq_num++) {
+        add_missing(seq_num);
+      }
+    }
+
+    // the fragments missing from this frame (up to the highest received)
+    if (not frame.complete()) {
+      for (uint16_t frag_id = 0; frag_id < frame.frag_cnt()
+           and first + frag_id < highest; frag_id++) {
+        if (not frame.has_frag(frag_id)) {
+          add_missing(first + frag_id);
+        }
+      }
+    }
+
+    expected = max(expected, first + frame.frag_cnt() + frame.parity_cnt());
+  }
+}
+
+bool Decoder::build_nack(NackMsg & nack, const uint64_t now)
+{
+  nack.num_seq_nums = 0;
+  next_nack_ts_.reset();
+
+  if (max_nacks_ == 0) {
+    return false;
+  }
+
+  if (new_gaps_) {
+    find_missing(now);
+    new_gaps_ = false;
+  }
+
+  // NACK again about an RTT after the last NACK went unanswered
+  const uint64_t rtt_us = ewma_nack_rtt_us_ ?
+      static_cast<uint64_t>(*ewma_nack_rtt_us_) : INITIAL_NACK_RTT_US;
+  const uint64_t nack_interval_us = max(MIN_NACK_INTERVAL_US, rtt_us * 5 / 4);
+
+  for (auto & [seq_num, missing] : missing_) {
+    if (missing.num_nacks >= max_nacks_) {
+      continue;
+    }
+
+    // a datagram missing briefly might be reordered rather than lost
+    const uint64_t due_ts = missing.num_nacks == 0 ?
+        missing.detect_ts + REORDER_DELAY_US :
+        missing.last_nack_ts + nack_interval_us;
+
+    if (now < due_ts or nack.num_seq_nums >= NackMsg::MAX_SEQ_NUMS) {
+      next_nack_ts_ = min(next_nack_ts_.value_or(UINT64_MAX), due_ts);
+      continue;
+    }
+
+    missing.num_nacks++;
+    missing.last_nack_ts = now;
+    nack.seq_nums[nack.num_seq_nums++] = seq_num;
+
+    if (missing.num_nacks < max_nacks_) {
+      next_nack_ts_ = min(next_nack_ts_.value_or(UINT64_MAX),
+                          now + nack_interval_us);
+    }
+  }
+
+  return nack.num_seq_nums > 0;
 }
 
 void Decoder::clean_up_to(const uint32_t frontier)
@@ -254,26 +774,28 @@ void Decoder::clean_up_to(const uint32_t frontier)
       break;
     }
 
-    it = frame_buf_.erase(it);
+    if (spare_frames_.size() < MAX_SPARE_FRAMES and
+        it->second.buffer_size() <= MAX_SPARE_BUFFER) {
+      spare_frames_.emplace_back(frame_buf_.extract(it++));
+    } else {
+      it = frame_buf_.erase(it);
+    }
   }
 }
 
-double Decoder::decode_frame(vpx_codec_ctx_t & context, const Frame & frame)
+double Decoder::decode_frame(vpx_codec_ctx_t & context,
+                             vector<uint8_t> & decode_buf, const Frame & frame)
 {
   if (not frame.complete()) {
     throw runtime_error("frame must be complete before decoding");
   }
 
-  // allocate a decoding buffer once
-  static constexpr size_t MAX_DECODING_BUF = 1000000; // 1 MB
-  static vector<uint8_t> decode_buf(MAX_DECODING_BUF);
-
   // copy the payload of the frame's datagrams to 'decode_buf'
   uint8_t * buf_ptr = decode_buf.data();
   const uint8_t * const buf_end = buf_ptr + decode_buf.size();
 
-  for (const auto & datagram : frame.frags()) {
-    const string & payload = datagram.value().payload;
+  for (uint16_t frag_id = 0; frag_id < frame.frag_cnt(); frag_id++) {
+    const string_view payload = frame.get_frag(frag_id);
 
     if (buf_ptr + payload.size() >= buf_end) {
       throw runtime_error("frame size exceeds max decoding buffer size");
@@ -340,8 +862,13 @@ void Decoder::worker_main()
     display = make_unique<VideoDisplay>(display_width_, display_height_);
   }
 
-  // local queue of frames
-  deque<Frame> local_queue;
+  // decoding buffer allocated once (per worker, as every simulcast stream
+  // has a decoder with its own worker)
+  vector<uint8_t> decode_buf(MAX_DECODING_BUF);
+
+  // local queue of frames (swapped with the shared queue, so that neither
+  // allocates once both have grown enough)
+  vector<Frame> local_queue;
 
   // stats maintained by the worker thread
   unsigned int num_decoded_frames = 0;
@@ -360,17 +887,14 @@ void Decoder::worker_main()
       unique_lock<mutex> lock(mtx_);
       cv_.wait(lock, [this] { return not shared_queue_.empty(); });
 
-      // worker owns the lock after wait and should copy shared queue quickly
-      while (not shared_queue_.empty()) {
-        local_queue.emplace_back(move(shared_queue_.front()));
-        shared_queue_.pop_front();
-      }
+      // worker owns the lock after wait and should take shared queue quickly
+      swap(local_queue, shared_queue_);
     } // worker releases the lock so it doesn't block the main thread anymore
 
     // now worker can take its time to decode and render the frames kept locally
-    while (not local_queue.empty()) {
-      const Frame & frame = local_queue.front();
-      const double decode_time_ms = decode_frame(context, frame);
+    for (const Frame & frame : local_queue) {
+      const double decode_time_ms = decode_frame(context, decode_buf,
+                                                frame);
 
       if (output_fd_) {
         const auto frame_decoded_ts = timestamp_us();
@@ -384,8 +908,6 @@ void Decoder::worker_main()
         display_decoded_frame(context, *display);
       }
 
-      local_queue.pop_front();
-
       // update stats
       num_decoded_frames++;
       total_decode_time_ms += decode_time_ms;
@@ -408,6 +930,15 @@ void Decoder::worker_main()
         last_stats_time += 1s;
       }
     }
+
+    // hand the decoded frames back to the main thread to reuse their buffers
+    {
+      lock_guard<mutex> lock(mtx_);
+      for (Frame & frame : local_queue) {
+        returned_frames_.emplace_back(move(frame));
+      }
+    }
+    local_queue.clear();
   }
 
   check_call(vpx_codec_destroy(&context), VPX_CODEC_OK, "vpx_codec_destroy");
@@ -7,8 +7,9 @@ extern "C" {
 }
 
 #include <map>
+#include <memory>
+#include <string_view>
 #include <vector>
-#include <deque>
 #include <optional>
 #include <chrono>
 #include <mutex>
@@ -16,6 +17,7 @@ extern "C" {
 #include <thread>
 
 #include "protocol.hh"
+#include "sliding_window_code.hh"
 #include "sdl.hh"
 #include "file_descriptor.hh"
 
@@ -25,18 +27,50 @@ class Frame
 public:
   Frame(const uint32_t frame_id,
         const FrameType frame_type,
-        const uint16_t frag_cnt);
-
-  // if the frame has fragment 'frag_id'
+        const uint8_t temporal_id,
+        const RefFrames ref_frames,
+        const uint16_t frag_cnt,
+        const uint16_t parity_cnt,
+        const SeqNum first_seq_num);
+
+  // a frame (its data fragments) must fit in the decoding buffer
+  static constexpr size_t MAX_FRAME_SIZE = 1000000; // 1 MB
+
+  // most data fragments in a frame, as the smallest ones (at the lowest MTU
+  // of 512 bytes, with the streaming FEC) would fill MAX_FRAME_SIZE
+  static constexpr size_t MIN_FRAG_SIZE = 512 - 28 - Datagram::HEADER_SIZE
+      - StreamParityHeader::serialized_size(StreamParityHeader::MAX_FRAMES)
+      - SlidingWindowCode::LENGTH_SIZE;
+  static constexpr size_t MAX_FRAG_CNT = MAX_FRAME_SIZE / MIN_FRAG_SIZE;
+
+  // parity fragments are kept only for FEC within the frame, whose code has
+  // at most this many fragments in total (see ReedSolomon); the streaming
+  // FEC's are not stored in the frame
+  static constexpr size_t MAX_CODED_FRAGS = 256;
+
+  // reinitialize the frame as a new one (as in the constructor), reusing the
+  // buffers it has allocated
+  void reset(const uint32_t frame_id,
+             const FrameType frame_type,
+             const uint8_t temporal_id,
+             const RefFrames ref_frames,
+             const uint16_t frag_cnt,
+             const uint16_t parity_cnt,
+             const SeqNum first_seq_num);
+
+  // if the frame has (data) fragment 'frag_id'
   bool has_frag(const uint16_t frag_id) const;
 
-  // get fragment 'frag_id'
-  Datagram & get_frag(const uint16_t frag_id);
-  const Datagram & get_frag(const uint16_t frag_id) const;
+  // get the payload of (data) fragment 'frag_id'
+  std::string_view get_frag(const uint16_t frag_id) const;
+
+  // copy a fragment's payload into the frame (if not inserted yet); once
+  // as many data and parity fragments as data fragments have arrived, the
+  // missing data fragments are recovered with FEC
+  void insert_frag(const DatagramView & datagram);
 
-  // insert a fragment into the frame
-  void insert_frag(const Datagram & datagram);
-  void insert_frag(Datagram && datagram);
+  // bytes allocated for the payloads
+  size_t buffer_size() const { return payloads_.size(); }
 
   // if the frame has received all fragments
   bool complete() const { return null_frags_ == 0; }
@@ -45,22 +79,47 @@ public:
   // accessors
   uint32_t id() const { return id_; }
   FrameType type() const { return type_; }
-
-  std::vector<std::optional<Datagram>> & frags() { return frags_; }
-  const std::vector<std::optional<Datagram>> & frags() const { return frags_; }
-
+  uint8_t temporal_id() const { return temporal_id_; }
+  RefFrames ref_frames() const { return ref_frames_; }
+  uint16_t frag_cnt() const { return frag_sizes_.size(); }
+  uint16_t parity_cnt() const { return has_parity_.size(); }
   unsigned int null_frags() const { return null_frags_; }
+  unsigned int num_recovered() const { return num_recovered_; }
+
+  // sequence number of fragment 0 (fragments are numbered consecutively)
+  SeqNum first_seq_num() const { return first_seq_num_; }
 
 private:
   uint32_t id_;    // frame ID
   FrameType type_; // frame type
+  uint8_t temporal_id_;
+  RefFrames ref_frames_; // the frames it predicts from (see RefFrames)
+  SeqNum first_seq_num_;
+
+  // payloads of fragments stored in fixed-size slots (one per fragment),
+  // only grown (see reset()) so that inserting a fragment never allocates
+  std::vector<char> payloads_ {};
+  std::vector<std::optional<uint16_t>> frag_sizes_ {}; // payload size (if any)
 
-  std::vector<std::optional<Datagram>> frags_; // fragments of this frame
-  unsigned int null_frags_; // number of uninitialized fragments
+  unsigned int null_frags_ {0}; // number of uninitialized fragments
   size_t frame_size_ {0}; // frame size so far
 
+  // FEC: parity fragments received (stored after the data fragments), the
+  // frame size and shard size they carry, and data fragments recovered
+  std::vector<bool> has_parity_ {};
+  unsigned int num_parity_ {0};
+  size_t fec_frame_size_ {0};
+  size_t shard_size_ {0};
+  unsigned int num_recovered_ {0};
+
   // validate if a datagram belongs to this frame
-  void validate_datagram(const Datagram & datagram) const;
+  void validate_datagram(const DatagramView & datagram) const;
+
+  // store a parity fragment
+  void insert_parity(const DatagramView & datagram);
+
+  // recover the missing data fragments from the parity fragments
+  void recover_frags();
 };
 
 class Decoder
@@ -77,11 +136,14 @@ public:
           const int lazy_level = 0,
           const std::string & output_path = "");
 
-  // add a received datagram
-  void add_datagram(const Datagram & datagram);
-  void add_datagram(Datagram && datagram);
+  // add a received datagram (its payload is copied into the frame buffer)
+  void add_datagram(const DatagramView & datagram);
 
-  // is next frame complete; might skip to a complete key frame ahead
+  // is next frame complete (and are the frames it predicts from decoded);
+  // might recover missing fragments with the streaming FEC, or skip to a
+  // complete key (or recovery) frame ahead, or to the first frame ahead that
+  // is complete and predicts only from frames decoded (as when a frame of a
+  // temporal enhancement layer is lost)
   bool next_frame_complete();
 
   // depending on the lazy level, might decode and display the next frame
@@ -90,12 +152,36 @@ public:
   // output stats every second and reset
   void output_periodic_stats();
 
+  // NACK each datagram missing from (or between) the frames yet to consume
+  // up to 'max_nacks' times, about an RTT apart
+  void enable_nacks(const unsigned int max_nacks);
+
+  // fill 'nack' with the missing datagrams to (re-)NACK at 'now' (us, on
+  // mono_us() clock); return false if there are none
+  bool build_nack(NackMsg & nack, const uint64_t now);
+
+  // when the next NACK is due as of the last build_nack(), if any
+  std::optional<uint64_t> next_nack_ts() const { return next_nack_ts_; }
+
   // accessors
   uint32_t next_frame() const { return next_frame_; }
 
+  // the last key frame or FrameType::REF frame consumed (to report back)
+  std::optional<uint32_t> last_ref_frame() const { return last_ref_frame_; }
+
+  // sequence numbers of the datagrams that need not arrive anymore, as FEC
+  // recovered their data, their frame is complete without them (parity is
+  // never retransmitted), or their frame was skipped; to acknowledge them
+  // (the caller should clear it)
+  std::vector<SeqNum> & recovered_seq_nums() { return recovered_seq_nums_; }
+
   // mutators
   void set_verbose(const bool verbose) { verbose_ = verbose; }
 
+  // simulcast stream of the frames (to label the stats of streams but the
+  // first)
+  void set_stream_id(const uint8_t stream_id) { stream_id_ = stream_id; }
+
   // forbid copying and moving
   Decoder(const Decoder & other) = delete;
   const Decoder & operator=(const Decoder & other) = delete;
@@ -113,36 +199,135 @@ private:
   // print debugging info
   bool verbose_ {false};
 
+  // see set_stream_id()
+  uint8_t stream_id_ {0};
+
   // next frame ID to decode
   uint32_t next_frame_ {0};
 
+  // see last_ref_frame()
+  std::optional<uint32_t> last_ref_frame_ {};
+
+  // bit i is set if frame 'next_frame_ - 1 - i' was decoded
+  uint64_t decoded_frames_ {0};
+
+  // if the frames that 'frame' predicts from are decoded
+  bool refs_decoded(const Frame & frame) const;
+
   // frame ID => class Frame
   std::map<uint32_t, Frame> frame_buf_ {};
 
+  // nodes of frame_buf_ cleaned up, kept (with their frames' buffers) for
+  // the frames to come, so that a frame allocates nothing once warmed up
+  std::vector<std::map<uint32_t, Frame>::node_type> spare_frames_ {};
+  static constexpr size_t MAX_SPARE_FRAMES = 32;
+
+  // larger buffers (of frames with many fragments) are not kept
+  static constexpr size_t MAX_SPARE_BUFFER =
+      Frame::MAX_CODED_FRAGS * Datagram::MAX_PAYLOAD;
+
+  // see recovered_seq_nums()
+  std::vector<SeqNum> recovered_seq_nums_ {};
+
+  // add datagrams [first, end) to recovered_seq_nums_
+  void add_recovered(const SeqNum first, const SeqNum end);
+
+  // streaming FEC (from the first parity datagram of it on): the data
+  // fragments received or recovered, and the parity datagrams
+  std::optional<SlidingWindowDecoder> stream_fec_ {};
+  static constexpr size_t STREAM_FEC_CAPACITY = 4096; // data fragments kept
+
+  // the frames covered by the parity datagrams: first sequence number => ...
+  struct StreamFrame
+  {
+    uint32_t frame_id;
+    StreamParityHeader::CoveredFrame header;
+  };
+
+  std::map<SeqNum, StreamFrame> stream_frames_ {};
+
+  // nodes of stream_frames_ cleaned up, and the sources of the last parity
+  // datagram, kept so that a parity datagram allocates nothing
+  std::vector<std::map<SeqNum, StreamFrame>::node_type>
+      spare_stream_frames_ {};
+  std::vector<SeqNum> stream_source_ids_ {};
+
+  // add a parity datagram of the streaming FEC
+  void add_stream_parity(const DatagramView & datagram);
+
+  // insert the data fragments that the streaming FEC recovers into their
+  // frames
+  void recover_stream_frags();
+
+  // find (or create) the frame that a datagram belongs to
+  Frame & get_frame(const DatagramView & datagram);
+
+  // sequence number of the first datagram of next_frame_ (assuming the
+  // frames are consecutive), and the highest sequence number received
+  SeqNum next_seq_num_ {0};
+  std::optional<SeqNum> highest_seq_num_ {};
+
+  // NACK-related
+  struct MissingDatagram
+  {
+    uint64_t detect_ts;           // when the gap was found
+    uint64_t last_nack_ts {0};    // when it was last NACKed
+    unsigned int num_nacks {0};
+  };
+
+  unsigned int max_nacks_ {0}; // NACKs disabled if 0
+  std::map<SeqNum, MissingDatagram> missing_ {}; // sequence number => ...
+  bool new_gaps_ {false}; // if there might be gaps not in missing_ yet
+  std::optional<uint64_t> next_nack_ts_ {};
+
+  // round trip from NACKing a datagram to receiving it
+  std::optional<double> ewma_nack_rtt_us_ {};
+  static constexpr double ALPHA = 0.2;
+
+  // constants
+  static constexpr size_t MAX_MISSING = 4096;
+  static constexpr uint64_t REORDER_DELAY_US = 2000; // before the first NACK
+  static constexpr uint64_t INITIAL_NACK_RTT_US = 100 * 1000;
+  static constexpr uint64_t MIN_NACK_INTERVAL_US = 2000;
+
+  // add the datagrams below highest_seq_num_ missing from (or between) the
+  // frames yet to consume to missing_
+  void find_missing(const uint64_t now);
+
   // performance stats
   unsigned int num_decodable_frames_ {0};
+  unsigned int num_recovered_frags_ {0}; // by FEC
+  unsigned int num_skipped_frames_ {0}; // not needed by the frames after
   size_t total_decodable_frame_size_ {0}; // bytes
+
+  // when the last frame was consumed, and the longest the video froze
+  // between two frames
+  std::optional<std::chrono::time_point<std::chrono::steady_clock>>
+      last_consumed_time_ {};
+  double max_freeze_ms_ {0.0};
   std::chrono::time_point<std::chrono::steady_clock> last_stats_time_ {};
 
   // shared between main (Decoder) and worker threads
   std::mutex mtx_ {};
   std::condition_variable cv_ {};
-  std::deque<Frame> shared_queue_ {};
+  std::vector<Frame> shared_queue_ {};
+  std::vector<Frame> returned_frames_ {}; // decoded, to reuse their buffers
 
   // worker thread for decoding and displaying frames
   std::thread worker_ {};
 
-  // common code between the two versions of add_datagram()
-  bool add_datagram_common(const Datagram & datagram);
-
   // advance next frame ID by 'n'
   void advance_next_frame(const unsigned int n = 1);
 
   // clean up states (such as frame_buf_) up to frame 'frontier'
   void clean_up_to(const uint32_t frontier);
 
+  // the compressed frame is copied into a buffer of the worker to decode
+  static constexpr size_t MAX_DECODING_BUF = Frame::MAX_FRAME_SIZE;
+
   // worker thread calls the functions below
-  double decode_frame(vpx_codec_ctx_t & context, const Frame & frame);
+  double decode_frame(vpx_codec_ctx_t & context,
+                      std::vector<uint8_t> & decode_buf, const Frame & frame);
   void display_decoded_frame(vpx_codec_ctx_t & context, VideoDisplay & display);
   void worker_main();
 };
@@ -0,0 +1,74 @@
+#include <utility>
+
+#include "encode_worker.hh"
+
+using namespace std;
+
+EncodeWorker::EncodeWorker(Encoder & encoder)
+  : encoder_(encoder)
+{
+  thread_ = thread(&EncodeWorker::worker_main, this);
+}
+
+EncodeWorker::~EncodeWorker()
+{
+  {
+    lock_guard<mutex> lock(mtx_);
+    quit_ = true;
+  }
+  cv_.notify_all();
+
+  thread_.join();
+}
+
+void EncodeWorker::encode(const RawImage & raw_img)
+{
+  {
+    lock_guard<mutex> lock(mtx_);
+    raw_img_ = &raw_img;
+    busy_ = true;
+  }
+  cv_.notify_all();
+}
+
+void EncodeWorker::wait()
+{
+  unique_lock<mutex> lock(mtx_);
+  cv_.wait(lock, [this] { return not busy_; });
+
+  if (error_) {
+    rethrow_exception(exchange(error_, nullptr));
+  }
+}
+
+void EncodeWorker::worker_main()
+{
+  while (true) {
+    const RawImage * raw_img;
+
+    {
+      unique_lock<mutex> lock(mtx_);
+      cv_.wait(lock, [this] { return quit_ or raw_img_; });
+
+      if (quit_) {
+        return;
+      }
+
+      raw_img = exchange(raw_img_, nullptr);
+    } // encode without holding the lock
+
+    exception_ptr error;
+    try {
+      encoder_.encode_frame(*raw_img);
+    } catch (...) {
+      error = current_exception();
+    }
+
+    {
+      lock_guard<mutex> lock(mtx_);
+      error_ = error;
+      busy_ = false;
+    }
+    cv_.notify_all();
+  }
+}
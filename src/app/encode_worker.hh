@@ -0,0 +1,53 @@
+#ifndef ENCODE_WORKER_HH
+#define ENCODE_WORKER_HH
+
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <exception>
+
+#include "encoder.hh"
+#include "image.hh"
+
+// long-lived thread that encodes the frames of a simulcast stream handed to
+// it (see Encoder::encode_frame()), so that the streams encode in parallel
+// without starting a thread per frame
+class EncodeWorker
+{
+public:
+  // start a thread encoding with 'encoder'
+  EncodeWorker(Encoder & encoder);
+
+  // stop the thread (after the frame being encoded, if any)
+  ~EncodeWorker();
+
+  // start encoding 'raw_img', which must not change until wait() returns
+  void encode(const RawImage & raw_img);
+
+  // wait until the frame is encoded, and rethrow the exception if it threw
+  void wait();
+
+  // forbid copying and moving
+  EncodeWorker(const EncodeWorker & other) = delete;
+  const EncodeWorker & operator=(const EncodeWorker & other) = delete;
+  EncodeWorker(EncodeWorker && other) = delete;
+  EncodeWorker & operator=(EncodeWorker && other) = delete;
+
+private:
+  Encoder & encoder_;
+
+  // shared between the caller and the thread
+  std::mutex mtx_ {};
+  std::condition_variable cv_ {};
+  const RawImage * raw_img_ {nullptr}; // frame to encode (if any)
+  bool busy_ {false};                  // until the frame is encoded
+  bool quit_ {false};
+  std::exception_ptr error_ {};
+
+  // started last, once the members above are initialized
+  std::thread thread_ {};
+
+  void worker_main();
+};
+
+#endif /* ENCODE_WORKER_HH */
@@ -1,15 +1,20 @@
 #include <sys/sysinfo.h>
 #include <cassert>
+#include <cstring>
+#include <cmath>
 #include <iostream>
 #include <string>
 #include <stdexcept>
 #include <chrono>
 #include <algorithm>
 #include <limits>
+#include <vector>
 
 #include "encoder.hh"
 #include "conversion.hh"
-#include "timestamp.hh"
+#include "mono_clock.hh"
+#include "reed_solomon.hh"
+#include "sliding_window_code.hh"
 
 using namespace std;
 using namespace chrono;
@@ -17,10 +22,17 @@ using namespace chrono;
 Encoder::Encoder(const uint16_t display_width,
                  const uint16_t display_height,
                  const uint16_t frame_rate,
-                 const string & output_path)
+                 const string & output_path,
+                 const unsigned int num_temporal_layers)
   : display_width_(display_width), display_height_(display_height),
-    frame_rate_(frame_rate), output_fd_()
+    frame_rate_(frame_rate), output_fd_(),
+    num_temporal_layers_(num_temporal_layers)
 {
+  if (num_temporal_layers_ == 0 or
+      num_temporal_layers_ > MAX_TEMPORAL_LAYERS) {
+    throw runtime_error("Encoder: invalid number of temporal layers");
+  }
+
   // open the output file
   if (not output_path.empty()) {
     output_fd_ = FileDescriptor(check_syscall(
@@ -60,6 +72,44 @@ Encoder::Encoder(const uint16_t display_width,
   cfg_.rc_end_usage = VPX_CBR;
   cfg_.rc_target_bitrate = target_bitrate_;
 
+  // temporal layers with a single spatial layer (as libvpx's examples); the
+  // layer and reference slots of each frame are set in encode_frame()
+  if (num_temporal_layers_ > 1) {
+    // every frame predicts from the last frame and updates only it unless
+    // stated otherwise
+    constexpr vpx_enc_frame_flags_t NO_REF_GF_ARF = VP8_EFLAG_NO_REF_GF |
+                                                    VP8_EFLAG_NO_REF_ARF;
+    constexpr vpx_enc_frame_flags_t NO_UPD_GF_ARF = VP8_EFLAG_NO_UPD_GF |
+                                                    VP8_EFLAG_NO_UPD_ARF;
+    constexpr vpx_enc_frame_flags_t NO_UPD = NO_UPD_GF_ARF |
+                                             VP8_EFLAG_NO_UPD_LAST;
+
+    if (num_temporal_layers_ == 2) {
+      // 0-1
+      layer_pattern_ = {{0, NO_REF_GF_ARF | NO_UPD_GF_ARF},
+                        {1, NO_REF_GF_ARF | NO_UPD}};
+    } else {
+      // 0-2-1-2: layer 1 is kept in the golden slot for the second frame
+      // of layer 2
+      layer_pattern_ = {{0, NO_REF_GF_ARF | NO_UPD_GF_ARF},
+                        {2, NO_REF_GF_ARF | NO_UPD},
+                        {1, NO_REF_GF_ARF | VP8_EFLAG_NO_UPD_LAST |
+                            VP8_EFLAG_NO_UPD_ARF},
+                        {2, VP8_EFLAG_NO_REF_ARF | NO_UPD}};
+    }
+
+    cfg_.ss_number_layers = 1;
+    cfg_.ts_number_layers = num_temporal_layers_;
+    cfg_.ts_periodicity = layer_pattern_.size();
+    for (size_t i = 0; i < layer_pattern_.size(); i++) {
+      cfg_.ts_layer_id[i] = layer_pattern_[i].temporal_id;
+    }
+    for (unsigned int i = 0; i < num_temporal_layers_; i++) {
+      cfg_.ts_rate_decimator[i] = 1 << (num_temporal_layers_ - 1 - i);
+    }
+    cfg_.temporal_layering_mode = VP9E_TEMPORAL_LAYERING_MODE_BYPASS;
+  }
+
   // use no more than 16 or the number of avaialble CPUs
   const unsigned int cpu_used = min(get_nprocs(), 16);
 
@@ -67,6 +117,10 @@ Encoder::Encoder(const uint16_t display_width,
   check_call(vpx_codec_enc_init(&context_, &vpx_codec_vp9_cx_algo, &cfg_, 0),
              VPX_CODEC_OK, "vpx_codec_enc_init");
 
+  if (num_temporal_layers_ > 1) {
+    codec_control(&context_, VP9E_SET_SVC, 1);
+  }
+
   // this value affects motion estimation and *dominates* the encoding speed
   codec_control(&context_, VP8E_SET_CPUUSED, cpu_used);
 
@@ -103,67 +157,124 @@ Encoder::~Encoder()
 
 void Encoder::compress_frame(const RawImage & raw_img)
 {
-  const auto frame_generation_ts = timestamp_us();
+  prepare_frame();
 
   // encode raw_img into frame 'frame_id_'
   encode_frame(raw_img);
 
   // packetize frame 'frame_id_' into datagrams
-  const size_t frame_size = packetize_encoded_frame();
+  packetize_frame();
+}
+
+void Encoder::packetize_frame()
+{
+  const size_t frame_size = packetize_encoded_frame(frame_generation_ts_ +
+                                                    playout_deadline_us_);
+
+  if (num_temporal_layers_ > 1) {
+    layer_idx_ = (layer_idx_ + 1) % layer_pattern_.size();
+  }
+
+  // a frame dropped is not numbered (so the receiver sees no gap)
+  if (frame_size == 0) {
+    return;
+  }
 
   // output frame information
   if (output_fd_) {
-    const auto frame_encoded_ts = timestamp_us();
+    const auto frame_encoded_ts = mono_us();
 
+    // output wall-clock timestamps
     output_fd_->write(to_string(frame_id_) + "," +
                       to_string(target_bitrate_) + "," +
                       to_string(frame_size) + "," +
-                      to_string(frame_generation_ts) + "," +
-                      to_string(frame_encoded_ts) + "\n");
+                      to_string(mono_to_wall_us(frame_generation_ts_)) + "," +
+                      to_string(mono_to_wall_us(frame_encoded_ts)) + "\n");
   }
 
   // move onto the next frame
   frame_id_++;
 }
 
-void Encoder::encode_frame(const RawImage & raw_img)
+void Encoder::prepare_frame()
 {
-  if (raw_img.display_width() != display_width_ or
-      raw_img.display_height() != display_height_) {
-    throw runtime_error("Encoder: image dimensions don't match");
+  // check if a key (or recovery) frame needs to be encoded
+  vpx_enc_frame_flags_t encode_flags = 0; // normal frame
+  nonkey_type_ = FrameType::NONKEY;
+
+  const auto curr_ts = mono_us();
+  frame_generation_ts_ = curr_ts;
+  abandon_frames(curr_ts);
+
+  // give up on a long-term reference that receiver has not decoded in time
+  if (pending_ref_ and curr_ts >= pending_ref_->deadline_ts) {
+    pending_ref_.reset();
   }
 
-  // check if a key frame needs to be encoded
-  vpx_enc_frame_flags_t encode_flags = 0; // normal frame
-  if (not unacked_.empty()) {
-    const auto & first_unacked = unacked_.cbegin()->second;
+  if (need_recovery_) {
+    need_recovery_ = false;
+    recovery_frame_ = frame_id_;
 
-    // give up if first unacked datagram was initially sent MAX_UNACKED_US ago
-    const auto us_since_first_send = timestamp_us() - first_unacked.send_ts;
+    if (ref_recovery_ and acked_ref_) {
+      // predict only from the reference frame that receiver decoded
+      encode_flags = ref_flags(false, acked_ref_, nullopt);
+      nonkey_type_ = FrameType::RECOVERY;
 
-    if (us_since_first_send > MAX_UNACKED_US) {
+      cerr << "* Recovery: abandoned frames past deadline and predicted frame "
+           << frame_id_ << " from reference frame " << acked_ref_->frame_id
+           << endl;
+    } else {
       encode_flags = VPX_EFLAG_FORCE_KF; // force next frame to be key frame
 
-      cerr << "* Recovery: gave up retransmissions and forced a key frame "
-           << frame_id_ << endl;
+      cerr << "* Recovery: abandoned frames past deadline and forced a key "
+           << "frame " << frame_id_ << endl;
+    }
+  } else if (ref_recovery_) {
+    // now and then, replace the long-term reference not acked
+    optional<LongTermRef> update;
+    if (not pending_ref_ and frame_id_ >= last_pending_frame_ + REF_INTERVAL) {
+      const unsigned int slot = acked_ref_ and acked_ref_->slot == GOLDEN ?
+                                ALTREF : GOLDEN;
+      pending_ref_ = LongTermRef {frame_id_, slot,
+                                 curr_ts + playout_deadline_us_};
+      update = pending_ref_;
+      last_pending_frame_ = frame_id_;
+      nonkey_type_ = FrameType::REF;
+    }
 
-      if (verbose_) {
-        cerr << "Giving up on lost datagram: frame_id="
-             << first_unacked.frame_id << " frag_id=" << first_unacked.frag_id
-             << " rtx=" << first_unacked.num_rtx
-             << " us_since_first_send=" << us_since_first_send << endl;
-      }
+    encode_flags = ref_flags(true, acked_ref_, update);
+  }
 
-      // clean up
-      send_buf_.clear();
-      unacked_.clear();
+  if (num_temporal_layers_ > 1) {
+    // a key frame starts a period
+    if (encode_flags & VPX_EFLAG_FORCE_KF) {
+      layer_idx_ = 0;
     }
+
+    encode_flags |= layer_pattern_[layer_idx_].flags;
+  }
+
+  encode_flags_ = encode_flags;
+}
+
+void Encoder::encode_frame(const RawImage & raw_img)
+{
+  if (raw_img.display_width() != display_width_ or
+      raw_img.display_height() != display_height_) {
+    throw runtime_error("Encoder: image dimensions don't match");
+  }
+
+  if (num_temporal_layers_ > 1) {
+    vpx_svc_layer_id_t layer_id {};
+    layer_id.spatial_layer_id = 0;
+    layer_id.temporal_layer_id = layer_pattern_[layer_idx_].temporal_id;
+    codec_control(&context_, VP9E_SET_SVC_LAYER_ID, &layer_id);
   }
 
   // encode a frame and calculate encoding time
   const auto encode_start = steady_clock::now();
   check_call(vpx_codec_encode(&context_, raw_img.get_vpx_image(), frame_id_, 1,
-                              encode_flags, VPX_DL_REALTIME),
+                              encode_flags_, VPX_DL_REALTIME),
              VPX_CODEC_OK, "failed to encode a frame");
   const auto encode_end = steady_clock::now();
   const double encode_time_ms = duration<double, milli>(
@@ -175,7 +286,7 @@ void Encoder::encode_frame(const RawImage & raw_img)
   max_encode_time_ms_ = max(max_encode_time_ms_, encode_time_ms);
 }
 
-size_t Encoder::packetize_encoded_frame()
+size_t Encoder::packetize_encoded_frame(const uint64_t deadline_ts)
 {
   // read the encoded frame's "encoder packets" from 'context_'
   const vpx_codec_cx_pkt_t * encoder_pkt;
@@ -196,103 +307,810 @@ size_t Encoder::packetize_encoded_frame()
       assert(frame_size > 0);
 
       // read the returned frame type
-      auto frame_type = FrameType::NONKEY;
+      auto frame_type = nonkey_type_;
       if (encoder_pkt->data.frame.flags & VPX_FRAME_IS_KEY) {
         frame_type = FrameType::KEY;
+        num_key_frames_++;
+        key_frame_bytes_ += frame_size;
+
+        // a key frame replaces both long-term references
+        if (ref_recovery_) {
+          acked_ref_.reset();
+          pending_ref_ = LongTermRef {frame_id_, GOLDEN, deadline_ts};
+          last_pending_frame_ = frame_id_;
+        }
 
         if (verbose_) {
           cerr << "Encoded a key frame: frame_id=" << frame_id_ << endl;
         }
+      } else if (frame_type == FrameType::RECOVERY) {
+        num_recovery_frames_++;
+        recovery_frame_bytes_ += frame_size;
       }
 
-      // total fragments to divide this frame into
+      // drop the frame if the receiver could do without it under congestion
+      const uint8_t temporal_id = num_temporal_layers_ > 1 ?
+                                  layer_pattern_[layer_idx_].temporal_id : 0;
+      const auto ref_frames = this->ref_frames(frame_type, temporal_id);
+      if (not ref_frames) {
+        num_dropped_frames_++;
+
+        if (verbose_) {
+          cerr << "Dropped a frame of temporal layer "
+               << static_cast<int>(temporal_id) << endl;
+        }
+
+        return 0;
+      }
+      num_layer_frames_[temporal_id]++;
+
+      // with FEC, fragments leave room for the parity header (and with the
+      // streaming FEC, a source symbol's length) in a datagram, as parity
+      // fragments are as large as the data fragments
+      size_t max_frag_size = Datagram::max_payload;
+      if (fec_percent_ > 0) {
+        max_frag_size -= fec_window_size_ > 0 ?
+            StreamParityHeader::serialized_size(fec_window_size_)
+            + SlidingWindowCode::LENGTH_SIZE : Datagram::PARITY_HEADER_SIZE;
+      }
+
+      // total fragments to divide this frame into (at least one)
       const uint16_t frag_cnt = narrow_cast<uint16_t>(
-          frame_size / (Datagram::max_payload + 1) + 1);
+          max<size_t>((frame_size + max_frag_size - 1) / max_frag_size, 1));
+
+      // parity fragments: with the streaming FEC, the percentage of data
+      // fragments accumulates across frames (so a frame of one fragment is
+      // not necessarily followed by parity); otherwise, per frame, as the
+      // code has at most 256 fragments in total
+      uint16_t parity_cnt = 0;
+      if (fec_window_size_ > 0) {
+        fec_credit_ += frag_cnt * fec_percent_;
+        parity_cnt = narrow_cast<uint16_t>(fec_credit_ / 100);
+        fec_credit_ %= 100;
+      } else if (frag_cnt < 256) {
+        parity_cnt = narrow_cast<uint16_t>(min<size_t>(
+            (frag_cnt * fec_percent_ + 99) / 100, 256 - frag_cnt));
+      }
 
-      // next address to copy compressed frame data from
-      uint8_t * buf_ptr = static_cast<uint8_t *>(encoder_pkt->data.frame.buf);
-      const uint8_t * const buf_end = buf_ptr + frame_size;
+      // FEC within the frame codes the fragments as equal-sized shards (with
+      // the last one zero-padded), and stores the parity fragments after them
+      const bool frame_fec = fec_window_size_ == 0 and parity_cnt > 0;
+      const size_t shard_size = min(frame_size, max_frag_size);
+      const size_t data_size = frame_fec ? frag_cnt * shard_size : frame_size;
+
+      // copy the compressed frame once into a buffer shared by its
+      // fragments (and retransmissions)
+      const SharedBuffer frame_buf = payload_pool_.alloc(data_size +
+          (frame_fec ? parity_cnt * (Datagram::PARITY_HEADER_SIZE + shard_size) : 0));
+      memcpy(frame_buf.data(), encoder_pkt->data.frame.buf, frame_size);
+      memset(frame_buf.data() + frame_size, 0, data_size - frame_size);
+
+      // next address to take a fragment from
+      const char * buf_ptr = frame_buf.data();
+      const char * const buf_end = buf_ptr + frame_size;
 
       for (uint16_t frag_id = 0; frag_id < frag_cnt; frag_id++) {
         // calculate payload size and construct the payload
         const size_t payload_size = (frag_id < frag_cnt - 1) ?
-            Datagram::max_payload : buf_end - buf_ptr;
+            max_frag_size : buf_end - buf_ptr;
 
         // enqueue a datagram
-        send_buf_.emplace_back(frame_id_, frame_type, frag_id, frag_cnt,
-          string_view {reinterpret_cast<const char *>(buf_ptr), payload_size});
+        send_buf_.emplace_back(stream_id_, frame_id_, frame_type, temporal_id,
+                               *ref_frames, frag_id, frag_cnt, parity_cnt,
+                               next_seq_num_++, frame_buf,
+                               string_view {buf_ptr, payload_size});
 
         buf_ptr += payload_size;
       }
+
+      num_data_frags_ += frag_cnt;
+      inflight_frames_.push_back({frame_id_, frame_type, temporal_id,
+                                  next_seq_num_ - frag_cnt, frag_cnt,
+                                  frag_cnt, deadline_ts});
+
+      if (fec_window_size_ > 0) {
+        // slide the window of the streaming FEC to end with this frame
+        FECWindowFrame & window_frame = fec_window_.emplace_back();
+        window_frame.header = {frame_type, temporal_id, *ref_frames,
+                               frag_cnt, parity_cnt};
+        window_frame.first_seq_num = next_seq_num_ - frag_cnt;
+        window_frame.buffer = frame_buf;
+        window_frame.data = {frame_buf.data(), frame_size};
+        window_frame.max_frag_size = max_frag_size;
+
+        while (fec_window_.size() > fec_window_size_) {
+          fec_window_.pop_front();
+        }
+
+        if (parity_cnt > 0) {
+          packetize_stream_parity(frag_cnt, parity_cnt);
+        }
+      } else if (parity_cnt > 0) {
+        packetize_parity(frame_buf, frame_size, frame_type, temporal_id,
+                         *ref_frames, frag_cnt, parity_cnt, shard_size);
+      }
     }
   }
 
   return frame_size;
 }
 
+void Encoder::packetize_parity(const SharedBuffer & frame_buf,
+                               const size_t frame_size,
+                               const FrameType frame_type,
+                               const uint8_t temporal_id,
+                               const RefFrames ref_frames,
+                               const uint16_t frag_cnt,
+                               const uint16_t parity_cnt,
+                               const size_t shard_size)
+{
+  uint8_t * const data = reinterpret_cast<uint8_t *>(frame_buf.data());
+  uint8_t * const parity_start = data + frag_cnt * shard_size;
+  constexpr size_t PARITY_HEADER_SIZE = Datagram::PARITY_HEADER_SIZE;
+
+  vector<const uint8_t *> data_shards(frag_cnt);
+  for (uint16_t i = 0; i < frag_cnt; i++) {
+    data_shards[i] = data + i * shard_size;
+  }
+
+  // each parity fragment: frame size followed by the parity shard
+  vector<uint8_t *> parity_shards(parity_cnt);
+  for (uint16_t j = 0; j < parity_cnt; j++) {
+    uint8_t * const parity = parity_start + j * (PARITY_HEADER_SIZE + shard_size);
+    put_number(reinterpret_cast<char *>(parity),
+               narrow_cast<uint32_t>(frame_size));
+    parity_shards[j] = parity + PARITY_HEADER_SIZE;
+  }
+
+  ReedSolomon(frag_cnt, parity_cnt).encode(data_shards, parity_shards,
+                                           shard_size);
+
+  for (uint16_t j = 0; j < parity_cnt; j++) {
+    const char * const parity = reinterpret_cast<const char *>(parity_shards[j])
+                                - PARITY_HEADER_SIZE;
+
+    send_buf_.emplace_back(stream_id_, frame_id_, frame_type, temporal_id,
+                           ref_frames, frag_cnt + j, frag_cnt, parity_cnt,
+                           next_seq_num_++, frame_buf,
+                           string_view {parity, PARITY_HEADER_SIZE + shard_size});
+  }
+
+  num_parity_frags_ += parity_cnt;
+}
+
+void Encoder::packetize_stream_parity(const uint16_t frag_cnt,
+                                     const uint16_t parity_cnt)
+{
+  // the data fragments of the frames in the window are the source symbols
+  StreamParityHeader header;
+  header.num_frames = narrow_cast<uint8_t>(fec_window_.size());
+
+  vector<SlidingWindowCode::Source> sources;
+  size_t max_source_size = 0;
+
+  for (size_t i = 0; i < fec_window_.size(); i++) {
+    const auto & frame = fec_window_[i];
+    header.frames[i] = frame.header;
+
+    string_view data = frame.data;
+    for (SeqNum seq_num = frame.first_seq_num; not data.empty(); seq_num++) {
+      const string_view frag = data.substr(0, frame.max_frag_size);
+      data.remove_prefix(frag.size());
+
+      sources.emplace_back(seq_num, frag);
+      max_source_size = max(max_source_size, frag.size());
+    }
+  }
+
+  // each parity datagram: header followed by a repair symbol
+  const size_t header_size = header.serialized_size();
+  const size_t symbol_size = SlidingWindowCode::symbol_size(max_source_size);
+  const SharedBuffer parity_buf = payload_pool_.alloc(
+      parity_cnt * (header_size + symbol_size));
+
+  // numbered as the frame's own
+  const auto & own = fec_window_.back().header;
+
+  for (uint16_t j = 0; j < parity_cnt; j++) {
+    char * const parity = parity_buf.data() + j * (header_size + symbol_size);
+    header.serialize_to(parity);
+
+    const SeqNum seq_num = next_seq_num_++;
+    SlidingWindowCode::encode(seq_num, sources,
+        reinterpret_cast<uint8_t *>(parity + header_size), symbol_size);
+
+    send_buf_.emplace_back(stream_id_, frame_id_, FrameType::PARITY,
+                           own.temporal_id, own.ref_frames, frag_cnt + j,
+                           frag_cnt, parity_cnt, seq_num, parity_buf,
+                           string_view {parity, header_size + symbol_size});
+  }
+
+  num_parity_frags_ += parity_cnt;
+}
+
 void Encoder::add_unacked(const Datagram & datagram)
 {
-  const auto seq_num = make_pair(datagram.frame_id, datagram.frag_id);
-  auto [it, success] = unacked_.emplace(seq_num, datagram);
+  if (cc_) {
+    cc_->on_sent(datagram.seq_num,
+                 Datagram::HEADER_SIZE + datagram.payload.size());
+  }
 
-  if (not success) {
-    throw runtime_error("datagram already exists in unacked");
+  // parity fragments are never retransmitted (a retransmitted data fragment
+  // is as useful), so they are not tracked either
+  if (datagram.is_parity()) {
+    return;
   }
 
-  it->second.last_send_ts = it->second.send_ts;
+  auto & meta = unacked_.add(datagram);
+  schedule_rto(datagram.seq_num, meta, rto_us());
+
+  if (loss_recovery_ != LossRecovery::NACK) {
+    sent_order_.emplace_back(datagram.seq_num, meta.send_ts);
+  }
 }
 
 void Encoder::add_unacked(Datagram && datagram)
 {
-  const auto seq_num = make_pair(datagram.frame_id, datagram.frag_id);
-  auto [it, success] = unacked_.emplace(seq_num, move(datagram));
+  if (cc_) {
+    cc_->on_sent(datagram.seq_num,
+                 Datagram::HEADER_SIZE + datagram.payload.size());
+  }
+
+  if (datagram.is_parity()) {
+    return;
+  }
+
+  const SeqNum seq_num = datagram.seq_num;
+  auto & meta = unacked_.add(move(datagram));
+  schedule_rto(seq_num, meta, rto_us());
+
+  if (loss_recovery_ != LossRecovery::NACK) {
+    sent_order_.emplace_back(seq_num, meta.send_ts);
+  }
+}
+
+void Encoder::add_tx_id(const uint32_t tx_id, const SeqNum seq_num)
+{
+  // bound the memory in case TX timestamps are never delivered
+  if (pending_tx_ids_.size() >= MAX_PENDING_TX_IDS) {
+    pending_tx_ids_.pop_front();
+  }
+
+  pending_tx_ids_.emplace_back(tx_id, seq_num);
+}
+
+void Encoder::handle_tx_timestamp(const uint32_t tx_id, const uint64_t tx_ts)
+{
+  // IDs are sequential: discard earlier IDs whose timestamps were not delivered
+  while (not pending_tx_ids_.empty() and
+         static_cast<int32_t>(pending_tx_ids_.front().first - tx_id) < 0) {
+    pending_tx_ids_.pop_front();
+  }
+
+  // datagrams sent in the same message (e.g., a GSO buffer) share one ID
+  while (not pending_tx_ids_.empty() and
+         pending_tx_ids_.front().first == tx_id) {
+    auto * meta = unacked_.find(pending_tx_ids_.front().second);
+    if (meta) {
+      meta->tx_ts = tx_ts;
+    }
+
+    pending_tx_ids_.pop_front();
+  }
+}
+
+void Encoder::handle_feedback(const FeedbackMsg & feedback,
+                              const uint64_t feedback_recv_ts)
+{
+  const auto curr_ts = mono_us();
+  num_feedback_++;
+
+  // RTT samples from the datagrams that arrived since the last feedback
+  for (size_t i = 0; i < feedback.num_receipts; i++) {
+    handle_receipt(feedback.receipts[i], feedback.feedback_ts,
+                   feedback_recv_ts, curr_ts);
+  }
+
+  // erase the acked datagrams from 'unacked_': all before the cumulative
+  // sequence number...
+  num_acked_ += unacked_.erase_before(feedback.cum_seq_num,
+    [this, curr_ts](const SeqNum seq_num, UnackedStore::Meta & meta)
+    {
+      on_acked(seq_num, meta, curr_ts);
+    }
+  );
+
+  // ...and the highest and the ones in the SACK bitmap below it
+  erase_acked(feedback.highest_seq_num, curr_ts);
+
+  for (uint64_t bits = feedback.sack_bitmap; bits != 0; bits &= bits - 1) {
+    const unsigned int bit = __builtin_ctzll(bits);
+    if (bit < feedback.highest_seq_num) {
+      erase_acked(feedback.highest_seq_num - 1 - bit, curr_ts);
+    }
+  }
+
+  // older receipts (e.g., of retransmissions) might be outside the bitmap
+  for (size_t i = 0; i < feedback.num_receipts; i++) {
+    erase_acked(feedback.receipts[i].seq_num, curr_ts);
+  }
+
+  // receiver decoded a long-term reference to predict recovery frames from
+  if (ref_recovery_ and feedback.ref_frame_id != FeedbackMsg::NO_REF_FRAME) {
+    handle_ref_frame(feedback.ref_frame_id);
+  }
+
+  // stop retransmitting the frames no longer useful
+  abandon_frames(curr_ts);
+
+  // receiver NACKs the datagrams it misses instead
+  if (loss_recovery_ != LossRecovery::NACK) {
+    detect_losses(curr_ts);
+  }
+
+  // adapt the bitrate to the receipts and losses
+  if (cc_) {
+    cc_->on_feedback(curr_ts);
+    apply_cc_bitrate();
+  }
+}
+
+void Encoder::handle_ref_frame(const uint32_t frame_id)
+{
+  // the reports of the references replaced since are of no use
+  if (pending_ref_ and pending_ref_->frame_id == frame_id) {
+    acked_ref_ = pending_ref_;
+    pending_ref_.reset();
+
+    if (verbose_) {
+      cerr << "Reference frame decoded: frame_id=" << frame_id << " slot="
+           << (acked_ref_->slot == GOLDEN ? "golden" : "altref") << endl;
+    }
+  }
+}
+
+vpx_enc_frame_flags_t Encoder::ref_flags(const bool ref_last,
+                                         const optional<LongTermRef> & ref,
+                                         const optional<LongTermRef> & update)
+{
+  static constexpr vpx_enc_frame_flags_t NO_REF[] = {VP8_EFLAG_NO_REF_GF,
+                                                     VP8_EFLAG_NO_REF_ARF};
+  static constexpr vpx_enc_frame_flags_t NO_UPD[] = {VP8_EFLAG_NO_UPD_GF,
+                                                     VP8_EFLAG_NO_UPD_ARF};
+
+  // the last frame is always updated
+  vpx_enc_frame_flags_t flags = ref_last ? 0 : VP8_EFLAG_NO_REF_LAST;
+
+  for (const unsigned int slot : {GOLDEN, ALTREF}) {
+    if (not ref or ref->slot != slot) {
+      flags |= NO_REF[slot];
+    }
+
+    if (not update or update->slot != slot) {
+      flags |= NO_UPD[slot];
+    }
+  }
+
+  return flags;
+}
+
+bool Encoder::congested() const
+{
+  // the datagrams of the frames before are still queued, or queuing delay
+  // has built up
+  return not send_buf_.empty() or
+         (min_rtt_us_ and srtt_us_ and
+          *srtt_us_ > *min_rtt_us_ + CONGESTION_DELAY_US);
+}
+
+optional<RefFrames> Encoder::ref_frames(const FrameType frame_type,
+                                        const uint8_t temporal_id)
+{
+  // without temporal layers, each frame predicts from the one before (and
+  // the frames further back that it depends on), unless a key or recovery
+  // frame
+  if (num_temporal_layers_ == 1) {
+    if (frame_type == FrameType::KEY or frame_type == FrameType::RECOVERY or
+        frame_id_ == 0) {
+      return 0;
+    }
+    return 1;
+  }
+
+  // a key frame fills every slot
+  if (frame_type == FrameType::KEY) {
+    slot_frames_.fill(frame_id_);
+    return 0;
+  }
+
+  static constexpr vpx_enc_frame_flags_t NO_REF[] = {VP8_EFLAG_NO_REF_LAST,
+                                                     VP8_EFLAG_NO_REF_GF};
+  static constexpr vpx_enc_frame_flags_t NO_UPD[] = {VP8_EFLAG_NO_UPD_LAST,
+                                                     VP8_EFLAG_NO_UPD_GF};
+  const vpx_enc_frame_flags_t flags = layer_pattern_[layer_idx_].flags;
+
+  bool dropped = temporal_id > 0 and congested();
+  RefFrames refs = 0;
+
+  for (size_t slot = 0; slot < slot_frames_.size(); slot++) {
+    if (flags & NO_REF[slot]) {
+      continue;
+    }
+
+    // predicted from a frame dropped
+    if (not slot_frames_[slot]) {
+      dropped = true;
+      continue;
+    }
+
+    const uint32_t distance = frame_id_ - *slot_frames_[slot];
+    if (distance == 0 or distance > Datagram::MAX_REF_DISTANCE) {
+      throw runtime_error("Encoder: reference frame is too far back");
+    }
+
+    refs |= 1 << (distance - 1);
+  }
+
+  for (size_t slot = 0; slot < slot_frames_.size(); slot++) {
+    if (not (flags & NO_UPD[slot])) {
+      slot_frames_[slot] = dropped ? nullopt : optional<uint32_t>(frame_id_);
+    }
+  }
+
+  if (dropped) {
+    return nullopt;
+  }
+
+  return refs;
+}
+
+Encoder::InflightFrame * Encoder::find_inflight_frame(const uint32_t frame_id)
+{
+  // frame IDs are ascending (but not consecutive if the encoder drops frames)
+  const auto it = lower_bound(inflight_frames_.begin(), inflight_frames_.end(),
+                              frame_id,
+    [](const InflightFrame & frame, const uint32_t id)
+    {
+      return frame.frame_id < id;
+    }
+  );
+
+  if (it == inflight_frames_.end() or it->frame_id != frame_id) {
+    return nullptr;
+  }
+
+  return &*it;
+}
+
+void Encoder::abandon_frames(const uint64_t curr_ts)
+{
+  // both the frames past their deadlines (as deadlines ascend) and the
+  // obsolete ones are the oldest in flight
+  while (not inflight_frames_.empty()) {
+    const InflightFrame & frame = inflight_frames_.front();
+
+    if (frame.num_unacked == 0) {
+      inflight_frames_.pop_front();
+      continue;
+    }
+
+    if (frame.frame_id < obsolete_before_) {
+      num_obsolete_frames_++;
+    } else if (curr_ts >= frame.deadline_ts) {
+      num_expired_frames_++;
+
+      // the receiver skips a frame of an enhancement layer, but cannot
+      // decode the frames after a base layer frame until a key or recovery
+      // frame (unless one after it is in flight already)
+      if (frame.temporal_id == 0 and
+          (not recovery_frame_ or frame.frame_id >= *recovery_frame_)) {
+        need_recovery_ = true;
+      }
+    } else {
+      break;
+    }
 
-  if (not success) {
-    throw runtime_error("datagram already exists in unacked");
+    if (verbose_) {
+      cerr << "Abandoned frame: frame_id=" << frame.frame_id
+           << " unacked=" << frame.num_unacked << "/" << frame.frag_cnt
+           << (frame.frame_id < obsolete_before_ ? " (obsolete)" : "")
+           << endl;
+    }
+
+    drop_oldest_frame();
+  }
+}
+
+void Encoder::drop_oldest_frame()
+{
+  const InflightFrame & frame = inflight_frames_.front();
+
+  // the datagrams of this frame (and the parity of older ones) still queued,
+  // never to be sent: receiver acknowledges them once it skips the frame
+  while (not send_buf_.empty() and
+         send_buf_.front().frame_id <= frame.frame_id) {
+    dropped_bytes_ += Datagram::HEADER_SIZE + send_buf_.front().payload.size();
+    num_dropped_queued_++;
+    send_buf_.pop_front();
   }
 
-  it->second.last_send_ts = it->second.send_ts;
+  // the ones unacked, which rtx_buf_ and sent_order_ then skip
+  for (SeqNum seq_num = frame.first_seq_num;
+       seq_num < frame.first_seq_num + frame.frag_cnt; seq_num++) {
+    auto * meta = unacked_.find(seq_num);
+    if (meta) {
+      cancel_rto(*meta);
+
+      // each would have been retransmitted at least once more
+      dropped_bytes_ += Datagram::HEADER_SIZE +
+                        unacked_.datagram(seq_num).payload.size();
+      num_dropped_unacked_++;
+      unacked_.erase(seq_num);
+    }
+  }
+
+  inflight_frames_.pop_front();
 }
 
-void Encoder::handle_ack(const shared_ptr<AckMsg> & ack)
+void Encoder::on_acked(const SeqNum seq_num, UnackedStore::Meta & meta,
+                       const uint64_t curr_ts)
 {
-  const auto curr_ts = timestamp_us();
+  cancel_rto(meta);
 
-  // observed an RTT sample
-  add_rtt_sample(curr_ts - ack->send_ts);
+  // a key (or recovery) frame acked makes the frames before it obsolete
+  auto * frame = find_inflight_frame(unacked_.datagram(seq_num).frame_id);
+  if (frame and --frame->num_unacked == 0 and
+      (frame->type == FrameType::KEY or frame->type == FrameType::RECOVERY)) {
+    obsolete_before_ = max(obsolete_before_, frame->frame_id);
 
-  // find the acked datagram in 'unacked_'
-  const auto acked_seq_num = make_pair(ack->frame_id, ack->frag_id);
-  auto acked_it = unacked_.find(acked_seq_num);
+    if (recovery_frame_ and frame->frame_id >= *recovery_frame_) {
+      recovery_frame_.reset();
+    }
+  }
 
-  if (acked_it == unacked_.end()) {
-    // do nothing else if ACK is not for an unacked datagram
+  // the time sent is ambiguous for a retransmitted datagram (unless it has a
+  // receipt), which instead took this long to recover
+  if (meta.num_rtx == 0) {
+    rack_update(seq_num, meta.send_ts, curr_ts);
+  } else {
+    recovery_delays_us_.emplace_back(curr_ts - meta.send_ts);
+  }
+}
+
+void Encoder::rack_update(const SeqNum seq_num, const uint64_t send_ts,
+                          const uint64_t curr_ts)
+{
+  if (rack_xmit_ts_ and (send_ts < *rack_xmit_ts_ or
+      (send_ts == *rack_xmit_ts_ and seq_num <= rack_seq_num_))) {
     return;
   }
 
-  // retransmit all unacked datagrams before the acked one (backward)
-  for (auto rit = make_reverse_iterator(acked_it);
-       rit != unacked_.rend(); rit++) {
-    auto & datagram = rit->second;
+  rack_xmit_ts_ = send_ts;
+  rack_seq_num_ = seq_num;
+  rack_rtt_us_ = curr_ts > send_ts ? curr_ts - send_ts : 0;
+}
+
+uint64_t Encoder::reo_wnd_us() const
+{
+  if (not min_rtt_us_ or not srtt_us_) {
+    return 0;
+  }
+
+  return min<uint64_t>(*min_rtt_us_ / 4, *srtt_us_);
+}
+
+void Encoder::detect_losses(const uint64_t curr_ts)
+{
+  if (not rack_xmit_ts_) {
+    return; // nothing acked yet
+  }
+
+  if (rack_timer_) {
+    timer_wheel_->cancel(*rack_timer_);
+    rack_timer_.reset();
+  }
+
+  // a transmission is lost if one sent after it was acked, and its ack is
+  // overdue by the reordering window; visit them in the order sent, up to
+  // the first one that is not (yet), so never the whole window
+  const uint64_t reo_wnd = reo_wnd_us();
+  size_t num_lost = 0;
 
-    // skip if a datagram has been retransmitted MAX_NUM_RTX times
-    if (datagram.num_rtx >= MAX_NUM_RTX) {
+  while (not sent_order_.empty()) {
+    const auto [seq_num, send_ts] = sent_order_.front();
+    auto * meta = unacked_.find(seq_num);
+
+    // skip if acked or retransmitted since
+    if (not meta or meta->last_send_ts != send_ts) {
+      sent_order_.pop_front();
       continue;
     }
 
-    // retransmit if it's the first RTX or the last RTX was about one RTT ago
-    if (datagram.num_rtx == 0 or
-        curr_ts - datagram.last_send_ts > ewma_rtt_us_.value()) {
-      datagram.num_rtx++;
-      datagram.last_send_ts = curr_ts;
+    // neither this nor the later transmissions are known lost
+    if (send_ts > *rack_xmit_ts_ or
+        (send_ts == *rack_xmit_ts_ and seq_num >= rack_seq_num_)) {
+      break;
+    }
 
-      // retransmissions are more urgent
-      send_buf_.emplace_front(datagram);
+    // might be reordered: check again when its ack becomes overdue
+    const uint64_t deadline = send_ts + rack_rtt_us_ + reo_wnd;
+    if (curr_ts < deadline) {
+      if (timer_wheel_) {
+        rack_timer_ = timer_wheel_->schedule(deadline - curr_ts,
+          [this]()
+          {
+            rack_timer_.reset();
+            detect_losses(mono_us());
+          }
+        );
+      }
+      break;
     }
+
+    sent_order_.pop_front();
+
+    // give up retransmitting; the frame is abandoned at its deadline or once
+    // obsolete (see prepare_frame() and abandon_frames())
+    if (meta->num_rtx >= MAX_NUM_RTX) {
+      continue;
+    }
+
+    if (verbose_) {
+      const auto & datagram = unacked_.datagram(seq_num);
+      cerr << "Lost: frame_id=" << datagram.frame_id
+           << " frag_id=" << datagram.frag_id
+           << " seq_num=" << seq_num
+           << " rtx=" << meta->num_rtx << endl;
+    }
+
+    retransmit(seq_num, *meta, curr_ts);
+    num_rack_rtx_++;
+
+    if (cc_) {
+      cc_->on_loss();
+    }
+
+    // retransmissions are more urgent (but keep the order sent)
+    rtx_buf_.emplace(rtx_buf_.begin() + num_lost, seq_num);
+    num_lost++;
+  }
+}
+
+void Encoder::retransmit(const SeqNum seq_num, UnackedStore::Meta & meta,
+                         const uint64_t curr_ts)
+{
+  meta.num_rtx++;
+  meta.last_send_ts = curr_ts;
+
+  if (loss_recovery_ != LossRecovery::NACK) {
+    sent_order_.emplace_back(seq_num, curr_ts);
+  }
+}
+
+void Encoder::handle_nack(const NackMsg & nack)
+{
+  const auto curr_ts = mono_us();
+
+  // retransmit backward so that rtx_buf_ ends up in the NACKed order
+  for (size_t i = nack.num_seq_nums; i > 0; i--) {
+    const SeqNum seq_num = nack.seq_nums[i - 1];
+
+    // skip the datagrams acked (or given up on) since NACKed
+    auto * meta = unacked_.find(seq_num);
+    if (not meta) {
+      continue;
+    }
+
+    if (verbose_) {
+      const auto & datagram = unacked_.datagram(seq_num);
+      cerr << "NACK: frame_id=" << datagram.frame_id
+           << " frag_id=" << datagram.frag_id
+           << " seq_num=" << seq_num
+           << " rtx=" << meta->num_rtx << endl;
+    }
+
+    // receiver NACKs a datagram again if the retransmission is lost too
+    if (cc_ and meta->num_rtx == 0) {
+      cc_->on_loss();
+    }
+
+    retransmit(seq_num, *meta, curr_ts);
+    num_nack_rtx_++;
+
+    // retransmissions are more urgent
+    rtx_buf_.emplace_front(seq_num);
   }
+}
 
-  // finally, erase the acked datagram from 'unacked_'
-  unacked_.erase(acked_it);
+void Encoder::handle_report(const ReportMsg & report)
+{
+  if (verbose_) {
+    cerr << "Receiver report: received " << report.received_bitrate
+         << " kbps, loss " << unsigned(report.loss_fraction) << "/256, jitter "
+         << report.jitter << " us, estimate " << report.estimated_bitrate
+         << " kbps" << endl;
+  }
+
+  num_reports_++;
+  last_report_ = report;
+
+  if (cc_ and report.estimated_bitrate != ReportMsg::NO_ESTIMATE) {
+    cc_->on_receiver_estimate(report.estimated_bitrate);
+    apply_cc_bitrate();
+  }
+}
+
+void Encoder::handle_receipt(const FeedbackMsg::Receipt & receipt,
+                             const uint64_t feedback_ts,
+                             const uint64_t feedback_recv_ts,
+                             const uint64_t curr_ts)
+{
+  // time between the datagram's arrival and the feedback's departure
+  const uint64_t ack_delay_us = feedback_ts > receipt.recv_ts ?
+                                feedback_ts - receipt.recv_ts : 0;
+
+  // the RTT samples exclude the delay in reporting, but RTO must cover it
+  max_ack_delay_us_ = max(max_ack_delay_us_, ack_delay_us);
+
+  // the transmission that arrived, even if retransmitted, by its send_ts
+  rack_update(receipt.seq_num, receipt.send_ts, curr_ts);
+
+  if (cc_) {
+    cc_->on_receipt(receipt.seq_num, receipt.send_ts, receipt.recv_ts);
+  }
+
+  // kernel TX timestamp of the acked transmission (first transmissions only)
+  uint64_t tx_ts = 0;
+  const auto * acked_meta = unacked_.find(receipt.seq_num);
+  if (acked_meta and acked_meta->send_ts == receipt.send_ts) {
+    tx_ts = acked_meta->tx_ts;
+
+    // the first transmission arrived after all
+    if (acked_meta->num_rtx > 0) {
+      num_spurious_rtx_++;
+    }
+  }
+
+  // kernel timestamps are wall-clock time, unlike the monotonic send_ts and
+  // curr_ts; compare them on the monotonic clock
+  const uint64_t tx_mono_ts = tx_ts ? wall_to_mono_us(tx_ts) : 0;
+  const uint64_t feedback_recv_mono_ts =
+      feedback_recv_ts ? wall_to_mono_us(feedback_recv_ts) : 0;
+
+  // observed an RTT sample: between kernel timestamps if available, so as to
+  // exclude the delays (e.g., in scheduling) in user space at both ends
+  if (tx_ts > 0 and feedback_recv_ts > tx_ts + ack_delay_us and
+      tx_mono_ts >= receipt.send_ts and curr_ts >= feedback_recv_mono_ts) {
+    add_rtt_sample(feedback_recv_ts - tx_ts - ack_delay_us);
+
+    num_kernel_rtt_samples_++;
+    total_send_delay_us_ += tx_mono_ts - receipt.send_ts;
+    total_ack_delay_us_ += ack_delay_us;
+    total_ack_recv_delay_us_ += curr_ts - feedback_recv_mono_ts;
+
+    if (receipt.recv_ts >= tx_ts) {
+      const double owd_us = receipt.recv_ts - tx_ts;
+
+      if (not ewma_owd_us_) {
+        ewma_owd_us_ = owd_us;
+      } else {
+        ewma_owd_us_ = ALPHA * owd_us + (1 - ALPHA) * (*ewma_owd_us_);
+      }
+    }
+  } else if (curr_ts > receipt.send_ts + ack_delay_us) {
+    // the receiver held the receipt for 'ack_delay_us' before reporting it
+    add_rtt_sample(curr_ts - receipt.send_ts - ack_delay_us);
+  }
+}
+
+void Encoder::erase_acked(const SeqNum seq_num, const uint64_t curr_ts)
+{
+  auto * meta = unacked_.find(seq_num);
+  if (meta) {
+    on_acked(seq_num, *meta, curr_ts);
+    unacked_.erase(seq_num);
+    num_acked_++;
+  }
 }
 
 void Encoder::add_rtt_sample(const unsigned int rtt_us)
@@ -302,12 +1120,103 @@ void Encoder::add_rtt_sample(const unsigned int rtt_us)
     min_rtt_us_ = rtt_us;
   }
 
-  // EWMA RTT
-  if (not ewma_rtt_us_) {
-    ewma_rtt_us_ = rtt_us;
+  // smoothed RTT and RTT variation (RFC 6298)
+  if (not srtt_us_) {
+    srtt_us_ = rtt_us;
+    rttvar_us_ = rtt_us / 2.0;
   } else {
-    ewma_rtt_us_ = ALPHA * rtt_us + (1 - ALPHA) * (*ewma_rtt_us_);
+    rttvar_us_ = (1 - RTTVAR_GAIN) * rttvar_us_ +
+                 RTTVAR_GAIN * abs(*srtt_us_ - rtt_us);
+    srtt_us_ = (1 - SRTT_GAIN) * (*srtt_us_) + SRTT_GAIN * rtt_us;
+  }
+
+  if (cc_) {
+    cc_->on_rtt_sample(rtt_us);
+  }
+}
+
+uint64_t Encoder::rto_us() const
+{
+  if (not srtt_us_) {
+    return INITIAL_RTO_US;
+  }
+
+  // as RFC 6298, plus the delay the receiver might hold an ack for (like
+  // QUIC's probe timeout in RFC 9002)
+  return max(MIN_RTO_US, static_cast<uint64_t>(
+      *srtt_us_ + 4 * rttvar_us_ + max_ack_delay_us_));
+}
+
+void Encoder::schedule_rto(const SeqNum seq_num, UnackedStore::Meta & meta,
+                           const uint64_t delay_us)
+{
+  if (not timer_wheel_ or loss_recovery_ == LossRecovery::NACK) {
+    return;
+  }
+
+  meta.rto_timer = timer_wheel_->schedule(delay_us,
+    [this, seq_num]()
+    {
+      handle_rto(seq_num);
+    }
+  );
+  meta.rto_armed = true;
+}
+
+void Encoder::cancel_rto(UnackedStore::Meta & meta)
+{
+  if (timer_wheel_ and meta.rto_armed) {
+    timer_wheel_->cancel(meta.rto_timer);
+    meta.rto_armed = false;
+  }
+}
+
+void Encoder::handle_rto(const SeqNum seq_num)
+{
+  // the frame might be past its deadline
+  abandon_frames(mono_us());
+
+  auto * meta = unacked_.find(seq_num);
+  if (not meta) {
+    return;
+  }
+
+  meta->rto_armed = false;
+
+  // give up retransmitting; the frame is abandoned at its deadline or once
+  // obsolete (see prepare_frame() and abandon_frames())
+  if (meta->num_rtx >= MAX_NUM_RTX) {
+    return;
+  }
+
+  // exponential backoff after each retransmission
+  const uint64_t rto = rto_us() << meta->num_rtx;
+  const auto curr_ts = mono_us();
+
+  // feedback on a later datagram might have triggered a retransmission since
+  if (curr_ts < meta->last_send_ts + rto) {
+    schedule_rto(seq_num, *meta, meta->last_send_ts + rto - curr_ts);
+    return;
+  }
+
+  if (verbose_) {
+    const auto & datagram = unacked_.datagram(seq_num);
+    cerr << "RTO: frame_id=" << datagram.frame_id
+         << " frag_id=" << datagram.frag_id
+         << " rtx=" << meta->num_rtx << endl;
+  }
+
+  retransmit(seq_num, *meta, curr_ts);
+  num_rto_rtx_++;
+
+  if (cc_) {
+    cc_->on_loss();
   }
+
+  // retransmissions are more urgent
+  rtx_buf_.emplace_front(seq_num);
+
+  schedule_rto(seq_num, *meta, rto_us() << meta->num_rtx);
 }
 
 void Encoder::output_periodic_stats()
@@ -320,15 +1229,149 @@ void Encoder::output_periodic_stats()
          << "/" << double_to_string(max_encode_time_ms_) << endl;
   }
 
-  if (min_rtt_us_ and ewma_rtt_us_) {
-    cerr << "  - Min/EWMA RTT (ms): " << double_to_string(*min_rtt_us_ / 1000.0)
-         << "/" << double_to_string(*ewma_rtt_us_ / 1000.0) << endl;
+  if (min_rtt_us_ and srtt_us_) {
+    cerr << "  - Min/Smoothed RTT (ms): "
+         << double_to_string(*min_rtt_us_ / 1000.0) << "/"
+         << double_to_string(*srtt_us_ / 1000.0) << ", variation "
+         << double_to_string(rttvar_us_ / 1000.0) << ", RTO "
+         << double_to_string(rto_us() / 1000.0) << endl;
+  }
+
+  if (cc_) {
+    cc_->output_periodic_stats();
+  }
+
+  if (num_feedback_ > 0) {
+    cerr << "  - Feedback received: " << num_feedback_ << " (acking "
+         << num_acked_ << " datagrams)" << endl;
+  }
+
+  if (num_reports_ > 0) {
+    cerr << "  - Receiver reports: " << num_reports_ << " (last: received "
+         << last_report_->received_bitrate << " kbps, loss "
+         << double_to_string(100.0 * last_report_->loss_fraction / 256)
+         << "%, jitter " << double_to_string(last_report_->jitter / 1000.0)
+         << " ms, estimate ";
+    if (last_report_->estimated_bitrate != ReportMsg::NO_ESTIMATE) {
+      cerr << last_report_->estimated_bitrate << " kbps)" << endl;
+    } else {
+      cerr << "-)" << endl;
+    }
+  }
+
+  if (loss_recovery_ == LossRecovery::NACK) {
+    cerr << "  - Retransmissions on NACK: " << num_nack_rtx_ << endl;
+  } else {
+    cerr << "  - Retransmissions: " << num_rack_rtx_ << " on loss detection, "
+         << num_rto_rtx_ << " on RTO (" << num_spurious_rtx_
+         << " datagrams retransmitted spuriously)" << endl;
+  }
+
+  // delay from the first transmission of each datagram retransmitted until
+  // acked
+  if (not recovery_delays_us_.empty()) {
+    auto & delays = recovery_delays_us_;
+    const auto percentile = [&delays](const double p)
+    {
+      const size_t k = min(delays.size() - 1,
+                           static_cast<size_t>(p * delays.size()));
+      nth_element(delays.begin(), delays.begin() + k, delays.end());
+      return double_to_string(delays[k] / 1000.0);
+    };
+
+    cerr << "  - Recovery delay (ms) of " << delays.size()
+         << " datagrams: median " << percentile(0.5) << ", 90th "
+         << percentile(0.9) << ", 99th " << percentile(0.99) << ", max "
+         << double_to_string(*max_element(delays.begin(), delays.end())
+                             / 1000.0) << endl;
+  }
+
+  if (num_expired_frames_ + num_obsolete_frames_ > 0) {
+    cerr << "  - Frames abandoned: " << num_expired_frames_
+         << " past deadline, " << num_obsolete_frames_ << " obsolete ("
+         << num_dropped_queued_ << " datagrams not sent, "
+         << num_dropped_unacked_ << " not retransmitted, saving at least "
+         << double_to_string(dropped_bytes_ / 1000.0) << " KB)" << endl;
+  }
+
+  if (num_key_frames_ + num_recovery_frames_ > 0) {
+    cerr << "  - Key frames: " << num_key_frames_ << " (avg size "
+         << double_to_string(num_key_frames_ ?
+                             key_frame_bytes_ / 1000.0 / num_key_frames_ : 0)
+         << " KB), recovery frames: " << num_recovery_frames_ << " (avg size "
+         << double_to_string(num_recovery_frames_ ? recovery_frame_bytes_
+                             / 1000.0 / num_recovery_frames_ : 0)
+         << " KB)" << endl;
+  }
+
+  if (num_temporal_layers_ > 1) {
+    cerr << "  - Frames sent per temporal layer: ";
+    for (unsigned int i = 0; i < num_temporal_layers_; i++) {
+      cerr << (i > 0 ? "/" : "") << num_layer_frames_[i];
+    }
+    cerr << " (" << num_dropped_frames_ << " dropped under congestion)"
+         << endl;
+  }
+
+  if (num_parity_frags_ > 0) {
+    cerr << "  - FEC: " << num_parity_frags_ << " parity fragments for "
+         << num_data_frags_ << " data fragments" << endl;
+  }
+
+  // each encoded frame is copied once into a buffer from the pool
+  const auto & pool = payload_pool_.stats();
+  if (pool.num_allocs > 0) {
+    cerr << "  - Payload buffers: " << pool.num_allocs << " frames, "
+         << double_to_string(1.0 * pool.num_heap_allocs / pool.num_allocs)
+         << " heap allocations per frame, " << pool.slabs_in_use << "/"
+         << pool.slabs_in_use + pool.slabs_free << " slabs in use ("
+         << pool.bytes_pooled / 1024 << " KB)" << endl;
+  }
+
+  if (ewma_owd_us_) {
+    cerr << "  - EWMA one-way delay (ms): "
+         << double_to_string(*ewma_owd_us_ / 1000.0) << endl;
+  }
+
+  if (num_kernel_rtt_samples_ > 0) {
+    const double n = num_kernel_rtt_samples_ * 1000.0; // to ms per sample
+    cerr << "  - Avg delay excluded from RTT (ms): sending "
+         << double_to_string(total_send_delay_us_ / n) << ", reporting "
+         << double_to_string(total_ack_delay_us_ / n) << ", receiving feedback "
+         << double_to_string(total_ack_recv_delay_us_ / n) << " ("
+         << num_kernel_rtt_samples_ << " samples)" << endl;
   }
 
   // reset all but RTT-related stats
   num_encoded_frames_ = 0;
   total_encode_time_ms_ = 0.0;
   max_encode_time_ms_ = 0.0;
+  num_rto_rtx_ = 0;
+  num_rack_rtx_ = 0;
+  num_expired_frames_ = 0;
+  num_obsolete_frames_ = 0;
+  num_dropped_queued_ = 0;
+  num_dropped_unacked_ = 0;
+  dropped_bytes_ = 0;
+  num_key_frames_ = 0;
+  key_frame_bytes_ = 0;
+  num_recovery_frames_ = 0;
+  recovery_frame_bytes_ = 0;
+  num_layer_frames_.fill(0);
+  num_dropped_frames_ = 0;
+  num_spurious_rtx_ = 0;
+  num_nack_rtx_ = 0;
+  recovery_delays_us_.clear();
+  num_data_frags_ = 0;
+  num_parity_frags_ = 0;
+  num_feedback_ = 0;
+  num_acked_ = 0;
+  num_reports_ = 0;
+  payload_pool_.reset_alloc_stats();
+  num_kernel_rtt_samples_ = 0;
+  total_send_delay_us_ = 0;
+  total_ack_delay_us_ = 0;
+  total_ack_recv_delay_us_ = 0;
 }
 
 void Encoder::set_target_bitrate(const unsigned int bitrate_kbps)
@@ -336,6 +1379,44 @@ void Encoder::set_target_bitrate(const unsigned int bitrate_kbps)
   target_bitrate_ = bitrate_kbps;
 
   cfg_.rc_target_bitrate = target_bitrate_;
+
+  // the bitrate of each temporal layer includes the layers below (split as
+  // in libvpx's examples)
+  static constexpr unsigned int LAYER_RATE_PCT[][MAX_TEMPORAL_LAYERS] = {
+    {100}, {60, 100}, {40, 60, 100}
+  };
+
+  if (num_temporal_layers_ > 1) {
+    for (unsigned int i = 0; i < num_temporal_layers_; i++) {
+      cfg_.ts_target_bitrate[i] = cfg_.layer_target_bitrate[i] =
+          target_bitrate_ * LAYER_RATE_PCT[num_temporal_layers_ - 1][i] / 100;
+    }
+  }
+
   check_call(vpx_codec_enc_config_set(&context_, &cfg_),
              VPX_CODEC_OK, "set_target_bitrate");
 }
+
+void Encoder::set_congestion_controller(unique_ptr<CongestionController> cc)
+{
+  cc_ = move(cc);
+  set_target_bitrate(cc_->target_bitrate());
+}
+
+void Encoder::apply_cc_bitrate()
+{
+  const unsigned int bitrate = cc_->target_bitrate();
+  const unsigned int change = bitrate > target_bitrate_ ?
+                              bitrate - target_bitrate_ :
+                              target_bitrate_ - bitrate;
+
+  // reconfiguring the codec on every feedback is costly
+  if (change * 100 >= target_bitrate_ * MIN_BITRATE_CHANGE_PCT) {
+    if (verbose_) {
+      cerr << "Target bitrate: " << target_bitrate_ << " -> " << bitrate
+           << " kbps" << endl;
+    }
+
+    set_target_bitrate(bitrate);
+  }
+}
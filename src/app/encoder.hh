@@ -6,35 +6,65 @@ extern "C" {
 #include <vpx/vp8cx.h>
 }
 
+#include <array>
 #include <deque>
-#include <map>
 #include <memory>
 #include <optional>
+#include <vector>
 
 #include "exception.hh"
 #include "image.hh"
 #include "protocol.hh"
 #include "file_descriptor.hh"
+#include "timer_wheel.hh"
+#include "buffer_pool.hh"
+#include "unacked_store.hh"
+#include "congestion_controller.hh"
 
 class Encoder
 {
 public:
-  // initialize a VP9 encoder
+  // initialize a VP9 encoder, with 'num_temporal_layers' temporal layers
+  // (up to MAX_TEMPORAL_LAYERS)
   Encoder(const uint16_t display_width,
           const uint16_t display_height,
           const uint16_t frame_rate,
-          const std::string & output_path = "");
+          const std::string & output_path = "",
+          const unsigned int num_temporal_layers = 1);
   ~Encoder();
 
   // encode raw_img and packetize into datagrams
   void compress_frame(const RawImage & raw_img);
 
+  // compress_frame() in three steps, so that the encoders of simulcast
+  // streams can encode in parallel: encode_frame() uses the codec only, and
+  // may run on another thread as long as the encoder is not used otherwise
+  // until it returns
+  void prepare_frame();
+  void encode_frame(const RawImage & raw_img);
+  void packetize_frame();
+
   // add a transmitted but unacked datagram (except retransmissions) to unacked
   void add_unacked(const Datagram & datagram);
   void add_unacked(Datagram && datagram);
 
-  // handle ACK
-  void handle_ack(const std::shared_ptr<AckMsg> & ack);
+  // handle feedback on a batch of datagrams in one pass; 'feedback_recv_ts'
+  // is the kernel RX timestamp (us) of the feedback, or 0 if unavailable
+  void handle_feedback(const FeedbackMsg & feedback,
+                       const uint64_t feedback_recv_ts = 0);
+
+  // retransmit the unacked datagrams NACKed by receiver
+  void handle_nack(const NackMsg & nack);
+
+  // cap the target bitrate at the estimate of a receiver report (with
+  // congestion control)
+  void handle_report(const ReportMsg & report);
+
+  // kernel TX timestamps: the first transmission of datagram 'seq_num' was
+  // sent in the message with timestamping ID 'tx_id', and the message with
+  // timestamping ID 'tx_id' was sent by the kernel at 'tx_ts'
+  void add_tx_id(const uint32_t tx_id, const SeqNum seq_num);
+  void handle_tx_timestamp(const uint32_t tx_id, const uint64_t tx_ts);
 
   // output stats every second and reset some of them
   void output_periodic_stats();
@@ -42,14 +72,53 @@ public:
   // set target bitrate
   void set_target_bitrate(const unsigned int bitrate_kbps);
 
+  // adapt the target bitrate to the feedback with 'cc' from now on
+  void set_congestion_controller(std::unique_ptr<CongestionController> cc);
+
   // accessors
   uint32_t frame_id() const { return frame_id_; }
+  unsigned int target_bitrate() const { return target_bitrate_; }
   std::deque<Datagram> & send_buf() { return send_buf_; }
-  std::map<SeqNum, Datagram> & unacked() { return unacked_; }
+  std::deque<SeqNum> & rtx_buf() { return rtx_buf_; }
+  UnackedStore & unacked() { return unacked_; }
 
   // mutators
   void set_verbose(const bool verbose) { verbose_ = verbose; }
 
+  // simulcast stream that the datagrams belong to (see ConfigMsg)
+  void set_stream_id(const uint8_t stream_id) { stream_id_ = stream_id; }
+
+  // with LossRecovery::NACK, retransmit only what receiver NACKs (instead of
+  // the holes in feedback and on RTO)
+  void set_loss_recovery(const LossRecovery loss_recovery)
+  { loss_recovery_ = loss_recovery; }
+
+  // protect each frame of k fragments with ceil(k * 'percent' / 100) parity
+  // fragments of a Reed-Solomon code (0: no FEC)
+  void set_fec_percent(const unsigned int percent) { fec_percent_ = percent; }
+
+  // instead, send 'percent' of the data fragments as parity fragments of a
+  // streaming code across the last 'frames' frames (0: FEC within frames),
+  // up to StreamParityHeader::MAX_FRAMES
+  void set_fec_window(const size_t frames) { fec_window_size_ = frames; }
+
+  // abandon a frame (dropping its datagrams queued or unacked) once it could
+  // no longer be played out in time: 'deadline_ms' after it was captured
+  void set_playout_deadline(const unsigned int deadline_ms)
+  { playout_deadline_us_ = static_cast<uint64_t>(deadline_ms) * 1000; }
+
+  // after abandoning frames, encode a recovery frame predicted from the last
+  // reference frame that receiver decoded instead of a key frame (if any);
+  // not with temporal layers, which take the same reference slots
+  void set_ref_recovery(const bool ref_recovery)
+  { ref_recovery_ = ref_recovery; }
+
+  // retransmit unacked datagrams on RTO with timers on 'timer_wheel'; the
+  // caller should send rtx_buf() after the timers expire
+  void set_timer_wheel(TimerWheel & timer_wheel) { timer_wheel_ = &timer_wheel; }
+
+  static constexpr unsigned int MAX_TEMPORAL_LAYERS = 3;
+
   // forbid copying and moving
   Encoder(const Encoder & other) = delete;
   const Encoder & operator=(const Encoder & other) = delete;
@@ -65,44 +134,321 @@ private:
   // print debugging info
   bool verbose_ {false};
 
+  // see set_stream_id()
+  uint8_t stream_id_ {0};
+
   // current target bitrate
   unsigned int target_bitrate_ {0};
 
+  // congestion control (if any) setting the target bitrate; the codec is
+  // reconfigured only if it changes by MIN_BITRATE_CHANGE_PCT
+  std::unique_ptr<CongestionController> cc_ {};
+  static constexpr unsigned int MIN_BITRATE_CHANGE_PCT = 2;
+
+  // apply the bitrate of the congestion control
+  void apply_cc_bitrate();
+
   // VPX encoding configuration and context
   vpx_codec_enc_cfg_t cfg_ {};
   vpx_codec_ctx_t context_ {};
 
-  // frame ID to encode
+  // frame ID to encode (frames dropped are not numbered)
   uint32_t frame_id_ {0};
 
+  // when the frame being compressed was captured, and how to encode it
+  // (set by prepare_frame())
+  uint64_t frame_generation_ts_ {0};
+  vpx_enc_frame_flags_t encode_flags_ {0};
+
+  // temporal layers: the frames of a period cycle through the layers as in
+  // libvpx's examples (0-1 or 0-2-1-2). The base layer predicts from the
+  // last base layer frame only, and an enhancement layer from the layers
+  // below, so that its frames can be lost (or dropped under congestion)
+  // without affecting the layers below
+  struct LayerFrame
+  {
+    uint8_t temporal_id {0};
+    vpx_enc_frame_flags_t flags {0}; // slots to predict from and update
+  };
+
+  unsigned int num_temporal_layers_;
+  std::vector<LayerFrame> layer_pattern_ {}; // a period of frames
+  size_t layer_idx_ {0}; // index in the period of the frame being encoded
+
+  // frames in the last frame and golden slots as of the frame being encoded
+  // (nullopt if dropped, so the frames predicting from it are dropped too)
+  std::array<std::optional<uint32_t>, 2> slot_frames_ {};
+
+  // frames sent per layer and frames dropped (stats)
+  std::array<unsigned int, MAX_TEMPORAL_LAYERS> num_layer_frames_ {};
+  unsigned int num_dropped_frames_ {0};
+
+  // queuing delay (smoothed RTT above min RTT) at which the frames of the
+  // enhancement layers are dropped
+  static constexpr uint64_t CONGESTION_DELAY_US = 50 * 1000;
+
+  // if sending the frames of the enhancement layers would add to congestion
+  bool congested() const;
+
+  // the frames that the frame just encoded is predicted from, or nullopt if
+  // it must be dropped (under congestion or predicted from a frame dropped)
+  std::optional<RefFrames> ref_frames(const FrameType frame_type,
+                                      const uint8_t temporal_id);
+
+  // sequence number of the next datagram packetized
+  SeqNum next_seq_num_ {0};
+
+  // buffers of encoded frames, shared by their datagrams until sent and acked
+  // (declared before the datagrams so as to outlive them)
+  BufferPool payload_pool_ {};
+
   // queue of datagrams (packetized video frames) to send
   std::deque<Datagram> send_buf_ {};
 
+  // queue of unacked datagrams to retransmit, which are more urgent than
+  // send_buf_ and sent in place from unacked_ (rather than copied)
+  std::deque<SeqNum> rtx_buf_ {};
+
   // unacked datagrams
-  std::map<SeqNum, Datagram> unacked_ {};
+  UnackedStore unacked_ {};
+
+  // time-based loss detection (RACK, RFC 8985): the transmissions of unacked
+  // datagrams (first or not) in the order sent, with their send times; those
+  // of datagrams acked or retransmitted since are skipped
+  std::deque<std::pair<SeqNum, uint64_t>> sent_order_ {};
+
+  // the most recently sent transmission acked: send time, sequence number
+  // (among the ones sent at once), and the time until it was acked
+  std::optional<uint64_t> rack_xmit_ts_ {};
+  SeqNum rack_seq_num_ {0};
+  uint64_t rack_rtt_us_ {0};
+
+  // fires when the ack of the first transmission not known lost is overdue
+  std::optional<TimerWheel::TimerId> rack_timer_ {};
+  unsigned int num_rack_rtx_ {0}; // retransmissions on loss detection (stats)
+  unsigned int num_spurious_rtx_ {0}; // original arrived after all (stats)
+
+  // delays from first transmissions to acks of datagrams retransmitted (stats)
+  std::vector<uint64_t> recovery_delays_us_ {};
+
+  // frames with data fragments not acked yet, oldest first (frames acked
+  // in between stay until they are the oldest)
+  struct InflightFrame
+  {
+    uint32_t frame_id {0};
+    FrameType type {FrameType::UNKNOWN};
+    uint8_t temporal_id {0};
+    SeqNum first_seq_num {0};
+    uint16_t frag_cnt {0};
+    uint16_t num_unacked {0}; // data fragments not acked yet
+    uint64_t deadline_ts {0}; // playout deadline
+  };
+
+  std::deque<InflightFrame> inflight_frames_ {};
+  uint64_t playout_deadline_us_ {DEFAULT_PLAYOUT_DEADLINE_US};
+
+  // frames before a key (or recovery) frame acked are obsolete, as the
+  // receiver skips ahead to it
+  uint32_t obsolete_before_ {0};
 
-  // RTT-related
+  // a key (or recovery) frame is encoded after abandoning a frame past its
+  // deadline, unless one encoded since (recovery_frame_) is still in flight
+  bool need_recovery_ {false};
+  std::optional<uint32_t> recovery_frame_ {};
+
+  // reference-frame recovery: besides the last frame, the encoder keeps two
+  // long-term references in the golden and altref slots. Every frame may
+  // predict from the one acked (that receiver reported decoding), and every
+  // REF_INTERVAL frames one also replaces the other (pending) until receiver
+  // reports it, so that a recovery frame predicted only from the acked one
+  // is decodable after any losses. A key frame fills both slots.
+  // Prediction across frames skipped relies on error resilient mode, which
+  // resets the entropy contexts and motion vectors of past frames
+  struct LongTermRef
+  {
+    uint32_t frame_id {0};
+    unsigned int slot {0};    // GOLDEN or ALTREF
+    uint64_t deadline_ts {0}; // given up on if not reported by then
+  };
+
+  bool ref_recovery_ {false};
+  std::optional<LongTermRef> acked_ref_ {};
+  std::optional<LongTermRef> pending_ref_ {};
+  uint32_t last_pending_frame_ {0};
+
+  // type that the frame being encoded is packetized as unless a key frame
+  FrameType nonkey_type_ {FrameType::NONKEY};
+
+  static constexpr unsigned int GOLDEN = 0;
+  static constexpr unsigned int ALTREF = 1;
+  static constexpr uint32_t REF_INTERVAL = 10; // frames
+
+  // encoding flags of a frame predicting from the last frame and 'ref' (if
+  // any), and replacing 'update' (if any) besides the last frame
+  static vpx_enc_frame_flags_t ref_flags(const bool ref_last,
+                                         const std::optional<LongTermRef> & ref,
+                                         const std::optional<LongTermRef> & update);
+
+  // the reference frame that receiver reported decoding
+  void handle_ref_frame(const uint32_t frame_id);
+
+  // key frames and recovery frames encoded and their sizes (stats)
+  unsigned int num_key_frames_ {0};
+  size_t key_frame_bytes_ {0};
+  unsigned int num_recovery_frames_ {0};
+  size_t recovery_frame_bytes_ {0};
+
+  // abandonment stats
+  unsigned int num_expired_frames_ {0};
+  unsigned int num_obsolete_frames_ {0};
+  unsigned int num_dropped_queued_ {0};  // datagrams never sent
+  unsigned int num_dropped_unacked_ {0}; // datagrams no longer retransmitted
+  size_t dropped_bytes_ {0};
+
+  // the frame in flight 'frame_id' (if any)
+  InflightFrame * find_inflight_frame(const uint32_t frame_id);
+
+  // FEC: parity fragments as a percentage of data fragments
+  unsigned int fec_percent_ {0};
+  unsigned int num_data_frags_ {0};   // data fragments packetized (stats)
+  unsigned int num_parity_frags_ {0}; // parity fragments packetized (stats)
+
+  // streaming FEC: the last frames packetized, whose data fragments the
+  // parity fragments after each frame cover
+  struct FECWindowFrame
+  {
+    StreamParityHeader::CoveredFrame header {};
+    SeqNum first_seq_num {};
+    SharedBuffer buffer {};  // holding the data below
+    std::string_view data {}; // the frame, in fragments of 'max_frag_size'
+    size_t max_frag_size {};
+  };
+
+  size_t fec_window_size_ {0}; // frames (0: FEC within frames)
+  std::deque<FECWindowFrame> fec_window_ {};
+  unsigned int fec_credit_ {0}; // parity fragments owed (in percent)
+
+  // how lost datagrams are recovered
+  LossRecovery loss_recovery_ {LossRecovery::SENDER};
+  unsigned int num_nack_rtx_ {0}; // retransmissions on NACK (stats)
+
+  // RTT-related: smoothed RTT and its variation as in RFC 6298
   std::optional<unsigned int> min_rtt_us_ {};
-  std::optional<double> ewma_rtt_us_ {};
+  std::optional<double> srtt_us_ {};
+  double rttvar_us_ {0};
+  uint64_t max_ack_delay_us_ {0}; // receiver's delay in reporting (excluded)
+  static constexpr double SRTT_GAIN = 1.0 / 8;
+  static constexpr double RTTVAR_GAIN = 1.0 / 4;
   static constexpr double ALPHA = 0.2;
 
+  // retransmission timeout (RTO)
+  TimerWheel * timer_wheel_ {nullptr};
+  unsigned int num_rto_rtx_ {0}; // retransmissions on RTO (stats)
+
+  // one-way delay between the kernel timestamps on sender and receiver
+  // (assuming their clocks are synchronized)
+  std::optional<double> ewma_owd_us_ {};
+
+  // timestamping IDs of first transmissions awaiting TX timestamps (in order)
+  std::deque<std::pair<uint32_t, SeqNum>> pending_tx_ids_ {};
+  static constexpr size_t MAX_PENDING_TX_IDS = 65536;
+
   // performance stats
   unsigned int num_encoded_frames_ {0};
   double total_encode_time_ms_ {0.0};
   double max_encode_time_ms_ {0.0};
 
+  // delays that RTT samples between kernel timestamps exclude
+  unsigned int num_kernel_rtt_samples_ {0};
+  uint64_t total_send_delay_us_ {0};     // sender: sending datagrams
+  uint64_t total_ack_delay_us_ {0};      // receiver: receiving and reporting
+  uint64_t total_ack_recv_delay_us_ {0}; // sender: receiving feedback
+
+  // feedback received, and datagrams newly acked by it
+  unsigned int num_feedback_ {0};
+  unsigned int num_acked_ {0};
+
+  // receiver reports received, and the last one
+  unsigned int num_reports_ {0};
+  std::optional<ReportMsg> last_report_ {};
+
   // constants
   static constexpr unsigned int MAX_NUM_RTX = 3;
-  static constexpr uint64_t MAX_UNACKED_US = 1000 * 1000; // 1 second
+  static constexpr uint64_t DEFAULT_PLAYOUT_DEADLINE_US = 1000 * 1000; // 1 s
+  static constexpr uint64_t INITIAL_RTO_US = 200 * 1000; // before RTT samples
+  static constexpr uint64_t MIN_RTO_US = 10 * 1000;
 
   // track RTT
   void add_rtt_sample(const unsigned int rtt_us);
 
-  // encode the raw frame stored in 'raw_img'
-  void encode_frame(const RawImage & raw_img);
+  // take RTT (and one-way delay) samples from the arrival of a datagram
+  void handle_receipt(const FeedbackMsg::Receipt & receipt,
+                      const uint64_t feedback_ts,
+                      const uint64_t feedback_recv_ts,
+                      const uint64_t curr_ts);
+
+  // erase an acked datagram from unacked (if there)
+  void erase_acked(const SeqNum seq_num, const uint64_t curr_ts);
+
+  // an unacked datagram was acked (before it is erased)
+  void on_acked(const SeqNum seq_num, UnackedStore::Meta & meta,
+                const uint64_t curr_ts);
+
+  // a transmission of datagram 'seq_num' sent at 'send_ts' was acked
+  void rack_update(const SeqNum seq_num, const uint64_t send_ts,
+                   const uint64_t curr_ts);
+
+  // reordering window: how much longer than the RTT an ack may be late
+  // before the datagram is deemed lost
+  uint64_t reo_wnd_us() const;
+
+  // retransmit the transmissions deemed lost (or arm the RACK timer)
+  void detect_losses(const uint64_t curr_ts);
+
+  // current RTO (before exponential backoff)
+  uint64_t rto_us() const;
+
+  // (re)schedule the RTO timer of unacked datagram 'seq_num', or cancel it
+  void schedule_rto(const SeqNum seq_num, UnackedStore::Meta & meta,
+                    const uint64_t delay_us);
+  void cancel_rto(UnackedStore::Meta & meta);
+
+  // account for retransmitting unacked datagram 'seq_num' (which the caller
+  // queues in rtx_buf_)
+  void retransmit(const SeqNum seq_num, UnackedStore::Meta & meta,
+                  const uint64_t curr_ts);
+
+  // RTO timer of unacked datagram 'seq_num' fired
+  void handle_rto(const SeqNum seq_num);
+
+  // packetize the just encoded frame (stored in context_), to be played out
+  // by 'deadline_ts', and return its size (0 if dropped)
+  size_t packetize_encoded_frame(const uint64_t deadline_ts);
+
+  // abandon the frames past their deadlines or made obsolete by a key (or
+  // recovery) frame acked (oldest first), and note if the receiver needs a
+  // key or recovery frame
+  void abandon_frames(const uint64_t curr_ts);
+
+  // drop the datagrams of the oldest frame in flight, queued or unacked
+  void drop_oldest_frame();
+
+  // compute the parity fragments of a frame whose 'frag_cnt' data fragments
+  // of 'shard_size' bytes (the last zero-padded) start 'frame_buf', into
+  // 'frame_buf' after them, and enqueue them after the data fragments
+  void packetize_parity(const SharedBuffer & frame_buf,
+                        const size_t frame_size,
+                        const FrameType frame_type,
+                        const uint8_t temporal_id,
+                        const RefFrames ref_frames,
+                        const uint16_t frag_cnt,
+                        const uint16_t parity_cnt,
+                        const size_t shard_size);
 
-  // packetize the just encoded frame (stored in context_) and return its size
-  size_t packetize_encoded_frame();
+  // enqueue 'parity_cnt' parity fragments of the streaming FEC after the
+  // 'frag_cnt' data fragments of the frame just packetized
+  void packetize_stream_parity(const uint16_t frag_cnt,
+                               const uint16_t parity_cnt);
 
   // VPX API wrappers
   template <typename ... Args>
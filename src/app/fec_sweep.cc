@@ -0,0 +1,167 @@
+#include <getopt.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstring>
+#include <algorithm>
+
+#include "reed_solomon.hh"
+#include "conversion.hh"
+
+using namespace std;
+
+void print_usage(const string & program_name)
+{
+  cerr <<
+  "Usage: " << program_name << " [options]\n\n"
+  "Sweeps i.i.d. datagram loss rates and reports the percentage of frames\n"
+  "that are not decodable without retransmissions, for each amount of\n"
+  "Reed-Solomon parity fragments (as with video_sender --fec). Every frame\n"
+  "is actually coded and recovered, and the recovered fragments verified.\n\n"
+  "Options:\n"
+  "--frags <k>          data fragments per frame (default: 10)\n"
+  "--frames <N>         frames per loss rate and FEC amount (default: 10000)\n"
+  "--seed <S>           seed of the random losses (default: 0)"
+  << endl;
+}
+
+int main(int argc, char * argv[])
+{
+  size_t frag_cnt = 10;
+  unsigned int num_frames = 10000;
+  unsigned int seed = 0;
+
+  const option cmd_line_opts[] = {
+    {"frags",  required_argument, nullptr, 'K'},
+    {"frames", required_argument, nullptr, 'N'},
+    {"seed",   required_argument, nullptr, 'S'},
+    { nullptr, 0,                 nullptr,  0 },
+  };
+
+  while (true) {
+    const int opt = getopt_long(argc, argv, "", cmd_line_opts, nullptr);
+    if (opt == -1) {
+      break;
+    }
+
+    switch (opt) {
+      case 'K':
+        frag_cnt = strict_stoi(optarg);
+        break;
+      case 'N':
+        num_frames = strict_stoi(optarg);
+        break;
+      case 'S':
+        seed = strict_stoi(optarg);
+        break;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (optind != argc or frag_cnt == 0 or frag_cnt >= 256 or num_frames == 0) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  constexpr size_t SHARD_SIZE = 1400;
+  const vector<unsigned int> loss_percents {0, 1, 2, 5, 10, 15, 20, 30};
+  const vector<unsigned int> fec_percents {0, 10, 20, 30, 50, 100};
+
+  mt19937 prng(seed);
+  uniform_real_distribution<double> uniform(0.0, 1.0);
+
+  // random data fragments (the same for all frames)
+  vector<uint8_t> data(frag_cnt * SHARD_SIZE);
+  for (auto & byte : data) {
+    byte = prng();
+  }
+
+  cerr << "Frames not decodable without retransmissions (%) with "
+       << frag_cnt << " data fragments per frame\n"
+       << "(rows: datagram loss rate (%), columns: parity fragments (%))\n";
+  for (const auto fec_percent : fec_percents) {
+    cerr << "\t" << fec_percent;
+  }
+  cerr << endl;
+
+  for (const auto loss_percent : loss_percents) {
+    cerr << loss_percent;
+
+    for (const auto fec_percent : fec_percents) {
+      // as many parity fragments as Encoder sends
+      const size_t parity_cnt = min((frag_cnt * fec_percent + 99) / 100,
+                                    256 - frag_cnt);
+
+      vector<uint8_t> shards_buf((frag_cnt + parity_cnt) * SHARD_SIZE);
+      vector<uint8_t *> shards;
+      for (size_t i = 0; i < frag_cnt + parity_cnt; i++) {
+        shards.emplace_back(&shards_buf[i * SHARD_SIZE]);
+      }
+
+      // encode once
+      vector<uint8_t> parity_buf(parity_cnt * SHARD_SIZE);
+      if (parity_cnt > 0) {
+        vector<const uint8_t *> data_shards;
+        vector<uint8_t *> parity_shards;
+        for (size_t i = 0; i < frag_cnt; i++) {
+          data_shards.emplace_back(&data[i * SHARD_SIZE]);
+        }
+        for (size_t j = 0; j < parity_cnt; j++) {
+          parity_shards.emplace_back(&parity_buf[j * SHARD_SIZE]);
+        }
+
+        ReedSolomon(frag_cnt, parity_cnt).encode(data_shards, parity_shards,
+                                                 SHARD_SIZE);
+      }
+
+      unsigned int num_lost_frames = 0;
+      vector<bool> present(frag_cnt + parity_cnt);
+
+      for (unsigned int frame = 0; frame < num_frames; frame++) {
+        bool data_lost = false;
+        for (size_t i = 0; i < present.size(); i++) {
+          present[i] = uniform(prng) >= loss_percent / 100.0;
+          data_lost |= (i < frag_cnt and not present[i]);
+        }
+
+        if (not data_lost) {
+          continue;
+        }
+
+        if (parity_cnt == 0) {
+          num_lost_frames++;
+          continue;
+        }
+
+        // the fragments received, with the rest wiped
+        memcpy(shards_buf.data(), data.data(), data.size());
+        memcpy(&shards_buf[data.size()], parity_buf.data(), parity_buf.size());
+        for (size_t i = 0; i < frag_cnt; i++) {
+          if (not present[i]) {
+            memset(shards[i], 0, SHARD_SIZE);
+          }
+        }
+
+        if (not ReedSolomon(frag_cnt, parity_cnt).reconstruct(shards, present,
+                                                              SHARD_SIZE)) {
+          num_lost_frames++;
+          continue;
+        }
+
+        if (memcmp(shards_buf.data(), data.data(), data.size()) != 0) {
+          cerr << "Error: fragments were not recovered correctly" << endl;
+          return EXIT_FAILURE;
+        }
+      }
+
+      cerr << "\t" << double_to_string(100.0 * num_lost_frames / num_frames);
+    }
+
+    cerr << endl;
+  }
+
+  return EXIT_SUCCESS;
+}
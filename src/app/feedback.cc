@@ -0,0 +1,81 @@
+#include <algorithm>
+
+#include "feedback.hh"
+
+using namespace std;
+
+void FeedbackTracker::add(const DatagramHeader & header, const uint64_t recv_ts)
+{
+  const SeqNum seq_num = header.seq_num;
+
+  if (num_pending_ < FeedbackMsg::MAX_RECEIPTS) {
+    feedback_.receipts[num_pending_++] = {seq_num, header.send_ts, recv_ts};
+  }
+
+  if (not highest_seq_num_ or seq_num > *highest_seq_num_) {
+    highest_seq_num_ = seq_num;
+  }
+
+  mark_received(seq_num);
+}
+
+void FeedbackTracker::add_recovered(const SeqNum seq_num)
+{
+  mark_received(seq_num);
+}
+
+void FeedbackTracker::mark_received(const SeqNum seq_num)
+{
+  if (seq_num < cum_seq_num_) {
+    return; // duplicate
+  }
+
+  // give up on the oldest missing datagrams if too far behind
+  if (seq_num - cum_seq_num_ >= MAX_TRACKED) {
+    const size_t num_dropped = seq_num - cum_seq_num_ - MAX_TRACKED + 1;
+    received_.erase(received_.begin(),
+                    received_.begin() + min(num_dropped, received_.size()));
+    cum_seq_num_ += num_dropped;
+  }
+
+  const size_t idx = seq_num - cum_seq_num_;
+  if (idx >= received_.size()) {
+    received_.resize(idx + 1, false);
+  }
+  received_[idx] = true;
+
+  // advance the cumulative sequence number past the datagrams received
+  while (not received_.empty() and received_.front()) {
+    received_.pop_front();
+    cum_seq_num_++;
+  }
+}
+
+bool FeedbackTracker::received(const SeqNum seq_num) const
+{
+  if (seq_num < cum_seq_num_) {
+    return true;
+  }
+
+  const size_t idx = seq_num - cum_seq_num_;
+  return idx < received_.size() and received_[idx];
+}
+
+const FeedbackMsg & FeedbackTracker::build(const uint64_t feedback_ts)
+{
+  feedback_.cum_seq_num = cum_seq_num_;
+  feedback_.highest_seq_num = highest_seq_num_.value_or(0);
+  feedback_.feedback_ts = feedback_ts;
+  feedback_.num_receipts = num_pending_;
+
+  // SACK bitmap of the 64 datagrams below the highest
+  feedback_.sack_bitmap = 0;
+  for (SeqNum bit = 0; bit < 64 and bit < feedback_.highest_seq_num; bit++) {
+    if (received(feedback_.highest_seq_num - 1 - bit)) {
+      feedback_.sack_bitmap |= 1ULL << bit;
+    }
+  }
+
+  num_pending_ = 0;
+  return feedback_;
+}
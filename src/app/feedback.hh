@@ -0,0 +1,61 @@
+#ifndef FEEDBACK_HH
+#define FEEDBACK_HH
+
+#include <deque>
+#include <optional>
+
+#include "protocol.hh"
+
+// receiver's record of the datagrams received, to build FeedbackMsg from
+class FeedbackTracker
+{
+public:
+  // track the datagrams of simulcast stream 'stream_id'
+  FeedbackTracker(const uint8_t stream_id = 0)
+  { feedback_.stream_id = stream_id; }
+
+  // datagram 'header' arrived at 'recv_ts' (us); the receipt is left out
+  // of the next feedback (which still acknowledges the datagram) if there
+  // are FeedbackMsg::MAX_RECEIPTS pending already
+  void add(const DatagramHeader & header, const uint64_t recv_ts);
+
+  // datagram 'seq_num' need not arrive anymore (e.g., FEC recovered its
+  // data), so acknowledge it without a receipt (even if above the highest
+  // received, as the parity of a frame complete before it arrived)
+  void add_recovered(const SeqNum seq_num);
+
+  // frame 'frame_id' (a key frame or FrameType::REF) was decoded, to report
+  // in the feedback from now on
+  void set_ref_frame(const uint32_t frame_id)
+  { feedback_.ref_frame_id = frame_id; }
+
+  // number of receipts since the last feedback
+  size_t num_pending() const { return num_pending_; }
+
+  // build the feedback to send at 'feedback_ts' (us) from the receipts since
+  // the last feedback, and clear them
+  const FeedbackMsg & build(const uint64_t feedback_ts);
+
+private:
+  // every datagram before 'cum_seq_num_' has been received; received_[i]
+  // records if datagram 'cum_seq_num_ + i' has (so received_[0] is false)
+  SeqNum cum_seq_num_ {0};
+  std::deque<bool> received_ {};
+  std::optional<SeqNum> highest_seq_num_ {};
+
+  // pending receipts are stored in place in the next feedback
+  FeedbackMsg feedback_ {};
+  size_t num_pending_ {0};
+
+  // max datagrams tracked after a missing one: the missing datagram is then
+  // considered received, as the sender must have given up on it long before
+  static constexpr size_t MAX_TRACKED = 65536;
+
+  // record datagram 'seq_num' as received
+  void mark_received(const SeqNum seq_num);
+
+  // whether datagram 'seq_num' has been received
+  bool received(const SeqNum seq_num) const;
+};
+
+#endif /* FEEDBACK_HH */
@@ -0,0 +1,237 @@
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+#include "gcc_controller.hh"
+#include "conversion.hh"
+
+using namespace std;
+
+GCCController::GCCController(const unsigned int start_bitrate_kbps,
+                             const unsigned int min_bitrate_kbps,
+                             const unsigned int max_bitrate_kbps)
+  : rate_control_(start_bitrate_kbps, min_bitrate_kbps, max_bitrate_kbps),
+    loss_bitrate_kbps_(max_bitrate_kbps)
+{}
+
+void GCCController::on_sent(const SeqNum seq_num, const size_t size)
+{
+  const SeqNum end_seq_num = first_sent_seq_num_ + sent_sizes_.size();
+
+  // the datagrams skipped were never sent (e.g., abandoned while queued)
+  if (sent_sizes_.empty() or seq_num < end_seq_num or
+      seq_num - end_seq_num >= MAX_SENT_HISTORY) {
+    sent_sizes_.clear();
+    first_sent_seq_num_ = seq_num;
+  } else {
+    sent_sizes_.resize(seq_num - first_sent_seq_num_);
+  }
+
+  sent_sizes_.emplace_back(size);
+
+  while (sent_sizes_.size() > MAX_SENT_HISTORY) {
+    sent_sizes_.pop_front();
+    first_sent_seq_num_++;
+  }
+}
+
+void GCCController::on_receipt(const SeqNum seq_num, const uint64_t send_ts,
+                               const uint64_t recv_ts)
+{
+  // sent too long ago
+  if (seq_num < first_sent_seq_num_ or
+      seq_num - first_sent_seq_num_ >= sent_sizes_.size()) {
+    return;
+  }
+
+  const size_t size = sent_sizes_[seq_num - first_sent_seq_num_];
+  if (size == 0) {
+    return; // never sent
+  }
+
+  num_received_++;
+
+  // bitrate acked over the last window (once a window has elapsed)
+  if (not first_recv_ts_) {
+    first_recv_ts_ = recv_ts;
+  }
+
+  acked_.emplace_back(recv_ts, size);
+  acked_bytes_ += size;
+
+  while (acked_.front().first + ACKED_WINDOW_US < recv_ts) {
+    acked_bytes_ -= acked_.front().second;
+    acked_.pop_front();
+  }
+
+  if (recv_ts >= *first_recv_ts_ + ACKED_WINDOW_US) {
+    acked_bitrate_kbps_ = acked_bytes_ * 8.0 * 1000 / ACKED_WINDOW_US;
+  }
+
+  // group the datagrams sent in a burst (e.g., the fragments of a frame)
+  if (not curr_group_) {
+    curr_group_ = {send_ts, send_ts, recv_ts};
+    return;
+  }
+
+  // sent before the current group (reordered or a late receipt)
+  if (send_ts < curr_group_->first_send_ts) {
+    return;
+  }
+
+  if (send_ts - curr_group_->first_send_ts <= BURST_US) {
+    curr_group_->last_send_ts = max(curr_group_->last_send_ts, send_ts);
+    curr_group_->last_recv_ts = max(curr_group_->last_recv_ts, recv_ts);
+    return;
+  }
+
+  // a datagram of the next group completes the current one: compare the
+  // delays of the last two groups
+  if (prev_group_) {
+    const int64_t send_delta = curr_group_->last_send_ts
+                               - prev_group_->last_send_ts;
+    const int64_t recv_delta = curr_group_->last_recv_ts
+                               - prev_group_->last_recv_ts;
+    add_delta(send_delta / 1000.0, recv_delta / 1000.0,
+              curr_group_->last_recv_ts);
+  }
+
+  prev_group_ = curr_group_;
+  curr_group_ = {send_ts, send_ts, recv_ts};
+}
+
+void GCCController::add_delta(const double send_delta_ms,
+                              const double recv_delta_ms,
+                              const uint64_t arrival_ts)
+{
+  num_deltas_ = min(num_deltas_ + 1, MAX_NUM_DELTAS);
+
+  if (not first_arrival_ts_) {
+    first_arrival_ts_ = arrival_ts;
+  }
+
+  // smoothed one-way delay (relative to the first group's)
+  accumulated_delay_ms_ += recv_delta_ms - send_delta_ms;
+  smoothed_delay_ms_ = SMOOTHING * smoothed_delay_ms_ +
+                       (1 - SMOOTHING) * accumulated_delay_ms_;
+
+  trendline_.emplace_back(
+      static_cast<int64_t>(arrival_ts - *first_arrival_ts_) / 1000.0,
+      smoothed_delay_ms_);
+
+  if (trendline_.size() > TRENDLINE_WINDOW) {
+    trendline_.pop_front();
+  }
+
+  // slope of the least-squares fit of the delays over arrival times
+  if (trendline_.size() == TRENDLINE_WINDOW) {
+    double mean_x = 0, mean_y = 0;
+    for (const auto & [x, y] : trendline_) {
+      mean_x += x;
+      mean_y += y;
+    }
+    mean_x /= trendline_.size();
+    mean_y /= trendline_.size();
+
+    double num = 0, den = 0;
+    for (const auto & [x, y] : trendline_) {
+      num += (x - mean_x) * (y - mean_y);
+      den += (x - mean_x) * (x - mean_x);
+    }
+
+    if (den != 0) {
+      trend_ = num / den;
+    }
+  }
+
+  // the slope (ms of delay per ms) scaled to be compared with the threshold
+  if (num_deltas_ >= 2) {
+    detector_.detect(num_deltas_ * trend_ * THRESHOLD_GAIN, send_delta_ms,
+                     arrival_ts);
+  }
+}
+
+void GCCController::on_rtt_sample(const unsigned int rtt_us)
+{
+  rate_control_.set_rtt(rtt_us);
+}
+
+void GCCController::on_feedback(const uint64_t curr_ts)
+{
+  rate_control_.update(detector_.usage(), acked_bitrate_kbps_, curr_ts);
+  update_loss_bitrate(curr_ts);
+}
+
+void GCCController::on_receiver_estimate(const unsigned int bitrate_kbps)
+{
+  receiver_estimate_kbps_ = bitrate_kbps;
+}
+
+void GCCController::update_loss_bitrate(const uint64_t curr_ts)
+{
+  if (not last_loss_update_ts_) {
+    last_loss_update_ts_ = curr_ts;
+    return;
+  }
+
+  if (curr_ts < *last_loss_update_ts_ + LOSS_INTERVAL_US or
+      num_lost_ + num_received_ < MIN_LOSS_SAMPLES) {
+    return;
+  }
+
+  loss_fraction_ = 1.0 * num_lost_ / (num_lost_ + num_received_);
+
+  // back off on heavy losses, and increase while there are hardly any
+  if (loss_fraction_ > 0.1) {
+    loss_bitrate_kbps_ = target_bitrate() * (1 - 0.5 * loss_fraction_);
+  } else if (loss_fraction_ < 0.02) {
+    loss_bitrate_kbps_ *= 1.05;
+  }
+
+  loss_bitrate_kbps_ = clamp(loss_bitrate_kbps_,
+      static_cast<double>(rate_control_.min_bitrate()),
+      static_cast<double>(rate_control_.max_bitrate()));
+
+  num_lost_ = 0;
+  num_received_ = 0;
+  last_loss_update_ts_ = curr_ts;
+}
+
+unsigned int GCCController::target_bitrate() const
+{
+  double bitrate = min(rate_control_.bitrate(), loss_bitrate_kbps_);
+
+  if (receiver_estimate_kbps_) {
+    bitrate = max<double>(min<double>(bitrate, *receiver_estimate_kbps_),
+                          rate_control_.min_bitrate());
+  }
+
+  return lrint(bitrate);
+}
+
+void GCCController::set_max_bitrate(const unsigned int bitrate_kbps)
+{
+  rate_control_.set_max_bitrate(bitrate_kbps);
+  loss_bitrate_kbps_ = min<double>(loss_bitrate_kbps_,
+                                   rate_control_.max_bitrate());
+}
+
+void GCCController::output_periodic_stats()
+{
+  cerr << "  - Congestion control: target " << target_bitrate()
+       << " kbps (delay-based " << lrint(rate_control_.bitrate())
+       << ", loss-based " << lrint(loss_bitrate_kbps_) << ", receiver's "
+       << (receiver_estimate_kbps_ ? to_string(*receiver_estimate_kbps_) : "-")
+       << "), acked "
+       << (acked_bitrate_kbps_ ? to_string(lrint(*acked_bitrate_kbps_)) : "-")
+       << " kbps, loss " << double_to_string(100 * loss_fraction_) << "%"
+       << endl;
+
+  cerr << "  - Delay gradient: trend "
+       << double_to_string(detector_.trend()) << " (threshold "
+       << double_to_string(detector_.threshold()) << "), "
+       << OveruseDetector::usage_name(detector_.usage()) << ", "
+       << detector_.num_overuses() << " overuse signals" << endl;
+
+  detector_.reset_stats();
+}
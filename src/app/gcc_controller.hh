@@ -0,0 +1,112 @@
+#ifndef GCC_CONTROLLER_HH
+#define GCC_CONTROLLER_HH
+
+#include <deque>
+#include <cstdint>
+#include <optional>
+#include <utility>
+
+#include "congestion_controller.hh"
+#include "overuse_detector.hh"
+#include "aimd_rate_control.hh"
+
+// delay-based congestion control in the style of GCC (Google Congestion
+// Control, draft-ietf-rmcat-gcc), run on the sender from per-datagram
+// feedback: the growth of one-way delay between groups of datagrams sent
+// within a burst is smoothed and fitted by a trendline, whose slope is
+// compared against an adaptive threshold to detect overuse of the
+// bottleneck. An AIMD controller then backs off to a fraction of the bitrate
+// acked, or otherwise probes for more, and a loss-based bound (and
+// receiver's estimate, if reported) caps the bitrate
+class GCCController : public CongestionController
+{
+public:
+  GCCController(const unsigned int start_bitrate_kbps,
+                const unsigned int min_bitrate_kbps,
+                const unsigned int max_bitrate_kbps);
+
+  void on_sent(const SeqNum seq_num, const size_t size) override;
+  void on_receipt(const SeqNum seq_num, const uint64_t send_ts,
+                  const uint64_t recv_ts) override;
+  void on_loss() override { num_lost_++; }
+  void on_rtt_sample(const unsigned int rtt_us) override;
+  void on_feedback(const uint64_t curr_ts) override;
+  void on_receiver_estimate(const unsigned int bitrate_kbps) override;
+
+  unsigned int target_bitrate() const override;
+  void set_max_bitrate(const unsigned int bitrate_kbps) override;
+
+  void output_periodic_stats() override;
+
+  // what the delay gradient signals about the bottleneck
+  OveruseDetector::Usage usage() const { return detector_.usage(); }
+
+private:
+  // sizes of the datagrams sent, by sequence number from
+  // 'first_sent_seq_num_' (0 if never sent; the oldest are forgotten)
+  std::deque<uint16_t> sent_sizes_ {};
+  SeqNum first_sent_seq_num_ {0};
+  static constexpr size_t MAX_SENT_HISTORY = 8192;
+
+  // datagrams sent within BURST_US of the first of a group form a group,
+  // whose delay is that of its last datagram
+  struct PacketGroup
+  {
+    uint64_t first_send_ts {0};
+    uint64_t last_send_ts {0};
+    uint64_t last_recv_ts {0};
+  };
+
+  std::optional<PacketGroup> curr_group_ {};
+  std::optional<PacketGroup> prev_group_ {};
+  static constexpr uint64_t BURST_US = 5000;
+
+  // trendline filter: the accumulated delay variation (ms), smoothed, over
+  // the last TRENDLINE_WINDOW groups (by arrival time in ms), and its slope
+  std::optional<uint64_t> first_arrival_ts_ {};
+  double accumulated_delay_ms_ {0};
+  double smoothed_delay_ms_ {0};
+  std::deque<std::pair<double, double>> trendline_ {};
+  double trend_ {0};
+  unsigned int num_deltas_ {0};
+
+  static constexpr size_t TRENDLINE_WINDOW = 20;
+  static constexpr double SMOOTHING = 0.9;
+  static constexpr double THRESHOLD_GAIN = 4;
+  static constexpr unsigned int MAX_NUM_DELTAS = 60;
+
+  // overuse detection on the trend, and AIMD on the bitrate acked
+  OveruseDetector detector_ {};
+  AimdRateControl rate_control_;
+
+  // bitrate acked over the last ACKED_WINDOW_US (by arrival time)
+  std::deque<std::pair<uint64_t, size_t>> acked_ {};
+  size_t acked_bytes_ {0};
+  std::optional<uint64_t> first_recv_ts_ {};
+  std::optional<double> acked_bitrate_kbps_ {};
+  static constexpr uint64_t ACKED_WINDOW_US = 500 * 1000;
+
+  // receiver's estimate (see ReportMsg), capping the target
+  std::optional<unsigned int> receiver_estimate_kbps_ {};
+
+  // loss-based bound, updated every LOSS_INTERVAL_US (and MIN_LOSS_SAMPLES
+  // datagrams, not to back off on a few random losses) from the fraction of
+  // the datagrams reported lost
+  double loss_bitrate_kbps_;
+  unsigned int num_lost_ {0};
+  unsigned int num_received_ {0};
+  std::optional<uint64_t> last_loss_update_ts_ {};
+  double loss_fraction_ {0};
+  static constexpr uint64_t LOSS_INTERVAL_US = 1000 * 1000;
+  static constexpr unsigned int MIN_LOSS_SAMPLES = 50;
+
+  // feed the delay variation between the last two groups to the trendline
+  // filter and the overuse detector
+  void add_delta(const double send_delta_ms, const double recv_delta_ms,
+                 const uint64_t arrival_ts);
+
+  // apply the loss-based bound
+  void update_loss_bitrate(const uint64_t curr_ts);
+};
+
+#endif /* GCC_CONTROLLER_HH */
@@ -0,0 +1,75 @@
+#include <cmath>
+#include <algorithm>
+
+#include "overuse_detector.hh"
+
+using namespace std;
+
+OveruseDetector::Usage OveruseDetector::detect(const double trend,
+                                               const double send_delta_ms,
+                                               const uint64_t arrival_ts)
+{
+  trend_ = trend;
+
+  if (trend_ > threshold_) {
+    if (time_over_using_ms_ < 0) {
+      // assume it has been over for half of the time since the last group
+      time_over_using_ms_ = send_delta_ms / 2;
+    } else {
+      time_over_using_ms_ += send_delta_ms;
+    }
+    overuse_counter_++;
+
+    // overuse if it keeps growing for long enough
+    if (time_over_using_ms_ > OVERUSE_TIME_MS and overuse_counter_ > 1 and
+        trend_ >= prev_trend_) {
+      time_over_using_ms_ = 0;
+      overuse_counter_ = 0;
+      usage_ = Usage::OVERUSING;
+      num_overuses_++;
+    }
+  } else {
+    time_over_using_ms_ = -1;
+    overuse_counter_ = 0;
+    usage_ = trend_ < -threshold_ ? Usage::UNDERUSING : Usage::NORMAL;
+  }
+
+  prev_trend_ = trend_;
+  update_threshold(arrival_ts);
+
+  return usage_;
+}
+
+void OveruseDetector::update_threshold(const uint64_t arrival_ts)
+{
+  if (not last_threshold_ts_) {
+    last_threshold_ts_ = arrival_ts;
+  }
+
+  // ignore the spikes (e.g., of a sudden change of capacity)
+  const double abs_trend = fabs(trend_);
+  if (abs_trend > threshold_ + 15) {
+    last_threshold_ts_ = arrival_ts;
+    return;
+  }
+
+  const double k = abs_trend < threshold_ ? K_DOWN : K_UP;
+  const double dt_ms = arrival_ts > *last_threshold_ts_ ?
+      min((arrival_ts - *last_threshold_ts_) / 1000.0, 100.0) : 0;
+
+  threshold_ += k * (abs_trend - threshold_) * dt_ms;
+  threshold_ = clamp(threshold_, MIN_THRESHOLD, MAX_THRESHOLD);
+  last_threshold_ts_ = arrival_ts;
+}
+
+const char * OveruseDetector::usage_name(const Usage usage)
+{
+  switch (usage) {
+    case Usage::OVERUSING:
+      return "overusing";
+    case Usage::UNDERUSING:
+      return "underusing";
+    default:
+      return "normal";
+  }
+}
@@ -0,0 +1,55 @@
+#ifndef OVERUSE_DETECTOR_HH
+#define OVERUSE_DETECTOR_HH
+
+#include <cstdint>
+#include <optional>
+
+// GCC's overuse detector (draft-ietf-rmcat-gcc): compares an estimate of
+// the growth of one-way delay against an adaptive threshold, and signals
+// overuse of the bottleneck once the delay keeps growing above it for
+// OVERUSE_TIME_MS. The threshold tracks the estimate (slowly when above it)
+// so that the delay-based control does not starve against loss-based flows
+class OveruseDetector
+{
+public:
+  // what the delay gradient signals about the bottleneck
+  enum class Usage { NORMAL, OVERUSING, UNDERUSING };
+
+  // the delay gradient 'trend' (ms, scaled to be compared with the
+  // threshold) of a group of datagrams sent 'send_delta_ms' after the last
+  // group arrived at 'arrival_ts' (us)
+  Usage detect(const double trend, const double send_delta_ms,
+               const uint64_t arrival_ts);
+
+  Usage usage() const { return usage_; }
+  double trend() const { return trend_; }
+  double threshold() const { return threshold_; }
+
+  // overuse signals (stats)
+  unsigned int num_overuses() const { return num_overuses_; }
+  void reset_stats() { num_overuses_ = 0; }
+
+  // name of 'usage' (for stats)
+  static const char * usage_name(const Usage usage);
+
+private:
+  Usage usage_ {Usage::NORMAL};
+  double trend_ {0};
+  double prev_trend_ {0};
+  double threshold_ {12.5};
+  std::optional<uint64_t> last_threshold_ts_ {};
+  double time_over_using_ms_ {-1};
+  unsigned int overuse_counter_ {0};
+  unsigned int num_overuses_ {0};
+
+  static constexpr double OVERUSE_TIME_MS = 10;
+  static constexpr double K_UP = 0.0087;
+  static constexpr double K_DOWN = 0.039;
+  static constexpr double MIN_THRESHOLD = 6;
+  static constexpr double MAX_THRESHOLD = 600;
+
+  // adapt the threshold to the trend
+  void update_threshold(const uint64_t arrival_ts);
+};
+
+#endif /* OVERUSE_DETECTOR_HH */
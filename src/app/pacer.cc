@@ -0,0 +1,70 @@
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+
+#include "pacer.hh"
+
+using namespace std;
+
+Pacer::Pacer(const unsigned int factor_percent)
+  : factor_percent_(factor_percent)
+{
+  if (factor_percent_ == 0) {
+    throw runtime_error("Pacer: invalid pacing factor");
+  }
+}
+
+void Pacer::set_target_bitrate(const unsigned int bitrate_kbps)
+{
+  rate_kbps_ = bitrate_kbps * factor_percent_ / 100.0;
+}
+
+void Pacer::refill(const uint64_t now)
+{
+  if (last_update_ts_ and now > *last_update_ts_) {
+    // kbps is bytes per 8 ms
+    tokens_ += rate_kbps_ * (now - *last_update_ts_) / 8000;
+    tokens_ = min(tokens_, max(rate_kbps_ * BURST_US / 8000, MIN_BURST_BYTES));
+  }
+
+  if (not last_update_ts_ or now > *last_update_ts_) {
+    last_update_ts_ = now;
+  }
+}
+
+size_t Pacer::budget(const uint64_t now)
+{
+  refill(now);
+
+  // not paced without a target bitrate
+  if (rate_kbps_ <= 0) {
+    return SIZE_MAX;
+  }
+
+  return tokens_ > 0 ? ceil(tokens_) : 0;
+}
+
+void Pacer::on_sent(const size_t size, const uint64_t now)
+{
+  refill(now);
+
+  if (rate_kbps_ > 0) {
+    tokens_ -= size;
+  }
+}
+
+uint64_t Pacer::delay(const uint64_t now) const
+{
+  if (tokens_ > 0 or rate_kbps_ <= 0) {
+    return 0;
+  }
+
+  // until the debt is paid back and a byte more accrues (minus what accrued
+  // since the last update)
+  const uint64_t elapsed = last_update_ts_ and now > *last_update_ts_ ?
+                           now - *last_update_ts_ : 0;
+  const uint64_t payback = ceil((1 - tokens_) * 8000 / rate_kbps_);
+
+  return payback > elapsed ? payback - elapsed : 0;
+}
@@ -0,0 +1,52 @@
+#ifndef PACER_HH
+#define PACER_HH
+
+#include <cstdint>
+#include <cstddef>
+#include <optional>
+
+// token bucket that paces the datagrams sent at a multiple of the target
+// bitrate, so that a frame (e.g., a key frame) is spread over time instead
+// of leaving in a line-rate burst that overflows shallow buffers: tokens
+// (bytes) accrue at the pacing rate up to a burst of BURST_US, and datagrams
+// are released as long as any are left (so the bucket goes into debt by
+// less than a datagram)
+class Pacer
+{
+public:
+  // pace at 'factor_percent' (> 0) of the target bitrate
+  Pacer(const unsigned int factor_percent);
+
+  // target bitrate (kbps) of all the datagrams paced, from now on
+  void set_target_bitrate(const unsigned int bitrate_kbps);
+
+  // bytes that may be sent at 'now' (us), or 0 if none (unlimited until the
+  // target bitrate is set)
+  size_t budget(const uint64_t now);
+
+  // 'size' bytes were sent at 'now' (us)
+  void on_sent(const size_t size, const uint64_t now);
+
+  // time (us) from 'now' until a datagram may be sent
+  uint64_t delay(const uint64_t now) const;
+
+  // pacing rate (kbps)
+  double pacing_rate() const { return rate_kbps_; }
+
+private:
+  unsigned int factor_percent_;
+  double rate_kbps_ {0};
+
+  // tokens (bytes) in the bucket as of 'last_update_ts_'; negative in debt
+  double tokens_ {0};
+  std::optional<uint64_t> last_update_ts_ {};
+
+  // the bucket holds BURST_US at the pacing rate, but at least a datagram
+  static constexpr uint64_t BURST_US = 5000;
+  static constexpr double MIN_BURST_BYTES = 1500;
+
+  // add the tokens accrued until 'now'
+  void refill(const uint64_t now);
+};
+
+#endif /* PACER_HH */
@@ -1,19 +1,26 @@
+#include <cstring>
 #include <stdexcept>
 #include "protocol.hh"
-#include "serialization.hh"
 
 using namespace std;
 
-Datagram::Datagram(const uint32_t _frame_id,
+Datagram::Datagram(const uint8_t _stream_id,
+                   const uint32_t _frame_id,
                    const FrameType _frame_type,
+                   const uint8_t _temporal_id,
+                   const RefFrames _ref_frames,
                    const uint16_t _frag_id,
                    const uint16_t _frag_cnt,
+                   const uint16_t _parity_cnt,
+                   const SeqNum _seq_num,
+                   const SharedBuffer & _buffer,
                    const string_view _payload)
-  : frame_id(_frame_id), frame_type(_frame_type),
-    frag_id(_frag_id), frag_cnt(_frag_cnt), payload(_payload)
+  : DatagramHeader{_stream_id, _frame_id, _frame_type, _temporal_id,
+                   _ref_frames, _frag_id, _frag_cnt, _parity_cnt, 0, _seq_num},
+    buffer(_buffer), payload(_payload)
 {}
 
-size_t Datagram::max_payload = 1500 - 28 - Datagram::HEADER_SIZE;
+size_t Datagram::max_payload = Datagram::MAX_PAYLOAD;
 
 void Datagram::set_mtu(const size_t mtu)
 {
@@ -25,122 +32,280 @@ void Datagram::set_mtu(const size_t mtu)
   max_payload = mtu - 28 - Datagram::HEADER_SIZE;
 }
 
-bool Datagram::parse_from_string(const string & binary)
+bool DatagramView::parse_from_string(const string_view binary)
 {
   if (binary.size() < HEADER_SIZE) {
     return false; // datagram is too small to contain a header
   }
 
-  WireParser parser(binary);
-  frame_id = parser.read_uint32();
-  frame_type = static_cast<FrameType>(parser.read_uint8());
-  frag_id = parser.read_uint16();
-  frag_cnt = parser.read_uint16();
-  send_ts = parser.read_uint64();
-  payload = parser.read_string();
+  Format::read(*this, binary.data());
+  payload = binary.substr(HEADER_SIZE);
 
   return true;
 }
 
+bool Datagram::parse_from_string(const string_view binary)
+{
+  DatagramView view;
+  if (not view.parse_from_string(binary)) {
+    return false;
+  }
+
+  static_cast<DatagramHeader &>(*this) = view;
+
+  // copy the payload into a buffer of its own
+  buffer = SharedBuffer(view.payload.size());
+  memcpy(buffer.data(), view.payload.data(), view.payload.size());
+  payload = buffer.str();
+
+  return true;
+}
+
+string_view DatagramHeader::serialize_to(char * buf) const
+{
+  Format::write(*this, buf);
+  return {buf, HEADER_SIZE};
+}
+
 string Datagram::serialize_to_string() const
 {
+  char header[HEADER_SIZE];
+
   string binary;
   binary.reserve(HEADER_SIZE + payload.size());
 
-  binary += put_number(frame_id);
-  binary += put_number(static_cast<uint8_t>(frame_type));
-  binary += put_number(frag_id);
-  binary += put_number(frag_cnt);
-  binary += put_number(send_ts);
+  binary += serialize_to(header);
   binary += payload;
 
   return binary;
 }
 
-size_t Msg::serialized_size() const
+char * StreamParityHeader::serialize_to(char * dst) const
 {
-  return sizeof(type);
+  dst = Format::write(*this, dst);
+
+  for (size_t i = 0; i < num_frames; i++) {
+    dst = CoveredFrame::Format::write(frames[i], dst);
+  }
+
+  return dst;
 }
 
-string Msg::serialize_to_string() const
+optional<string_view> StreamParityHeader::parse_from_string(
+    const string_view payload)
 {
-  return put_number(static_cast<uint8_t>(type));
+  if (payload.size() < Format::SIZE) {
+    return nullopt;
+  }
+
+  const char * src = Format::read(*this, payload.data());
+
+  if (num_frames == 0 or num_frames > MAX_FRAMES or
+      payload.size() < serialized_size()) {
+    return nullopt;
+  }
+
+  for (size_t i = 0; i < num_frames; i++) {
+    src = CoveredFrame::Format::read(frames[i], src);
+  }
+
+  return payload.substr(serialized_size());
 }
 
-shared_ptr<Msg> Msg::parse_from_string(const string & binary)
+// parse the message of type M following its type in 'binary'
+template<typename M>
+optional<Msg> parse_fields(const string_view binary)
 {
-  if (binary.size() < sizeof(type)) {
-    return nullptr;
+  if (binary.size() < M::SERIALIZED_SIZE) {
+    return nullopt;
   }
 
-  WireParser parser(binary);
-  auto type = static_cast<Type>(parser.read_uint8());
+  M msg;
+  M::Format::read(msg, binary.data() + sizeof(MsgType));
+  return msg;
+}
 
-  if (type == Type::ACK) {
-    auto ret = make_shared<AckMsg>();
-    ret->frame_id = parser.read_uint32();
-    ret->frag_id = parser.read_uint16();
-    ret->send_ts = parser.read_uint64();
-    return ret;
+// FeedbackMsg is followed by a variable number of receipts
+template<>
+optional<Msg> parse_fields<FeedbackMsg>(const string_view binary)
+{
+  if (binary.size() < FeedbackMsg::SERIALIZED_SIZE) {
+    return nullopt;
   }
-  else if (type == Type::CONFIG) {
-    auto ret = make_shared<ConfigMsg>();
-    ret->width = parser.read_uint16();
-    ret->height = parser.read_uint16();
-    ret->frame_rate = parser.read_uint16();
-    ret->target_bitrate = parser.read_uint32();
-    return ret;
+
+  FeedbackMsg feedback;
+  const char * src = FeedbackMsg::Format::read(feedback,
+                                               binary.data() + sizeof(MsgType));
+
+  if (feedback.num_receipts > FeedbackMsg::MAX_RECEIPTS or
+      binary.size() < feedback.serialized_size()) {
+    return nullopt;
   }
-  else {
-    return nullptr;
+
+  for (size_t i = 0; i < feedback.num_receipts; i++) {
+    src = FeedbackMsg::Receipt::Format::read(feedback.receipts[i], src);
   }
+
+  return feedback;
 }
 
-AckMsg::AckMsg(const Datagram & datagram)
-  : Msg(Type::ACK), frame_id(datagram.frame_id), frag_id(datagram.frag_id),
-    send_ts(datagram.send_ts)
-{}
+// NackMsg is followed by a variable number of sequence numbers
+template<>
+optional<Msg> parse_fields<NackMsg>(const string_view binary)
+{
+  if (binary.size() < NackMsg::SERIALIZED_SIZE) {
+    return nullopt;
+  }
+
+  NackMsg nack;
+  const char * src = NackMsg::Format::read(nack, binary.data() + sizeof(MsgType));
+
+  if (nack.num_seq_nums > NackMsg::MAX_SEQ_NUMS or
+      binary.size() < nack.serialized_size()) {
+    return nullopt;
+  }
 
-size_t AckMsg::serialized_size() const
+  for (size_t i = 0; i < nack.num_seq_nums; i++) {
+    nack.seq_nums[i] = get_uint32(src);
+    src += sizeof(SeqNum);
+  }
+
+  return nack;
+}
+
+// serialize a message of type M along with its type into 'buf' (of at least
+// M::SERIALIZED_SIZE bytes)
+template<typename M>
+string_view serialize_msg_to(const M & msg, char * buf)
 {
-  return Msg::serialized_size() + sizeof(uint16_t) + sizeof(uint32_t)
-         + sizeof(uint64_t);
+  char * dst = put_number(buf, static_cast<uint8_t>(M::TYPE));
+  M::Format::write(msg, dst);
+
+  return {buf, M::SERIALIZED_SIZE};
 }
 
-string AckMsg::serialize_to_string() const
+// serialize a message of type M along with its type
+template<typename M>
+string serialize_msg(const M & msg)
 {
-  string binary;
-  binary.reserve(serialized_size());
+  char buf[M::SERIALIZED_SIZE];
+  return string(serialize_msg_to(msg, buf));
+}
+
+optional<Msg> parse_msg(const string_view binary)
+{
+  if (binary.size() < sizeof(MsgType)) {
+    return nullopt;
+  }
+
+  switch (static_cast<MsgType>(get_uint8(binary.data()))) {
+    case MsgType::FEEDBACK:
+      return parse_fields<FeedbackMsg>(binary);
+    case MsgType::NACK:
+      return parse_fields<NackMsg>(binary);
+    case MsgType::CONFIG:
+      return parse_fields<ConfigMsg>(binary);
+    case MsgType::REPORT:
+      return parse_fields<ReportMsg>(binary);
+    default:
+      return nullopt;
+  }
+}
+
+bool FeedbackMsg::received(const SeqNum seq_num) const
+{
+  if (seq_num < cum_seq_num or seq_num == highest_seq_num) {
+    return true;
+  }
+
+  if (seq_num > highest_seq_num) {
+    return false;
+  }
+
+  const SeqNum bit = highest_seq_num - 1 - seq_num;
+  return bit < 64 and ((sack_bitmap >> bit) & 1);
+}
 
-  binary += Msg::serialize_to_string();
-  binary += put_number(frame_id);
-  binary += put_number(frag_id);
-  binary += put_number(send_ts);
+size_t FeedbackMsg::serialized_size() const
+{
+  return SERIALIZED_SIZE + num_receipts * Receipt::Format::SIZE;
+}
+
+string FeedbackMsg::serialize_to_string() const
+{
+  string binary(serialized_size(), '\0');
+  serialize_to(binary.data());
 
   return binary;
 }
 
+string_view FeedbackMsg::serialize_to(char * buf) const
+{
+  char * dst = put_number(buf, static_cast<uint8_t>(TYPE));
+  dst = Format::write(*this, dst);
+
+  for (size_t i = 0; i < num_receipts; i++) {
+    dst = Receipt::Format::write(receipts[i], dst);
+  }
+
+  return {buf, serialized_size()};
+}
+
+size_t NackMsg::serialized_size() const
+{
+  return SERIALIZED_SIZE + num_seq_nums * sizeof(SeqNum);
+}
+
+string NackMsg::serialize_to_string() const
+{
+  string binary(serialized_size(), '\0');
+  serialize_to(binary.data());
+
+  return binary;
+}
+
+string_view NackMsg::serialize_to(char * buf) const
+{
+  char * dst = put_number(buf, static_cast<uint8_t>(TYPE));
+  dst = Format::write(*this, dst);
+
+  for (size_t i = 0; i < num_seq_nums; i++) {
+    dst = put_number(dst, seq_nums[i]);
+  }
+
+  return {buf, serialized_size()};
+}
+
+string ReportMsg::serialize_to_string() const
+{
+  return serialize_msg(*this);
+}
+
+string_view ReportMsg::serialize_to(char * buf) const
+{
+  return serialize_msg_to(*this, buf);
+}
+
 ConfigMsg::ConfigMsg(const uint16_t _width, const uint16_t _height,
-                     const uint16_t _frame_rate, const uint32_t _target_bitrate)
-  : Msg(Type::CONFIG), width(_width), height(_height),
-    frame_rate(_frame_rate), target_bitrate(_target_bitrate)
+                     const uint16_t _frame_rate, const uint32_t _target_bitrate,
+                     const LossRecovery _loss_recovery,
+                     const uint8_t _num_streams)
+  : width(_width), height(_height),
+    frame_rate(_frame_rate), target_bitrate(_target_bitrate),
+    loss_recovery(_loss_recovery), num_streams(_num_streams)
 {}
 
-size_t ConfigMsg::serialized_size() const
+uint32_t ConfigMsg::stream_bitrate(const uint8_t stream_id) const
 {
-  return Msg::serialized_size() + 3 * sizeof(uint16_t) + sizeof(uint32_t);
+  uint32_t bitrate = target_bitrate;
+  for (uint8_t i = 0; i < stream_id; i++) {
+    bitrate /= 3;
+  }
+
+  return bitrate;
 }
 
 string ConfigMsg::serialize_to_string() const
 {
-  string binary;
-  binary.reserve(serialized_size());
-
-  binary += Msg::serialize_to_string();
-  binary += put_number(width);
-  binary += put_number(height);
-  binary += put_number(frame_rate);
-  binary += put_number(target_bitrate);
-
-  return binary;
+  return serialize_msg(*this);
 }
@@ -2,103 +2,366 @@
 #define PROTOCOL_HH
 
 #include <string>
-#include <memory>
+#include <string_view>
 #include <utility>
+#include <optional>
+#include <variant>
+#include <array>
+
+#include "buffer_pool.hh"
+#include "serialization.hh"
 
 enum class FrameType : uint8_t {
   UNKNOWN = 0, // unknown
   KEY = 1,     // key frame
   NONKEY = 2,  // non-key frame
+  PARITY = 3,  // not a frame: parity of the streaming FEC across frames
+  REF = 4,     // non-key frame that the encoder keeps as a long-term
+               // reference, whose decoding the receiver reports back
+  RECOVERY = 5 // non-key frame predicted only from a long-term reference
+               // that the receiver reported, so it can skip ahead to it
+};
+
+// sequence number of a datagram, assigned consecutively across frames in
+// the order of packetization (and kept by retransmissions)
+using SeqNum = uint32_t;
+
+// frames among the 8 before a frame that it is predicted from: bit i is
+// frame 'frame_id - 1 - i' (frames further back, such as the long-term
+// reference of a FrameType::RECOVERY frame, are known to be decoded)
+using RefFrames = uint8_t;
+
+// datagram header on wire
+struct DatagramHeader
+{
+  uint8_t stream_id {};    // simulcast stream (see ConfigMsg) (1)
+  uint32_t frame_id {};    // frame ID in the stream (2)
+  FrameType frame_type {}; // frame type (3)
+  uint8_t temporal_id {};  // temporal layer of the frame (0: base layer) (4)
+  RefFrames ref_frames {}; // frames that this frame is predicted from (5)
+  uint16_t frag_id {};     // fragment ID in this frame (6)
+  uint16_t frag_cnt {};    // total (data) fragments in this frame (7)
+  uint16_t parity_cnt {};  // FEC parity fragments following them (8)
+  uint64_t send_ts {};     // sender's monotonic time (us) of sending (9)
+  SeqNum seq_num {};       // sequence number in the stream (10)
+
+  // wire format of the header
+  using Format = WireFormat<&DatagramHeader::stream_id,
+                            &DatagramHeader::frame_id,
+                            &DatagramHeader::frame_type,
+                            &DatagramHeader::temporal_id,
+                            &DatagramHeader::ref_frames,
+                            &DatagramHeader::frag_id,
+                            &DatagramHeader::frag_cnt,
+                            &DatagramHeader::parity_cnt,
+                            &DatagramHeader::send_ts,
+                            &DatagramHeader::seq_num>;
+
+  // header size after serialization
+  static constexpr size_t HEADER_SIZE = Format::SIZE;
+
+  // the furthest back a frame in 'ref_frames' can be
+  static constexpr uint32_t MAX_REF_DISTANCE = 8 * sizeof(RefFrames);
+
+  // parity fragment 'frag_id - frag_cnt' of the frame's Reed-Solomon code
+  // (see ReedSolomon), whose payload is the frame size (uint32_t) followed
+  // by the parity of the data fragments (zero-padded to the first's size);
+  // or with FrameType::PARITY, a parity datagram of the streaming FEC sent
+  // after the frame (see StreamParityHeader)
+  bool is_parity() const { return frag_id >= frag_cnt; }
+  static constexpr size_t PARITY_HEADER_SIZE = sizeof(uint32_t);
+
+  // serialize the header into 'buf' (of at least HEADER_SIZE bytes) without
+  // allocating and return a view of it, to be sent along with the payload
+  std::string_view serialize_to(char * buf) const;
 };
 
-// uses (frame_id, frag_id) as sequence number
-using SeqNum = std::pair<uint32_t, uint16_t>;
+// non-owning datagram parsed in place: 'payload' points into the parsed data,
+// so the data must outlive the view (e.g., until the next receive into it)
+struct DatagramView : DatagramHeader
+{
+  std::string_view payload {}; // payload (11)
 
-struct Datagram
+  // construct this view by parsing binary string on wire (without copying)
+  bool parse_from_string(const std::string_view binary);
+};
+
+struct Datagram : DatagramHeader
 {
   Datagram() {}
-  Datagram(const uint32_t _frame_id,
+  Datagram(const uint8_t _stream_id,
+           const uint32_t _frame_id,
            const FrameType _frame_type,
+           const uint8_t _temporal_id,
+           const RefFrames _ref_frames,
            const uint16_t _frag_id,
            const uint16_t _frag_cnt,
+           const uint16_t _parity_cnt,
+           const SeqNum _seq_num,
+           const SharedBuffer & _buffer,
            const std::string_view _payload);
 
-  uint32_t frame_id {};    // frame ID (1)
-  FrameType frame_type {}; // frame type (2)
-  uint16_t frag_id {};     // fragment ID in this frame (3)
-  uint16_t frag_cnt {};    // total fragments in this frame (4)
-  uint64_t send_ts {};     // timestamp (us) when the datagram is sent (5)
-  std::string payload {};  // payload (6)
-
-  // retransmission-related
-  unsigned int num_rtx {0};
-  uint64_t last_send_ts {0};
+  // payload (11): a view into 'buffer', which is shared (not copied) by the
+  // fragments of a frame, as well as by copies of a datagram
+  SharedBuffer buffer {};
+  std::string_view payload {};
 
-  // header size after serialization
-  static constexpr size_t HEADER_SIZE = sizeof(uint32_t) +
-      sizeof(FrameType) + 2 * sizeof(uint16_t) + sizeof(uint64_t);
+  // upper bound of 'payload' size (MTU is no more than 1500 bytes)
+  static constexpr size_t MAX_PAYLOAD = 1500 - 28 - HEADER_SIZE;
 
   // maximum size for 'payload' (initialized in .cc and modified by set_mtu())
   static size_t max_payload;
   static void set_mtu(const size_t mtu);
 
   // construct this datagram by parsing binary string on wire
-  bool parse_from_string(const std::string & binary);
+  bool parse_from_string(const std::string_view binary);
 
   // serialize this datagram to binary string on wire
   std::string serialize_to_string() const;
 };
 
-struct Msg
+// payload of a parity datagram of the streaming FEC, which follows the data
+// fragments of a frame and covers those of the last 'num_frames' frames up
+// to it: the frames covered (oldest first), followed by a repair symbol of
+// their data fragments (see SlidingWindowCode) whose source IDs are their
+// sequence numbers
+struct StreamParityHeader
 {
-  enum class Type : uint8_t {
-    INVALID = 0, // invalid message type
-    ACK = 1,     // AckMsg
-    CONFIG = 2   // ConfigMsg
+  // a frame covered, whose datagrams are numbered right before the next's
+  struct CoveredFrame
+  {
+    FrameType frame_type {};
+    uint8_t temporal_id {};
+    RefFrames ref_frames {};
+    uint16_t frag_cnt {};
+    uint16_t parity_cnt {};
+
+    using Format = WireFormat<&CoveredFrame::frame_type,
+                              &CoveredFrame::temporal_id,
+                              &CoveredFrame::ref_frames,
+                              &CoveredFrame::frag_cnt,
+                              &CoveredFrame::parity_cnt>;
   };
 
-  Type type {Type::INVALID}; // message type
+  static constexpr size_t MAX_FRAMES = 16;
 
-  Msg() {}
-  Msg(const Type _type) : type(_type) {}
-  virtual ~Msg() {}
+  uint8_t num_frames {};
+  std::array<CoveredFrame, MAX_FRAMES> frames {};
 
-  // factory method to make a (derived class of) Msg
-  static std::shared_ptr<Msg> parse_from_string(const std::string & binary);
+  using Format = WireFormat<&StreamParityHeader::num_frames>;
 
-  // virtual functions
-  virtual size_t serialized_size() const;
-  virtual std::string serialize_to_string() const;
+  // size after serialization (with 'num_frames' frames covered)
+  static constexpr size_t serialized_size(const size_t num_frames)
+  { return Format::SIZE + num_frames * CoveredFrame::Format::SIZE; }
+  size_t serialized_size() const { return serialized_size(num_frames); }
+
+  // serialize into 'dst' and return the end of the serialized data
+  char * serialize_to(char * dst) const;
+
+  // parse from the start of 'payload' and return the rest (repair symbol)
+  std::optional<std::string_view> parse_from_string(
+      const std::string_view payload);
 };
 
-struct AckMsg : Msg
+// type of a control message on wire, followed by its fields
+enum class MsgType : uint8_t {
+  INVALID = 0,  // invalid message type
+  CONFIG = 2,   // ConfigMsg
+  FEEDBACK = 3, // FeedbackMsg
+  NACK = 4,     // NackMsg
+  REPORT = 5    // ReportMsg
+};
+
+// feedback on the datagrams received: which ones have been received so far
+// (a cumulative sequence number and a SACK bitmap below the highest), and
+// when the ones received since the last feedback arrived
+struct FeedbackMsg
 {
-  // construct an AckMsg
-  AckMsg() : Msg(Type::ACK) {}
-  AckMsg(const Datagram & datagram);
+  static constexpr MsgType TYPE = MsgType::FEEDBACK;
+
+  // arrival of a datagram
+  struct Receipt
+  {
+    SeqNum seq_num {};   // sequence number of the datagram
+    uint64_t send_ts {}; // timestamp (us) on sender when it was sent
+    uint64_t recv_ts {}; // timestamp (us) on receiver when it arrived
+
+    using Format = WireFormat<&Receipt::seq_num, &Receipt::send_ts,
+                              &Receipt::recv_ts>;
+  };
+
+  // max receipts in a message (to fit in an MTU)
+  static constexpr size_t MAX_RECEIPTS = 64;
+
+  uint8_t stream_id {};      // the simulcast stream of the datagrams
+  SeqNum cum_seq_num {};     // every datagram before it has been received
+  SeqNum highest_seq_num {}; // highest sequence number received
+  uint64_t sack_bitmap {};   // bit i: datagram 'highest_seq_num - 1 - i' received
+  uint64_t feedback_ts {};   // timestamp (us) on receiver when this was sent
 
-  uint32_t frame_id {}; // frame ID
-  uint16_t frag_id {};  // fragment ID in this frame
-  uint64_t send_ts {};  // timestamp (us) on sender when the datagram was sent
+  // the last key frame or FrameType::REF frame that receiver decoded, which
+  // the encoder may predict a FrameType::RECOVERY frame from
+  static constexpr uint32_t NO_REF_FRAME = UINT32_MAX;
+  uint32_t ref_frame_id {NO_REF_FRAME};
 
-  size_t serialized_size() const override;
-  std::string serialize_to_string() const override;
+  uint8_t num_receipts {};
+  std::array<Receipt, MAX_RECEIPTS> receipts {};
+
+  // wire format of the fields following the type, followed by the receipts
+  using Format = WireFormat<&FeedbackMsg::stream_id,
+                            &FeedbackMsg::cum_seq_num,
+                            &FeedbackMsg::highest_seq_num,
+                            &FeedbackMsg::sack_bitmap,
+                            &FeedbackMsg::feedback_ts,
+                            &FeedbackMsg::ref_frame_id,
+                            &FeedbackMsg::num_receipts>;
+
+  // size after serialization (including the type) without any receipts
+  static constexpr size_t SERIALIZED_SIZE = sizeof(MsgType) + Format::SIZE;
+
+  // size after serialization with the most receipts
+  static constexpr size_t MAX_SERIALIZED_SIZE =
+      SERIALIZED_SIZE + MAX_RECEIPTS * Receipt::Format::SIZE;
+
+  // return true if datagram 'seq_num' is known to have been received
+  bool received(const SeqNum seq_num) const;
+
+  size_t serialized_size() const;
+  std::string serialize_to_string() const;
+
+  // serialize into 'buf' (of at least MAX_SERIALIZED_SIZE bytes) without
+  // allocating and return a view of it
+  std::string_view serialize_to(char * buf) const;
 };
 
-struct ConfigMsg : Msg
+// negative acknowledgment: the datagrams that receiver found missing (from
+// the gaps in frames and between frames) and requests to be retransmitted
+struct NackMsg
 {
+  static constexpr MsgType TYPE = MsgType::NACK;
+
+  // max sequence numbers in a message (to fit in an MTU)
+  static constexpr size_t MAX_SEQ_NUMS = 128;
+
+  uint8_t stream_id {}; // the simulcast stream of the datagrams
+  uint8_t num_seq_nums {};
+  std::array<SeqNum, MAX_SEQ_NUMS> seq_nums {};
+
+  // wire format of the fields following the type, followed by the sequence
+  // numbers
+  using Format = WireFormat<&NackMsg::stream_id, &NackMsg::num_seq_nums>;
+
+  // size after serialization (including the type) without any sequence numbers
+  static constexpr size_t SERIALIZED_SIZE = sizeof(MsgType) + Format::SIZE;
+
+  // size after serialization with the most sequence numbers
+  static constexpr size_t MAX_SERIALIZED_SIZE =
+      SERIALIZED_SIZE + MAX_SEQ_NUMS * sizeof(SeqNum);
+
+  size_t serialized_size() const;
+  std::string serialize_to_string() const;
+
+  // serialize into 'buf' (of at least MAX_SERIALIZED_SIZE bytes) without
+  // allocating and return a view of it
+  std::string_view serialize_to(char * buf) const;
+};
+
+// receiver report, sent periodically (and at once when the estimate drops):
+// the statistics of the datagrams received since the last report, and the
+// bitrate that receiver estimates to get through from the arrival times
+struct ReportMsg
+{
+  static constexpr MsgType TYPE = MsgType::REPORT;
+
+  uint8_t stream_id {};         // the simulcast stream of the datagrams
+  uint32_t received_bitrate {}; // bitrate (kbps) of the datagrams received
+  uint8_t loss_fraction {};     // fraction (in 1/256) of those expected lost
+  uint32_t jitter {};           // inter-arrival jitter (us, as RFC 3550)
+
+  // bitrate (kbps) estimated from the delay variation between groups of
+  // datagrams (see ArrivalEstimator), or NO_ESTIMATE before enough arrivals
+  static constexpr uint32_t NO_ESTIMATE = 0;
+  uint32_t estimated_bitrate {NO_ESTIMATE};
+
+  // wire format of the fields following the type
+  using Format = WireFormat<&ReportMsg::stream_id,
+                            &ReportMsg::received_bitrate,
+                            &ReportMsg::loss_fraction,
+                            &ReportMsg::jitter,
+                            &ReportMsg::estimated_bitrate>;
+
+  // size after serialization (including the type)
+  static constexpr size_t SERIALIZED_SIZE = sizeof(MsgType) + Format::SIZE;
+
+  std::string serialize_to_string() const;
+
+  // serialize into 'buf' (of at least SERIALIZED_SIZE bytes) without
+  // allocating and return a view of it
+  std::string_view serialize_to(char * buf) const;
+};
+
+// how lost datagrams are recovered, as requested by receiver
+enum class LossRecovery : uint8_t {
+  SENDER = 0, // sender infers losses from feedback and RTOs
+  NACK = 1    // sender retransmits only the datagrams NACKed by receiver
+};
+
+struct ConfigMsg
+{
+  static constexpr MsgType TYPE = MsgType::CONFIG;
+
   // construct a ConfigMsg
-  ConfigMsg() : Msg(Type::CONFIG) {}
+  ConfigMsg() {}
   ConfigMsg(const uint16_t _width, const uint16_t _height,
-            const uint16_t _frame_rate, const uint32_t _target_bitrate);
+            const uint16_t _frame_rate, const uint32_t _target_bitrate,
+            const LossRecovery _loss_recovery = LossRecovery::SENDER,
+            const uint8_t _num_streams = 1);
 
   uint16_t width {};          // display width
   uint16_t height {};         // display height
   uint16_t frame_rate {};     // FPS
   uint32_t target_bitrate {}; // target bitrate
+  LossRecovery loss_recovery {LossRecovery::SENDER};
+
+  // simulcast streams to encode from each raw frame: stream i is at 1/2^i
+  // of the resolution above (and of a lower bitrate, see stream_bitrate())
+  uint8_t num_streams {1};
+  static constexpr uint8_t MAX_STREAMS = 3;
+
+  // wire format of the fields following the type
+  using Format = WireFormat<&ConfigMsg::width, &ConfigMsg::height,
+                            &ConfigMsg::frame_rate, &ConfigMsg::target_bitrate,
+                            &ConfigMsg::loss_recovery, &ConfigMsg::num_streams>;
+
+  // size after serialization (including the type)
+  static constexpr size_t SERIALIZED_SIZE = sizeof(MsgType) + Format::SIZE;
 
-  size_t serialized_size() const override;
-  std::string serialize_to_string() const override;
+  // target bitrate of stream 'stream_id': a third of the stream above, as
+  // the bitrate for a quality scales about with the pixels^0.8
+  uint32_t stream_bitrate(const uint8_t stream_id) const;
+
+  std::string serialize_to_string() const;
+};
+
+// a control message of any type, parsed by value (without allocating) and
+// dispatched on its type with std::visit()
+using Msg = std::variant<FeedbackMsg, NackMsg, ConfigMsg, ReportMsg>;
+
+// parse a control message; return nullopt if invalid
+std::optional<Msg> parse_msg(const std::string_view binary);
+
+// visitor made of a lambda per message type, e.g.,
+//   std::visit(MsgVisitor {[](const FeedbackMsg &) {...},
+//                          [](const NackMsg &) {...},
+//                          [](const ConfigMsg &) {...},
+//                          [](const ReportMsg &) {...}}, msg);
+template<typename... Handlers>
+struct MsgVisitor : Handlers...
+{
+  using Handlers::operator()...;
 };
 
+template<typename... Handlers>
+MsgVisitor(Handlers...) -> MsgVisitor<Handlers...>;
+
 #endif /* PROTOCOL_HH */
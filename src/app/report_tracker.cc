@@ -0,0 +1,80 @@
+#include <cmath>
+#include <cstdlib>
+#include <algorithm>
+
+#include "report_tracker.hh"
+
+using namespace std;
+
+void ReportTracker::add(const DatagramHeader & header, const size_t size,
+                        const uint64_t recv_ts)
+{
+  const SeqNum seq_num = header.seq_num;
+
+  if (not interval_start_ts_) {
+    interval_start_ts_ = recv_ts;
+  }
+
+  if (not highest_seq_num_) {
+    base_seq_num_ = seq_num;
+    highest_seq_num_ = seq_num;
+  } else if (seq_num > *highest_seq_num_) {
+    highest_seq_num_ = seq_num;
+  }
+
+  interval_bytes_ += size;
+  num_received_++;
+
+  const int64_t transit_us = static_cast<int64_t>(recv_ts - header.send_ts);
+  if (prev_transit_us_) {
+    const double d = llabs(transit_us - *prev_transit_us_);
+    jitter_us_ += (d - jitter_us_) / 16;
+  }
+  prev_transit_us_ = transit_us;
+
+  estimator_.add(header.send_ts, recv_ts, size);
+}
+
+bool ReportTracker::urgent() const
+{
+  const auto estimate = estimator_.estimate();
+  const uint32_t reported = report_.estimated_bitrate;
+
+  return estimate and reported != ReportMsg::NO_ESTIMATE and
+         *estimate * 100 <= reported * (100 - URGENT_DROP_PCT);
+}
+
+const ReportMsg & ReportTracker::build(const uint64_t report_ts)
+{
+  // received bitrate since the last report
+  report_.received_bitrate = 0;
+  if (interval_start_ts_ and report_ts > *interval_start_ts_) {
+    report_.received_bitrate = lrint(interval_bytes_ * 8.0 * 1000
+                                     / (report_ts - *interval_start_ts_));
+  }
+
+  // fraction of the datagrams expected that were lost (none if duplicated)
+  report_.loss_fraction = 0;
+  if (highest_seq_num_ and *highest_seq_num_ >= base_seq_num_) {
+    const uint64_t expected = *highest_seq_num_ - base_seq_num_ + 1;
+    if (expected > num_received_) {
+      report_.loss_fraction = min<uint64_t>(
+          (expected - num_received_) * 256 / expected, UINT8_MAX);
+    }
+  }
+
+  report_.jitter = lrint(jitter_us_);
+
+  const auto estimate = estimator_.estimate();
+  report_.estimated_bitrate = estimate ? *estimate : ReportMsg::NO_ESTIMATE;
+
+  // start the next interval
+  interval_start_ts_ = report_ts;
+  interval_bytes_ = 0;
+  num_received_ = 0;
+  if (highest_seq_num_) {
+    base_seq_num_ = *highest_seq_num_ + 1;
+  }
+
+  return report_;
+}
@@ -0,0 +1,49 @@
+#ifndef REPORT_TRACKER_HH
+#define REPORT_TRACKER_HH
+
+#include <cstdint>
+#include <optional>
+
+#include "protocol.hh"
+#include "arrival_estimator.hh"
+
+// receiver's statistics of the datagrams received, to build ReportMsg from
+class ReportTracker
+{
+public:
+  // track the datagrams of simulcast stream 'stream_id'
+  ReportTracker(const uint8_t stream_id = 0)
+  { report_.stream_id = stream_id; }
+
+  // datagram 'header' of 'size' bytes arrived at 'recv_ts' (us)
+  void add(const DatagramHeader & header, const size_t size,
+           const uint64_t recv_ts);
+
+  // whether the estimate dropped by URGENT_DROP_PCT since the last report,
+  // so that the report should be sent now rather than when due
+  bool urgent() const;
+
+  // build the report to send at 'report_ts' (us) from the datagrams received
+  // since the last report, and start over
+  const ReportMsg & build(const uint64_t report_ts);
+
+private:
+  ReportMsg report_ {};
+  ArrivalEstimator estimator_ {};
+  static constexpr unsigned int URGENT_DROP_PCT = 3;
+
+  // since the last report: bytes received, and the datagrams received out
+  // of those expected (from 'base_seq_num_' up to the highest received)
+  std::optional<uint64_t> interval_start_ts_ {};
+  uint64_t interval_bytes_ {0};
+  unsigned int num_received_ {0};
+  SeqNum base_seq_num_ {0};
+  std::optional<SeqNum> highest_seq_num_ {};
+
+  // inter-arrival jitter (us) as in RFC 3550: the smoothed difference of
+  // the transit times (with the offset between the clocks cancelled out)
+  std::optional<int64_t> prev_transit_us_ {};
+  double jitter_us_ {0};
+};
+
+#endif /* REPORT_TRACKER_HH */
@@ -0,0 +1,348 @@
+#include <getopt.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <random>
+#include <cstring>
+#include <algorithm>
+
+#include "sliding_window_code.hh"
+#include "conversion.hh"
+
+using namespace std;
+
+void print_usage(const string & program_name)
+{
+  cerr <<
+  "Usage: " << program_name << " [options]\n\n"
+  "Simulates bursty datagram loss (Gilbert-Elliott) on a stream of frames\n"
+  "(mostly of one or two fragments, as at low bitrates) and reports, for FEC\n"
+  "within each frame (as with video_sender --fec) and the streaming FEC over\n"
+  "windows of frames (--fec-window), how many frames with lost fragments are\n"
+  "recovered without retransmissions, and after how many more frames. The\n"
+  "streaming FEC is actually coded and recovered, and the recovered fragments\n"
+  "verified.\n\n"
+  "Options:\n"
+  "--loss <percent>     average datagram loss rate (default: 5)\n"
+  "--burst <N>          average datagrams lost in a row (default: 3)\n"
+  "--fec <percent>      parity fragments per data fragment (default: 30)\n"
+  "--frames <N>         frames to simulate per FEC scheme (default: 20000)\n"
+  "--fps <FPS>          frame rate, to convert delays to ms (default: 30)\n"
+  "--seed <S>           seed of the random losses (default: 0)"
+  << endl;
+}
+
+namespace {
+  constexpr size_t FRAG_SIZE = 1400;
+  constexpr unsigned int KEY_FRAME_INTERVAL = 150;
+  const vector<unsigned int> DELAYS {0, 1, 2, 4, 8, 16}; // frames
+
+  // datagram losses with bursts: lost in the bad state and delivered in the
+  // good state, with an average burst length of 'burst'
+  class GilbertElliott
+  {
+  public:
+    GilbertElliott(const double loss, const double burst, const unsigned int seed)
+      : prng_(seed), to_good_(1 / burst),
+        to_bad_(loss < 1 ? loss / (burst * (1 - loss)) : 1)
+    {}
+
+    bool lost()
+    {
+      bad_ = bad_ ? uniform_(prng_) >= to_good_ : uniform_(prng_) < to_bad_;
+      return bad_;
+    }
+
+  private:
+    mt19937 prng_;
+    uniform_real_distribution<double> uniform_ {0.0, 1.0};
+    double to_good_;
+    double to_bad_;
+    bool bad_ {false};
+  };
+
+  // number of data fragments of each frame: a key frame periodically and
+  // otherwise one or two fragments
+  vector<uint16_t> frame_frag_cnts(const unsigned int num_frames,
+                                   const unsigned int seed)
+  {
+    mt19937 prng(seed);
+    vector<uint16_t> frag_cnts(num_frames);
+
+    for (unsigned int i = 0; i < num_frames; i++) {
+      if (i % KEY_FRAME_INTERVAL == 0) {
+        frag_cnts[i] = 10;
+      } else {
+        frag_cnts[i] = prng() % 10 < 7 ? 1 : 2;
+      }
+    }
+
+    return frag_cnts;
+  }
+
+  struct Result
+  {
+    string scheme {};
+    size_t num_data {0};
+    size_t num_parity {0};
+    unsigned int num_lossy_frames {0}; // frames missing data fragments
+    vector<unsigned int> num_recovered_within {}; // per DELAYS
+    unsigned int num_recovered {0};
+    double total_delay {0}; // frames
+  };
+
+  // record a frame with losses recovered 'delay' frames later
+  void add_recovered(Result & result, const unsigned int delay)
+  {
+    result.num_recovered++;
+    result.total_delay += delay;
+
+    for (size_t i = 0; i < DELAYS.size(); i++) {
+      if (delay <= DELAYS[i]) {
+        result.num_recovered_within[i]++;
+      }
+    }
+  }
+
+  // Reed-Solomon within each frame: recovered right away if any k of the
+  // k + m fragments arrive (which holds for the MDS code)
+  Result simulate_frame_fec(const vector<uint16_t> & frag_cnts,
+                            const unsigned int fec_percent,
+                            GilbertElliott loss)
+  {
+    Result result;
+    result.scheme = "within frames";
+    result.num_recovered_within.resize(DELAYS.size());
+
+    for (const uint16_t k : frag_cnts) {
+      const size_t m = min<size_t>((k * fec_percent + 99) / 100, 256 - k);
+      result.num_data += k;
+      result.num_parity += m;
+
+      size_t data_received = 0;
+      size_t parity_received = 0;
+      for (size_t i = 0; i < k + m; i++) {
+        if (not loss.lost()) {
+          (i < k ? data_received : parity_received)++;
+        }
+      }
+
+      if (data_received < k) {
+        result.num_lossy_frames++;
+        if (data_received + parity_received >= k) {
+          add_recovered(result, 0);
+        }
+      }
+    }
+
+    return result;
+  }
+
+  // the streaming FEC across 'window' frames, as Encoder and Decoder do it
+  Result simulate_stream_fec(const vector<uint16_t> & frag_cnts,
+                             const unsigned int fec_percent,
+                             const size_t window,
+                             GilbertElliott loss,
+                             mt19937 & data_prng)
+  {
+    Result result;
+    result.scheme = "window of " + to_string(window) + " frames";
+    result.num_recovered_within.resize(DELAYS.size());
+
+    SlidingWindowDecoder decoder(4096, FRAG_SIZE);
+
+    // every frame: sequence number of its first data fragment, data fragments
+    // (kept while in the window or a while after, to encode and verify), and
+    // how many are still missing
+    struct SimFrame
+    {
+      uint32_t first_seq_num {0};
+      vector<string> frags {};
+      size_t num_missing {0};
+    };
+
+    vector<SimFrame> frames;
+    vector<unsigned int> frame_of_seq; // sequence number => frame index
+    unsigned int credit = 0;
+
+    for (unsigned int f = 0; f < frag_cnts.size(); f++) {
+      // data fragments of random bytes (the last one shorter)
+      SimFrame & frame = frames.emplace_back();
+      frame.first_seq_num = frame_of_seq.size();
+
+      for (uint16_t i = 0; i < frag_cnts[f]; i++) {
+        string frag(i + 1 < frag_cnts[f] ? FRAG_SIZE
+                                         : 1 + data_prng() % FRAG_SIZE, '\0');
+        for (auto & byte : frag) {
+          byte = data_prng();
+        }
+
+        const uint32_t seq_num = frame_of_seq.size();
+        frame_of_seq.emplace_back(f);
+
+        if (loss.lost()) {
+          frame.num_missing++;
+        } else {
+          decoder.add_source(seq_num, frag);
+        }
+
+        frame.frags.emplace_back(move(frag));
+      }
+
+      if (frame.num_missing > 0) {
+        result.num_lossy_frames++;
+      }
+
+      result.num_data += frag_cnts[f];
+
+      // parity fragments across the window
+      credit += frag_cnts[f] * fec_percent;
+      const unsigned int parity_cnt = credit / 100;
+      credit %= 100;
+
+      vector<SlidingWindowCode::Source> sources;
+      vector<uint32_t> source_ids;
+      size_t max_size = 0;
+
+      for (size_t w = f + 1 - min<size_t>(f + 1, window); w <= f; w++) {
+        for (size_t i = 0; i < frames[w].frags.size(); i++) {
+          sources.emplace_back(frames[w].first_seq_num + i, frames[w].frags[i]);
+          source_ids.emplace_back(frames[w].first_seq_num + i);
+          max_size = max(max_size, frames[w].frags[i].size());
+        }
+      }
+
+      vector<uint8_t> symbol(SlidingWindowCode::symbol_size(max_size));
+      for (unsigned int j = 0; j < parity_cnt; j++) {
+        const uint32_t seq_num = frame_of_seq.size();
+        frame_of_seq.emplace_back(f);
+
+        if (not loss.lost()) {
+          SlidingWindowCode::encode(seq_num, sources, symbol.data(),
+                                    symbol.size());
+          decoder.add_repair(seq_num, source_ids,
+                             {reinterpret_cast<char *>(symbol.data()),
+                              symbol.size()});
+        }
+      }
+      result.num_parity += parity_cnt;
+
+      // recover (and verify) what the datagrams so far allow
+      for (const auto & [seq_num, data] : decoder.recover()) {
+        const unsigned int index = frame_of_seq.at(seq_num);
+        SimFrame & lossy = frames[index];
+
+        if (data != lossy.frags.at(seq_num - lossy.first_seq_num)) {
+          throw runtime_error("fragment was not recovered correctly");
+        }
+
+        if (--lossy.num_missing == 0) {
+          add_recovered(result, f - index);
+        }
+      }
+
+      // the data of the frames long out of the window is no longer needed
+      if (f >= 4 * window + DELAYS.back()) {
+        frames[f - 4 * window - DELAYS.back()].frags.clear();
+      }
+    }
+
+    return result;
+  }
+}
+
+int main(int argc, char * argv[])
+{
+  double loss_percent = 5;
+  double burst = 3;
+  unsigned int fec_percent = 30;
+  unsigned int num_frames = 20000;
+  unsigned int fps = 30;
+  unsigned int seed = 0;
+
+  const option cmd_line_opts[] = {
+    {"loss",   required_argument, nullptr, 'L'},
+    {"burst",  required_argument, nullptr, 'B'},
+    {"fec",    required_argument, nullptr, 'F'},
+    {"frames", required_argument, nullptr, 'N'},
+    {"fps",    required_argument, nullptr, 'R'},
+    {"seed",   required_argument, nullptr, 'S'},
+    { nullptr, 0,                 nullptr,  0 },
+  };
+
+  while (true) {
+    const int opt = getopt_long(argc, argv, "", cmd_line_opts, nullptr);
+    if (opt == -1) {
+      break;
+    }
+
+    switch (opt) {
+      case 'L':
+        loss_percent = stod(optarg);
+        break;
+      case 'B':
+        burst = stod(optarg);
+        break;
+      case 'F':
+        fec_percent = strict_stoi(optarg);
+        break;
+      case 'N':
+        num_frames = strict_stoi(optarg);
+        break;
+      case 'R':
+        fps = strict_stoi(optarg);
+        break;
+      case 'S':
+        seed = strict_stoi(optarg);
+        break;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (optind != argc or loss_percent < 0 or loss_percent >= 100 or
+      burst < 1 or num_frames == 0 or fps == 0) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const auto frag_cnts = frame_frag_cnts(num_frames, seed);
+  const GilbertElliott loss(loss_percent / 100, burst, seed);
+  mt19937 data_prng(seed);
+
+  // every scheme sees the same losses (of its datagrams in order)
+  vector<Result> results;
+  results.emplace_back(simulate_frame_fec(frag_cnts, fec_percent, loss));
+  for (const size_t window : {1, 2, 4, 8, 16}) {
+    results.emplace_back(simulate_stream_fec(frag_cnts, fec_percent, window,
+                                             loss, data_prng));
+  }
+
+  cerr << "Loss " << double_to_string(loss_percent) << "% in bursts of "
+       << double_to_string(burst) << " datagrams on average, FEC "
+       << fec_percent << "%\n"
+       << "Frames with lost fragments recovered without retransmissions (%),"
+       << " within 0/1/2/... frames\n"
+       << "FEC\t\t\tparity (%)\tlossy frames (%)";
+  for (const auto delay : DELAYS) {
+    cerr << "\t<=" << delay;
+  }
+  cerr << "\tavg delay (ms)" << endl;
+
+  for (const auto & r : results) {
+    cerr << r.scheme << (r.scheme.size() < 16 ? "\t\t" : "\t")
+         << double_to_string(100.0 * r.num_parity / r.num_data) << "\t\t"
+         << double_to_string(100.0 * r.num_lossy_frames / num_frames) << "\t\t";
+
+    for (const auto n : r.num_recovered_within) {
+      cerr << "\t" << double_to_string(r.num_lossy_frames ?
+                                       100.0 * n / r.num_lossy_frames : 0);
+    }
+
+    cerr << "\t" << double_to_string(r.num_recovered ?
+        r.total_delay / r.num_recovered * 1000 / fps : 0) << endl;
+  }
+
+  return EXIT_SUCCESS;
+}
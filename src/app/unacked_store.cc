@@ -0,0 +1,129 @@
+#include <stdexcept>
+#include <utility>
+
+#include "unacked_store.hh"
+
+using namespace std;
+
+UnackedStore::UnackedStore()
+  : mask_(INITIAL_CAPACITY - 1), metas_(INITIAL_CAPACITY),
+    datagrams_(INITIAL_CAPACITY)
+{}
+
+UnackedStore::Meta & UnackedStore::claim(const SeqNum seq_num)
+{
+  if (seq_num < end_) {
+    throw runtime_error("UnackedStore: datagrams must be added in order");
+  }
+
+  if (empty()) {
+    begin_ = seq_num;
+  } else if (seq_num - begin_ > mask_) {
+    grow(seq_num - begin_ + 1);
+  }
+
+  end_ = seq_num + 1;
+  size_++;
+
+  Meta & meta = metas_[seq_num & mask_];
+  meta = Meta();
+  meta.valid = true;
+
+  return meta;
+}
+
+UnackedStore::Meta & UnackedStore::add(const Datagram & datagram)
+{
+  Meta & meta = claim(datagram.seq_num);
+  datagrams_[datagram.seq_num & mask_] = datagram;
+
+  meta.send_ts = meta.last_send_ts = datagram.send_ts;
+  return meta;
+}
+
+UnackedStore::Meta & UnackedStore::add(Datagram && datagram)
+{
+  const SeqNum seq_num = datagram.seq_num;
+
+  Meta & meta = claim(seq_num);
+  meta.send_ts = meta.last_send_ts = datagram.send_ts;
+
+  datagrams_[seq_num & mask_] = move(datagram);
+  return meta;
+}
+
+UnackedStore::Meta * UnackedStore::find(const SeqNum seq_num)
+{
+  if (seq_num < begin_ or seq_num >= end_) {
+    return nullptr;
+  }
+
+  Meta & meta = metas_[seq_num & mask_];
+  return meta.valid ? &meta : nullptr;
+}
+
+Datagram & UnackedStore::datagram(const SeqNum seq_num)
+{
+  return datagrams_[seq_num & mask_];
+}
+
+void UnackedStore::erase(const SeqNum seq_num)
+{
+  Meta & meta = metas_[seq_num & mask_];
+  if (seq_num < begin_ or seq_num >= end_ or not meta.valid) {
+    throw runtime_error("UnackedStore: datagram to erase is not unacked");
+  }
+
+  meta.valid = false;
+  datagrams_[seq_num & mask_].buffer = {}; // release the payload early
+  size_--;
+
+  if (seq_num == begin_) {
+    advance_begin();
+  }
+}
+
+optional<SeqNum> UnackedStore::first() const
+{
+  if (empty()) {
+    return nullopt;
+  }
+
+  return begin_;
+}
+
+void UnackedStore::advance_begin()
+{
+  if (empty()) {
+    begin_ = end_;
+    return;
+  }
+
+  while (not metas_[begin_ & mask_].valid) {
+    begin_++;
+  }
+}
+
+void UnackedStore::grow(const size_t capacity)
+{
+  size_t new_capacity = metas_.size();
+  while (new_capacity < capacity) {
+    new_capacity *= 2;
+  }
+
+  vector<Meta> metas(new_capacity);
+  vector<Datagram> datagrams(new_capacity);
+  const size_t new_mask = new_capacity - 1;
+
+  for (SeqNum seq_num = begin_; seq_num < end_; seq_num++) {
+    Meta & meta = metas_[seq_num & mask_];
+    if (meta.valid) {
+      metas[seq_num & new_mask] = meta;
+      datagrams[seq_num & new_mask] = move(datagrams_[seq_num & mask_]);
+    }
+  }
+
+  metas_ = move(metas);
+  datagrams_ = move(datagrams);
+  mask_ = new_mask;
+}
@@ -0,0 +1,102 @@
+#ifndef UNACKED_STORE_HH
+#define UNACKED_STORE_HH
+
+#include <vector>
+#include <optional>
+
+#include "protocol.hh"
+#include "timer_wheel.hh"
+
+// sender's datagrams sent but not acked yet, in a ring buffer indexed by
+// sequence number: as sequence numbers are dense, finding, adding and
+// erasing a datagram is O(1) without allocating (except to grow the ring).
+// The retransmission state that loss detection reads is kept in an array
+// apart from the datagrams (and their payload handles)
+class UnackedStore
+{
+public:
+  // retransmission state of an unacked datagram
+  struct Meta
+  {
+    uint64_t send_ts {0};      // first transmission (us, on mono_us() clock)
+    uint64_t last_send_ts {0}; // last (re)transmission
+    uint64_t tx_ts {0};        // kernel TX timestamp of the first (0 if none)
+    TimerWheel::TimerId rto_timer {0}; // sender's RTO timer if 'rto_armed'
+    unsigned int num_rtx {0};
+    bool rto_armed {false};
+    bool valid {false};        // if the slot holds an unacked datagram
+  };
+
+  UnackedStore();
+
+  // add a datagram just sent for the first time, numbered after every
+  // datagram added before; return its state
+  Meta & add(const Datagram & datagram);
+  Meta & add(Datagram && datagram);
+
+  // state of datagram 'seq_num' if unacked, or nullptr
+  Meta * find(const SeqNum seq_num);
+
+  // unacked datagram 'seq_num' (which must be unacked)
+  Datagram & datagram(const SeqNum seq_num);
+
+  // erase datagram 'seq_num' (which must be unacked)
+  void erase(const SeqNum seq_num);
+
+  // erase the datagrams before 'seq_num', calling 'on_erase(seq_num, meta)'
+  // on each first; return how many there were
+  template<typename F>
+  size_t erase_before(const SeqNum seq_num, F && on_erase);
+
+  // the oldest unacked datagram, if any
+  std::optional<SeqNum> first() const;
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+private:
+  // slot of 'seq_num' is 'seq_num & mask_' (capacity is a power of two)
+  size_t mask_;
+  std::vector<Meta> metas_;
+  std::vector<Datagram> datagrams_;
+
+  // every unacked datagram is in [begin_, end_), and begin_ is unacked
+  // unless empty
+  SeqNum begin_ {0};
+  SeqNum end_ {0};
+  size_t size_ {0};
+
+  static constexpr size_t INITIAL_CAPACITY = 1024;
+
+  // claim the slot of 'seq_num' (after the last datagram added)
+  Meta & claim(const SeqNum seq_num);
+
+  // grow the ring to hold at least 'capacity' datagrams
+  void grow(const size_t capacity);
+
+  // advance begin_ past the datagrams acked
+  void advance_begin();
+};
+
+template<typename F>
+size_t UnackedStore::erase_before(const SeqNum seq_num, F && on_erase)
+{
+  size_t num_erased = 0;
+
+  for (; begin_ < seq_num and begin_ < end_; begin_++) {
+    Meta & meta = metas_[begin_ & mask_];
+    if (meta.valid) {
+      on_erase(begin_, meta);
+
+      meta.valid = false;
+      datagrams_[begin_ & mask_].buffer = {};
+      size_--;
+      num_erased++;
+    }
+  }
+
+  advance_begin();
+  return num_erased;
+}
+
+#endif /* UNACKED_STORE_HH */
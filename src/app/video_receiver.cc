@@ -5,16 +5,35 @@
 #include <memory>
 #include <stdexcept>
 #include <chrono>
+#include <optional>
+#include <type_traits>
+#include <algorithm>
+#include <array>
+#include <string_view>
 
 #include "conversion.hh"
+#include "timerfd.hh"
 #include "udp_socket.hh"
+#include "poller.hh"
+#include "epoller.hh"
+#include "uring_poller.hh"
 #include "sdl.hh"
 #include "protocol.hh"
 #include "decoder.hh"
+#include "feedback.hh"
+#include "report_tracker.hh"
+#include "timestamp.hh"
+#include "mono_clock.hh"
 
 using namespace std;
 using namespace chrono;
 
+// global variables in an unnamed namespace
+namespace {
+  // max number of datagrams to receive per system call
+  constexpr size_t MAX_RECV_BATCH = 64;
+}
+
 void print_usage(const string & program_name)
 {
   cerr <<
@@ -22,6 +41,22 @@ void print_usage(const string & program_name)
   "Options:\n"
   "--fps <FPS>          frame rate to request from sender (default: 30)\n"
   "--cbr <bitrate>      request CBR from sender\n"
+  "--gro                let the kernel coalesce received datagrams\n"
+  "--feedback-count <N> send feedback on the datagrams received every N\n"
+  "                     datagrams (default: 16, max: 64)...\n"
+  "--feedback-interval <ms>\n"
+  "                     ...or <ms> after the first datagram not reported\n"
+  "                     (default: 5; 0: after each batch received)\n"
+  "--nack <N>           NACK missing datagrams (up to N times each) to be\n"
+  "                     retransmitted, instead of sender inferring losses\n"
+  "--report <ms>        send a receiver report every <ms> (and at once when\n"
+  "                     the bandwidth estimate drops), which caps the\n"
+  "                     bitrate of sender's congestion control\n"
+  "--simulcast <N>      request N simulcast streams (1 to 3, default: 1),\n"
+  "                     each at half the resolution of the one before, and\n"
+  "                     decode them all (but display only the first)\n"
+  "--loop <type>        event loop: poll, epoll (default), or uring\n"
+  "                     (completion-based I/O with io_uring)\n"
   "--lazy <level>       0: decode and display frames (default)\n"
   "                     1: decode but not display frames\n"
   "                     2: neither decode nor display frames\n"
@@ -30,6 +65,337 @@ void print_usage(const string & program_name)
   << endl;
 }
 
+template<typename Loop>
+void serve(Loop & loop, UDPSocket & udp_sock,
+           vector<unique_ptr<Decoder>> & decoders,
+           const size_t feedback_count, const unsigned int feedback_interval_ms,
+           const bool nack_enabled, const unsigned int report_interval_ms,
+           const bool verbose)
+{
+  // io_uring waits in the kernel; otherwise set UDP socket to non-blocking
+  udp_sock.set_blocking(is_same_v<Loop, URingPoller>);
+
+  // buffers to receive datagrams into (reused to avoid allocations)
+  UDPSocket::RecvBuffers recv_bufs(MAX_RECV_BATCH);
+
+  // feedback on the datagrams received (of each stream) to send back to
+  // sender
+  vector<FeedbackTracker> feedback_trackers;
+  for (size_t i = 0; i < decoders.size(); i++) {
+    feedback_trackers.emplace_back(i);
+  }
+  Timerfd feedback_timer;
+  bool feedback_timer_armed = false;
+
+  // receiver reports (of each stream), if enabled
+  vector<ReportTracker> report_trackers;
+  for (size_t i = 0; i < decoders.size(); i++) {
+    report_trackers.emplace_back(i);
+  }
+  Timerfd report_timer;
+
+  // reception stats in the current period
+  unsigned int num_datagrams_received = 0;
+  unsigned int num_recv_batches = 0;
+  uint64_t last_stats_cpu_us = cpu_time_us();
+  auto last_stats_time = steady_clock::now();
+  uint64_t last_stats_enter_calls = 0;
+  unsigned int num_feedback_sent = 0;
+  unsigned int num_nacks_sent = 0;
+  unsigned int num_datagrams_nacked = 0;
+  unsigned int num_reports_sent = 0;
+
+  // control messages are serialized into a buffer reused for each one,
+  // rather than into a string allocated per message
+  static constexpr size_t MAX_MSG_SIZE = max({
+    FeedbackMsg::MAX_SERIALIZED_SIZE, NackMsg::MAX_SERIALIZED_SIZE,
+    ReportMsg::SERIALIZED_SIZE});
+  array<char, MAX_MSG_SIZE> msg_buf;
+
+  // 'msg' is a view of 'msg_buf', only valid until the next message
+  const auto send_msg = [&](const string_view msg)
+  {
+    if constexpr (is_same_v<Loop, URingPoller>) {
+      // the submitted batch owns a copy until the message is sent
+      udp_sock.submit_send_batch(loop, {string(msg)});
+    } else {
+      // a message not sent due to EWOULDBLOCK is recovered by later feedback
+      // (or retransmissions) and NACKs
+      udp_sock.send(msg);
+    }
+  };
+
+  const auto send_feedback = [&](FeedbackTracker & feedback_tracker)
+  {
+    send_msg(feedback_tracker.build(timestamp_us()).serialize_to(
+        msg_buf.data()));
+    num_feedback_sent++;
+  };
+
+  const auto send_report = [&](ReportTracker & report_tracker)
+  {
+    const ReportMsg & report = report_tracker.build(timestamp_us());
+    send_msg(report.serialize_to(msg_buf.data()));
+    num_reports_sent++;
+
+    if (verbose) {
+      cerr << "Sent report: stream_id=" << unsigned(report.stream_id)
+           << " received_bitrate=" << report.received_bitrate
+           << " loss_fraction=" << unsigned(report.loss_fraction)
+           << " jitter=" << report.jitter
+           << " estimated_bitrate=" << report.estimated_bitrate << endl;
+    }
+  };
+
+  // NACKs on the datagrams missing, and a timer to (re-)NACK when due
+  NackMsg nack;
+  Timerfd nack_timer;
+  optional<uint64_t> nack_timer_ts; // when 'nack_timer' is armed to expire
+
+  const auto send_nacks = [&]()
+  {
+    const uint64_t now = mono_us();
+    optional<uint64_t> next_nack_ts;
+
+    for (size_t i = 0; i < decoders.size(); i++) {
+      nack.stream_id = i;
+
+      while (decoders[i]->build_nack(nack, now)) {
+        send_msg(nack.serialize_to(msg_buf.data()));
+        num_nacks_sent++;
+        num_datagrams_nacked += nack.num_seq_nums;
+      }
+
+      // the earliest NACK due of any stream
+      const auto stream_nack_ts = decoders[i]->next_nack_ts();
+      if (stream_nack_ts and
+          (not next_nack_ts or *stream_nack_ts < *next_nack_ts)) {
+        next_nack_ts = stream_nack_ts;
+      }
+    }
+
+    if (next_nack_ts != nack_timer_ts) {
+      // next_nack_ts is after now, as every NACK due has been sent
+      const uint64_t delay_us = next_nack_ts ? *next_nack_ts - now : 0;
+      nack_timer.set_time({static_cast<time_t>(delay_us / 1000000),
+                           static_cast<long>(delay_us % 1000000 * 1000)},
+                          {0, 0});
+      nack_timer_ts = next_nack_ts;
+    }
+  };
+
+  // handle the datagrams received into 'recv_bufs'
+  const auto handle_datagrams = [&]()
+  {
+    num_datagrams_received += recv_bufs.size();
+    num_recv_batches++;
+
+    for (size_t i = 0; i < recv_bufs.size(); i++) {
+      // parse a datagram received from sender in place
+      DatagramView datagram;
+      if (not datagram.parse_from_string(recv_bufs[i])) {
+        throw runtime_error("failed to parse a datagram");
+      }
+
+      // ignore the datagrams of a stream not requested
+      if (datagram.stream_id >= decoders.size()) {
+        continue;
+      }
+
+      Decoder & decoder = *decoders[datagram.stream_id];
+      auto & feedback_tracker = feedback_trackers[datagram.stream_id];
+
+      // record the arrival time of the datagram (kernel RX timestamp if
+      // available) to report back to sender
+      uint64_t recv_ts = recv_bufs.recv_ts(i);
+      if (recv_ts == 0) {
+        recv_ts = timestamp_us();
+      }
+
+      feedback_tracker.add(datagram, recv_ts);
+
+      if (report_interval_ms > 0) {
+        report_trackers[datagram.stream_id].add(datagram, recv_bufs[i].size(),
+                                                recv_ts);
+      }
+
+      if (verbose) {
+        cerr << "Received datagram: stream_id=" << unsigned(datagram.stream_id)
+             << " frame_id=" << datagram.frame_id
+             << " frag_id=" << datagram.frag_id
+             << " seq_num=" << datagram.seq_num << endl;
+      }
+
+      if (feedback_tracker.num_pending() >= feedback_count) {
+        send_feedback(feedback_tracker);
+      }
+
+      // process the received datagram in the decoder
+      decoder.add_datagram(datagram);
+    }
+
+    // report the rest of the datagrams now or once the interval elapses
+    const bool feedback_pending = any_of(
+        feedback_trackers.begin(), feedback_trackers.end(),
+        [](const FeedbackTracker & tracker)
+        { return tracker.num_pending() > 0; });
+
+    if (feedback_pending) {
+      if (feedback_interval_ms == 0) {
+        for (auto & feedback_tracker : feedback_trackers) {
+          if (feedback_tracker.num_pending() > 0) {
+            send_feedback(feedback_tracker);
+          }
+        }
+      } else if (not feedback_timer_armed) {
+        feedback_timer.set_time({feedback_interval_ms / 1000,
+                                 feedback_interval_ms % 1000 * 1000000L},
+                                {0, 0});
+        feedback_timer_armed = true;
+      }
+    }
+
+    // report a drop of the bandwidth estimate without waiting
+    if (report_interval_ms > 0) {
+      for (auto & report_tracker : report_trackers) {
+        if (report_tracker.urgent()) {
+          send_report(report_tracker);
+        }
+      }
+    }
+
+    // output reception stats roughly every second
+    const auto stats_now = steady_clock::now();
+    if (stats_now >= last_stats_time + 1s) {
+      const uint64_t curr_cpu_us = cpu_time_us();
+      const double diff_us = duration<double, micro>(
+                             stats_now - last_stats_time).count();
+
+      cerr << "Datagrams received in the last ~1s: " << num_datagrams_received
+           << " (" << num_recv_batches << " batches)\n"
+           << "  - CPU usage (%): "
+           << double_to_string(100.0 * (curr_cpu_us - last_stats_cpu_us)
+                               / diff_us) << "\n"
+           << "  - Feedback sent: " << num_feedback_sent << endl;
+
+      if (nack_enabled) {
+        cerr << "  - NACKs sent: " << num_nacks_sent << " (requesting "
+             << num_datagrams_nacked << " datagrams)" << endl;
+      }
+
+      if (report_interval_ms > 0) {
+        cerr << "  - Reports sent: " << num_reports_sent << endl;
+      }
+
+      if constexpr (is_same_v<Loop, URingPoller>) {
+        cerr << "  - io_uring_enter calls: "
+             << loop.num_enter_calls() - last_stats_enter_calls << endl;
+        last_stats_enter_calls = loop.num_enter_calls();
+      }
+
+      // reset stats
+      num_datagrams_received = 0;
+      num_recv_batches = 0;
+      num_feedback_sent = 0;
+      num_nacks_sent = 0;
+      num_datagrams_nacked = 0;
+      num_reports_sent = 0;
+      last_stats_cpu_us = curr_cpu_us;
+      last_stats_time = stats_now;
+    }
+
+    for (size_t i = 0; i < decoders.size(); i++) {
+      Decoder & decoder = *decoders[i];
+      FeedbackTracker & feedback_tracker = feedback_trackers[i];
+
+      // check if the expected frame(s) is complete
+      while (decoder.next_frame_complete()) {
+        // depending on the lazy level, might decode and display the next frame
+        decoder.consume_next_frame();
+      }
+
+      // acknowledge the datagrams that FEC recovered so as not to be
+      // retransmitted (in the next feedback)
+      for (const SeqNum seq_num : decoder.recovered_seq_nums()) {
+        feedback_tracker.add_recovered(seq_num);
+      }
+      decoder.recovered_seq_nums().clear();
+
+      // report the last reference frame decoded, for the sender to recover
+      // from the frames lost by predicting from it
+      if (decoder.last_ref_frame()) {
+        feedback_tracker.set_ref_frame(*decoder.last_ref_frame());
+      }
+    }
+
+    // NACK the datagrams found missing (of the frames not consumed yet)
+    if (nack_enabled) {
+      send_nacks();
+    }
+  };
+
+  // the datagrams not reported within the interval are reported now (the
+  // timer is left armed if feedback was sent by count in the meantime)
+  add_timer(loop, feedback_timer,
+    [&](const unsigned int)
+    {
+      feedback_timer_armed = false;
+
+      for (auto & feedback_tracker : feedback_trackers) {
+        if (feedback_tracker.num_pending() > 0) {
+          send_feedback(feedback_tracker);
+        }
+      }
+    }
+  );
+
+  if (nack_enabled) {
+    add_timer(loop, nack_timer,
+      [&](const unsigned int)
+      {
+        nack_timer_ts.reset();
+        send_nacks();
+      }
+    );
+  }
+
+  if (report_interval_ms > 0) {
+    const timespec interval {report_interval_ms / 1000,
+                             report_interval_ms % 1000 * 1000000L};
+    report_timer.set_time(interval, interval);
+
+    add_timer(loop, report_timer,
+      [&](const unsigned int)
+      {
+        for (auto & report_tracker : report_trackers) {
+          send_report(report_tracker);
+        }
+      }
+    );
+  }
+
+  if constexpr (is_same_v<Loop, URingPoller>) {
+    // keep receiving datagrams asynchronously
+    udp_sock.submit_recv(loop, recv_bufs, handle_datagrams);
+  } else {
+    // when UDP socket is readable
+    loop.register_event(udp_sock, Loop::In,
+      [&]()
+      {
+        // receive datagrams in batches until EWOULDBLOCK
+        while (udp_sock.recv_batch(recv_bufs) > 0) {
+          handle_datagrams();
+        }
+      }
+    );
+  }
+
+  // main loop
+  while (true) {
+    loop.poll(-1);
+  }
+}
+
 int main(int argc, char * argv[])
 {
   // argument parsing
@@ -38,10 +404,24 @@ int main(int argc, char * argv[])
   int lazy_level = 0;
   string output_path;
   bool verbose = false;
+  bool gro = false;
+  string loop_type = "epoll";
+  size_t feedback_count = 16;
+  unsigned int feedback_interval_ms = 5;
+  unsigned int max_nacks = 0;
+  unsigned int report_interval_ms = 0;
+  unsigned int num_streams = 1;
 
   const option cmd_line_opts[] = {
     {"fps",     required_argument, nullptr, 'F'},
     {"cbr",     required_argument, nullptr, 'C'},
+    {"gro",     no_argument,       nullptr, 'G'},
+    {"feedback-count",    required_argument, nullptr, 'N'},
+    {"feedback-interval", required_argument, nullptr, 'I'},
+    {"nack",    required_argument, nullptr, 'K'},
+    {"report",  required_argument, nullptr, 'R'},
+    {"simulcast", required_argument, nullptr, 'S'},
+    {"loop",    required_argument, nullptr, 'E'},
     {"lazy",    required_argument, nullptr, 'L'},
     {"output",  required_argument, nullptr, 'o'},
     {"verbose", no_argument,       nullptr, 'v'},
@@ -61,6 +441,27 @@ int main(int argc, char * argv[])
       case 'C':
         target_bitrate = strict_stoi(optarg);
         break;
+      case 'G':
+        gro = true;
+        break;
+      case 'N':
+        feedback_count = strict_stoi(optarg);
+        break;
+      case 'I':
+        feedback_interval_ms = strict_stoi(optarg);
+        break;
+      case 'K':
+        max_nacks = strict_stoi(optarg);
+        break;
+      case 'R':
+        report_interval_ms = strict_stoi(optarg);
+        break;
+      case 'S':
+        num_streams = strict_stoi(optarg);
+        break;
+      case 'E':
+        loop_type = optarg;
+        break;
       case 'L':
         lazy_level = strict_stoi(optarg);
         break;
@@ -76,7 +477,10 @@ int main(int argc, char * argv[])
     }
   }
 
-  if (optind != argc - 4) {
+  if (optind != argc - 4 or feedback_count == 0 or
+      feedback_count > FeedbackMsg::MAX_RECEIPTS or
+      num_streams == 0 or num_streams > ConfigMsg::MAX_STREAMS or
+      (loop_type != "poll" and loop_type != "epoll" and loop_type != "uring")) {
     print_usage(argv[0]);
     return EXIT_FAILURE;
   }
@@ -94,39 +498,61 @@ int main(int argc, char * argv[])
   udp_sock.connect(peer_addr);
   cerr << "Local address: " << udp_sock.local_address().str() << endl;
 
+  // let the kernel timestamp datagrams received
+  udp_sock.set_timestamping(true, false);
+
+  // datagrams coalesced by GRO are split back in UDPSocket::recv_batch()
+  if (gro) {
+    udp_sock.set_gro(true);
+    cerr << "Enabled UDP GRO" << endl;
+  }
+
   // request a specific configuration
-  const ConfigMsg config_msg(width, height, frame_rate, target_bitrate);
+  const ConfigMsg config_msg(width, height, frame_rate, target_bitrate,
+                             max_nacks > 0 ? LossRecovery::NACK
+                                           : LossRecovery::SENDER,
+                             num_streams);
   udp_sock.send(config_msg.serialize_to_string());
 
-  // initialize decoder
-  Decoder decoder(width, height, lazy_level, output_path);
-  decoder.set_verbose(verbose);
-
-  // main loop
-  while (true) {
-    // parse a datagram received from sender
-    Datagram datagram;
-    if (not datagram.parse_from_string(udp_sock.recv().value())) {
-      throw runtime_error("failed to parse a datagram");
-    }
+  // initialize a decoder per simulcast stream (only the first one displays
+  // frames and outputs performance results)
+  vector<unique_ptr<Decoder>> decoders;
 
-    // send an ACK back to sender
-    AckMsg ack(datagram);
-    udp_sock.send(ack.serialize_to_string());
+  for (unsigned int i = 0; i < num_streams; i++) {
+    auto & decoder = *decoders.emplace_back(make_unique<Decoder>(
+        width >> i, height >> i,
+        i == 0 ? lazy_level : max<int>(lazy_level, Decoder::DECODE_ONLY),
+        i == 0 ? output_path : ""));
+    decoder.set_verbose(verbose);
+    decoder.set_stream_id(i);
 
-    if (verbose) {
-      cerr << "Acked datagram: frame_id=" << datagram.frame_id
-           << " frag_id=" << datagram.frag_id << endl;
+    if (max_nacks > 0) {
+      decoder.enable_nacks(max_nacks);
     }
+  }
+
+  if (max_nacks > 0) {
+    cerr << "Enabled NACKs (up to " << max_nacks << " per datagram)" << endl;
+  }
 
-    // process the received datagram in the decoder
-    decoder.add_datagram(move(datagram));
+  if (report_interval_ms > 0) {
+    cerr << "Enabled receiver reports (every " << report_interval_ms
+         << " ms)" << endl;
+  }
 
-    // check if the expected frame(s) is complete
-    while (decoder.next_frame_complete()) {
-      // depending on the lazy level, might decode and display the next frame
-      decoder.consume_next_frame();
-    }
+  // run the event loop of the requested type
+  if (loop_type == "uring") {
+    URingPoller loop;
+    serve(loop, udp_sock, decoders, feedback_count, feedback_interval_ms,
+          max_nacks > 0, report_interval_ms, verbose);
+  } else if (loop_type == "epoll") {
+    Epoller loop;
+    serve(loop, udp_sock, decoders, feedback_count, feedback_interval_ms,
+          max_nacks > 0, report_interval_ms, verbose);
+  } else {
+    Poller loop;
+    serve(loop, udp_sock, decoders, feedback_count, feedback_interval_ms,
+          max_nacks > 0, report_interval_ms, verbose);
   }
 
   return EXIT_SUCCESS;
@@ -1,26 +1,52 @@
 #include <getopt.h>
+#include <fcntl.h>
 #include <iostream>
 #include <string>
+#include <cmath>
+#include <optional>
 #include <memory>
 #include <stdexcept>
 #include <utility>
 #include <chrono>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <functional>
+#include <type_traits>
+#include <variant>
 
 #include "conversion.hh"
 #include "timerfd.hh"
+#include "timer_wheel.hh"
 #include "udp_socket.hh"
 #include "poller.hh"
+#include "epoller.hh"
+#include "uring_poller.hh"
 #include "yuv4mpeg.hh"
+#include "image.hh"
 #include "protocol.hh"
 #include "encoder.hh"
+#include "encode_worker.hh"
+#include "gcc_controller.hh"
+#include "pacer.hh"
 #include "timestamp.hh"
+#include "mono_clock.hh"
 
 using namespace std;
 using namespace chrono;
 
 // global variables in an unnamed namespace
 namespace {
-  constexpr unsigned int BILLION = 1000 * 1000 * 1000;
+  constexpr unsigned int MILLION = 1000 * 1000;
+
+  // max number of datagrams to send or receive per system call
+  constexpr size_t MAX_SEND_BATCH = 64;
+  constexpr size_t MAX_RECV_BATCH = 64;
+
+  // bitrates (kbps) that congestion control starts at and never goes below
+  // per stream (before probing for more, up to receiver's bitrate)
+  constexpr unsigned int START_CC_BITRATE = 300;
+  constexpr unsigned int MIN_CC_BITRATE = 50;
 }
 
 void print_usage(const string & program_name)
@@ -29,6 +55,34 @@ void print_usage(const string & program_name)
   "Usage: " << program_name << " [options] port y4m\n\n"
   "Options:\n"
   "--mtu <MTU>                MTU for deciding UDP payload size\n"
+  "--gso                      let the kernel segment equal-sized datagrams\n"
+  "                           (e.g., fragments of a frame) sent at once\n"
+  "--fec <percent>            send Reed-Solomon parity fragments amounting to\n"
+  "                           <percent> of each frame's fragments (rounded up)\n"
+  "--fec-window <frames>      with --fec, send parity fragments of a streaming\n"
+  "                           code across the last <frames> frames (up to 16)\n"
+  "                           instead, amounting to <percent> of all fragments\n"
+  "--deadline <ms>            playout deadline of each frame after capture,\n"
+  "                           past which its datagrams are no longer sent or\n"
+  "                           retransmitted (default: 1000)\n"
+  "--recovery <type>          after abandoning frames past deadline, encode a\n"
+  "                           key frame (key, default) or a frame predicted\n"
+  "                           from the last reference frame that receiver\n"
+  "                           decoded (ref)\n"
+  "--temporal-layers <N>      encode N temporal layers (1 to 3, default: 1)\n"
+  "                           and drop frames of the enhancement layers under\n"
+  "                           congestion (not with --recovery ref)\n"
+  "--cc <type>                congestion control adapting the bitrate up to\n"
+  "                           receiver's: none (constant bitrate, default) or\n"
+  "                           gcc (delay-based, in the style of GCC)\n"
+  "--pacing <percent>         pace the datagrams at <percent> of the target\n"
+  "                           bitrate (e.g., 250) instead of sending each\n"
+  "                           frame at once (0: no pacing, default)\n"
+  "--send-log <file>          log each datagram sent: stream_id, seq_num,\n"
+  "                           frame_id, size, rtx (0 or 1), and wall-clock\n"
+  "                           send_ts (us)\n"
+  "--loop <type>              event loop: poll, epoll (default), or uring\n"
+  "                           (completion-based I/O with io_uring)\n"
   "-o, --output <file>        file to output performance results to\n"
   "-v, --verbose              enable more logging for debugging"
   << endl;
@@ -40,15 +94,608 @@ pair<Address, ConfigMsg> recv_config_msg(UDPSocket & udp_sock)
   while (true) {
     const auto & [peer_addr, raw_data] = udp_sock.recvfrom();
 
-    const shared_ptr<Msg> msg = Msg::parse_from_string(raw_data.value());
-    if (msg == nullptr or msg->type != Msg::Type::CONFIG) {
-      continue; // ignore invalid or non-config messages
+    const auto msg = parse_msg(raw_data.value());
+
+    // ignore invalid or non-config messages
+    if (msg and holds_alternative<ConfigMsg>(*msg)) {
+      return {peer_addr, get<ConfigMsg>(*msg)};
+    }
+  }
+}
+
+// downscale raw_imgs[0] into the images of the other simulcast streams, and
+// compress each into a frame of its stream, encoding them in parallel (with
+// workers[i - 1] encoding stream i); add the time spent to the totals
+void compress_simulcast_frame(vector<unique_ptr<Encoder>> & encoders,
+                              vector<unique_ptr<EncodeWorker>> & workers,
+                              vector<unique_ptr<RawImage>> & raw_imgs,
+                              double & total_scale_time_ms,
+                              double & total_encode_time_ms)
+{
+  const auto scale_start = steady_clock::now();
+  for (size_t i = 1; i < raw_imgs.size(); i++) {
+    raw_imgs[i]->downscale_from(*raw_imgs[i - 1]);
+  }
+  const auto encode_start = steady_clock::now();
+
+  for (auto & encoder : encoders) {
+    encoder->prepare_frame();
+  }
+
+  // the first stream is encoded on this thread; an exception on a worker
+  // is rethrown here
+  for (size_t i = 1; i < encoders.size(); i++) {
+    workers[i - 1]->encode(*raw_imgs[i]);
+  }
+
+  encoders.front()->encode_frame(*raw_imgs.front());
+
+  for (auto & worker : workers) {
+    worker->wait();
+  }
+
+  const auto encode_end = steady_clock::now();
+  total_scale_time_ms += duration<double, milli>(
+                         encode_start - scale_start).count();
+  total_encode_time_ms += duration<double, milli>(
+                          encode_end - encode_start).count();
+
+  for (auto & encoder : encoders) {
+    encoder->packetize_frame();
+  }
+}
+
+template<typename Loop>
+void serve(Loop & loop, UDPSocket & udp_sock, YUV4MPEG & video_input,
+           vector<unique_ptr<Encoder>> & encoders, const uint16_t frame_rate,
+           optional<Pacer> & pacer, optional<FileDescriptor> & send_log,
+           const bool verbose)
+{
+  // io_uring performs completion-based I/O in place of readiness-based I/O
+  constexpr bool uring = is_same_v<Loop, URingPoller>;
+
+  // io_uring waits in the kernel; otherwise set UDP socket to non-blocking
+  udp_sock.set_blocking(uring);
+
+  // all the timers (frames, stats, and retransmissions) share one timerfd
+  TimerWheel timer_wheel;
+  for (auto & encoder : encoders) {
+    encoder->set_timer_wheel(timer_wheel);
+  }
+
+  // allocate a raw image per simulcast stream, each half as large as the
+  // one before (into which the raw frame is downscaled)
+  vector<unique_ptr<RawImage>> raw_imgs;
+  for (size_t i = 0; i < encoders.size(); i++) {
+    raw_imgs.emplace_back(make_unique<RawImage>(
+        video_input.display_width() >> i, video_input.display_height() >> i));
+  }
+  RawImage & raw_img = *raw_imgs.front();
+
+  // simulcast: a worker thread encoding each stream after the first
+  vector<unique_ptr<EncodeWorker>> workers;
+  for (size_t i = 1; i < encoders.size(); i++) {
+    workers.emplace_back(make_unique<EncodeWorker>(*encoders[i]));
+  }
+
+  // io_uring: the next frame record is read into 'frame_record' in advance
+  string frame_record(uring ? video_input.frame_record_size() : 0, '\0');
+  uint64_t next_frame_idx = 0;
+  bool frame_prefetched = false;
+
+  const auto prefetch_frame = [&]()
+  {
+    if constexpr (is_same_v<Loop, URingPoller>) {
+      frame_prefetched = false;
+
+      loop.submit_read(video_input.fd().fd_num(), frame_record.data(),
+                       frame_record.size(),
+                       video_input.frame_record_offset(next_frame_idx),
+        [&](const int result)
+        {
+          if (result != static_cast<int>(frame_record.size())) {
+            throw runtime_error("failed to read a frame record");
+          }
+
+          frame_prefetched = true;
+        }
+      );
+    }
+  };
+
+  // transmission stats in the current period
+  unsigned int num_datagrams_sent = 0;
+  unsigned int num_send_batches = 0;
+  uint64_t last_stats_cpu_us = cpu_time_us();
+  uint64_t last_stats_ts = mono_us();
+  uint64_t last_stats_enter_calls = 0;
+
+  // simulcast: time spent downscaling and encoding each raw frame into
+  // every stream (in parallel)
+  unsigned int num_raw_frames = 0;
+  double total_scale_time_ms = 0;
+  double total_encode_time_ms = 0;
+
+  // datagrams to send in a batch: retransmissions (in place in unacked)
+  // followed by first transmissions (in send_buf)
+  vector<Datagram *> batch;
+  size_t batch_rtx = 0;
+
+  // headers of the datagrams in a batch, serialized apart from the payloads
+  // so that the kernel gathers both without the payloads being copied
+  constexpr size_t HEADER_BUF_SIZE = MAX_SEND_BATCH * DatagramHeader::HEADER_SIZE;
+  SharedBuffer header_buf(HEADER_BUF_SIZE);
+  vector<UDPSocket::GatherDatagram> gather_batch;
+
+  // io_uring: the buffers a submitted batch points into, held until sent
+  vector<SharedBuffer> batch_buffers;
+
+  const auto stream_has_datagrams = [](Encoder & encoder)
+  {
+    return not encoder.rtx_buf().empty() or not encoder.send_buf().empty();
+  };
+
+  const auto has_datagrams_to_send = [&]()
+  {
+    return any_of(encoders.begin(), encoders.end(),
+                  [&](const unique_ptr<Encoder> & encoder)
+                  { return stream_has_datagrams(*encoder); });
+  };
+
+  // pacing (if enabled): the streams share the budget of 'pacer', and once
+  // it runs out, a timer resumes sending when it allows
+  optional<TimerWheel::TimerId> pacing_timer;
+  unsigned int num_pacing_waits = 0;
+
+  // bytes of the datagrams that may be sent now
+  const auto pacing_budget = [&]()
+  {
+    if (not pacer) {
+      return SIZE_MAX;
+    }
+
+    // pace at a multiple of the total target bitrate of the streams
+    unsigned int total_bitrate = 0;
+    for (const auto & encoder : encoders) {
+      total_bitrate += encoder->target_bitrate();
+    }
+    pacer->set_target_bitrate(total_bitrate);
+
+    return pacer->budget(mono_us());
+  };
+
+  const auto wait_for_pacing = [&]()
+  {
+    if (pacing_timer) {
+      return;
+    }
+
+    num_pacing_waits++;
+    pacing_timer = timer_wheel.schedule(
+      max<uint64_t>(pacer->delay(mono_us()), 1),
+      [&]() { pacing_timer.reset(); } // then send what is left
+    );
+  };
+
+  // wire size of a datagram
+  const auto datagram_size = [](const Datagram & datagram)
+  {
+    return DatagramHeader::HEADER_SIZE + datagram.payload.size();
+  };
+
+  // fill 'batch' with up to MAX_SEND_BATCH datagrams of 'encoder' to send,
+  // until they reach 'budget' bytes
+  const auto fill_batch = [&](Encoder & encoder, const size_t budget)
+  {
+    deque<SeqNum> & rtx_buf = encoder.rtx_buf();
+    auto & unacked = encoder.unacked();
+
+    batch.clear();
+    size_t batch_bytes = 0;
+
+    while (not rtx_buf.empty() and batch.size() < MAX_SEND_BATCH and
+           batch_bytes < budget) {
+      const SeqNum seq_num = rtx_buf.front();
+      rtx_buf.pop_front();
+
+      // skip the datagrams acked (or given up on) since queued
+      if (unacked.find(seq_num)) {
+        batch.emplace_back(&unacked.datagram(seq_num));
+        batch_bytes += datagram_size(*batch.back());
+      }
+    }
+
+    batch_rtx = batch.size();
+
+    deque<Datagram> & send_buf = encoder.send_buf();
+    for (size_t i = 0; i < send_buf.size() and
+                       batch.size() < MAX_SEND_BATCH and
+                       batch_bytes < budget; i++) {
+      batch.emplace_back(&send_buf[i]);
+      batch_bytes += datagram_size(send_buf[i]);
+    }
+  };
+
+  // log lines of the datagrams sent in a batch (reused to avoid allocations)
+  string send_log_lines;
+
+  // remove the first 'num_sent' datagrams that were sent in 'batch' at
+  // 'send_ts' from send_buf, and requeue the retransmissions that were not
+  const auto pop_sent = [&](Encoder & encoder, const size_t num_sent,
+                            const uint64_t send_ts)
+  {
+    deque<Datagram> & send_buf = encoder.send_buf();
+    send_log_lines.clear();
+
+    for (size_t i = 0; i < num_sent; i++) {
+      const auto & datagram = *batch[i];
+
+      if (pacer) {
+        pacer->on_sent(datagram_size(datagram), send_ts);
+      }
+
+      if (send_log) {
+        send_log_lines += to_string(datagram.stream_id) + "," +
+                          to_string(datagram.seq_num) + "," +
+                          to_string(datagram.frame_id) + "," +
+                          to_string(datagram_size(datagram)) + "," +
+                          to_string(i < batch_rtx) + "," +
+                          to_string(mono_to_wall_us(send_ts)) + "\n";
+      }
+
+      if (verbose) {
+        cerr << "Sent datagram: stream_id=" << unsigned(datagram.stream_id)
+             << " frame_id=" << datagram.frame_id
+             << " frag_id=" << datagram.frag_id
+             << " frag_cnt=" << datagram.frag_cnt
+             << " seq_num=" << datagram.seq_num
+             << " rtx=" << (i < batch_rtx ?
+                 encoder.unacked().find(datagram.seq_num)->num_rtx : 0)
+             << endl;
+      }
+
+      // move the sent datagram to unacked if not a retransmission
+      if (i >= batch_rtx) {
+        encoder.add_tx_id(udp_sock.batch_tx_id(i), datagram.seq_num);
+        encoder.add_unacked(move(send_buf.front()));
+        send_buf.pop_front();
+      }
+    }
+
+    for (size_t i = batch_rtx; i > num_sent; i--) {
+      encoder.rtx_buf().emplace_front(batch[i - 1]->seq_num);
+    }
+
+    if (send_log and not send_log_lines.empty()) {
+      send_log->write(send_log_lines);
+    }
+  };
+
+  // send the datagrams in rtx_buf and send_buf of 'encoder' in batches until
+  // empty; return false on EWOULDBLOCK (or if paced)
+  const auto send_stream_datagrams = [&](Encoder & encoder)
+  {
+    while (stream_has_datagrams(encoder)) {
+      const size_t budget = pacing_budget();
+      if (budget == 0) {
+        wait_for_pacing();
+        return false;
+      }
+
+      fill_batch(encoder, budget);
+      const size_t batch_size = batch.size();
+
+      if (batch_size == 0) {
+        return true; // only stale retransmissions were left
+      }
+
+      // timestamp the sending time before sending
+      const auto send_ts = mono_us();
+
+      // io_uring might still be sending the last batch's headers
+      if (header_buf.use_count() > 1) {
+        header_buf = SharedBuffer(HEADER_BUF_SIZE);
+      }
+
+      gather_batch.clear();
+      batch_buffers.assign({header_buf});
+
+      for (size_t i = 0; i < batch_size; i++) {
+        // a retransmission keeps the send_ts of its first transmission in
+        // unacked, so only the header on wire carries the new one
+        DatagramHeader header = *batch[i];
+        header.send_ts = send_ts;
+
+        if (i >= batch_rtx) {
+          batch[i]->send_ts = send_ts;
+        }
+
+        char * header_ptr = header_buf.data() + i * DatagramHeader::HEADER_SIZE;
+        gather_batch.push_back({header.serialize_to(header_ptr),
+                                batch[i]->payload});
+
+        // the fragments of a frame share a payload buffer
+        if (uring and batch[i]->buffer != batch_buffers.back()) {
+          batch_buffers.emplace_back(batch[i]->buffer);
+        }
+      }
+
+      num_send_batches++;
+
+      if constexpr (is_same_v<Loop, URingPoller>) {
+        // the batch is handed over to the kernel and sent asynchronously
+        udp_sock.submit_send_batch(loop, move(gather_batch), move(batch_buffers),
+          [&num_datagrams_sent](const size_t num_sent)
+          {
+            num_datagrams_sent += num_sent;
+          }
+        );
+
+        pop_sent(encoder, batch_size, send_ts);
+      } else {
+        // send the whole batch with (usually) a single system call
+        const size_t num_sent = udp_sock.send_batch(gather_batch);
+        num_datagrams_sent += num_sent;
+
+        pop_sent(encoder, num_sent, send_ts);
+
+        if (num_sent < batch_size) { // EWOULDBLOCK; try again later
+          // first transmissions left at the front of send_buf
+          const size_t num_unsent = batch_size - max(num_sent, batch_rtx);
+          for (size_t i = 0; i < num_unsent; i++) {
+            encoder.send_buf()[i].send_ts = 0; // since it wasn't sent successfully
+          }
+          return false;
+        }
+      }
+    }
+
+    return true;
+  };
+
+  // send the datagrams of every stream (lower resolutions after) until
+  // empty (or EWOULDBLOCK)
+  const auto send_datagrams = [&]()
+  {
+    for (auto & encoder : encoders) {
+      if (not send_stream_datagrams(*encoder)) {
+        return;
+      }
+    }
+  };
+
+  // read kernel TX timestamps of the datagrams sent (regularly, as they
+  // take up the socket's receive buffer space until read)
+  const auto read_tx_timestamps = [&]()
+  {
+    // the streams share the socket's timestamping IDs (each skips the ones
+    // of the others)
+    for (const auto & [tx_id, tx_ts] : udp_sock.recv_tx_timestamps()) {
+      for (auto & encoder : encoders) {
+        encoder->handle_tx_timestamp(tx_id, tx_ts);
+      }
+    }
+  };
+
+  // send (or wait to send) the datagrams in rtx_buf and send_buf
+  const auto flush_send_buf = [&]()
+  {
+    // if paced, the pacing timer flushes send_buf when due
+    if (not has_datagrams_to_send() or pacing_timer) {
+      return;
+    }
+
+    if constexpr (is_same_v<Loop, URingPoller>) {
+      send_datagrams();
+    } else {
+      // interested in socket being writable if there are datagrams to send
+      loop.activate(udp_sock, Loop::Out);
+    }
+  };
+
+  // read a raw frame every frame interval
+  timer_wheel.schedule_periodic(MILLION / frame_rate,
+    [&](const unsigned int num_exp)
+    {
+      // being lenient: read raw frames 'num_exp' times and use the last one
+      if (num_exp > 1) {
+        cerr << "Warning: skipping " << num_exp - 1 << " raw frames" << endl;
+      }
+
+      if constexpr (is_same_v<Loop, URingPoller>) {
+        if (not frame_prefetched) {
+          cerr << "Warning: raw frame not read in time" << endl;
+          return;
+        }
+
+        // use the frame read in advance and read the next one
+        video_input.parse_frame_record(frame_record, raw_img);
+        next_frame_idx += num_exp;
+        prefetch_frame();
+      } else {
+        for (unsigned int i = 0; i < num_exp; i++) {
+          // fetch a raw frame into 'raw_img' from the video input
+          if (not video_input.read_frame(raw_img)) {
+            throw runtime_error("Reached the end of video input");
+          }
+        }
+      }
+
+      read_tx_timestamps();
+
+      if (encoders.size() == 1) {
+        // compress 'raw_img' into frame 'frame_id' and packetize it
+        encoders.front()->compress_frame(raw_img);
+      } else {
+        compress_simulcast_frame(encoders, workers, raw_imgs,
+                                 total_scale_time_ms, total_encode_time_ms);
+        num_raw_frames++;
+      }
+
+      flush_send_buf();
+    }
+  );
+
+  prefetch_frame();
+
+  // buffers to receive feedback into (reused to avoid allocations)
+  UDPSocket::RecvBuffers recv_bufs(MAX_RECV_BATCH);
+
+  // handle the feedback received into 'recv_bufs'
+  const auto handle_feedback = [&]()
+  {
+    // the datagrams acked were sent before; so were their TX timestamps
+    read_tx_timestamps();
+
+    for (size_t i = 0; i < recv_bufs.size(); i++) {
+      const auto msg = parse_msg(recv_bufs[i]);
+
+      // ignore invalid messages
+      if (not msg) {
+        continue;
+      }
+
+      visit(MsgVisitor {
+        [&](const FeedbackMsg & feedback)
+        {
+          if (verbose) {
+            cerr << "Received feedback: cum_seq_num=" << feedback.cum_seq_num
+                 << " highest_seq_num=" << feedback.highest_seq_num
+                 << " receipts=" << unsigned(feedback.num_receipts) << endl;
+          }
+
+          // RTT estimation, retransmission, etc. (of the stream acked)
+          if (feedback.stream_id < encoders.size()) {
+            encoders[feedback.stream_id]->handle_feedback(
+                feedback, recv_bufs.recv_ts(i));
+          }
+        },
+        [&](const NackMsg & nack)
+        {
+          if (verbose) {
+            cerr << "Received NACK: datagrams="
+                 << unsigned(nack.num_seq_nums) << endl;
+          }
+
+          if (nack.stream_id < encoders.size()) {
+            encoders[nack.stream_id]->handle_nack(nack);
+          }
+        },
+        [&](const ReportMsg & report)
+        {
+          // cap the bitrate of the stream at receiver's estimate
+          if (report.stream_id < encoders.size()) {
+            encoders[report.stream_id]->handle_report(report);
+          }
+        },
+        [](const ConfigMsg &) {} // ignore ConfigMsg after the handshake
+      }, *msg);
+    }
+
+    // rtx_buf might contain datagrams to be retransmitted now
+    flush_send_buf();
+  };
+
+  if constexpr (is_same_v<Loop, URingPoller>) {
+    // keep receiving feedback asynchronously
+    udp_sock.submit_recv(loop, recv_bufs, handle_feedback);
+  } else {
+    // when UDP socket is writable
+    loop.register_event(udp_sock, Loop::Out,
+      [&]()
+      {
+        send_datagrams();
+
+        // not interested in socket being writable if no datagrams to send
+        // (until the pacing timer fires, if paced)
+        if (not has_datagrams_to_send() or pacing_timer) {
+          loop.deactivate(udp_sock, Loop::Out);
+        }
+      }
+    );
+
+    // when UDP socket is readable
+    loop.register_event(udp_sock, Loop::In,
+      [&]()
+      {
+        // receive feedback in batches until EWOULDBLOCK
+        while (udp_sock.recv_batch(recv_bufs) > 0) {
+          handle_feedback();
+        }
+      }
+    );
+  }
+
+  // output stats every second
+  timer_wheel.schedule_periodic(MILLION,
+    [&](const unsigned int)
+    {
+      for (size_t i = 0; i < encoders.size(); i++) {
+        if (encoders.size() > 1) {
+          cerr << "Stream " << i << " (" << raw_imgs[i]->display_width()
+               << "x" << raw_imgs[i]->display_height() << "):" << endl;
+        }
+
+        encoders[i]->output_periodic_stats();
+      }
+
+      if (num_raw_frames > 0) {
+        cerr << "Simulcast: avg time per raw frame (ms) to downscale "
+             << double_to_string(total_scale_time_ms / num_raw_frames)
+             << ", to encode every stream "
+             << double_to_string(total_encode_time_ms / num_raw_frames)
+             << endl;
+      }
+
+      const uint64_t curr_cpu_us = cpu_time_us();
+      const uint64_t curr_ts = mono_us();
+
+      cerr << "Datagrams sent in the last ~1s: " << num_datagrams_sent
+           << " (" << num_send_batches << " batches)" << endl;
+
+      if (curr_ts > last_stats_ts) {
+        cerr << "  - CPU usage (%): " << double_to_string(
+                100.0 * (curr_cpu_us - last_stats_cpu_us)
+                / (curr_ts - last_stats_ts)) << endl;
+      }
+
+      if (pacer) {
+        cerr << "  - Pacing rate (kbps): " << lrint(pacer->pacing_rate())
+             << ", waited " << num_pacing_waits << " times" << endl;
+      }
+
+      if constexpr (is_same_v<Loop, URingPoller>) {
+        cerr << "  - io_uring_enter calls: "
+             << loop.num_enter_calls() - last_stats_enter_calls << endl;
+        last_stats_enter_calls = loop.num_enter_calls();
+      }
+
+      // reset stats
+      num_datagrams_sent = 0;
+      num_send_batches = 0;
+      num_pacing_waits = 0;
+      num_raw_frames = 0;
+      total_scale_time_ms = 0;
+      total_encode_time_ms = 0;
+      last_stats_cpu_us = curr_cpu_us;
+      last_stats_ts = curr_ts;
     }
+  );
 
-    const auto config_msg = dynamic_pointer_cast<ConfigMsg>(msg);
-    if (config_msg) {
-      return {peer_addr, *config_msg};
+  // execute the expired timers whenever the timer wheel's timerfd fires
+  add_timer(loop, timer_wheel.timerfd(),
+    [&](const unsigned int)
+    {
+      timer_wheel.expire();
+
+      // datagrams might have been queued for retransmission on RTO
+      flush_send_buf();
     }
+  );
+
+  // main loop
+  while (true) {
+    loop.poll(-1);
   }
 }
 
@@ -57,12 +704,32 @@ int main(int argc, char * argv[])
   // argument parsing
   string output_path;
   bool verbose = false;
+  bool gso = false;
+  string loop_type = "epoll";
+  unsigned int fec_percent = 0;
+  unsigned int fec_window = 0;
+  unsigned int deadline_ms = 1000;
+  string recovery = "key";
+  unsigned int num_temporal_layers = 1;
+  string cc = "none";
+  unsigned int pacing_percent = 0;
+  string send_log_path;
 
   const option cmd_line_opts[] = {
-    {"mtu",     required_argument, nullptr, 'M'},
-    {"output",  required_argument, nullptr, 'o'},
-    {"verbose", no_argument,       nullptr, 'v'},
-    { nullptr,  0,                 nullptr,  0 },
+    {"mtu",        required_argument, nullptr, 'M'},
+    {"gso",        no_argument,       nullptr, 'G'},
+    {"fec",        required_argument, nullptr, 'F'},
+    {"fec-window", required_argument, nullptr, 'W'},
+    {"deadline",   required_argument, nullptr, 'D'},
+    {"recovery",   required_argument, nullptr, 'R'},
+    {"temporal-layers", required_argument, nullptr, 'T'},
+    {"cc",         required_argument, nullptr, 'C'},
+    {"pacing",     required_argument, nullptr, 'P'},
+    {"send-log",   required_argument, nullptr, 'L'},
+    {"loop",       required_argument, nullptr, 'E'},
+    {"output",     required_argument, nullptr, 'o'},
+    {"verbose",    no_argument,       nullptr, 'v'},
+    { nullptr,     0,                 nullptr,  0 },
   };
 
   while (true) {
@@ -75,6 +742,36 @@ int main(int argc, char * argv[])
       case 'M':
         Datagram::set_mtu(strict_stoi(optarg));
         break;
+      case 'G':
+        gso = true;
+        break;
+      case 'F':
+        fec_percent = strict_stoi(optarg);
+        break;
+      case 'W':
+        fec_window = strict_stoi(optarg);
+        break;
+      case 'D':
+        deadline_ms = strict_stoi(optarg);
+        break;
+      case 'R':
+        recovery = optarg;
+        break;
+      case 'T':
+        num_temporal_layers = strict_stoi(optarg);
+        break;
+      case 'C':
+        cc = optarg;
+        break;
+      case 'P':
+        pacing_percent = strict_stoi(optarg);
+        break;
+      case 'L':
+        send_log_path = optarg;
+        break;
+      case 'E':
+        loop_type = optarg;
+        break;
       case 'o':
         output_path = optarg;
         break;
@@ -87,7 +784,13 @@ int main(int argc, char * argv[])
     }
   }
 
-  if (optind != argc - 2) {
+  if (optind != argc - 2 or fec_window > StreamParityHeader::MAX_FRAMES or
+      deadline_ms == 0 or (recovery != "key" and recovery != "ref") or
+      num_temporal_layers == 0 or
+      num_temporal_layers > Encoder::MAX_TEMPORAL_LAYERS or
+      (num_temporal_layers > 1 and recovery == "ref") or
+      (cc != "none" and cc != "gcc") or
+      (loop_type != "poll" and loop_type != "epoll" and loop_type != "uring")) {
     print_usage(argv[0]);
     return EXIT_FAILURE;
   }
@@ -111,154 +814,103 @@ int main(int argc, char * argv[])
   const auto height = config_msg.height;
   const auto frame_rate = config_msg.frame_rate;
   const auto target_bitrate = config_msg.target_bitrate;
+  const auto loss_recovery = config_msg.loss_recovery;
+  const auto num_streams = config_msg.num_streams;
 
   cerr << "Received config: width=" << to_string(width)
        << " height=" << to_string(height)
        << " FPS=" << to_string(frame_rate)
-       << " bitrate=" << to_string(target_bitrate) << endl;
+       << " bitrate=" << to_string(target_bitrate)
+       << " NACK=" << (loss_recovery == LossRecovery::NACK)
+       << " streams=" << to_string(num_streams) << endl;
+
+  // the smallest stream's dimensions must be even as well (for I420)
+  if (num_streams == 0 or num_streams > ConfigMsg::MAX_STREAMS or
+      width % (2 << (num_streams - 1)) or height % (2 << (num_streams - 1))) {
+    throw runtime_error("Invalid number of simulcast streams for the "
+                        "resolution");
+  }
+
+  // let the kernel timestamp feedback received and datagrams sent
+  udp_sock.set_timestamping(true, true);
 
-  // set UDP socket to non-blocking now
-  udp_sock.set_blocking(false);
+  // the fragments of a frame are all equal-sized except the last one, so
+  // GSO can pass each frame to the kernel as a single buffer
+  if (gso) {
+    udp_sock.set_gso(true);
+    cerr << "Enabled UDP GSO" << endl;
+  }
 
   // open the video file
   YUV4MPEG video_input(y4m_path, width, height);
 
-  // allocate a raw image
-  RawImage raw_img(width, height);
-
-  // initialize the encoder
-  Encoder encoder(width, height, frame_rate, output_path);
-  encoder.set_target_bitrate(target_bitrate);
-  encoder.set_verbose(verbose);
-
-  Poller poller;
-
-  // create a periodic timer with the same period as the frame interval
-  Timerfd fps_timer;
-  const timespec frame_interval {0, static_cast<long>(BILLION / frame_rate)};
-  fps_timer.set_time(frame_interval, frame_interval);
-
-  // read a raw frame when the periodic timer fires
-  poller.register_event(fps_timer, Poller::In,
-    [&]()
-    {
-      // being lenient: read raw frames 'num_exp' times and use the last one
-      const auto num_exp = fps_timer.read_expirations();
-      if (num_exp > 1) {
-        cerr << "Warning: skipping " << num_exp - 1 << " raw frames" << endl;
-      }
-
-      for (unsigned int i = 0; i < num_exp; i++) {
-        // fetch a raw frame into 'raw_img' from the video input
-        if (not video_input.read_frame(raw_img)) {
-          throw runtime_error("Reached the end of video input");
-        }
-      }
-
-      // compress 'raw_img' into frame 'frame_id' and packetize it
-      encoder.compress_frame(raw_img);
-
-      // interested in socket being writable if there are datagrams to send
-      if (not encoder.send_buf().empty()) {
-        poller.activate(udp_sock, Poller::Out);
-      }
+  // initialize an encoder per simulcast stream (only the first one outputs
+  // performance results)
+  vector<unique_ptr<Encoder>> encoders;
+
+  for (uint8_t i = 0; i < num_streams; i++) {
+    auto & encoder = *encoders.emplace_back(make_unique<Encoder>(
+        width >> i, height >> i, frame_rate, i == 0 ? output_path : "",
+        num_temporal_layers));
+    encoder.set_stream_id(i);
+    encoder.set_target_bitrate(config_msg.stream_bitrate(i));
+    encoder.set_loss_recovery(loss_recovery);
+    encoder.set_verbose(verbose);
+    encoder.set_playout_deadline(deadline_ms);
+    encoder.set_ref_recovery(recovery == "ref");
+
+    if (fec_percent > 0) {
+      encoder.set_fec_percent(fec_percent);
+      encoder.set_fec_window(fec_window);
     }
-  );
-
-  // when UDP socket is writable
-  poller.register_event(udp_sock, Poller::Out,
-    [&]()
-    {
-      deque<Datagram> & send_buf = encoder.send_buf();
-
-      while (not send_buf.empty()) {
-        auto & datagram = send_buf.front();
-
-        // timestamp the sending time before sending
-        datagram.send_ts = timestamp_us();
-
-        if (udp_sock.send(datagram.serialize_to_string())) {
-          if (verbose) {
-            cerr << "Sent datagram: frame_id=" << datagram.frame_id
-                 << " frag_id=" << datagram.frag_id
-                 << " frag_cnt=" << datagram.frag_cnt
-                 << " rtx=" << datagram.num_rtx << endl;
-          }
-
-          // move the sent datagram to unacked if not a retransmission
-          if (datagram.num_rtx == 0) {
-            encoder.add_unacked(move(datagram));
-          }
-
-          send_buf.pop_front();
-        } else { // EWOULDBLOCK; try again later
-          datagram.send_ts = 0; // since it wasn't sent successfully
-          break;
-        }
-      }
 
-      // not interested in socket being writable if no datagrams to send
-      if (send_buf.empty()) {
-        poller.deactivate(udp_sock, Poller::Out);
-      }
+    // never exceed the bitrate receiver requested
+    if (cc == "gcc") {
+      const auto bitrate = config_msg.stream_bitrate(i);
+      encoder.set_congestion_controller(make_unique<GCCController>(
+          min(bitrate, START_CC_BITRATE >> i), min(bitrate, MIN_CC_BITRATE),
+          bitrate));
     }
-  );
-
-  // when UDP socket is readable
-  poller.register_event(udp_sock, Poller::In,
-    [&]()
-    {
-      while (true) {
-        const auto & raw_data = udp_sock.recv();
-
-        if (not raw_data) { // EWOULDBLOCK; try again when data is available
-          break;
-        }
-        const shared_ptr<Msg> msg = Msg::parse_from_string(*raw_data);
-
-        // ignore invalid or non-ACK messages
-        if (msg == nullptr or msg->type != Msg::Type::ACK) {
-          return;
-        }
-
-        const auto ack = dynamic_pointer_cast<AckMsg>(msg);
-
-        if (verbose) {
-          cerr << "Received ACK: frame_id=" << ack->frame_id
-               << " frag_id=" << ack->frag_id << endl;
-        }
-
-        // RTT estimation, retransmission, etc.
-        encoder.handle_ack(ack);
+  }
 
-        // send_buf might contain datagrams to be retransmitted now
-        if (not encoder.send_buf().empty()) {
-          poller.activate(udp_sock, Poller::Out);
-        }
-      }
-    }
-  );
+  if (cc != "none") {
+    cerr << "Enabled congestion control (" << cc << ")" << endl;
+  }
 
-  // create a periodic timer for outputting stats every second
-  Timerfd stats_timer;
-  const timespec stats_interval {1, 0};
-  stats_timer.set_time(stats_interval, stats_interval);
+  optional<Pacer> pacer;
+  if (pacing_percent > 0) {
+    pacer.emplace(pacing_percent);
+    cerr << "Enabled pacing (at " << pacing_percent << "% of the target "
+         << "bitrate)" << endl;
+  }
 
-  poller.register_event(stats_timer, Poller::In,
-    [&]()
-    {
-      if (stats_timer.read_expirations() == 0) {
-        return;
-      }
+  optional<FileDescriptor> send_log;
+  if (not send_log_path.empty()) {
+    send_log = FileDescriptor(check_syscall(
+        open(send_log_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)));
+  }
 
-      // output stats every second
-      encoder.output_periodic_stats();
+  if (fec_percent > 0) {
+    cerr << "Enabled FEC (" << fec_percent << "% parity fragments";
+    if (fec_window > 0) {
+      cerr << " across " << fec_window << " frames";
     }
-  );
+    cerr << ")" << endl;
+  }
 
-  // main loop
-  while (true) {
-    poller.poll(-1);
+  // run the event loop of the requested type
+  if (loop_type == "uring") {
+    URingPoller loop;
+    serve(loop, udp_sock, video_input, encoders, frame_rate, pacer, send_log,
+          verbose);
+  } else if (loop_type == "epoll") {
+    Epoller loop;
+    serve(loop, udp_sock, video_input, encoders, frame_rate, pacer, send_log,
+          verbose);
+  } else {
+    Poller loop;
+    serve(loop, udp_sock, video_input, encoders, frame_rate, pacer, send_log,
+          verbose);
   }
 
   return EXIT_SUCCESS;
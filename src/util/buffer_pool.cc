@@ -0,0 +1,178 @@
+#include <new>
+#include <stdexcept>
+
+#include "buffer_pool.hh"
+
+using namespace std;
+
+SharedBuffer::SharedBuffer(const size_t size)
+  : slab_(alloc_slab(nullptr, size))
+{
+  slab_->size = size;
+}
+
+SharedBuffer::SharedBuffer(const SharedBuffer & other)
+  : slab_(other.slab_)
+{
+  if (slab_) {
+    slab_->refcount++;
+  }
+}
+
+SharedBuffer & SharedBuffer::operator=(const SharedBuffer & other)
+{
+  // take the new reference first in case of self-assignment
+  if (other.slab_) {
+    other.slab_->refcount++;
+  }
+
+  release();
+  slab_ = other.slab_;
+
+  return *this;
+}
+
+SharedBuffer::SharedBuffer(SharedBuffer && other) noexcept
+  : slab_(other.slab_)
+{
+  other.slab_ = nullptr;
+}
+
+SharedBuffer & SharedBuffer::operator=(SharedBuffer && other) noexcept
+{
+  if (this != &other) {
+    release();
+    slab_ = other.slab_;
+    other.slab_ = nullptr;
+  }
+
+  return *this;
+}
+
+char * SharedBuffer::data() const
+{
+  if (not slab_) {
+    return nullptr;
+  }
+
+  return reinterpret_cast<char *>(slab_ + 1);
+}
+
+size_t SharedBuffer::size() const
+{
+  return slab_ ? slab_->size : 0;
+}
+
+unsigned int SharedBuffer::use_count() const
+{
+  return slab_ ? slab_->refcount : 0;
+}
+
+void SharedBuffer::release()
+{
+  if (not slab_) {
+    return;
+  }
+
+  if (--slab_->refcount == 0) {
+    if (slab_->pool) {
+      slab_->pool->recycle(slab_);
+    } else {
+      free_slab(slab_);
+    }
+  }
+
+  slab_ = nullptr;
+}
+
+SharedBuffer::Slab * SharedBuffer::alloc_slab(BufferPool * pool,
+                                              const size_t capacity)
+{
+  void * mem = ::operator new(sizeof(Slab) + capacity);
+  return new (mem) Slab {pool, 1, 0, capacity, nullptr};
+}
+
+void SharedBuffer::free_slab(Slab * slab)
+{
+  slab->~Slab();
+  ::operator delete(slab);
+}
+
+BufferPool::~BufferPool()
+{
+  for (auto & free_list : free_lists_) {
+    while (free_list.head) {
+      SharedBuffer::Slab * slab = free_list.head;
+      free_list.head = slab->next_free;
+      SharedBuffer::free_slab(slab);
+    }
+  }
+}
+
+size_t BufferPool::size_class(const size_t capacity)
+{
+  size_t c = 0;
+  while ((MIN_SLAB_SIZE << c) < capacity) {
+    c++;
+  }
+
+  if (c >= NUM_CLASSES) {
+    throw runtime_error("BufferPool: buffer too large");
+  }
+
+  return c;
+}
+
+SharedBuffer BufferPool::alloc(const size_t size)
+{
+  const size_t c = size_class(size);
+  FreeList & free_list = free_lists_[c];
+
+  SharedBuffer::Slab * slab = free_list.head;
+
+  if (slab) {
+    free_list.head = slab->next_free;
+    free_list.size--;
+    stats_.slabs_free--;
+
+    slab->refcount = 1;
+    slab->next_free = nullptr;
+  } else {
+    const size_t capacity = MIN_SLAB_SIZE << c;
+    slab = SharedBuffer::alloc_slab(this, capacity);
+
+    stats_.num_heap_allocs++;
+    stats_.bytes_pooled += capacity;
+  }
+
+  slab->size = size;
+
+  stats_.num_allocs++;
+  stats_.slabs_in_use++;
+
+  return SharedBuffer(slab);
+}
+
+void BufferPool::recycle(SharedBuffer::Slab * slab)
+{
+  stats_.slabs_in_use--;
+
+  FreeList & free_list = free_lists_[size_class(slab->capacity)];
+
+  if (free_list.size >= MAX_FREE_SLABS) {
+    stats_.bytes_pooled -= slab->capacity;
+    SharedBuffer::free_slab(slab);
+    return;
+  }
+
+  slab->next_free = free_list.head;
+  free_list.head = slab;
+  free_list.size++;
+  stats_.slabs_free++;
+}
+
+void BufferPool::reset_alloc_stats()
+{
+  stats_.num_allocs = 0;
+  stats_.num_heap_allocs = 0;
+}
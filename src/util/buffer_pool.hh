@@ -0,0 +1,124 @@
+#ifndef BUFFER_POOL_HH
+#define BUFFER_POOL_HH
+
+#include <cstdint>
+#include <string_view>
+#include <array>
+
+class BufferPool;
+
+// reference-counted buffer (not thread-safe): copies share the same bytes,
+// which are freed, or recycled into the BufferPool that allocated them, once
+// the last copy is gone
+class SharedBuffer
+{
+public:
+  // an empty buffer
+  SharedBuffer() {}
+
+  // a standalone (unpooled) buffer of 'size' uninitialized bytes
+  explicit SharedBuffer(const size_t size);
+
+  ~SharedBuffer() { release(); }
+
+  // copying shares the buffer
+  SharedBuffer(const SharedBuffer & other);
+  SharedBuffer & operator=(const SharedBuffer & other);
+
+  SharedBuffer(SharedBuffer && other) noexcept;
+  SharedBuffer & operator=(SharedBuffer && other) noexcept;
+
+  // accessors
+  char * data() const;
+  size_t size() const;
+  std::string_view str() const { return {data(), size()}; }
+
+  // number of SharedBuffers sharing this buffer (0 if empty)
+  unsigned int use_count() const;
+
+  explicit operator bool() const { return slab_ != nullptr; }
+  bool operator==(const SharedBuffer & other) const { return slab_ == other.slab_; }
+  bool operator!=(const SharedBuffer & other) const { return slab_ != other.slab_; }
+
+private:
+  friend class BufferPool;
+
+  // header of a slab, immediately followed by its bytes
+  struct Slab
+  {
+    BufferPool * pool;   // nullptr if standalone
+    unsigned int refcount;
+    size_t size;         // bytes requested
+    size_t capacity;     // bytes allocated
+    Slab * next_free;    // next slab in the pool's free list
+  };
+
+  Slab * slab_ {nullptr};
+
+  explicit SharedBuffer(Slab * slab) : slab_(slab) {}
+
+  // drop this reference
+  void release();
+
+  static Slab * alloc_slab(BufferPool * pool, const size_t capacity);
+  static void free_slab(Slab * slab);
+};
+
+// pool of slabs in power-of-two size classes to allocate SharedBuffers from,
+// so that buffers of similar sizes (e.g., encoded frames) reuse memory rather
+// than reaching the heap every time; must outlive the buffers it allocates
+class BufferPool
+{
+public:
+  BufferPool() {}
+  ~BufferPool();
+
+  // a buffer of 'size' uninitialized bytes
+  SharedBuffer alloc(const size_t size);
+
+  struct Stats
+  {
+    uint64_t num_allocs {0};      // buffers allocated
+    uint64_t num_heap_allocs {0}; // ...of which needed a new slab from heap
+    size_t slabs_in_use {0};      // slabs held by SharedBuffers
+    size_t slabs_free {0};        // slabs kept for reuse
+    size_t bytes_pooled {0};      // capacity of all the slabs
+  };
+
+  const Stats & stats() const { return stats_; }
+
+  // reset the counters of allocations (but not the usage)
+  void reset_alloc_stats();
+
+  // forbid copying and moving
+  BufferPool(const BufferPool & other) = delete;
+  const BufferPool & operator=(const BufferPool & other) = delete;
+  BufferPool(BufferPool && other) = delete;
+  BufferPool & operator=(BufferPool && other) = delete;
+
+private:
+  friend class SharedBuffer;
+
+  // size class c holds slabs of (MIN_SLAB_SIZE << c) bytes
+  static constexpr size_t MIN_SLAB_SIZE = 4096;
+  static constexpr size_t NUM_CLASSES = 40;
+
+  // free slabs kept per size class before returning the rest to heap
+  static constexpr size_t MAX_FREE_SLABS = 64;
+
+  struct FreeList
+  {
+    SharedBuffer::Slab * head {nullptr};
+    size_t size {0};
+  };
+
+  std::array<FreeList, NUM_CLASSES> free_lists_ {};
+  Stats stats_ {};
+
+  // recycle a slab that is no longer referenced
+  void recycle(SharedBuffer::Slab * slab);
+
+  static size_t size_class(const size_t capacity);
+};
+
+#endif /* BUFFER_POOL_HH */
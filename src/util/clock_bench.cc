@@ -0,0 +1,140 @@
+#include <time.h>
+#include <getopt.h>
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <algorithm>
+
+#include "mono_clock.hh"
+#include "timestamp.hh"
+#include "conversion.hh"
+
+using namespace std;
+using namespace chrono;
+
+void print_usage(const string & program_name)
+{
+  cerr <<
+  "Usage: " << program_name << " [options]\n\n"
+  "Reports the time per call (ns) of the clock sources for timestamps, and\n"
+  "how far mono_ns() deviates from CLOCK_MONOTONIC over time.\n\n"
+  "Options:\n"
+  "--calls <N>          calls per clock source (default: 10000000)\n"
+  "--duration <S>       seconds to compare mono_ns() against CLOCK_MONOTONIC\n"
+  "                     (default: 3)"
+  << endl;
+}
+
+uint64_t clock_monotonic_ns()
+{
+  timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// mean nanoseconds per call of 'read_clock'
+template<typename F>
+double ns_per_call(const unsigned int num_calls, const F & read_clock)
+{
+  // sum up the readings so that the calls are not optimized away
+  uint64_t sum = 0;
+
+  const auto start = steady_clock::now();
+  for (unsigned int i = 0; i < num_calls; i++) {
+    sum += read_clock();
+  }
+  const auto end = steady_clock::now();
+
+  // never true, but the compiler can't tell
+  if (sum == 42) {
+    cerr << "";
+  }
+
+  return 1.0 * duration_cast<nanoseconds>(end - start).count() / num_calls;
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int num_calls = 10000000;
+  unsigned int duration_s = 3;
+
+  const option cmd_line_opts[] = {
+    {"calls",    required_argument, nullptr, 'N'},
+    {"duration", required_argument, nullptr, 'D'},
+    { nullptr,   0,                 nullptr,  0 },
+  };
+
+  while (true) {
+    const int opt = getopt_long(argc, argv, "", cmd_line_opts, nullptr);
+    if (opt == -1) {
+      break;
+    }
+
+    switch (opt) {
+      case 'N':
+        num_calls = strict_stoi(optarg);
+        break;
+      case 'D':
+        duration_s = strict_stoi(optarg);
+        break;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (optind != argc or num_calls == 0) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  cerr << "mono_ns() reads the TSC: "
+       << (mono_clock_uses_tsc() ? "yes" : "no (CLOCK_MONOTONIC)") << "\n"
+       << "Time per call (ns):\n"
+       << "  - timestamp_us() (system_clock): " << double_to_string(
+          ns_per_call(num_calls, timestamp_us)) << "\n"
+       << "  - steady_clock::now(): " << double_to_string(
+          ns_per_call(num_calls, []() {
+            return steady_clock::now().time_since_epoch().count(); })) << "\n"
+       << "  - clock_gettime(CLOCK_MONOTONIC): " << double_to_string(
+          ns_per_call(num_calls, clock_monotonic_ns)) << "\n"
+       << "  - mono_ns(): " << double_to_string(
+          ns_per_call(num_calls, mono_ns)) << endl;
+
+  // compare mono_ns() against CLOCK_MONOTONIC read right before and after
+  int64_t max_deviation_ns = 0;
+  uint64_t num_samples = 0;
+  uint64_t num_backward = 0;
+  uint64_t last_mono_ns = 0;
+
+  const uint64_t end_ns = clock_monotonic_ns() + duration_s * 1000000000ULL;
+  while (true) {
+    const uint64_t before_ns = clock_monotonic_ns();
+    const uint64_t curr_mono_ns = mono_ns();
+    const uint64_t after_ns = clock_monotonic_ns();
+
+    if (after_ns >= end_ns) {
+      break;
+    }
+
+    // deviation outside of [before_ns, after_ns]
+    int64_t deviation_ns = 0;
+    if (curr_mono_ns < before_ns) {
+      deviation_ns = before_ns - curr_mono_ns;
+    } else if (curr_mono_ns > after_ns) {
+      deviation_ns = curr_mono_ns - after_ns;
+    }
+
+    max_deviation_ns = max(max_deviation_ns, deviation_ns);
+    num_backward += (curr_mono_ns < last_mono_ns);
+    last_mono_ns = curr_mono_ns;
+    num_samples++;
+  }
+
+  cerr << "mono_ns() vs. CLOCK_MONOTONIC over " << duration_s << " s ("
+       << num_samples << " samples):\n"
+       << "  - Max deviation (ns): " << max_deviation_ns << "\n"
+       << "  - Went backward: " << num_backward << " times" << endl;
+
+  return EXIT_SUCCESS;
+}
@@ -6,8 +6,14 @@
 
 using namespace std;
 
+// global variables in an unnamed namespace
+namespace {
+  constexpr size_t INIT_MAX_EVENTS = 64;
+}
+
 Epoller::Epoller()
-  : epfd_(check_syscall(epoll_create1(EPOLL_CLOEXEC)))
+  : epfd_(check_syscall(epoll_create1(EPOLL_CLOEXEC))),
+    events_(INIT_MAX_EVENTS)
 {}
 
 Epoller::~Epoller()
@@ -18,41 +24,69 @@ Epoller::~Epoller()
   }
 }
 
+Epoller::Interest & Epoller::interest(const int fd)
+{
+  if (fd < 0 or static_cast<size_t>(fd) >= interests_.size()
+      or interests_[fd].registered == 0) {
+    throw runtime_error("fd is not registered");
+  }
+
+  return interests_[fd];
+}
+
 void Epoller::register_event(const int fd,
                              const Flag flag,
-                             const Callback callback)
+                             const Callback & callback)
 {
-  if (not roster_.count(fd)) { // fd is not registered yet
-    roster_[fd][flag] = callback;
-    active_events_[fd] = flag;
-    epoll_add(fd, flag);
+  if (fd < 0) {
+    throw runtime_error("invalid fd");
+  }
+
+  if (static_cast<size_t>(fd) >= interests_.size()) {
+    interests_.resize(fd + 1);
+  }
+
+  Interest & interest = interests_[fd];
+
+  if (interest.registered & flag) {
+    throw runtime_error("attempted to register the same event");
   }
-  else { // fd is registered but flag should not be registered yet
-    if (roster_[fd].count(flag)) {
-      throw runtime_error("attempted to register the same event");
-    }
 
-    roster_[fd][flag] = callback;
-    active_events_[fd] |= flag;
-    epoll_mod(fd, active_events_[fd]);
+  if (flag == In) {
+    interest.in = callback;
+  } else {
+    interest.out = callback;
+  }
+
+  const bool new_fd = (interest.registered == 0);
+  interest.registered |= flag;
+  interest.active |= flag;
+  interest.armed |= flag;
+
+  if (new_fd) {
+    epoll_add(fd, interest.armed);
+  } else {
+    epoll_mod(fd, interest.armed);
   }
 }
 
 void Epoller::register_event(const FileDescriptor & fd,
                              const Flag flag,
-                             const Callback callback)
+                             const Callback & callback)
 {
   register_event(fd.fd_num(), flag, callback);
 }
 
 void Epoller::activate(const int fd, const Flag flag)
 {
-  uint32_t & active_events = active_events_.at(fd);
-
-  // activate only if not activated yet
-  if (not (active_events & flag)) {
-    active_events |= flag;
-    epoll_mod(fd, active_events);
+  Interest & interest = this->interest(fd);
+
+  // activate only if not activated yet; the edge might have been consumed
+  // while inactive, so have the kernel report the event if it is ready now
+  if (not (interest.active & flag)) {
+    interest.active |= flag;
+    interest.armed |= flag;
+    epoll_mod(fd, interest.armed);
   }
 }
 
@@ -63,13 +97,9 @@ void Epoller::activate(const FileDescriptor & fd, const Flag flag)
 
 void Epoller::deactivate(const int fd, const Flag flag)
 {
-  uint32_t & active_events = active_events_.at(fd);
-
-  // deactivate only if activated before
-  if (active_events & flag) {
-    active_events &= ~flag;
-    epoll_mod(fd, active_events);
-  }
+  // no system call: the kernel stops monitoring the event lazily, only
+  // if it occurs while inactive (see poll())
+  interest(fd).active &= ~flag;
 }
 
 void Epoller::deactivate(const FileDescriptor & fd, const Flag flag)
@@ -90,8 +120,7 @@ void Epoller::deregister(const FileDescriptor & fd)
 void Epoller::do_deregister()
 {
   for (const int fd : fds_to_deregister_) {
-    roster_.erase(fd);
-    active_events_.erase(fd);
+    interests_.at(fd) = {};
     check_syscall(epoll_ctl(epfd_, EPOLL_CTL_DEL, fd, nullptr));
   }
 
@@ -100,24 +129,47 @@ void Epoller::do_deregister()
 
 void Epoller::poll(const int timeout_ms)
 {
-  static constexpr size_t MAX_EVENTS = 32;
-  static epoll_event event_list[MAX_EVENTS];
-
   // first, deregister the fds that have been scheduled to deregister
   do_deregister();
 
-  int nfds = check_syscall(
-    epoll_wait(epfd_, event_list, MAX_EVENTS, timeout_ms));
+  const int nfds = check_syscall(
+    epoll_wait(epfd_, events_.data(), events_.size(), timeout_ms));
 
   for (int i = 0; i < nfds; i++) {
-    int fd = event_list[i].data.fd;
-    uint32_t revents = event_list[i].events;
+    const int fd = events_[i].data.fd;
+    const uint32_t revents = events_[i].events;
+    Interest & interest = interests_[fd];
+
+    // an event that occurs while inactive is no longer monitored
+    uint32_t inactive = 0;
+
+    if (revents & In) {
+      if (interest.active & In) {
+        interest.in(); // execute the callback function
+      } else {
+        inactive |= In;
+      }
+    }
 
-    for (const auto & [flag, callback] : roster_.at(fd)) {
-      if (revents & flag) {
-        callback(); // execute the callback function
+    if (revents & Out) {
+      if (interest.active & Out) {
+        interest.out(); // execute the callback function
+      } else {
+        inactive |= Out;
       }
     }
+
+    // the callbacks might have activated the events in the meantime
+    inactive &= interest.armed & ~interest.active;
+    if (inactive) {
+      interest.armed &= ~inactive;
+      epoll_mod(fd, interest.armed);
+    }
+  }
+
+  // more events might have been ready; make room for them next time
+  if (static_cast<size_t>(nfds) == events_.size()) {
+    events_.resize(events_.size() * 2);
   }
 }
 
@@ -125,7 +177,7 @@ void Epoller::epoll_add(const int fd, const uint32_t events)
 {
   epoll_event ev;
   ev.data.fd = fd;
-  ev.events = events;
+  ev.events = events | EPOLLET;
 
   check_syscall(epoll_ctl(epfd_, EPOLL_CTL_ADD, fd, &ev));
 }
@@ -134,7 +186,7 @@ void Epoller::epoll_mod(const int fd, const uint32_t events)
 {
   epoll_event ev;
   ev.data.fd = fd;
-  ev.events = events;
+  ev.events = events | EPOLLET;
 
   check_syscall(epoll_ctl(epfd_, EPOLL_CTL_MOD, fd, &ev));
 }
@@ -3,12 +3,16 @@
 
 #include <sys/epoll.h>
 
-#include <unordered_map>
+#include <deque>
 #include <unordered_set>
-#include <functional>
+#include <vector>
 
 #include "file_descriptor.hh"
+#include "inline_callback.hh"
 
+// edge-triggered event loop: a callback is executed only when its event
+// occurs anew, so it must consume all the input (or output space) available,
+// e.g., read until EWOULDBLOCK, or it might not be executed again
 class Epoller
 {
 public:
@@ -18,7 +22,8 @@ public:
     Out = EPOLLOUT
   };
 
-  using Callback = std::function<void()>;
+  // stored inline in the dispatch table (no heap allocation or indirection)
+  using Callback = InlineCallback<64>;
 
   Epoller();
   ~Epoller();
@@ -29,10 +34,10 @@ public:
   // register a single event (flag) on fd to monitor with a callback function
   void register_event(const int fd,
                       const Flag flag,
-                      const Callback callback);
+                      const Callback & callback);
   void register_event(const FileDescriptor & fd,
                       const Flag flag,
-                      const Callback callback);
+                      const Callback & callback);
 
   // activate an event on fd (safe to be called repeatedly)
   void activate(const int fd, const Flag flag);
@@ -49,7 +54,27 @@ public:
   // execute the callbacks on the ready fds
   void poll(const int timeout_ms = -1);
 
+  // forbid copying and moving
+  Epoller(const Epoller & other) = delete;
+  const Epoller & operator=(const Epoller & other) = delete;
+  Epoller(Epoller && other) = delete;
+  Epoller & operator=(Epoller && other) = delete;
+
 private:
+  // state of a fd in the dispatch table
+  struct Interest
+  {
+    uint32_t registered {0}; // registered events (bitmask)
+    uint32_t active {0};     // currently active events (bitmask)
+    uint32_t armed {0};      // events monitored by the kernel (bitmask)
+
+    Callback in {};
+    Callback out {};
+  };
+
+  // look up the state of a registered fd
+  Interest & interest(const int fd);
+
   // add fd to the interest list and monitor provided events
   void epoll_add(const int fd, const uint32_t events);
 
@@ -62,11 +87,12 @@ private:
   // data members
   int epfd_;
 
-  // fd -> {flag (bit value) -> callback}
-  std::unordered_map<int, std::unordered_map<Flag, Callback>> roster_ {};
+  // dispatch table indexed by fd; a deque keeps the callbacks in place
+  // even if a callback registers a new fd and the table grows
+  std::deque<Interest> interests_ {};
 
-  // fd -> currently active events (bitmask)
-  std::unordered_map<int, uint32_t> active_events_ {};
+  // ready events returned by epoll_wait() (grows if filled up)
+  std::vector<epoll_event> events_;
 
   // fds scheduled to deregister
   std::unordered_set<int> fds_to_deregister_ {};
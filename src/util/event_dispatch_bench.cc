@@ -0,0 +1,153 @@
+#include <sys/eventfd.h>
+#include <getopt.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "poller.hh"
+#include "epoller.hh"
+#include "uring_poller.hh"
+#include "exception.hh"
+#include "conversion.hh"
+
+using namespace std;
+using namespace chrono;
+
+void print_usage(const string & program_name)
+{
+  cerr <<
+  "Usage: " << program_name << " [options]\n\n"
+  "Makes K of the eventfds registered with an event loop ready at a time\n"
+  "and reports the time spent in poll() to dispatch each ready event to its\n"
+  "callback with Poller, Epoller, and URingPoller (readiness-based).\n\n"
+  "Options:\n"
+  "--rounds <N>         rounds of K ready events per K (default: 10000)\n"
+  "--idle <N>           registered eventfds that are never ready (default: 100)"
+  << endl;
+}
+
+// numbers of ready events in a round
+const vector<size_t> READY_COUNTS = {1, 8, 64, 256};
+
+// an eventfd to make readable and reset
+class EventFD : public FileDescriptor
+{
+public:
+  EventFD()
+    : FileDescriptor(check_syscall(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)))
+  {}
+
+  void signal()
+  {
+    const uint64_t one = 1;
+    check_syscall(::write(fd_num(), &one, sizeof(one)));
+  }
+
+  void reset()
+  {
+    uint64_t count;
+    check_syscall(::read(fd_num(), &count, sizeof(count)));
+  }
+};
+
+// mean nanoseconds spent in poll() per event dispatched
+template<typename Loop>
+double run(const unsigned int num_rounds, const size_t num_idle,
+           const size_t num_ready)
+{
+  vector<EventFD> ready_fds(num_ready);
+  vector<EventFD> idle_fds(num_idle);
+
+  Loop loop;
+  size_t num_dispatched = 0;
+
+  // the callbacks only count (the eventfds are reset outside the timing)
+  for (auto & fd : ready_fds) {
+    loop.register_event(fd, Loop::In, [&num_dispatched]() { num_dispatched++; });
+  }
+
+  for (auto & fd : idle_fds) {
+    loop.register_event(fd, Loop::In, [&num_dispatched]() { num_dispatched++; });
+  }
+
+  nanoseconds elapsed {0};
+
+  for (unsigned int round = 0; round < num_rounds; round++) {
+    for (auto & fd : ready_fds) {
+      fd.signal();
+    }
+
+    num_dispatched = 0;
+    const auto start = steady_clock::now();
+
+    // usually one poll() dispatches all the ready events
+    while (num_dispatched < num_ready) {
+      loop.poll(0);
+    }
+
+    elapsed += steady_clock::now() - start;
+
+    if (num_dispatched != num_ready) {
+      throw runtime_error("dispatched an unexpected number of events");
+    }
+
+    for (auto & fd : ready_fds) {
+      fd.reset();
+    }
+  }
+
+  return 1.0 * elapsed.count() / (1.0 * num_rounds * num_ready);
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int num_rounds = 10000;
+  size_t num_idle = 100;
+
+  const option cmd_line_opts[] = {
+    {"rounds", required_argument, nullptr, 'N'},
+    {"idle",   required_argument, nullptr, 'I'},
+    { nullptr, 0,                 nullptr,  0 },
+  };
+
+  while (true) {
+    const int opt = getopt_long(argc, argv, "", cmd_line_opts, nullptr);
+    if (opt == -1) {
+      break;
+    }
+
+    switch (opt) {
+      case 'N':
+        num_rounds = strict_stoi(optarg);
+        break;
+      case 'I':
+        num_idle = strict_stoi(optarg);
+        break;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (optind != argc or num_rounds == 0) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  cerr << "Rounds: " << num_rounds << " per K, idle eventfds: "
+       << num_idle << endl;
+
+  for (const size_t num_ready : READY_COUNTS) {
+    cerr << "K = " << num_ready << " ready events, dispatch time per event (ns):\n"
+         << "  - Poller: " << double_to_string(
+            run<Poller>(num_rounds, num_idle, num_ready)) << "\n"
+         << "  - Epoller: " << double_to_string(
+            run<Epoller>(num_rounds, num_idle, num_ready)) << "\n"
+         << "  - URingPoller: " << double_to_string(
+            run<URingPoller>(num_rounds, num_idle, num_ready)) << endl;
+  }
+
+  return EXIT_SUCCESS;
+}
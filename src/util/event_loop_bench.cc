@@ -0,0 +1,272 @@
+#include <getopt.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <type_traits>
+
+#include "poller.hh"
+#include "epoller.hh"
+#include "uring_poller.hh"
+#include "timerfd.hh"
+#include "udp_socket.hh"
+#include "conversion.hh"
+#include "timestamp.hh"
+
+using namespace std;
+using namespace chrono;
+
+// global variables in an unnamed namespace
+namespace {
+  constexpr size_t DATAGRAM_SIZE = 1400; // bytes
+  constexpr size_t ACK_SIZE = 16; // bytes
+  constexpr size_t MAX_RECV_BATCH = 64;
+
+  // a burst of datagrams is sent every tick
+  constexpr auto TICK_INTERVAL = 1ms;
+}
+
+void print_usage(const string & program_name)
+{
+  cerr <<
+  "Usage: " << program_name << " [options]\n\n"
+  "Sends a burst of datagrams every 1 ms over loopback to a socket that\n"
+  "acks each datagram, handling the timer and both sockets in one event\n"
+  "loop, and reports system calls and CPU time per datagram and the delay\n"
+  "in dispatching timer expirations with Poller, Epoller, and URingPoller\n"
+  "(readiness-based and completion-based I/O).\n\n"
+  "Options:\n"
+  "--rate <N>           datagrams per second (default: 10000)\n"
+  "--duration <S>       seconds to run each event loop (default: 5)"
+  << endl;
+}
+
+enum class Mode {
+  POLL,             // Poller
+  EPOLL,            // Epoller
+  URING,            // URingPoller with readiness-based I/O
+  URING_COMPLETION  // URingPoller with completion-based I/O
+};
+
+string mode_name(const Mode mode)
+{
+  switch (mode) {
+    case Mode::POLL: return "Poller";
+    case Mode::EPOLL: return "Epoller";
+    case Mode::URING: return "URingPoller (readiness)";
+    case Mode::URING_COMPLETION: return "URingPoller (completion)";
+    default: return "unknown";
+  }
+}
+
+struct BenchResult
+{
+  size_t syscalls {0};
+  size_t datagrams_received {0};
+  size_t acks_received {0};
+  size_t ticks {0};
+  uint64_t timer_delay_us {0}; // total
+  uint64_t cpu_us {0};
+  uint64_t wall_us {0};
+};
+
+template<typename Loop, bool completion>
+BenchResult run(const unsigned int rate, const unsigned int duration_s)
+{
+  UDPSocket receiver;
+  receiver.bind({"127.0.0.1", 0});
+
+  UDPSocket sender;
+  sender.connect(receiver.local_address());
+  receiver.connect(sender.local_address());
+
+  // completion-based I/O waits in the kernel instead of EWOULDBLOCK
+  sender.set_blocking(completion);
+  receiver.set_blocking(completion);
+
+  const size_t burst_size = max<size_t>(
+      rate * duration_cast<microseconds>(TICK_INTERVAL).count() / 1000000, 1);
+  const string payload(DATAGRAM_SIZE, 'x');
+  const string ack(ACK_SIZE, 'a');
+
+  UDPSocket::RecvBuffers data_bufs(MAX_RECV_BATCH);
+  UDPSocket::RecvBuffers ack_bufs(MAX_RECV_BATCH);
+
+  BenchResult result;
+
+  // send a vector of serialized datagrams (as the apps do)
+  const auto send = [&](Loop & loop, UDPSocket & sock, vector<string> && wire)
+  {
+    if constexpr (completion) {
+      sock.submit_send_batch(loop, move(wire));
+    } else {
+      const vector<string_view> views(wire.begin(), wire.end());
+      sock.send_batch(views);
+      result.syscalls++;
+    }
+  };
+
+  // declared last to be destroyed first, i.e., before any buffers in use
+  Loop loop;
+
+  Timerfd timer;
+  const auto tick_start = steady_clock::now();
+  const timespec interval {0, duration_cast<nanoseconds>(TICK_INTERVAL).count()};
+  timer.set_time(interval, interval);
+
+  // send a burst of datagrams every time the timer fires
+  const auto on_tick = [&](const unsigned int num_exp)
+  {
+    result.ticks += num_exp;
+
+    // delay since the last expiration
+    const auto delay = steady_clock::now() - tick_start
+                       - result.ticks * TICK_INTERVAL;
+    result.timer_delay_us += max<int64_t>(
+        duration_cast<microseconds>(delay).count(), 0);
+
+    send(loop, sender, vector<string>(burst_size, payload));
+  };
+
+  // ack every datagram received
+  const auto on_data = [&]()
+  {
+    result.datagrams_received += data_bufs.size();
+    send(loop, receiver, vector<string>(data_bufs.size(), ack));
+  };
+
+  const auto on_acks = [&]()
+  {
+    result.acks_received += ack_bufs.size();
+  };
+
+  if constexpr (completion) {
+    timer.set_blocking(true);
+    timer.submit_read_expirations(loop, on_tick);
+
+    receiver.submit_recv(loop, data_bufs, on_data);
+    sender.submit_recv(loop, ack_bufs, on_acks);
+  } else {
+    loop.register_event(timer, Loop::In,
+      [&]()
+      {
+        result.syscalls++;
+        on_tick(timer.read_expirations());
+      }
+    );
+
+    // receive in batches until EWOULDBLOCK
+    loop.register_event(receiver, Loop::In,
+      [&]()
+      {
+        while (result.syscalls++, receiver.recv_batch(data_bufs) > 0) {
+          on_data();
+        }
+      }
+    );
+
+    loop.register_event(sender, Loop::In,
+      [&]()
+      {
+        while (result.syscalls++, sender.recv_batch(ack_bufs) > 0) {
+          on_acks();
+        }
+      }
+    );
+  }
+
+  const uint64_t cpu_start = cpu_time_us();
+  const auto wall_start = steady_clock::now();
+  const auto wall_end = wall_start + seconds(duration_s);
+
+  size_t num_polls = 0;
+  while (steady_clock::now() < wall_end) {
+    loop.poll(-1);
+    num_polls++;
+  }
+
+  result.cpu_us = cpu_time_us() - cpu_start;
+  result.wall_us = duration_cast<microseconds>(
+                   steady_clock::now() - wall_start).count();
+
+  if constexpr (is_same_v<Loop, URingPoller>) {
+    result.syscalls += loop.num_enter_calls();
+  } else {
+    result.syscalls += num_polls;
+  }
+
+  return result;
+}
+
+BenchResult run(const Mode mode, const unsigned int rate,
+                const unsigned int duration_s)
+{
+  switch (mode) {
+    case Mode::POLL: return run<Poller, false>(rate, duration_s);
+    case Mode::EPOLL: return run<Epoller, false>(rate, duration_s);
+    case Mode::URING: return run<URingPoller, false>(rate, duration_s);
+    case Mode::URING_COMPLETION: return run<URingPoller, true>(rate, duration_s);
+    default: throw runtime_error("unknown mode");
+  }
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int rate = 10000;
+  unsigned int duration_s = 5;
+
+  const option cmd_line_opts[] = {
+    {"rate",     required_argument, nullptr, 'R'},
+    {"duration", required_argument, nullptr, 'D'},
+    { nullptr,   0,                 nullptr,  0 },
+  };
+
+  while (true) {
+    const int opt = getopt_long(argc, argv, "", cmd_line_opts, nullptr);
+    if (opt == -1) {
+      break;
+    }
+
+    switch (opt) {
+      case 'R':
+        rate = strict_stoi(optarg);
+        break;
+      case 'D':
+        duration_s = strict_stoi(optarg);
+        break;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (optind != argc or rate == 0 or duration_s == 0) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  cerr << "Rate: " << rate << " datagrams/s, duration: " << duration_s
+       << " s per event loop" << endl;
+
+  for (const Mode mode : {Mode::POLL, Mode::EPOLL, Mode::URING,
+                          Mode::URING_COMPLETION}) {
+    const auto result = run(mode, rate, duration_s);
+    const size_t num_datagrams = max<size_t>(result.datagrams_received, 1);
+
+    cerr << mode_name(mode) << ":\n"
+         << "  - Syscalls per datagram: "
+         << double_to_string(1.0 * result.syscalls / num_datagrams) << "\n"
+         << "  - CPU time per datagram (us): "
+         << double_to_string(1.0 * result.cpu_us / num_datagrams) << "\n"
+         << "  - Mean timer dispatch delay (us): "
+         << double_to_string(1.0 * result.timer_delay_us
+                             / max<size_t>(result.ticks, 1)) << "\n"
+         << "  - Datagrams (ACKs) received per second: "
+         << double_to_string(1e6 * result.datagrams_received / result.wall_us)
+         << " (" << double_to_string(1e6 * result.acks_received / result.wall_us)
+         << ")" << endl;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -3,6 +3,8 @@
 
 #include <system_error>
 #include <stdexcept>
+#include <string>
+#include <string_view>
 
 class unix_error : public std::system_error
 {
@@ -30,12 +32,14 @@ inline int check_syscall(const int return_value, const std::string & tag)
   throw unix_error(tag);
 }
 
+// the error message is a string_view so that a successful call (e.g., for
+// every frame) does not construct a string
 template<typename T>
 inline void check_call(const T & actual_return, const T & expected_return,
-                       const std::string & error_msg = "check_call")
+                       const std::string_view error_msg = "check_call")
 {
   if (actual_return != expected_return) {
-    throw std::runtime_error(error_msg);
+    throw std::runtime_error(std::string(error_msg));
   }
 }
 
@@ -0,0 +1,171 @@
+#include <getopt.h>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <cstring>
+#include <algorithm>
+
+#include "gf256.hh"
+#include "reed_solomon.hh"
+#include "conversion.hh"
+
+using namespace std;
+using namespace chrono;
+
+void print_usage(const string & program_name)
+{
+  cerr <<
+  "Usage: " << program_name << " [options]\n\n"
+  "Reports the throughput (GB/s of data shards) of Reed-Solomon encoding and\n"
+  "of recovering the max number of missing data shards, with each GF(256)\n"
+  "kernel supported by the CPU.\n\n"
+  "Options:\n"
+  "--data <k>           data shards (default: 32)\n"
+  "--parity <m>         parity shards (default: 8)\n"
+  "--shard-size <B>     bytes per shard (default: 1400)\n"
+  "--rounds <N>         rounds of encoding and decoding (default: 20000)"
+  << endl;
+}
+
+// GB/s of 'bytes' processed 'num_rounds' times by 'run'
+template<typename F>
+double gb_per_second(const size_t bytes, const unsigned int num_rounds,
+                     const F & run)
+{
+  const auto start = steady_clock::now();
+  for (unsigned int round = 0; round < num_rounds; round++) {
+    run(round);
+  }
+  const auto end = steady_clock::now();
+
+  return 1.0 * bytes * num_rounds / duration<double, nano>(end - start).count();
+}
+
+int main(int argc, char * argv[])
+{
+  size_t k = 32;
+  size_t m = 8;
+  size_t shard_size = 1400;
+  unsigned int num_rounds = 20000;
+
+  const option cmd_line_opts[] = {
+    {"data",       required_argument, nullptr, 'K'},
+    {"parity",     required_argument, nullptr, 'M'},
+    {"shard-size", required_argument, nullptr, 'S'},
+    {"rounds",     required_argument, nullptr, 'N'},
+    { nullptr,     0,                 nullptr,  0 },
+  };
+
+  while (true) {
+    const int opt = getopt_long(argc, argv, "", cmd_line_opts, nullptr);
+    if (opt == -1) {
+      break;
+    }
+
+    switch (opt) {
+      case 'K':
+        k = strict_stoi(optarg);
+        break;
+      case 'M':
+        m = strict_stoi(optarg);
+        break;
+      case 'S':
+        shard_size = strict_stoi(optarg);
+        break;
+      case 'N':
+        num_rounds = strict_stoi(optarg);
+        break;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (optind != argc or k == 0 or m == 0 or k + m > 256 or
+      shard_size == 0 or num_rounds == 0) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  const ReedSolomon rs(k, m);
+
+  // random data shards followed by the parity shards
+  vector<uint8_t> original((k + m) * shard_size);
+  mt19937 prng(0);
+  for (size_t i = 0; i < k * shard_size; i++) {
+    original[i] = prng();
+  }
+
+  vector<const uint8_t *> data;
+  vector<uint8_t *> parity;
+  for (size_t i = 0; i < k; i++) {
+    data.emplace_back(&original[i * shard_size]);
+  }
+  for (size_t j = 0; j < m; j++) {
+    parity.emplace_back(&original[(k + j) * shard_size]);
+  }
+
+  rs.encode(data, parity, shard_size);
+
+  // the shards to decode: the first min(k, m) data shards are missing
+  const size_t num_missing = min(k, m);
+  vector<uint8_t> received(original.size());
+  vector<uint8_t *> shards;
+  vector<bool> present(k + m, true);
+  for (size_t i = 0; i < k + m; i++) {
+    shards.emplace_back(&received[i * shard_size]);
+  }
+  for (size_t i = 0; i < num_missing; i++) {
+    present[i] = false;
+  }
+
+  cerr << "Reed-Solomon: " << k << " data + " << m << " parity shards of "
+       << shard_size << " bytes, " << num_missing << " missing\n"
+       << "Throughput (GB/s of data shards):" << endl;
+
+  const GF256Kernel default_kernel = gf256_kernel();
+
+  for (const auto kernel : {GF256Kernel::SCALAR, GF256Kernel::SSSE3,
+                            GF256Kernel::AVX2}) {
+    if (not gf256_set_kernel(kernel)) {
+      cerr << "  - " << gf256_kernel_name(kernel) << ": unsupported" << endl;
+      continue;
+    }
+
+    const double encode_rate = gb_per_second(k * shard_size, num_rounds,
+      [&](const unsigned int) { rs.encode(data, parity, shard_size); });
+
+    // decoding overwrites the parity shards, so restore them (and wipe the
+    // missing data shards) every round, which is included in the time
+    memcpy(received.data(), original.data(), received.size());
+
+    bool ok = true;
+    const double decode_rate = gb_per_second(k * shard_size, num_rounds,
+      [&](const unsigned int round)
+      {
+        memset(received.data(), 0, num_missing * shard_size);
+        memcpy(&received[k * shard_size], &original[k * shard_size],
+               m * shard_size);
+        ok &= rs.reconstruct(shards, present, shard_size);
+
+        if (round == 0) {
+          ok &= memcmp(received.data(), original.data(), k * shard_size) == 0;
+        }
+      }
+    );
+
+    if (not ok) {
+      cerr << "Error: data shards were not recovered correctly" << endl;
+      return EXIT_FAILURE;
+    }
+
+    cerr << "  - " << gf256_kernel_name(kernel)
+         << (kernel == default_kernel ? " (default)" : "") << ": encode "
+         << double_to_string(encode_rate) << ", decode "
+         << double_to_string(decode_rate) << endl;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,267 @@
+#include <cstring>
+#include <initializer_list>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GF256_X86 1
+#endif
+
+#include "gf256.hh"
+
+using namespace std;
+
+namespace {
+  constexpr unsigned int POLYNOMIAL = 0x11d;
+
+  struct Tables
+  {
+    uint8_t exp[512]; // exp[i] = 2^i (doubled to skip a modulo in mul)
+    uint8_t log[256]; // log[2^i] = i (log[0] is unused)
+    uint8_t mul[256][256];
+
+    // products of each constant and the low/high nibbles, for pshufb
+    alignas(16) uint8_t mul_lo[256][16];
+    alignas(16) uint8_t mul_hi[256][16];
+
+    Tables() : exp(), log(), mul(), mul_lo(), mul_hi()
+    {
+      unsigned int x = 1;
+      for (unsigned int i = 0; i < 255; i++) {
+        exp[i] = exp[i + 255] = x;
+        log[x] = i;
+
+        x <<= 1;
+        if (x & 0x100) {
+          x ^= POLYNOMIAL;
+        }
+      }
+
+      for (unsigned int a = 1; a < 256; a++) {
+        for (unsigned int b = 1; b < 256; b++) {
+          mul[a][b] = exp[log[a] + log[b]];
+        }
+      }
+
+      for (unsigned int c = 0; c < 256; c++) {
+        for (unsigned int x = 0; x < 16; x++) {
+          mul_lo[c][x] = mul[c][x];
+          mul_hi[c][x] = mul[c][x << 4];
+        }
+      }
+    }
+  };
+
+  const Tables & tables()
+  {
+    static const Tables t;
+    return t;
+  }
+
+  template<bool ADD>
+  void mul_scalar(const uint8_t c, const uint8_t * src, uint8_t * dst,
+                  const size_t len)
+  {
+    const uint8_t * row = tables().mul[c];
+
+    for (size_t i = 0; i < len; i++) {
+      dst[i] = ADD ? dst[i] ^ row[src[i]] : row[src[i]];
+    }
+  }
+
+#ifdef GF256_X86
+  template<bool ADD>
+  __attribute__((target("ssse3")))
+  void mul_ssse3(const uint8_t c, const uint8_t * src, uint8_t * dst,
+                 const size_t len)
+  {
+    const Tables & t = tables();
+    const __m128i lo = _mm_load_si128(reinterpret_cast<const __m128i *>(t.mul_lo[c]));
+    const __m128i hi = _mm_load_si128(reinterpret_cast<const __m128i *>(t.mul_hi[c]));
+    const __m128i mask = _mm_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+      const __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + i));
+
+      // c * s = c * (low nibble) ^ c * (high nibble << 4)
+      __m128i p = _mm_xor_si128(
+          _mm_shuffle_epi8(lo, _mm_and_si128(s, mask)),
+          _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi64(s, 4), mask)));
+
+      if (ADD) {
+        p = _mm_xor_si128(p, _mm_loadu_si128(reinterpret_cast<const __m128i *>(dst + i)));
+      }
+
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + i), p);
+    }
+
+    mul_scalar<ADD>(c, src + i, dst + i, len - i);
+  }
+
+  template<bool ADD>
+  __attribute__((target("avx2")))
+  void mul_avx2(const uint8_t c, const uint8_t * src, uint8_t * dst,
+                const size_t len)
+  {
+    const Tables & t = tables();
+
+    // the same table in both 128-bit lanes, as vpshufb looks up per lane
+    const __m256i lo = _mm256_broadcastsi128_si256(
+        _mm_load_si128(reinterpret_cast<const __m128i *>(t.mul_lo[c])));
+    const __m256i hi = _mm256_broadcastsi128_si256(
+        _mm_load_si128(reinterpret_cast<const __m128i *>(t.mul_hi[c])));
+    const __m256i mask = _mm256_set1_epi8(0x0f);
+
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+      const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + i));
+
+      __m256i p = _mm256_xor_si256(
+          _mm256_shuffle_epi8(lo, _mm256_and_si256(s, mask)),
+          _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(s, 4), mask)));
+
+      if (ADD) {
+        p = _mm256_xor_si256(p, _mm256_loadu_si256(reinterpret_cast<const __m256i *>(dst + i)));
+      }
+
+      _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + i), p);
+    }
+
+    mul_ssse3<ADD>(c, src + i, dst + i, len - i);
+  }
+#endif
+
+  bool kernel_supported(const GF256Kernel kernel)
+  {
+    switch (kernel) {
+      case GF256Kernel::SCALAR:
+        return true;
+#ifdef GF256_X86
+      case GF256Kernel::SSSE3:
+        return __builtin_cpu_supports("ssse3");
+      case GF256Kernel::AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+      default:
+        return false;
+    }
+  }
+
+  struct Dispatch
+  {
+    GF256Kernel kernel {GF256Kernel::SCALAR};
+    void (*mul_add)(const uint8_t, const uint8_t *, uint8_t *, const size_t)
+        {mul_scalar<true>};
+    void (*mul)(const uint8_t, const uint8_t *, uint8_t *, const size_t)
+        {mul_scalar<false>};
+
+    void set(const GF256Kernel _kernel)
+    {
+      kernel = _kernel;
+
+      switch (kernel) {
+#ifdef GF256_X86
+        case GF256Kernel::SSSE3:
+          mul_add = mul_ssse3<true>;
+          mul = mul_ssse3<false>;
+          break;
+        case GF256Kernel::AVX2:
+          mul_add = mul_avx2<true>;
+          mul = mul_avx2<false>;
+          break;
+#endif
+        default:
+          mul_add = mul_scalar<true>;
+          mul = mul_scalar<false>;
+          break;
+      }
+    }
+
+    // the fastest kernel supported
+    Dispatch()
+    {
+      for (const auto k : {GF256Kernel::AVX2, GF256Kernel::SSSE3}) {
+        if (kernel_supported(k)) {
+          set(k);
+          return;
+        }
+      }
+    }
+  };
+
+  Dispatch & dispatch()
+  {
+    static Dispatch d;
+    return d;
+  }
+}
+
+uint8_t gf256_mul(const uint8_t a, const uint8_t b)
+{
+  return tables().mul[a][b];
+}
+
+uint8_t gf256_div(const uint8_t a, const uint8_t b)
+{
+  if (a == 0) {
+    return 0;
+  }
+
+  const Tables & t = tables();
+  return t.exp[t.log[a] + 255 - t.log[b]];
+}
+
+uint8_t gf256_inv(const uint8_t a)
+{
+  return gf256_div(1, a);
+}
+
+void gf256_mul_add(const uint8_t c, const uint8_t * src, uint8_t * dst,
+                   const size_t len)
+{
+  if (c == 0) {
+    return;
+  }
+
+  dispatch().mul_add(c, src, dst, len);
+}
+
+void gf256_mul(const uint8_t c, const uint8_t * src, uint8_t * dst,
+               const size_t len)
+{
+  if (c == 0) {
+    memset(dst, 0, len);
+    return;
+  }
+
+  dispatch().mul(c, src, dst, len);
+}
+
+GF256Kernel gf256_kernel()
+{
+  return dispatch().kernel;
+}
+
+bool gf256_set_kernel(const GF256Kernel kernel)
+{
+  if (not kernel_supported(kernel)) {
+    return false;
+  }
+
+  dispatch().set(kernel);
+  return true;
+}
+
+const char * gf256_kernel_name(const GF256Kernel kernel)
+{
+  switch (kernel) {
+    case GF256Kernel::SCALAR:
+      return "scalar";
+    case GF256Kernel::SSSE3:
+      return "SSSE3";
+    case GF256Kernel::AVX2:
+      return "AVX2";
+    default:
+      return "unknown";
+  }
+}
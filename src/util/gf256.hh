@@ -0,0 +1,40 @@
+#ifndef GF256_HH
+#define GF256_HH
+
+#include <cstdint>
+#include <cstddef>
+
+/* Arithmetic in GF(2^8) with the polynomial x^8 + x^4 + x^3 + x^2 + 1 (0x11d),
+ * where addition is XOR. The bulk kernels multiply a buffer by a constant
+ * with pshufb lookups of the products of the low and high nibbles (SSSE3:
+ * 16 bytes, AVX2: 32 bytes at a time) if the CPU supports them. */
+
+uint8_t gf256_mul(const uint8_t a, const uint8_t b);
+uint8_t gf256_div(const uint8_t a, const uint8_t b); /* b must not be 0 */
+uint8_t gf256_inv(const uint8_t a);                  /* a must not be 0 */
+
+/* dst[i] ^= c * src[i] for i in [0, len) */
+void gf256_mul_add(const uint8_t c, const uint8_t * src, uint8_t * dst,
+                   const size_t len);
+
+/* dst[i] = c * src[i] for i in [0, len) */
+void gf256_mul(const uint8_t c, const uint8_t * src, uint8_t * dst,
+               const size_t len);
+
+/* implementations of the bulk kernels */
+enum class GF256Kernel {
+  SCALAR, /* a 256-byte row of the multiplication table per constant */
+  SSSE3,
+  AVX2
+};
+
+/* the kernel in use (the fastest supported by default) */
+GF256Kernel gf256_kernel();
+
+/* use 'kernel' if supported by the CPU (e.g., for benchmarking); return
+ * false otherwise */
+bool gf256_set_kernel(const GF256Kernel kernel);
+
+const char * gf256_kernel_name(const GF256Kernel kernel);
+
+#endif /* GF256_HH */
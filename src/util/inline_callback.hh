@@ -0,0 +1,88 @@
+#ifndef INLINE_CALLBACK_HH
+#define INLINE_CALLBACK_HH
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// a void() callable (e.g., a lambda) stored inline in a fixed-size buffer;
+// unlike std::function, it never allocates on the heap, so invoking it only
+// costs an indirect call on data right next to the caller's
+template<size_t Capacity>
+class InlineCallback
+{
+public:
+  InlineCallback() {}
+
+  template<typename F, typename = std::enable_if_t<
+           not std::is_same_v<std::decay_t<F>, InlineCallback>>>
+  InlineCallback(F && f)
+    : ops_(&ops_of<std::decay_t<F>>)
+  {
+    using T = std::decay_t<F>;
+    static_assert(sizeof(T) <= Capacity,
+                  "callable is too large to be stored inline");
+    static_assert(alignof(T) <= alignof(std::max_align_t),
+                  "callable is over-aligned");
+
+    new (storage_) T(std::forward<F>(f));
+  }
+
+  InlineCallback(const InlineCallback & other)
+    : ops_(other.ops_)
+  {
+    if (ops_) {
+      ops_->copy(storage_, other.storage_);
+    }
+  }
+
+  InlineCallback & operator=(const InlineCallback & other)
+  {
+    if (this != &other) {
+      reset();
+
+      if (other.ops_) {
+        other.ops_->copy(storage_, other.storage_);
+        ops_ = other.ops_;
+      }
+    }
+
+    return *this;
+  }
+
+  ~InlineCallback() { reset(); }
+
+  explicit operator bool() const { return ops_ != nullptr; }
+
+  void operator()() { ops_->invoke(storage_); }
+
+private:
+  // operations on the type-erased callable
+  struct Ops
+  {
+    void (*invoke)(void * f);
+    void (*copy)(void * dst, const void * src);
+    void (*destroy)(void * f);
+  };
+
+  template<typename T>
+  static constexpr Ops ops_of {
+    [](void * f) { (*static_cast<T *>(f))(); },
+    [](void * dst, const void * src) { new (dst) T(*static_cast<const T *>(src)); },
+    [](void * f) { static_cast<T *>(f)->~T(); }
+  };
+
+  void reset()
+  {
+    if (ops_) {
+      ops_->destroy(storage_);
+      ops_ = nullptr;
+    }
+  }
+
+  const Ops * ops_ {nullptr};
+  alignas(std::max_align_t) unsigned char storage_[Capacity] {};
+};
+
+#endif /* INLINE_CALLBACK_HH */
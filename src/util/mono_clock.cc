@@ -0,0 +1,159 @@
+#include <time.h>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#define MONO_CLOCK_TSC 1
+#endif
+
+#include "mono_clock.hh"
+
+using namespace std;
+
+namespace {
+  // calibrate the TSC against CLOCK_MONOTONIC for this long at first use
+  constexpr uint64_t CALIBRATION_NS = 1000 * 1000; // 1 ms
+
+  // re-anchor the TSC to CLOCK_MONOTONIC this often, refining the TSC
+  // frequency with the time elapsed since the first anchor
+  constexpr uint64_t RESYNC_NS = 10 * 1000 * 1000; // 10 ms
+
+  uint64_t clock_ns(const clockid_t clock_id)
+  {
+    timespec ts;
+    clock_gettime(clock_id, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+  }
+
+#ifdef MONO_CLOCK_TSC
+  // TSC frequency measured at first use (shared by all threads)
+  struct TscCalibration
+  {
+    bool usable {false};
+    double ns_per_tick {0.0};
+
+    TscCalibration()
+    {
+      // the TSC must tick at a constant rate and keep ticking in deep
+      // C-states (invariant TSC, i.e., CPUID.80000007H:EDX[8])
+      unsigned int eax, ebx, ecx, edx;
+      if (not __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)
+          or not (edx & (1 << 8))) {
+        return;
+      }
+
+      const uint64_t start_ns = clock_ns(CLOCK_MONOTONIC);
+      const uint64_t start_tsc = __rdtsc();
+
+      uint64_t end_ns;
+      do {
+        end_ns = clock_ns(CLOCK_MONOTONIC);
+      } while (end_ns - start_ns < CALIBRATION_NS);
+
+      const uint64_t end_tsc = __rdtsc();
+      if (end_tsc <= start_tsc) {
+        return;
+      }
+
+      ns_per_tick = 1.0 * (end_ns - start_ns) / (end_tsc - start_tsc);
+      usable = true;
+    }
+  };
+
+  const TscCalibration & tsc_calibration()
+  {
+    static const TscCalibration calibration;
+    return calibration;
+  }
+
+  // TSC-to-CLOCK_MONOTONIC mapping of the calling thread
+  struct TscAnchor
+  {
+    bool initialized {false};
+
+    uint64_t first_tsc {0};
+    uint64_t first_ns {0};
+
+    uint64_t tsc {0};
+    uint64_t ns {0};
+    uint64_t resync_ticks {0};
+    double ns_per_tick {0.0};
+
+    uint64_t last_ns {0}; // the last time returned (never go backward)
+  };
+
+  thread_local TscAnchor tsc_anchor;
+
+  // slow path: re-anchor to CLOCK_MONOTONIC
+  void resync(TscAnchor & anchor)
+  {
+    const uint64_t ns = clock_ns(CLOCK_MONOTONIC);
+    const uint64_t tsc = __rdtsc();
+
+    if (not anchor.initialized) {
+      anchor.first_tsc = tsc;
+      anchor.first_ns = ns;
+      anchor.ns_per_tick = tsc_calibration().ns_per_tick;
+      anchor.initialized = true;
+    } else if (tsc > anchor.first_tsc and ns > anchor.first_ns) {
+      anchor.ns_per_tick = 1.0 * (ns - anchor.first_ns)
+                           / (tsc - anchor.first_tsc);
+    }
+
+    anchor.tsc = tsc;
+    anchor.ns = max(ns, anchor.last_ns);
+    anchor.resync_ticks = RESYNC_NS / anchor.ns_per_tick;
+  }
+#endif
+}
+
+uint64_t mono_ns()
+{
+#ifdef MONO_CLOCK_TSC
+  if (tsc_calibration().usable) {
+    TscAnchor & anchor = tsc_anchor;
+    const uint64_t tsc = __rdtsc();
+
+    // also re-anchors if the TSC appears to go backward (e.g., on another CPU)
+    if (not anchor.initialized or tsc - anchor.tsc >= anchor.resync_ticks) {
+      resync(anchor);
+      anchor.last_ns = anchor.ns;
+      return anchor.ns;
+    }
+
+    const uint64_t ns = anchor.ns + static_cast<uint64_t>(
+                        (tsc - anchor.tsc) * anchor.ns_per_tick);
+    anchor.last_ns = max(ns, anchor.last_ns);
+    return anchor.last_ns;
+  }
+#endif
+
+  return clock_ns(CLOCK_MONOTONIC);
+}
+
+uint64_t mono_us()
+{
+  return mono_ns() / 1000;
+}
+
+uint64_t mono_to_wall_us(const uint64_t mono_us)
+{
+  const int64_t offset_ns = clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_MONOTONIC);
+  return mono_us + offset_ns / 1000;
+}
+
+uint64_t wall_to_mono_us(const uint64_t wall_us)
+{
+  const int64_t offset_ns = clock_ns(CLOCK_REALTIME) - clock_ns(CLOCK_MONOTONIC);
+  return wall_us - offset_ns / 1000;
+}
+
+bool mono_clock_uses_tsc()
+{
+#ifdef MONO_CLOCK_TSC
+  return tsc_calibration().usable;
+#else
+  return false;
+#endif
+}
@@ -0,0 +1,28 @@
+#ifndef MONO_CLOCK_HH
+#define MONO_CLOCK_HH
+
+#include <cstdint>
+
+/* Monotonic clock for timestamps on hot paths (e.g., per datagram) and
+ * durations: unlike timestamp_us(), it never steps with NTP adjustments.
+ * Reads the TSC calibrated against CLOCK_MONOTONIC if the TSC is invariant,
+ * or calls clock_gettime(CLOCK_MONOTONIC) (via vDSO) otherwise. */
+
+/* nanoseconds since an unspecified point (that of CLOCK_MONOTONIC) */
+uint64_t mono_ns();
+
+/* microseconds since an unspecified point (that of CLOCK_MONOTONIC) */
+uint64_t mono_us();
+
+/* wall-clock time (microseconds since epoch) of a monotonic time, e.g., for
+ * logs; reflects the current offset between the two clocks */
+uint64_t mono_to_wall_us(const uint64_t mono_us);
+
+/* monotonic time (microseconds) of a wall-clock time, e.g., of kernel
+ * timestamps (SO_TIMESTAMPING reports wall-clock time) */
+uint64_t wall_to_mono_us(const uint64_t wall_us);
+
+/* true if mono_ns() reads the TSC */
+bool mono_clock_uses_tsc();
+
+#endif /* MONO_CLOCK_HH */
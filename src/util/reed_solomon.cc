@@ -0,0 +1,156 @@
+#include <stdexcept>
+#include <utility>
+
+#include "reed_solomon.hh"
+#include "gf256.hh"
+
+using namespace std;
+
+ReedSolomon::ReedSolomon(const size_t k, const size_t m)
+  : k_(k), m_(m), matrix_(k * m)
+{
+  if (k == 0 or k + m > 256) {
+    throw runtime_error("ReedSolomon: invalid number of shards");
+  }
+
+  for (size_t j = 0; j < m; j++) {
+    for (size_t i = 0; i < k; i++) {
+      matrix_[j * k + i] = gf256_inv((k + j) ^ i);
+    }
+  }
+}
+
+void ReedSolomon::encode(const vector<const uint8_t *> & data,
+                         const vector<uint8_t *> & parity,
+                         const size_t len) const
+{
+  if (data.size() != k_ or parity.size() != m_) {
+    throw runtime_error("ReedSolomon: wrong number of shards to encode");
+  }
+
+  for (size_t j = 0; j < m_; j++) {
+    gf256_mul(coef(j, 0), data[0], parity[j], len);
+
+    for (size_t i = 1; i < k_; i++) {
+      gf256_mul_add(coef(j, i), data[i], parity[j], len);
+    }
+  }
+}
+
+bool ReedSolomon::reconstruct(const vector<uint8_t *> & shards,
+                              const vector<bool> & present,
+                              const size_t len) const
+{
+  if (shards.size() != k_ + m_ or present.size() != k_ + m_) {
+    throw runtime_error("ReedSolomon: wrong number of shards to reconstruct");
+  }
+
+  // the missing data shards, and as many parity shards present to solve for
+  // them
+  vector<size_t> missing;
+  vector<size_t> parity;
+
+  for (size_t i = 0; i < k_; i++) {
+    if (not present[i]) {
+      missing.emplace_back(i);
+    }
+  }
+
+  for (size_t j = 0; j < m_ and parity.size() < missing.size(); j++) {
+    if (present[k_ + j]) {
+      parity.emplace_back(j);
+    }
+  }
+
+  if (parity.size() < missing.size()) {
+    return false;
+  }
+
+  const size_t n = missing.size();
+  if (n == 0) {
+    return true;
+  }
+
+  // subtract (i.e., add) the data shards present from the parity shards to
+  // leave the missing shards' share: syndrome_p = sum_e coef(p, e) * data_e
+  for (const size_t j : parity) {
+    for (size_t i = 0; i < k_; i++) {
+      if (present[i]) {
+        gf256_mul_add(coef(j, i), shards[i], shards[k_ + j], len);
+      }
+    }
+  }
+
+  // data_e = sum_p inv[e][p] * syndrome_p, with the inverse of the Cauchy
+  // submatrix of the missing shards' columns and the parity shards' rows
+  vector<uint8_t> a(n * n);
+  for (size_t r = 0; r < n; r++) {
+    for (size_t c = 0; c < n; c++) {
+      a[r * n + c] = coef(parity[r], missing[c]);
+    }
+  }
+
+  invert(a, n);
+
+  for (size_t e = 0; e < n; e++) {
+    uint8_t * dst = shards[missing[e]];
+    gf256_mul(a[e * n], shards[k_ + parity[0]], dst, len);
+
+    for (size_t p = 1; p < n; p++) {
+      gf256_mul_add(a[e * n + p], shards[k_ + parity[p]], dst, len);
+    }
+  }
+
+  // the parity shards used hold syndromes now
+  return true;
+}
+
+void ReedSolomon::invert(vector<uint8_t> & a, const size_t n)
+{
+  // Gauss-Jordan elimination on [a | I]
+  vector<uint8_t> inv(n * n, 0);
+  for (size_t i = 0; i < n; i++) {
+    inv[i * n + i] = 1;
+  }
+
+  for (size_t col = 0; col < n; col++) {
+    // a pivot row (one exists as Cauchy matrices are invertible)
+    size_t pivot = col;
+    while (pivot < n and a[pivot * n + col] == 0) {
+      pivot++;
+    }
+
+    if (pivot == n) {
+      throw runtime_error("ReedSolomon: singular matrix");
+    }
+
+    if (pivot != col) {
+      for (size_t c = 0; c < n; c++) {
+        swap(a[pivot * n + c], a[col * n + c]);
+        swap(inv[pivot * n + c], inv[col * n + c]);
+      }
+    }
+
+    // scale the pivot row to 1
+    const uint8_t scale = gf256_inv(a[col * n + col]);
+    for (size_t c = 0; c < n; c++) {
+      a[col * n + c] = gf256_mul(a[col * n + c], scale);
+      inv[col * n + c] = gf256_mul(inv[col * n + c], scale);
+    }
+
+    // eliminate the column from the other rows
+    for (size_t r = 0; r < n; r++) {
+      const uint8_t factor = a[r * n + col];
+      if (r == col or factor == 0) {
+        continue;
+      }
+
+      for (size_t c = 0; c < n; c++) {
+        a[r * n + c] ^= gf256_mul(factor, a[col * n + c]);
+        inv[r * n + c] ^= gf256_mul(factor, inv[col * n + c]);
+      }
+    }
+  }
+
+  a = move(inv);
+}
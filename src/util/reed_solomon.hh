@@ -0,0 +1,48 @@
+#ifndef REED_SOLOMON_HH
+#define REED_SOLOMON_HH
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// systematic Reed-Solomon erasure code over GF(256): 'k' data shards are sent
+// as is along with 'm' parity shards of the same size, and any k of the k + m
+// shards recover the missing data shards. Parity shard j is the row j of the
+// Cauchy matrix 1 / (x_j + y_i), x_j = k + j and y_i = i, times the data
+// shards, so any square submatrix of it is invertible (k + m <= 256), and
+// the parity of a frame does not depend on m
+class ReedSolomon
+{
+public:
+  ReedSolomon(const size_t k, const size_t m);
+
+  size_t k() const { return k_; }
+  size_t m() const { return m_; }
+
+  // compute the m parity shards of the k data shards, each of 'len' bytes
+  void encode(const std::vector<const uint8_t *> & data,
+              const std::vector<uint8_t *> & parity,
+              const size_t len) const;
+
+  // recover the missing data shards in place: 'shards' are the k data shards
+  // followed by the m parity shards (each of 'len' bytes), and present[i] is
+  // whether shard i is valid (the parity shards present might be overwritten).
+  // Return false if fewer than k are present.
+  bool reconstruct(const std::vector<uint8_t *> & shards,
+                   const std::vector<bool> & present,
+                   const size_t len) const;
+
+private:
+  size_t k_;
+  size_t m_;
+
+  // coefficients of the parity shards: m rows of k
+  std::vector<uint8_t> matrix_;
+
+  uint8_t coef(const size_t j, const size_t i) const { return matrix_[j * k_ + i]; }
+
+  // invert the n x n matrix 'a' (row-major) in place
+  static void invert(std::vector<uint8_t> & a, const size_t n);
+};
+
+#endif /* REED_SOLOMON_HH */
@@ -36,6 +36,20 @@ string WireParser::read_string(const size_t len)
   return ret;
 }
 
+string_view WireParser::read_string_view(const size_t len)
+{
+  if (len > str_.size()) {
+    throw out_of_range("WireParser::read_string_view(): attempted to read past end");
+  }
+
+  const string_view ret = str_.substr(0, len);
+
+  // move the start of string view forward
+  str_.remove_prefix(len);
+
+  return ret;
+}
+
 void WireParser::skip(const size_t len)
 {
   if (len > str_.size()) {
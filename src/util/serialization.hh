@@ -6,6 +6,7 @@
 #include <stdexcept>
 #include <string>
 #include <string_view>
+#include <type_traits>
 
 // convert values from network to host byte order
 inline uint8_t ntoh(uint8_t net) { return net; }
@@ -27,6 +28,16 @@ std::string put_number(const T host)
   return {reinterpret_cast<const char *>(&net), sizeof(net)};
 }
 
+// serialize a number in host byte order into 'dst' without allocating
+// return the end of the serialized number in 'dst'
+template<typename T>
+char * put_number(char * dst, const T host)
+{
+  const T net = hton(host);
+  memcpy(dst, &net, sizeof(net));
+  return dst + sizeof(net);
+}
+
 // deserialize binary data received on wire to a number in host byte order
 template<typename T>
 T get_number(const std::string_view net)
@@ -66,6 +77,68 @@ T get_bits(const T number, const size_t bit_offset, const size_t bit_len)
   return ret;
 }
 
+// compile-time description of a fixed-size wire format: the (integer or
+// enum) members of a struct, serialized in order in network byte order with
+// no padding, e.g., WireFormat<&Foo::a, &Foo::b>::write(foo, buf); offsets
+// and SIZE are constants, so write() and read() compile down to a memcpy
+// and byte swap per field without allocating
+template<auto... Members>
+class WireFormat
+{
+private:
+  template<typename M> struct member;
+
+  template<typename C, typename V>
+  struct member<V C::*>
+  {
+    using value_type = V;
+
+    // integer type of the member on wire
+    using wire_type = typename std::conditional_t<std::is_enum_v<V>,
+        std::underlying_type<V>, std::enable_if<std::is_integral_v<V>, V>>::type;
+  };
+
+  template<auto Member>
+  using wire_type = typename member<decltype(Member)>::wire_type;
+
+  template<auto Member>
+  using value_type = typename member<decltype(Member)>::value_type;
+
+public:
+  // serialized size
+  static constexpr size_t SIZE = (sizeof(wire_type<Members>) + ... + 0);
+
+  // serialize the members of 'obj' into 'dst' (of at least SIZE bytes) and
+  // return the end of the serialized data
+  template<typename T>
+  static char * write(const T & obj, char * dst)
+  {
+    ((dst = put_number(dst, static_cast<wire_type<Members>>(obj.*Members))), ...);
+    return dst;
+  }
+
+  // deserialize the members of 'obj' from 'src' (of at least SIZE bytes)
+  // and return the end of the parsed data
+  template<typename T>
+  static const char * read(T & obj, const char * src)
+  {
+    ((obj.*Members = static_cast<value_type<Members>>(
+        read_number<wire_type<Members>>(src)), src += sizeof(wire_type<Members>)),
+     ...);
+    return src;
+  }
+
+private:
+  // similar to get_number() except with *no* bounds check
+  template<typename W>
+  static W read_number(const char * src)
+  {
+    W net;
+    memcpy(&net, src, sizeof(net));
+    return ntoh(net);
+  }
+};
+
 class WireParser
 {
 public:
@@ -79,6 +152,10 @@ public:
   std::string read_string(const size_t len);
   std::string read_string() { return read_string(str_.size()); }
 
+  // similar to read_string() but return a view into the parsed data (no copy)
+  std::string_view read_string_view(const size_t len);
+  std::string_view read_string_view() { return read_string_view(str_.size()); }
+
   // skip 'len' bytes ahead
   void skip(const size_t len);
 
@@ -0,0 +1,291 @@
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+#include "sliding_window_code.hh"
+#include "gf256.hh"
+
+using namespace std;
+
+namespace {
+  constexpr size_t LENGTH_SIZE = SlidingWindowCode::LENGTH_SIZE;
+
+  // symbol ^= c * (source's length followed by its data)
+  void add_source(const uint8_t c, const string_view data, uint8_t * symbol)
+  {
+    const uint16_t size = data.size();
+    symbol[0] ^= gf256_mul(c, size >> 8);
+    symbol[1] ^= gf256_mul(c, size & 0xff);
+
+    gf256_mul_add(c, reinterpret_cast<const uint8_t *>(data.data()),
+                  symbol + LENGTH_SIZE, data.size());
+  }
+}
+
+uint8_t SlidingWindowCode::coef(const uint32_t repair_id,
+                                const uint32_t source_id)
+{
+  // mix the IDs (splitmix64 finalizer) into a nonzero byte
+  uint64_t x = (static_cast<uint64_t>(repair_id) << 32) | source_id;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111eb;
+  x ^= x >> 31;
+
+  return 1 + x % 255;
+}
+
+void SlidingWindowCode::encode(const uint32_t repair_id,
+                               const vector<Source> & sources,
+                               uint8_t * symbol, const size_t len)
+{
+  memset(symbol, 0, len);
+
+  for (const auto & [source_id, data] : sources) {
+    if (symbol_size(data.size()) > len or data.size() > UINT16_MAX) {
+      throw runtime_error("SlidingWindowCode: source is too large to encode");
+    }
+
+    add_source(coef(repair_id, source_id), data, symbol);
+  }
+}
+
+SlidingWindowDecoder::SlidingWindowDecoder(const size_t capacity,
+                                           const size_t max_data_size)
+  : capacity_(capacity), max_data_size_(max_data_size), slots_(capacity),
+    data_(new uint8_t[capacity * max_data_size]), repairs_(MAX_REPAIRS)
+{
+  if (capacity == 0 or max_data_size > UINT16_MAX) {
+    throw runtime_error("SlidingWindowDecoder: invalid capacity");
+  }
+}
+
+bool SlidingWindowDecoder::expired(const uint32_t id) const
+{
+  return highest_id_ >= capacity_ and id <= highest_id_ - capacity_;
+}
+
+bool SlidingWindowDecoder::has_source(const uint32_t id) const
+{
+  const Slot & slot = slots_[id % capacity_];
+  return slot.valid and slot.id == id;
+}
+
+string_view SlidingWindowDecoder::source(const uint32_t id) const
+{
+  const Slot & slot = slots_[id % capacity_];
+  return {reinterpret_cast<const char *>(
+              data_.get() + (id % capacity_) * max_data_size_), slot.size};
+}
+
+string_view SlidingWindowDecoder::store(const uint32_t id, const uint8_t * data,
+                                        const size_t size)
+{
+  Slot & slot = slots_[id % capacity_];
+  slot.valid = true;
+  slot.id = id;
+  slot.size = size;
+
+  uint8_t * const dst = data_.get() + (id % capacity_) * max_data_size_;
+  memcpy(dst, data, size);
+
+  return {reinterpret_cast<const char *>(dst), size};
+}
+
+void SlidingWindowDecoder::add_source(const uint32_t id, const string_view data)
+{
+  if (data.size() > max_data_size_) {
+    throw runtime_error("SlidingWindowDecoder: source is too large");
+  }
+
+  if (expired(id) or has_source(id)) {
+    return;
+  }
+
+  highest_id_ = max(highest_id_, id);
+  store(id, reinterpret_cast<const uint8_t *>(data.data()), data.size());
+
+  // a new source might complete the ones a repair symbol needs
+  changed_ |= num_repairs_ > 0;
+}
+
+void SlidingWindowDecoder::add_repair(const uint32_t repair_id,
+                                      const vector<uint32_t> & source_ids,
+                                      const string_view symbol)
+{
+  if (source_ids.empty() or symbol.size() <= LENGTH_SIZE or
+      symbol.size() > SlidingWindowCode::symbol_size(max_data_size_)) {
+    throw runtime_error("SlidingWindowDecoder: invalid repair symbol");
+  }
+
+  // sources not received yet are missing once a repair symbol covers them
+  highest_id_ = max(highest_id_, source_ids.back());
+
+  // drop the oldest if full, rotating its slot to the end to be reused
+  if (num_repairs_ == MAX_REPAIRS) {
+    rotate(repairs_.begin(), repairs_.begin() + 1, repairs_.end());
+    num_repairs_--;
+  }
+
+  Repair & repair = repairs_[num_repairs_++];
+  repair.id = repair_id;
+  repair.source_ids.assign(source_ids.begin(), source_ids.end());
+  repair.symbol.assign(symbol.begin(), symbol.end());
+
+  changed_ = true;
+}
+
+bool SlidingWindowDecoder::useful(const Repair & repair) const
+{
+  bool missing = false;
+  for (const uint32_t id : repair.source_ids) {
+    if (expired(id)) {
+      return false;
+    }
+    missing |= not has_source(id);
+  }
+
+  return missing;
+}
+
+const vector<SlidingWindowCode::Source> & SlidingWindowDecoder::recover()
+{
+  recovered_.clear();
+
+  if (not changed_) {
+    return recovered_;
+  }
+  changed_ = false;
+
+  // drop the repair symbols no longer useful, swapping (rather than moving)
+  // them so that the slots keep their buffers
+  size_t num_useful = 0;
+  for (size_t i = 0; i < num_repairs_; i++) {
+    if (useful(repairs_[i])) {
+      if (i != num_useful) {
+        swap(repairs_[i], repairs_[num_useful]);
+      }
+      num_useful++;
+    }
+  }
+  num_repairs_ = num_useful;
+
+  if (num_repairs_ == 0) {
+    return recovered_;
+  }
+
+  // the unknowns: missing sources covered by any repair symbol
+  vector<uint32_t> & unknowns = unknowns_;
+  unknowns.clear();
+  size_t len = 0;
+
+  for (size_t r = 0; r < num_repairs_; r++) {
+    const Repair & repair = repairs_[r];
+    for (const uint32_t id : repair.source_ids) {
+      if (not has_source(id)) {
+        unknowns.emplace_back(id);
+      }
+    }
+    len = max(len, repair.symbol.size());
+  }
+
+  sort(unknowns.begin(), unknowns.end());
+  unknowns.erase(unique(unknowns.begin(), unknowns.end()), unknowns.end());
+
+  // each repair symbol minus the known sources is a linear equation of the
+  // unknowns: coefs * unknowns = syndrome
+  const size_t rows = num_repairs_;
+  const size_t n = unknowns.size();
+  vector<uint8_t> & coefs = coefs_;
+  vector<uint8_t> & syndromes = syndromes_;
+  coefs.assign(rows * n, 0);
+  syndromes.assign(rows * len, 0);
+
+  for (size_t r = 0; r < rows; r++) {
+    const Repair & repair = repairs_[r];
+    uint8_t * const syndrome = &syndromes[r * len];
+    memcpy(syndrome, repair.symbol.data(), repair.symbol.size());
+
+    for (const uint32_t id : repair.source_ids) {
+      const uint8_t c = SlidingWindowCode::coef(repair.id, id);
+
+      if (has_source(id)) {
+        ::add_source(c, source(id), syndrome);
+      } else {
+        const size_t col = lower_bound(unknowns.begin(), unknowns.end(), id)
+                           - unknowns.begin();
+        coefs[r * n + col] = c;
+      }
+    }
+  }
+
+  // Gauss-Jordan elimination of as many unknowns as there are independent
+  // equations; pivot_cols[r] is the unknown of pivot row r
+  vector<size_t> & pivot_cols = pivot_cols_;
+  pivot_cols.clear();
+
+  for (size_t col = 0; col < n and pivot_cols.size() < rows; col++) {
+    const size_t row = pivot_cols.size();
+
+    size_t pivot = row;
+    while (pivot < rows and coefs[pivot * n + col] == 0) {
+      pivot++;
+    }
+
+    if (pivot == rows) {
+      continue; // no equation left involves this unknown
+    }
+
+    if (pivot != row) {
+      swap_ranges(&coefs[pivot * n], &coefs[pivot * n] + n, &coefs[row * n]);
+      swap_ranges(&syndromes[pivot * len], &syndromes[pivot * len] + len,
+                  &syndromes[row * len]);
+    }
+
+    // scale the pivot row to 1
+    const uint8_t scale = gf256_inv(coefs[row * n + col]);
+    for (size_t c = col; c < n; c++) {
+      coefs[row * n + c] = gf256_mul(coefs[row * n + c], scale);
+    }
+    gf256_mul(scale, &syndromes[row * len], &syndromes[row * len], len);
+
+    // eliminate the unknown from the other rows
+    for (size_t r = 0; r < rows; r++) {
+      const uint8_t factor = coefs[r * n + col];
+      if (r == row or factor == 0) {
+        continue;
+      }
+
+      for (size_t c = col; c < n; c++) {
+        coefs[r * n + c] ^= gf256_mul(factor, coefs[row * n + c]);
+      }
+      gf256_mul_add(factor, &syndromes[row * len], &syndromes[r * len], len);
+    }
+
+    pivot_cols.emplace_back(col);
+  }
+
+  // a pivot row without other unknowns left determines its unknown
+  for (size_t r = 0; r < pivot_cols.size(); r++) {
+    const size_t col = pivot_cols[r];
+
+    bool determined = true;
+    for (size_t c = col + 1; c < n and determined; c++) {
+      determined = coefs[r * n + c] == 0;
+    }
+
+    if (not determined) {
+      continue;
+    }
+
+    const uint8_t * const symbol = &syndromes[r * len];
+    const size_t size = (symbol[0] << 8) | symbol[1];
+    if (size > len - LENGTH_SIZE or size > max_data_size_) {
+      continue; // inconsistent repair symbols
+    }
+
+    recovered_.emplace_back(unknowns[col],
+                            store(unknowns[col], symbol + LENGTH_SIZE, size));
+  }
+
+  return recovered_;
+}
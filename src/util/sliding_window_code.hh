@@ -0,0 +1,126 @@
+#ifndef SLIDING_WINDOW_CODE_HH
+#define SLIDING_WINDOW_CODE_HH
+
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <utility>
+
+// sliding-window random linear code over GF(256) (similar to RFC 8681): a
+// repair symbol combines the source symbols in a window, identified by IDs
+// that increase over time, with nonzero pseudorandom coefficients derived
+// from the repair and source IDs. A source symbol is its length (uint16_t)
+// followed by its data, zero-padded to the repair symbol size, so sources of
+// different sizes are coded together and recovered with their sizes.
+// Unlike ReedSolomon, the windows of consecutive repair symbols overlap, so
+// a loss is recovered by any of the repair symbols sent after it within a
+// window, at the cost of a small probability (about 1/256) that the repair
+// symbols received are not independent
+class SlidingWindowCode
+{
+public:
+  // a source symbol: ID and data
+  using Source = std::pair<uint32_t, std::string_view>;
+
+  static constexpr size_t LENGTH_SIZE = sizeof(uint16_t);
+
+  // size of a repair symbol protecting data of up to 'max_data_size' bytes
+  static size_t symbol_size(const size_t max_data_size)
+  { return LENGTH_SIZE + max_data_size; }
+
+  // coefficient of source 'source_id' in repair symbol 'repair_id'
+  static uint8_t coef(const uint32_t repair_id, const uint32_t source_id);
+
+  // compute repair symbol 'repair_id' of 'sources' into 'symbol' (of 'len'
+  // bytes, enough for the largest source)
+  static void encode(const uint32_t repair_id,
+                     const std::vector<Source> & sources,
+                     uint8_t * symbol, const size_t len);
+};
+
+// receiver's side: stores the recent source symbols received and recovers
+// the ones missing from the repair symbols received
+class SlidingWindowDecoder
+{
+public:
+  // keep up to 'capacity' recent source symbols of up to 'max_data_size'
+  // bytes (in fixed-size slots allocated once)
+  SlidingWindowDecoder(const size_t capacity, const size_t max_data_size);
+
+  // add a source symbol received (ignored if known or too old)
+  void add_source(const uint32_t id, const std::string_view data);
+
+  // if source symbol 'id' is known (received or recovered)
+  bool has_source(const uint32_t id) const;
+
+  // add repair symbol 'repair_id' of the sources 'source_ids' (ascending)
+  void add_repair(const uint32_t repair_id,
+                  const std::vector<uint32_t> & source_ids,
+                  const std::string_view symbol);
+
+  // recover the source symbols missing that the repair symbols received
+  // determine, and return them (in ascending order of IDs); the data views
+  // are valid until the next add_source()
+  const std::vector<SlidingWindowCode::Source> & recover();
+
+  // number of repair symbols still useful (covering missing sources)
+  size_t num_repairs() const { return num_repairs_; }
+
+private:
+  size_t capacity_;
+  size_t max_data_size_;
+
+  // source symbol 'id' is stored (if at all) in slot 'id % capacity_'
+  struct Slot
+  {
+    bool valid {false};
+    uint32_t id {0};
+    uint16_t size {0};
+  };
+
+  std::vector<Slot> slots_;
+  std::unique_ptr<uint8_t[]> data_;
+  uint32_t highest_id_ {0}; // highest source ID seen
+
+  struct Repair
+  {
+    uint32_t id {0};
+    std::vector<uint32_t> source_ids {};
+    std::vector<uint8_t> symbol {};
+  };
+
+  // repair symbols kept (the oldest are dropped beyond)
+  static constexpr size_t MAX_REPAIRS = 64;
+
+  // the repair symbols are the first 'num_repairs_' of MAX_REPAIRS slots
+  // (oldest first), whose buffers are reused by the repair symbols to come
+  std::vector<Repair> repairs_;
+  size_t num_repairs_ {0};
+  bool changed_ {false}; // if anything was added since the last recover()
+
+  std::vector<SlidingWindowCode::Source> recovered_ {};
+
+  // scratch space of recover(), reused across calls
+  std::vector<uint32_t> unknowns_ {};
+  std::vector<uint8_t> coefs_ {};
+  std::vector<uint8_t> syndromes_ {};
+  std::vector<size_t> pivot_cols_ {};
+
+  // whether a repair symbol can still help: it covers missing sources and
+  // every source it covers is still stored (so it can be subtracted)
+  bool useful(const Repair & repair) const;
+
+  // store a source symbol in its slot
+  std::string_view store(const uint32_t id, const uint8_t * data,
+                         const size_t size);
+
+  // if source 'id' is too old to be stored
+  bool expired(const uint32_t id) const;
+
+  // a stored source symbol (must be known)
+  std::string_view source(const uint32_t id) const;
+};
+
+#endif /* SLIDING_WINDOW_CODE_HH */
@@ -45,6 +45,10 @@ void Socket::setsockopt(const int level, const int option_name,
                              &option_value, sizeof(option_value)));
 }
 
+// explicit instantiations for the option types used by derived classes
+template socklen_t Socket::getsockopt(const int, const int, int &) const;
+template void Socket::setsockopt(const int, const int, const int &);
+
 void Socket::bind(const Address & local_addr)
 {
   check_syscall(::bind(fd_num(), &local_addr.sock_addr(), local_addr.size()));
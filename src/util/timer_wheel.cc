@@ -0,0 +1,358 @@
+#include <time.h>
+#include <algorithm>
+#include <stdexcept>
+
+#include "timer_wheel.hh"
+#include "mono_clock.hh"
+
+using namespace std;
+
+TimerWheel::TimerWheel()
+  : timerfd_(), current_us_(now_us()), links_(NUM_LISTS)
+{
+  // every list is empty (a head linked to itself)
+  for (uint32_t list = 0; list < NUM_LISTS; list++) {
+    links_[list] = {list, list};
+  }
+}
+
+uint64_t TimerWheel::now_us()
+{
+  return mono_us();
+}
+
+TimerWheel::TimerId TimerWheel::schedule(const uint64_t delay_us,
+                                         const Callback & callback)
+{
+  const uint32_t idx = alloc_timer();
+  Timer & timer = timers_[idx];
+  timer.expiration_us = now_us() + delay_us;
+  timer.callback = callback;
+
+  return add_timer(idx);
+}
+
+TimerWheel::TimerId TimerWheel::schedule_periodic(
+    const uint64_t interval_us, const PeriodicCallback & callback)
+{
+  if (interval_us == 0) {
+    throw runtime_error("TimerWheel: interval must be positive");
+  }
+
+  const uint32_t idx = alloc_timer();
+  Timer & timer = timers_[idx];
+  timer.expiration_us = now_us() + interval_us;
+  timer.interval_us = interval_us;
+  timer.periodic_callback = callback;
+
+  return add_timer(idx);
+}
+
+TimerWheel::TimerId TimerWheel::add_timer(const uint32_t idx)
+{
+  place(idx);
+  num_timers_++;
+
+  // arm the timerfd earlier if this timer expires first
+  const Timer & timer = timers_[idx];
+  if (not armed_us_ or timer.expiration_us < *armed_us_) {
+    arm(timer.expiration_us);
+  }
+
+  return (static_cast<uint64_t>(timer.generation) << 32) | idx;
+}
+
+bool TimerWheel::cancel(const TimerId id)
+{
+  const uint32_t idx = id & UINT32_MAX;
+
+  if (idx >= timers_.size() or timers_[idx].generation != (id >> 32)
+      or timers_[idx].list == FREE) {
+    return false;
+  }
+
+  // a periodic timer cancelled in its own callback is not linked
+  if (timers_[idx].list != FIRING) {
+    unlink(idx);
+  }
+
+  // the timerfd is left armed; expire() does nothing if it fires early
+  free_timer(idx);
+  num_timers_--;
+
+  return true;
+}
+
+void TimerWheel::expire()
+{
+  // the timerfd has fired: rearm it even at the same expiration, in case
+  // it fired slightly before now_us() reached the expiration
+  armed_us_.reset();
+
+  advance(now_us());
+  rearm();
+}
+
+uint32_t TimerWheel::alloc_timer()
+{
+  if (free_timers_.empty()) {
+    timers_.emplace_back();
+    links_.push_back({0, 0});
+    return timers_.size() - 1;
+  }
+
+  const uint32_t idx = free_timers_.back();
+  free_timers_.pop_back();
+  return idx;
+}
+
+void TimerWheel::free_timer(const uint32_t idx)
+{
+  Timer & timer = timers_[idx];
+  timer.generation++;
+  timer.list = FREE;
+  timer.interval_us = 0;
+  timer.callback = nullptr;
+  timer.periodic_callback = nullptr;
+
+  free_timers_.emplace_back(idx);
+}
+
+void TimerWheel::link(const uint32_t list, const uint32_t idx)
+{
+  const uint32_t node = NUM_LISTS + idx;
+  const uint32_t tail = links_[list].prev;
+
+  links_[node] = {tail, list};
+  links_[tail].next = node;
+  links_[list].prev = node;
+
+  timers_[idx].list = list;
+
+  if (list != EXPIRING) {
+    occupied_[list / NUM_SLOTS][list % NUM_SLOTS / 64] |= 1ULL << (list % 64);
+  }
+}
+
+void TimerWheel::unlink(const uint32_t idx)
+{
+  const uint32_t node = NUM_LISTS + idx;
+  const uint32_t list = timers_[idx].list;
+  const Link link = links_[node];
+
+  links_[link.prev].next = link.next;
+  links_[link.next].prev = link.prev;
+
+  timers_[idx].list = FREE;
+
+  // the slot is empty if its head is linked to itself
+  if (list != EXPIRING and links_[list].next == list) {
+    occupied_[list / NUM_SLOTS][list % NUM_SLOTS / 64] &= ~(1ULL << (list % 64));
+  }
+}
+
+void TimerWheel::place(const uint32_t idx)
+{
+  // an overdue timer expires at the next tick to process
+  uint64_t expiration = max(timers_[idx].expiration_us, current_us_);
+
+  // clamp expirations beyond the top level (to be re-placed when cascaded)
+  const uint64_t max_delta = (1ULL << (SLOT_BITS * NUM_LEVELS)) - 1;
+  expiration = min(expiration, current_us_ + max_delta);
+
+  // the lowest level whose range covers the expiration
+  const uint64_t delta = expiration - current_us_;
+  unsigned int level = 0;
+  while (delta >> (SLOT_BITS * (level + 1))) {
+    level++;
+  }
+
+  const uint32_t slot = (expiration >> (SLOT_BITS * level)) & (NUM_SLOTS - 1);
+  link(level * NUM_SLOTS + slot, idx);
+}
+
+optional<uint32_t> TimerWheel::first_occupied(const unsigned int level,
+                                              const uint32_t start) const
+{
+  for (uint32_t word = start / 64; word < NUM_SLOTS / 64; word++) {
+    uint64_t bits = occupied_[level][word];
+
+    // ignore the slots before 'start' in its word
+    if (word == start / 64) {
+      bits &= ~0ULL << (start % 64);
+    }
+
+    if (bits) {
+      return word * 64 + __builtin_ctzll(bits);
+    }
+  }
+
+  return nullopt;
+}
+
+optional<pair<uint64_t, uint32_t>> TimerWheel::next_tick(const uint64_t from) const
+{
+  // higher-level slots starting at 'from' are yet to be cascaded (e.g., if
+  // advance() skipped to 'from'), and might hold earlier timers than level 0
+  for (unsigned int level = 1; level < NUM_LEVELS; level++) {
+    const unsigned int shift = SLOT_BITS * level;
+    if (from & ((1ULL << shift) - 1)) {
+      break;
+    }
+
+    const uint32_t idx = (from >> shift) & (NUM_SLOTS - 1);
+    if (occupied_[level][idx / 64] & (1ULL << (idx % 64))) {
+      return {{from, FREE}};
+    }
+  }
+
+  for (unsigned int level = 0; level < NUM_LEVELS; level++) {
+    const unsigned int shift = SLOT_BITS * level;
+    const uint32_t idx = (from >> shift) & (NUM_SLOTS - 1);
+
+    // slot 'idx' at a higher level has been cascaded, so what is left in it
+    // belongs to the next round of the level
+    const uint32_t start = (level == 0) ? idx : idx + 1;
+
+    const uint64_t round_start = (from >> (shift + SLOT_BITS))
+                                 << (shift + SLOT_BITS);
+
+    const auto slot = first_occupied(level, start);
+    if (slot) {
+      return {{round_start + (static_cast<uint64_t>(*slot) << shift),
+               level * NUM_SLOTS + *slot}};
+    }
+
+    // timers in the next round of this level are cascaded at its start
+    if (first_occupied(level, 0)) {
+      return {{round_start + (1ULL << (shift + SLOT_BITS)), FREE}};
+    }
+  }
+
+  return nullopt;
+}
+
+void TimerWheel::cascade(const uint64_t tick)
+{
+  // from the top level, as timers might move to the slot starting at
+  // 'tick' in a lower level
+  for (unsigned int level = NUM_LEVELS - 1; level > 0; level--) {
+    const unsigned int shift = SLOT_BITS * level;
+
+    if (tick & ((1ULL << shift) - 1)) {
+      continue;
+    }
+
+    const uint32_t list = level * NUM_SLOTS
+                          + ((tick >> shift) & (NUM_SLOTS - 1));
+
+    // timers never return to the slot being cascaded
+    while (links_[list].next != list) {
+      const uint32_t idx = links_[list].next - NUM_LISTS;
+      unlink(idx);
+      place(idx);
+    }
+  }
+}
+
+void TimerWheel::advance(const uint64_t now)
+{
+  while (current_us_ <= now) {
+    const uint64_t tick = current_us_;
+
+    if ((tick & (NUM_SLOTS - 1)) == 0) {
+      cascade(tick);
+    }
+
+    // move the timers expiring at 'tick' out of the wheel first, as their
+    // callbacks might add timers (that expire no earlier than the next tick)
+    const uint32_t list = tick & (NUM_SLOTS - 1);
+    while (links_[list].next != list) {
+      const uint32_t idx = links_[list].next - NUM_LISTS;
+      unlink(idx);
+      link(EXPIRING, idx);
+    }
+
+    current_us_ = tick + 1;
+
+    // a callback might cancel timers that have not fired yet
+    while (links_[EXPIRING].next != EXPIRING) {
+      const uint32_t idx = links_[EXPIRING].next - NUM_LISTS;
+      unlink(idx);
+      fire(idx, now);
+    }
+
+    // skip the ticks with nothing to process
+    const auto next = next_tick(current_us_);
+    current_us_ = next ? min(next->first, now + 1) : now + 1;
+  }
+}
+
+void TimerWheel::fire(const uint32_t idx, const uint64_t now)
+{
+  Timer & timer = timers_[idx];
+
+  if (timer.interval_us == 0) {
+    // free the one-shot timer before its callback might add timers
+    Callback callback = move(timer.callback);
+    free_timer(idx);
+    num_timers_--;
+
+    callback();
+    return;
+  }
+
+  // catch up if the timer expired more than an interval ago
+  const unsigned int num_exp = 1 + (now - timer.expiration_us) / timer.interval_us;
+  timer.expiration_us += num_exp * timer.interval_us;
+  timer.list = FIRING;
+
+  const uint32_t generation = timer.generation;
+  PeriodicCallback callback = move(timer.periodic_callback);
+
+  callback(num_exp);
+
+  // reschedule unless cancelled in the callback ('timer' might be moved)
+  if (timers_[idx].generation == generation) {
+    timers_[idx].periodic_callback = move(callback);
+    place(idx);
+  }
+}
+
+void TimerWheel::rearm()
+{
+  const auto next = next_tick(current_us_);
+
+  if (not next) {
+    // no timers: disarm
+    if (armed_us_) {
+      timerfd_.set_time({0, 0}, {0, 0});
+      armed_us_.reset();
+    }
+    return;
+  }
+
+  const auto [tick, list] = *next;
+  uint64_t expiration = tick;
+
+  if (list != FREE and list >= NUM_SLOTS) {
+    // a higher-level slot is cascaded at 'tick': wake up at its earliest
+    // expiration instead (in the slot's span, so no other timer is earlier)
+    expiration = UINT64_MAX;
+    for (uint32_t node = links_[list].next; node != list;
+         node = links_[node].next) {
+      expiration = min(expiration, timers_[node - NUM_LISTS].expiration_us);
+    }
+  }
+
+  if (armed_us_ != expiration) {
+    arm(expiration);
+  }
+}
+
+void TimerWheel::arm(const uint64_t expiration_us)
+{
+  timerfd_.set_abs_time({static_cast<time_t>(expiration_us / 1000000),
+                         static_cast<long>(expiration_us % 1000000 * 1000)});
+  armed_us_ = expiration_us;
+}
@@ -0,0 +1,138 @@
+#ifndef TIMER_WHEEL_HH
+#define TIMER_WHEEL_HH
+
+#include <array>
+#include <vector>
+#include <optional>
+#include <functional>
+#include <utility>
+
+#include "timerfd.hh"
+
+// hierarchical timer wheel that multiplexes any number of timers onto one
+// timerfd at microsecond granularity: adding and cancelling a timer is O(1),
+// and the timerfd is armed at the earliest expiration; register timerfd()
+// with an event loop and call expire() whenever it is readable
+class TimerWheel
+{
+public:
+  // one-shot timer callback
+  using Callback = std::function<void()>;
+
+  // periodic timer callback with the number of intervals elapsed (> 1 if the
+  // expiration was delayed by more than an interval)
+  using PeriodicCallback = std::function<void(unsigned int num_exp)>;
+
+  // identifies a timer; stays valid until the timer fires (if one-shot) or
+  // is cancelled, and is never reused
+  using TimerId = uint64_t;
+
+  TimerWheel();
+
+  // execute 'callback' once in 'delay_us'
+  TimerId schedule(const uint64_t delay_us, const Callback & callback);
+
+  // execute 'callback' every 'interval_us' (> 0), starting in 'interval_us'
+  TimerId schedule_periodic(const uint64_t interval_us,
+                            const PeriodicCallback & callback);
+
+  // cancel a timer; return false if it has fired (one-shot) or been cancelled
+  bool cancel(const TimerId id);
+
+  // execute the callbacks of expired timers and rearm the timerfd
+  void expire();
+
+  // accessors
+  Timerfd & timerfd() { return timerfd_; }
+  size_t size() const { return num_timers_; }
+
+  // current time (us) of the clock that timers are scheduled on (mono_us(),
+  // which follows CLOCK_MONOTONIC of the timerfd)
+  static uint64_t now_us();
+
+private:
+  // wheel geometry: NUM_LEVELS levels of NUM_SLOTS slots; a slot at level L
+  // spans NUM_SLOTS^L us, so timers up to NUM_SLOTS^NUM_LEVELS us (~71 min)
+  // away fit without being cascaded more than NUM_LEVELS - 1 times
+  static constexpr unsigned int SLOT_BITS = 8;
+  static constexpr unsigned int NUM_SLOTS = 1 << SLOT_BITS;
+  static constexpr unsigned int NUM_LEVELS = 4;
+
+  // a doubly-linked list per slot, plus the list of timers being expired
+  static constexpr uint32_t NUM_LISTS = NUM_LEVELS * NUM_SLOTS + 1;
+  static constexpr uint32_t EXPIRING = NUM_LISTS - 1;
+
+  // list of a timer that is not in any list
+  static constexpr uint32_t FREE = UINT32_MAX;
+  static constexpr uint32_t FIRING = UINT32_MAX - 1;
+
+  struct Timer
+  {
+    uint64_t expiration_us {0};
+    uint64_t interval_us {0}; // 0 if one-shot
+    uint32_t generation {0};  // incremented every time the timer is freed
+    uint32_t list {FREE};     // list (slot) the timer is linked into
+
+    Callback callback {};
+    PeriodicCallback periodic_callback {};
+  };
+
+  // intrusive list node: NUM_LISTS list heads followed by a node per timer
+  struct Link
+  {
+    uint32_t prev;
+    uint32_t next;
+  };
+
+  Timerfd timerfd_;
+
+  // every tick (us) before 'current_us_' has been processed
+  uint64_t current_us_;
+
+  std::vector<Link> links_;
+  std::vector<Timer> timers_ {};
+  std::vector<uint32_t> free_timers_ {};
+  size_t num_timers_ {0};
+
+  // bitmaps of non-empty slots at each level
+  std::array<std::array<uint64_t, NUM_SLOTS / 64>, NUM_LEVELS> occupied_ {};
+
+  // expiration (us) the timerfd is armed at
+  std::optional<uint64_t> armed_us_ {};
+
+  // allocate a timer and return its index in timers_
+  uint32_t alloc_timer();
+  void free_timer(const uint32_t idx);
+
+  TimerId add_timer(const uint32_t idx);
+
+  // link timer 'idx' into (the tail of) 'list', or unlink it from its list
+  void link(const uint32_t list, const uint32_t idx);
+  void unlink(const uint32_t idx);
+
+  // link a timer into the slot for its expiration (relative to current_us_)
+  void place(const uint32_t idx);
+
+  // index of the first non-empty slot at 'level' no less than 'start'
+  std::optional<uint32_t> first_occupied(const unsigned int level,
+                                         const uint32_t start) const;
+
+  // the first tick no less than 'from' at which a slot must be processed
+  // (expired or cascaded to lower levels), and the slot if known
+  std::optional<std::pair<uint64_t, uint32_t>> next_tick(const uint64_t from) const;
+
+  // re-place the timers in the higher-level slots that start at 'tick'
+  void cascade(const uint64_t tick);
+
+  // process every tick up to 'now'
+  void advance(const uint64_t now);
+
+  // execute the callback of an expired timer (and reschedule it if periodic)
+  void fire(const uint32_t idx, const uint64_t now);
+
+  // arm the timerfd at the earliest expiration
+  void rearm();
+  void arm(const uint64_t expiration_us);
+};
+
+#endif /* TIMER_WHEEL_HH */
@@ -1,4 +1,5 @@
 #include "timerfd.hh"
+#include "uring_poller.hh"
 #include "exception.hh"
 #include "conversion.hh"
 
@@ -18,14 +19,53 @@ void Timerfd::set_time(const timespec & initial_expiration,
   check_syscall(timerfd_settime(fd_num(), 0, &its, nullptr));
 }
 
+void Timerfd::set_abs_time(const timespec & expiration)
+{
+  itimerspec its {};
+  its.it_value = expiration;
+
+  check_syscall(timerfd_settime(fd_num(), TFD_TIMER_ABSTIME, &its, nullptr));
+}
+
 unsigned int Timerfd::read_expirations()
 {
   uint64_t num_exp = 0;
 
-  if (check_syscall(::read(fd_num(), &num_exp, sizeof(num_exp)))
-      != sizeof(num_exp)) {
+  const ssize_t ret = ::read(fd_num(), &num_exp, sizeof(num_exp));
+  if (ret < 0 and errno == EWOULDBLOCK) {
+    return 0;
+  }
+
+  if (check_syscall(ret) != sizeof(num_exp)) {
     throw runtime_error("read error in timerfd");
   }
 
   return narrow_cast<unsigned int>(num_exp);
 }
+
+void Timerfd::submit_read_expirations(URingPoller & loop,
+                                      const function<void(unsigned int)> & callback)
+{
+  loop.submit_read(fd_num(), &num_exp_, sizeof(num_exp_),
+                   URingPoller::CURRENT_POSITION,
+    [this, &loop, callback](const int result)
+    {
+      if (result != sizeof(num_exp_)) {
+        throw runtime_error("read error in timerfd");
+      }
+
+      callback(narrow_cast<unsigned int>(num_exp_));
+
+      // read the next expirations
+      submit_read_expirations(loop, callback);
+    }
+  );
+}
+
+void add_timer(URingPoller & loop, Timerfd & timer,
+               const function<void(unsigned int)> & callback)
+{
+  // the kernel waits for the timer to fire rather than failing the read
+  timer.set_blocking(true);
+  timer.submit_read_expirations(loop, callback);
+}
@@ -4,8 +4,12 @@
 #include <time.h>
 #include <sys/timerfd.h>
 
+#include <functional>
+
 #include "file_descriptor.hh"
 
+class URingPoller;
+
 class Timerfd : public FileDescriptor
 {
 public:
@@ -14,7 +18,38 @@ public:
   void set_time(const timespec & initial_expiration,
                 const timespec & interval);
 
+  // fire once at an absolute time of the timer's clock
+  void set_abs_time(const timespec & expiration);
+
+  // return the number of expirations; 0 indicates EWOULDBLOCK (e.g., the
+  // timer was rearmed after it fired)
   unsigned int read_expirations();
+
+  // completion-based counterpart of read_expirations() on an io_uring event
+  // loop (in blocking I/O mode): keep reading expirations and call 'callback'
+  // with the number of expirations every time the timer fires
+  void submit_read_expirations(URingPoller & loop,
+                               const std::function<void(unsigned int)> & callback);
+
+private:
+  uint64_t num_exp_ {0}; // expirations read by submit_read_expirations()
 };
 
+// call 'callback' with the number of expirations whenever 'timer' fires
+template<typename Loop>
+void add_timer(Loop & loop, Timerfd & timer,
+               const std::function<void(unsigned int)> & callback)
+{
+  loop.register_event(timer, Loop::In,
+    [&timer, callback]()
+    {
+      callback(timer.read_expirations());
+    }
+  );
+}
+
+// io_uring: read the expirations with completion-based reads instead
+void add_timer(URingPoller & loop, Timerfd & timer,
+               const std::function<void(unsigned int)> & callback);
+
 #endif /* TIMERFD_HH */
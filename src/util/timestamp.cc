@@ -1,3 +1,4 @@
+#include <sys/resource.h>
 #include <chrono>
 #include "timestamp.hh"
 
@@ -18,3 +19,12 @@ uint64_t timestamp_ms()
 {
   return system_clock::now().time_since_epoch() / 1ms;
 }
+
+uint64_t cpu_time_us()
+{
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000000ULL
+         + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
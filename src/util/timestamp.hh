@@ -12,4 +12,7 @@ uint64_t timestamp_us();
 /* milliseconds since epoch */
 uint64_t timestamp_ms();
 
+/* CPU time (us) consumed by this process in user and kernel space */
+uint64_t cpu_time_us();
+
 #endif /* TIMESTAMP_HH */
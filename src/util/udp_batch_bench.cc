@@ -0,0 +1,169 @@
+#include <getopt.h>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "udp_socket.hh"
+#include "conversion.hh"
+#include "timestamp.hh"
+
+using namespace std;
+
+// global variables in an unnamed namespace
+namespace {
+  constexpr size_t DATAGRAM_SIZE = 1400; // bytes
+}
+
+void print_usage(const string & program_name)
+{
+  cerr <<
+  "Usage: " << program_name << " [options]\n\n"
+  "Sends frames of datagrams over loopback and reports system calls, CPU\n"
+  "time per frame and datagrams/s with send()/recv(), sendmmsg()/recvmmsg()\n"
+  "and sendmmsg()/recvmmsg() with UDP GSO/GRO.\n\n"
+  "Options:\n"
+  "--frames <N>         number of frames to send (default: 20000)\n"
+  "--frame-size <B>     frame size in bytes (default: 62500, i.e.,\n"
+  "                     a 500 kbps keyframe at 9x the average size)"
+  << endl;
+}
+
+enum class Mode {
+  SINGLE,  // send()/recv()
+  BATCH,   // sendmmsg()/recvmmsg()
+  GSO_GRO  // sendmmsg()/recvmmsg() with UDP GSO/GRO
+};
+
+string mode_name(const Mode mode)
+{
+  switch (mode) {
+    case Mode::SINGLE: return "send/recv";
+    case Mode::BATCH: return "sendmmsg/recvmmsg";
+    case Mode::GSO_GRO: return "sendmmsg/recvmmsg + GSO/GRO";
+    default: return "unknown";
+  }
+}
+
+struct BenchResult
+{
+  size_t syscalls {0};
+  size_t datagrams_received {0};
+  uint64_t cpu_us {0};
+  uint64_t wall_us {0};
+};
+
+BenchResult run(const Mode mode, const unsigned int num_frames,
+                const size_t frame_size)
+{
+  UDPSocket receiver;
+  receiver.bind({"127.0.0.1", 0});
+  receiver.set_blocking(false);
+  receiver.set_gro(mode == Mode::GSO_GRO);
+
+  UDPSocket sender;
+  sender.connect(receiver.local_address());
+  sender.set_gso(mode == Mode::GSO_GRO);
+
+  // all datagrams but the last one have the same size (as in Encoder)
+  const size_t frag_cnt = frame_size / (DATAGRAM_SIZE + 1) + 1;
+  const string payload(DATAGRAM_SIZE, 'x');
+  vector<string_view> frame(frag_cnt, payload);
+  frame.back() = string_view(payload).substr(
+      0, frame_size - (frag_cnt - 1) * DATAGRAM_SIZE);
+
+  UDPSocket::RecvBuffers recv_bufs(frag_cnt);
+
+  BenchResult result;
+  const uint64_t cpu_start = cpu_time_us();
+  const uint64_t wall_start = timestamp_us();
+
+  for (unsigned int i = 0; i < num_frames; i++) {
+    // send a frame
+    if (mode == Mode::SINGLE) {
+      for (const auto & datagram : frame) {
+        sender.send(datagram);
+        result.syscalls++;
+      }
+    } else {
+      sender.send_batch(frame);
+      result.syscalls++;
+    }
+
+    // drain the receiver (the last call returns EWOULDBLOCK)
+    while (true) {
+      result.syscalls++;
+
+      if (mode == Mode::SINGLE) {
+        if (not receiver.recv()) {
+          break;
+        }
+        result.datagrams_received++;
+      } else {
+        const size_t num_received = receiver.recv_batch(recv_bufs);
+        if (num_received == 0) {
+          break;
+        }
+        result.datagrams_received += num_received;
+      }
+    }
+  }
+
+  result.cpu_us = cpu_time_us() - cpu_start;
+  result.wall_us = timestamp_us() - wall_start;
+  return result;
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int num_frames = 20000;
+  size_t frame_size = 62500;
+
+  const option cmd_line_opts[] = {
+    {"frames",     required_argument, nullptr, 'N'},
+    {"frame-size", required_argument, nullptr, 'S'},
+    { nullptr,     0,                 nullptr,  0 },
+  };
+
+  while (true) {
+    const int opt = getopt_long(argc, argv, "", cmd_line_opts, nullptr);
+    if (opt == -1) {
+      break;
+    }
+
+    switch (opt) {
+      case 'N':
+        num_frames = strict_stoi(optarg);
+        break;
+      case 'S':
+        frame_size = strict_stoi(optarg);
+        break;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  if (optind != argc or num_frames == 0) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  cerr << "Frames: " << num_frames << ", frame size: " << frame_size
+       << " bytes, datagrams per frame: "
+       << frame_size / (DATAGRAM_SIZE + 1) + 1 << endl;
+
+  for (const Mode mode : {Mode::SINGLE, Mode::BATCH, Mode::GSO_GRO}) {
+    const auto result = run(mode, num_frames, frame_size);
+
+    cerr << mode_name(mode) << ":\n"
+         << "  - Syscalls per frame: "
+         << double_to_string(1.0 * result.syscalls / num_frames) << "\n"
+         << "  - CPU time per frame (us): "
+         << double_to_string(1.0 * result.cpu_us / num_frames) << "\n"
+         << "  - Datagrams received per second: "
+         << double_to_string(1e6 * result.datagrams_received / result.wall_us)
+         << " (" << result.datagrams_received << " in total)" << endl;
+  }
+
+  return EXIT_SUCCESS;
+}
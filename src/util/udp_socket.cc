@@ -1,7 +1,13 @@
 #include <vector>
 #include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
 
 #include "udp_socket.hh"
+#include "uring_poller.hh"
 #include "exception.hh"
 
 using namespace std;
@@ -31,7 +37,12 @@ bool UDPSocket::send(const string_view data)
   }
 
   const ssize_t bytes_sent = ::send(fd_num(), data.data(), data.size(), 0);
-  return check_bytes_sent(bytes_sent, data.size());
+  if (not check_bytes_sent(bytes_sent, data.size())) {
+    return false;
+  }
+
+  next_tx_id_++;
+  return true;
 }
 
 bool UDPSocket::sendto(const Address & dst_addr, const string_view data)
@@ -42,7 +53,12 @@ bool UDPSocket::sendto(const Address & dst_addr, const string_view data)
 
   const ssize_t bytes_sent = ::sendto(fd_num(), data.data(), data.size(), 0,
                                       &dst_addr.sock_addr(), dst_addr.size());
-  return check_bytes_sent(bytes_sent, data.size());
+  if (not check_bytes_sent(bytes_sent, data.size())) {
+    return false;
+  }
+
+  next_tx_id_++;
+  return true;
 }
 
 bool UDPSocket::check_bytes_received(const ssize_t bytes_received) const
@@ -92,3 +108,470 @@ pair<Address, optional<string>> UDPSocket::recvfrom()
   return { Address{src_addr, src_addr_len},
            string{buf.data(), static_cast<size_t>(bytes_received)} };
 }
+
+UDPSocket::RecvBuffers::RecvBuffers(const size_t capacity)
+  : buf_(capacity * UDP_MTU), iovs_(capacity), msgs_(capacity),
+    controls_(capacity)
+{
+  if (capacity == 0 or capacity > MAX_BATCH_SIZE) {
+    throw runtime_error("RecvBuffers: invalid capacity");
+  }
+
+  for (size_t i = 0; i < capacity; i++) {
+    iovs_[i].iov_base = buf_.data() + i * UDP_MTU;
+    iovs_[i].iov_len = UDP_MTU;
+
+    msgs_[i].msg_hdr.msg_iov = &iovs_[i];
+    msgs_[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  // a message coalesced by GRO might contain up to MAX_GSO_SEGMENTS datagrams
+  datagrams_.reserve(capacity * MAX_GSO_SEGMENTS);
+  recv_timestamps_.reserve(capacity * MAX_GSO_SEGMENTS);
+}
+
+string_view UDPSocket::RecvBuffers::operator[](const size_t i) const
+{
+  if (i >= datagrams_.size()) {
+    throw out_of_range("RecvBuffers: datagram index out of range");
+  }
+
+  return datagrams_[i];
+}
+
+msghdr * UDPSocket::RecvBuffers::recvmsg_header(const size_t i)
+{
+  msghdr & hdr = msgs_.at(i).msg_hdr;
+
+  // the control buffer must be reset as the kernel overwrites its length
+  hdr.msg_control = controls_[i].buf;
+  hdr.msg_controllen = sizeof(controls_[i].buf);
+
+  return &hdr;
+}
+
+void UDPSocket::RecvBuffers::set_received(const size_t i, const size_t len)
+{
+  datagrams_.clear();
+  recv_timestamps_.clear();
+
+  msgs_.at(i).msg_len = len;
+  split_message(i);
+}
+
+void UDPSocket::RecvBuffers::split_message(const size_t i)
+{
+  msghdr & hdr = msgs_[i].msg_hdr;
+
+  if (hdr.msg_flags & MSG_TRUNC) {
+    throw runtime_error("UDPSocket::recv_batch(): datagram truncated");
+  }
+
+  // size of the original datagrams if coalesced by GRO
+  size_t segment_size = 0;
+
+  // kernel RX timestamp (shared by the segments)
+  uint64_t recv_ts = 0;
+
+  for (cmsghdr * cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr;
+       cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+    if (cmsg->cmsg_level == SOL_UDP and cmsg->cmsg_type == UDP_GRO) {
+      int gso_size;
+      memcpy(&gso_size, CMSG_DATA(cmsg), sizeof(gso_size));
+      segment_size = gso_size;
+    }
+    else if (cmsg->cmsg_level == SOL_SOCKET and
+             cmsg->cmsg_type == SCM_TIMESTAMPING) {
+      scm_timestamping tss;
+      memcpy(&tss, CMSG_DATA(cmsg), sizeof(tss));
+      recv_ts = tss.ts[0].tv_sec * 1000000ULL + tss.ts[0].tv_nsec / 1000;
+    }
+  }
+
+  const char * data = static_cast<const char *>(iovs_[i].iov_base);
+  size_t len = msgs_[i].msg_len;
+
+  if (segment_size == 0) {
+    segment_size = len; // not coalesced
+  }
+
+  // all segments but the last one have exactly 'segment_size' bytes
+  while (len > segment_size) {
+    datagrams_.emplace_back(data, segment_size);
+    recv_timestamps_.emplace_back(recv_ts);
+    data += segment_size;
+    len -= segment_size;
+  }
+  datagrams_.emplace_back(data, len);
+  recv_timestamps_.emplace_back(recv_ts);
+}
+
+size_t UDPSocket::SendMessages::msg_size(const size_t i) const
+{
+  const msghdr & hdr = msgs_[i].msg_hdr;
+
+  size_t size = 0;
+  for (size_t j = 0; j < hdr.msg_iovlen; j++) {
+    size += hdr.msg_iov[j].iov_len;
+  }
+
+  return size;
+}
+
+void UDPSocket::set_gso(const bool enabled)
+{
+  if (enabled) {
+    // verify that the kernel supports UDP_SEGMENT
+    setsockopt(SOL_UDP, UDP_SEGMENT, int(0));
+  }
+
+  gso_ = enabled;
+}
+
+void UDPSocket::set_gro(const bool enabled)
+{
+  setsockopt(SOL_UDP, UDP_GRO, int(enabled));
+}
+
+void UDPSocket::set_timestamping(const bool rx, const bool tx)
+{
+  int flags = 0;
+
+  if (rx) {
+    flags |= SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE;
+  }
+
+  if (tx) {
+    // identify TX timestamps by ID and return no payload with them
+    flags |= SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_TX_SOFTWARE |
+             SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+  }
+
+  setsockopt(SOL_SOCKET, SO_TIMESTAMPING, flags);
+
+  // the kernel restarts IDs from 0 once SOF_TIMESTAMPING_OPT_ID is set
+  next_tx_id_ = 0;
+}
+
+vector<UDPSocket::TxTimestamp> UDPSocket::recv_tx_timestamps()
+{
+  vector<TxTimestamp> timestamps;
+
+  while (true) {
+    // SCM_TIMESTAMPING and IP_RECVERR (with the offender's address)
+    union {
+      char buf[CMSG_SPACE(sizeof(scm_timestamping))
+               + CMSG_SPACE(sizeof(sock_extended_err) + sizeof(sockaddr_in))];
+      cmsghdr align;
+    } control;
+
+    msghdr hdr {};
+    hdr.msg_control = control.buf;
+    hdr.msg_controllen = sizeof(control.buf);
+
+    if (::recvmsg(fd_num(), &hdr, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+      if (errno == EWOULDBLOCK) {
+        break; // error queue is empty
+      }
+
+      throw unix_error("UDPSocket::recv_tx_timestamps()");
+    }
+
+    optional<uint64_t> ts;
+    optional<uint32_t> tx_id;
+
+    for (cmsghdr * cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr;
+         cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET and
+          cmsg->cmsg_type == SCM_TIMESTAMPING) {
+        scm_timestamping tss;
+        memcpy(&tss, CMSG_DATA(cmsg), sizeof(tss));
+        ts = tss.ts[0].tv_sec * 1000000ULL + tss.ts[0].tv_nsec / 1000;
+      }
+      else if (cmsg->cmsg_level == SOL_IP and cmsg->cmsg_type == IP_RECVERR) {
+        sock_extended_err err;
+        memcpy(&err, CMSG_DATA(cmsg), sizeof(err));
+
+        if (err.ee_errno == ENOMSG and
+            err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+          tx_id = err.ee_data;
+        }
+      }
+    }
+
+    if (ts and tx_id) {
+      timestamps.push_back({*tx_id, *ts});
+    }
+  }
+
+  return timestamps;
+}
+
+void UDPSocket::pack_messages(const vector<GatherDatagram> & datagrams,
+                              SendMessages & msgs) const
+{
+  const size_t batch_size = datagrams.size();
+
+  // up to two iovecs per datagram; never resized below while pointed to
+  msgs.iovs_.resize(2 * batch_size);
+  size_t num_iovs = 0;
+
+  // pack datagrams into messages: one per datagram, or one per GSO buffer
+  msgs.msgs_.clear();
+  msgs.controls_.resize(batch_size);
+  msgs.msg_datagrams_.clear();
+
+  for (size_t i = 0; i < batch_size; ) {
+    // checked before dividing by it below
+    const size_t segment_size = datagrams[i].size();
+    if (segment_size == 0) {
+      throw runtime_error("attempted to send empty data");
+    }
+
+    size_t count = 1;
+
+    if (gso_) {
+      const size_t max_segments = min(MAX_GSO_SEGMENTS,
+                                      MAX_GSO_SIZE / segment_size);
+
+      // a run of equal-sized datagrams...
+      while (i + count < batch_size and count < max_segments and
+             datagrams[i + count].size() == segment_size) {
+        count++;
+      }
+
+      // ...optionally followed by a smaller one (e.g., last fragment), but
+      // not an empty one (left to be rejected above)
+      if (i + count < batch_size and count < max_segments and
+          datagrams[i + count].size() > 0 and
+          datagrams[i + count].size() < segment_size) {
+        count++;
+      }
+    }
+
+    // the kernel segments the iovecs of a GSO buffer as if contiguous
+    const size_t first_iov = num_iovs;
+
+    for (size_t j = i; j < i + count; j++) {
+      for (const string_view part : {datagrams[j].header, datagrams[j].payload}) {
+        if (not part.empty()) {
+          msgs.iovs_[num_iovs].iov_base = const_cast<char *>(part.data());
+          msgs.iovs_[num_iovs].iov_len = part.size();
+          num_iovs++;
+        }
+      }
+    }
+
+    mmsghdr & msg = msgs.msgs_.emplace_back();
+    msg.msg_hdr.msg_iov = &msgs.iovs_[first_iov];
+    msg.msg_hdr.msg_iovlen = num_iovs - first_iov;
+
+    if (count > 1) {
+      // instruct the kernel to segment the buffer into 'segment_size' bytes
+      ControlBuffer & control = msgs.controls_[msgs.msgs_.size() - 1];
+      msg.msg_hdr.msg_control = control.buf;
+      msg.msg_hdr.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+
+      cmsghdr * cmsg = CMSG_FIRSTHDR(&msg.msg_hdr);
+      cmsg->cmsg_level = SOL_UDP;
+      cmsg->cmsg_type = UDP_SEGMENT;
+      cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+
+      const uint16_t gso_size = segment_size;
+      memcpy(CMSG_DATA(cmsg), &gso_size, sizeof(gso_size));
+    }
+
+    msgs.msg_datagrams_.emplace_back(count);
+    i += count;
+  }
+}
+
+size_t UDPSocket::send_batch(const vector<string_view> & datagrams)
+{
+  gather_buf_.clear();
+  for (const auto & datagram : datagrams) {
+    gather_buf_.push_back({{}, datagram});
+  }
+
+  return send_batch(gather_buf_);
+}
+
+size_t UDPSocket::send_batch(const vector<GatherDatagram> & datagrams)
+{
+  pack_messages(datagrams, send_msgs_);
+
+  const size_t num_msgs = send_msgs_.size();
+  size_t msgs_sent = 0;
+  size_t num_sent = 0; // datagrams sent
+
+  while (msgs_sent < num_msgs) {
+    const size_t vlen = min(num_msgs - msgs_sent, MAX_BATCH_SIZE);
+    const int ret = ::sendmmsg(fd_num(), &send_msgs_.msgs_[msgs_sent], vlen, 0);
+
+    if (ret < 0) {
+      if (errno == EWOULDBLOCK) {
+        break; // return the number sent so far to indicate EWOULDBLOCK
+      }
+
+      throw unix_error("UDPSocket::send_batch()");
+    }
+
+    for (size_t i = msgs_sent; i < msgs_sent + ret; i++) {
+      if (send_msgs_.msgs_[i].msg_len != send_msgs_.msg_size(i)) {
+        throw runtime_error("UDPSocket failed to deliver target number of bytes");
+      }
+
+      num_sent += send_msgs_.msg_datagrams_[i];
+    }
+
+    msgs_sent += ret;
+
+    // an error (most likely EWOULDBLOCK) occurred after sending 'ret'
+    if (static_cast<size_t>(ret) < vlen) {
+      break;
+    }
+  }
+
+  assign_tx_ids(send_msgs_, msgs_sent);
+  return num_sent;
+}
+
+void UDPSocket::assign_tx_ids(const SendMessages & msgs, const size_t num_msgs)
+{
+  batch_tx_ids_.clear();
+
+  for (size_t i = 0; i < num_msgs; i++) {
+    batch_tx_ids_.insert(batch_tx_ids_.end(), msgs.msg_datagrams_[i],
+                         next_tx_id_);
+    next_tx_id_++;
+  }
+}
+
+size_t UDPSocket::recv_batch(RecvBuffers & bufs)
+{
+  bufs.datagrams_.clear();
+  bufs.recv_timestamps_.clear();
+
+  for (size_t i = 0; i < bufs.capacity(); i++) {
+    bufs.recvmsg_header(i);
+  }
+
+  // MSG_WAITFORONE: block (if blocking) only until one datagram is received
+  const int ret = ::recvmmsg(fd_num(), bufs.msgs_.data(), bufs.msgs_.size(),
+                             MSG_WAITFORONE, nullptr);
+  if (ret < 0) {
+    if (errno == EWOULDBLOCK) {
+      return 0; // return 0 to indicate EWOULDBLOCK
+    }
+
+    throw unix_error("UDPSocket::recv_batch()");
+  }
+
+  for (int i = 0; i < ret; i++) {
+    bufs.split_message(i);
+  }
+
+  return bufs.size();
+}
+
+struct UDPSocket::PendingBatch
+{
+  // buffers that the messages point into
+  vector<string> datagrams {};
+  vector<SharedBuffer> buffers {};
+
+  SendMessages msgs {};
+  size_t msgs_left {0};
+  size_t num_sent {0};
+};
+
+void UDPSocket::submit_send_batch(URingPoller & loop,
+                                  vector<string> && datagrams,
+                                  const function<void(size_t)> & callback)
+{
+  // keep the batch alive until every message completes
+  const auto batch = make_shared<PendingBatch>();
+  batch->datagrams = move(datagrams);
+
+  vector<GatherDatagram> views;
+  for (const auto & datagram : batch->datagrams) {
+    views.push_back({{}, datagram});
+  }
+
+  submit_pending_batch(loop, batch, views, callback);
+}
+
+void UDPSocket::submit_send_batch(URingPoller & loop,
+                                  vector<GatherDatagram> && datagrams,
+                                  vector<SharedBuffer> && buffers,
+                                  const function<void(size_t)> & callback)
+{
+  const auto batch = make_shared<PendingBatch>();
+  batch->buffers = move(buffers);
+
+  submit_pending_batch(loop, batch, datagrams, callback);
+}
+
+void UDPSocket::submit_pending_batch(URingPoller & loop,
+                                     const shared_ptr<PendingBatch> & batch,
+                                     const vector<GatherDatagram> & datagrams,
+                                     const function<void(size_t)> & callback)
+{
+  pack_messages(datagrams, batch->msgs);
+  batch->msgs_left = batch->msgs.size();
+
+  // the messages are sent in the order submitted
+  assign_tx_ids(batch->msgs, batch->msgs.size());
+
+  for (size_t i = 0; i < batch->msgs.size(); i++) {
+    loop.submit_sendmsg(fd_num(), &batch->msgs.msgs_[i].msg_hdr,
+      [batch, i, callback](const int result)
+      {
+        if (result < 0) {
+          throw system_error(-result, system_category(),
+                             "UDPSocket::submit_send_batch()");
+        }
+
+        if (static_cast<size_t>(result) != batch->msgs.msg_size(i)) {
+          throw runtime_error("UDPSocket failed to deliver target number of bytes");
+        }
+
+        batch->num_sent += batch->msgs.msg_datagrams_[i];
+        batch->msgs_left--;
+
+        if (batch->msgs_left == 0 and callback) {
+          callback(batch->num_sent);
+        }
+      }
+    );
+  }
+}
+
+void UDPSocket::submit_recv(URingPoller & loop, RecvBuffers & bufs,
+                            const function<void()> & callback)
+{
+  for (size_t i = 0; i < bufs.capacity(); i++) {
+    submit_recv_slot(loop, bufs, i, callback);
+  }
+}
+
+void UDPSocket::submit_recv_slot(URingPoller & loop, RecvBuffers & bufs,
+                                 const size_t i,
+                                 const function<void()> & callback)
+{
+  loop.submit_recvmsg(fd_num(), bufs.recvmsg_header(i),
+    [this, &loop, &bufs, i, callback](const int result)
+    {
+      if (result < 0) {
+        throw system_error(-result, system_category(),
+                           "UDPSocket::submit_recv()");
+      }
+
+      bufs.set_received(i, result);
+      callback();
+
+      // keep receiving into the slot
+      submit_recv_slot(loop, bufs, i, callback);
+    }
+  );
+}
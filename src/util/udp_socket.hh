@@ -1,13 +1,23 @@
 #ifndef UDP_SOCKET_HH
 #define UDP_SOCKET_HH
 
+#include <sys/socket.h>
+#include <netinet/udp.h>
+#include <time.h>
+
 #include <string>
 #include <string_view>
 #include <utility>
 #include <optional>
+#include <vector>
+#include <memory>
+#include <functional>
 
 #include "socket.hh"
 #include "address.hh"
+#include "buffer_pool.hh"
+
+class URingPoller;
 
 class UDPSocket : public Socket
 {
@@ -27,11 +37,201 @@ public:
   // receive a datagram and its source address
   std::pair<Address, std::optional<std::string>> recvfrom();
 
+  // storage of ancillary data (control messages) for one message
+  union ControlBuffer {
+    char buf[CMSG_SPACE(sizeof(int))                // UDP_SEGMENT or UDP_GRO
+             + CMSG_SPACE(3 * sizeof(timespec))];   // SCM_TIMESTAMPING
+    cmsghdr align; // ensure proper alignment
+  };
+
+  // caller-owned buffers that recv_batch() receives datagrams into in place;
+  // allocated once and reused across calls to avoid allocating per datagram
+  class RecvBuffers
+  {
+  public:
+    RecvBuffers(const size_t capacity);
+
+    // number of datagrams received by the last recv_batch(); datagrams
+    // coalesced by GRO are counted (and split) into the original datagrams
+    size_t size() const { return datagrams_.size(); }
+    bool empty() const { return datagrams_.empty(); }
+
+    // datagram 'i', valid until the next recv_batch() into these buffers
+    std::string_view operator[](const size_t i) const;
+
+    // kernel RX timestamp (us) of datagram 'i', or 0 if unavailable
+    uint64_t recv_ts(const size_t i) const { return recv_timestamps_.at(i); }
+
+    // max number of messages received at once
+    size_t capacity() const { return msgs_.size(); }
+
+    // forbid copying (message headers point into the buffers)
+    RecvBuffers(const RecvBuffers & other) = delete;
+    const RecvBuffers & operator=(const RecvBuffers & other) = delete;
+
+  private:
+    friend class UDPSocket;
+
+    std::vector<char> buf_;      // one UDP_MTU-sized slot per message
+    std::vector<iovec> iovs_;    // iovs_[i] points to slot i
+    std::vector<mmsghdr> msgs_;  // msgs_[i] receives into iovs_[i]
+    std::vector<ControlBuffer> controls_; // ancillary data of msgs_[i]
+
+    // received datagrams (segments of the messages if coalesced by GRO)
+    std::vector<std::string_view> datagrams_ {};
+    std::vector<uint64_t> recv_timestamps_ {}; // RX timestamps of datagrams_
+
+    // completion-based receiving (e.g., with io_uring) into message slot i:
+    // prepare the header to pass to recvmsg(), and after 'len' bytes are
+    // received, replace the datagrams with the ones in slot i
+    msghdr * recvmsg_header(const size_t i);
+    void set_received(const size_t i, const size_t len);
+
+    // split the message received in slot i and append it to datagrams_
+    void split_message(const size_t i);
+  };
+
+  // datagrams packed into messages to send: one per datagram, or one per
+  // GSO buffer if enabled; reused across sends to avoid allocations
+  class SendMessages
+  {
+  public:
+    SendMessages() {}
+
+    size_t size() const { return msgs_.size(); }
+
+    // forbid copying (message headers point into the buffers)
+    SendMessages(const SendMessages & other) = delete;
+    const SendMessages & operator=(const SendMessages & other) = delete;
+
+  private:
+    friend class UDPSocket;
+
+    std::vector<mmsghdr> msgs_ {};
+    std::vector<iovec> iovs_ {};
+    std::vector<ControlBuffer> controls_ {};
+    std::vector<size_t> msg_datagrams_ {}; // datagrams in each message
+
+    // bytes to send in message i
+    size_t msg_size(const size_t i) const;
+  };
+
+  // a datagram gathered from two buffers, e.g., a header serialized apart
+  // from its payload, and sent with an iovec each instead of being copied
+  // into one buffer (either part can be empty)
+  struct GatherDatagram
+  {
+    std::string_view header {};
+    std::string_view payload {};
+
+    size_t size() const { return header.size() + payload.size(); }
+  };
+
+  // send a batch of datagrams (to a connected address) with sendmmsg()
+  // return the number of datagrams sent from the front of 'datagrams';
+  // fewer than requested indicates EWOULDBLOCK in nonblocking I/O mode
+  size_t send_batch(const std::vector<std::string_view> & datagrams);
+  size_t send_batch(const std::vector<GatherDatagram> & datagrams);
+
+  // UDP generic segmentation offload: send_batch() passes each run of
+  // equal-sized datagrams (optionally followed by a smaller one) to the
+  // kernel as a single buffer that is segmented as late as possible
+  void set_gso(const bool enabled);
+
+  // UDP generic receive offload: let the kernel coalesce datagrams of a flow,
+  // which recv_batch() splits back into the original datagrams
+  void set_gro(const bool enabled);
+
+  // kernel timestamping (SO_TIMESTAMPING) in software: RX timestamps are
+  // available in RecvBuffers::recv_ts(), and TX timestamps must be read from
+  // the error queue with recv_tx_timestamps() (which otherwise takes up the
+  // receive buffer space)
+  void set_timestamping(const bool rx, const bool tx);
+
+  // TX timestamp of the message sent with timestamping ID 'tx_id'
+  struct TxTimestamp
+  {
+    uint32_t tx_id;
+    uint64_t ts; // us, on the same clock as timestamp_us()
+  };
+
+  // read all the TX timestamps in the error queue without blocking
+  std::vector<TxTimestamp> recv_tx_timestamps();
+
+  // timestamping ID of datagram 'i' in the last batch sent (or submitted);
+  // every message sent is assigned the next sequential ID, so the datagrams
+  // packed into a GSO buffer share one
+  uint32_t batch_tx_id(const size_t i) const { return batch_tx_ids_.at(i); }
+
+  // receive up to 'bufs' capacity datagrams into 'bufs' with recvmmsg(),
+  // blocking only until the first one arrives in blocking I/O mode
+  // return the number of datagrams received; 0 indicates EWOULDBLOCK
+  size_t recv_batch(RecvBuffers & bufs);
+
+  // completion-based counterparts of send_batch() and recv_batch() on an
+  // io_uring event loop (the socket should be in blocking I/O mode so that
+  // the kernel waits instead of failing requests with EWOULDBLOCK):
+  // submit_send_batch() owns 'datagrams' until sent and calls 'callback'
+  // with the number of datagrams sent; submit_recv() keeps every message
+  // slot of 'bufs' receiving and calls 'callback' whenever a slot completes,
+  // with 'bufs' holding the datagrams of that slot
+  void submit_send_batch(URingPoller & loop,
+                         std::vector<std::string> && datagrams,
+                         const std::function<void(size_t)> & callback = {});
+
+  // submit_send_batch() of gather datagrams pointing into 'buffers' (e.g.,
+  // serialized headers and shared payloads), which are held until sent
+  void submit_send_batch(URingPoller & loop,
+                         std::vector<GatherDatagram> && datagrams,
+                         std::vector<SharedBuffer> && buffers,
+                         const std::function<void(size_t)> & callback = {});
+  void submit_recv(URingPoller & loop, RecvBuffers & bufs,
+                   const std::function<void()> & callback);
+
+  // max number of datagrams passed to a single sendmmsg()/recvmmsg()
+  static constexpr size_t MAX_BATCH_SIZE = 1024; // UIO_MAXIOV
+
 private:
   bool check_bytes_sent(const ssize_t bytes_sent, const size_t target) const;
   bool check_bytes_received(const ssize_t bytes_received) const;
 
+  // pack 'datagrams' (whose buffers must outlive 'msgs') into 'msgs'
+  void pack_messages(const std::vector<GatherDatagram> & datagrams,
+                     SendMessages & msgs) const;
+
+  // datagrams submitted to io_uring, and their messages in flight
+  struct PendingBatch;
+
+  // pack 'datagrams' into the messages of 'batch' and submit them
+  void submit_pending_batch(URingPoller & loop,
+                            const std::shared_ptr<PendingBatch> & batch,
+                            const std::vector<GatherDatagram> & datagrams,
+                            const std::function<void(size_t)> & callback);
+
+  // assign timestamping IDs to the datagrams in the first 'num_msgs' of 'msgs'
+  void assign_tx_ids(const SendMessages & msgs, const size_t num_msgs);
+
+  // resubmit the receiving into slot i of 'bufs' after every completion
+  void submit_recv_slot(URingPoller & loop, RecvBuffers & bufs,
+                        const size_t i, const std::function<void()> & callback);
+
   static constexpr size_t UDP_MTU = 65536; // bytes
+
+  // limits of a single GSO buffer
+  static constexpr size_t MAX_GSO_SEGMENTS = 64;   // UDP_MAX_SEGMENTS
+  static constexpr size_t MAX_GSO_SIZE = 65507;    // max UDP payload in IPv4
+
+  bool gso_ {false};
+
+  // messages reused across send_batch() calls
+  SendMessages send_msgs_ {};
+
+  // contiguous datagrams passed to send_batch() as gather datagrams
+  std::vector<GatherDatagram> gather_buf_ {};
+
+  // timestamping ID of the next message and of the last batch's datagrams
+  uint32_t next_tx_id_ {0};
+  std::vector<uint32_t> batch_tx_ids_ {};
 };
 
 #endif /* UDP_SOCKET_HH */
@@ -0,0 +1,374 @@
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <csignal>
+#include <algorithm>
+#include <iostream>
+
+#include "uring_poller.hh"
+#include "exception.hh"
+
+using namespace std;
+
+namespace {
+  int io_uring_setup(const unsigned int entries, io_uring_params & params)
+  {
+    return syscall(__NR_io_uring_setup, entries, &params);
+  }
+
+  int io_uring_enter(const int ring_fd, const unsigned int to_submit,
+                     const unsigned int min_complete, const unsigned int flags,
+                     const void * arg, const size_t arg_size)
+  {
+    return syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete,
+                   flags, arg, arg_size);
+  }
+
+  size_t sq_ring_size(const io_uring_params & params)
+  {
+    return params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+  }
+
+  size_t cq_ring_size(const io_uring_params & params)
+  {
+    return params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  }
+
+  // size of the SQ ring mapping, which includes the CQ ring if supported
+  size_t sq_mmap_size(const io_uring_params & params)
+  {
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      return max(sq_ring_size(params), cq_ring_size(params));
+    }
+
+    return sq_ring_size(params);
+  }
+
+  template<typename T>
+  T * ring_ptr(const MMap & ring, const unsigned int offset)
+  {
+    return reinterpret_cast<T *>(ring.addr() + offset);
+  }
+}
+
+URingPoller::URingPoller(const unsigned int queue_depth)
+  : params_(),
+    ring_fd_(check_syscall(io_uring_setup(queue_depth, params_),
+                           "io_uring_setup")),
+    sq_ring_(sq_mmap_size(params_), PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, ring_fd_.fd_num(), IORING_OFF_SQ_RING),
+    sqes_(params_.sq_entries * sizeof(io_uring_sqe), PROT_READ | PROT_WRITE,
+          MAP_SHARED | MAP_POPULATE, ring_fd_.fd_num(), IORING_OFF_SQES)
+{
+  // timeouts in poll() are passed to io_uring_enter() as an extended argument
+  if (not (params_.features & IORING_FEAT_EXT_ARG)) {
+    throw runtime_error("io_uring does not support IORING_FEAT_EXT_ARG");
+  }
+
+  if (not (params_.features & IORING_FEAT_SINGLE_MMAP)) {
+    cq_ring_.emplace(cq_ring_size(params_), PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, ring_fd_.fd_num(),
+                     IORING_OFF_CQ_RING);
+  }
+
+  const MMap & cq_ring = cq_ring_ ? *cq_ring_ : sq_ring_;
+
+  sq_head_ = ring_ptr<unsigned int>(sq_ring_, params_.sq_off.head);
+  sq_tail_ = ring_ptr<unsigned int>(sq_ring_, params_.sq_off.tail);
+  sq_mask_ = *ring_ptr<unsigned int>(sq_ring_, params_.sq_off.ring_mask);
+  sq_array_ = ring_ptr<unsigned int>(sq_ring_, params_.sq_off.array);
+  sqe_array_ = reinterpret_cast<io_uring_sqe *>(sqes_.addr());
+
+  cq_head_ = ring_ptr<unsigned int>(cq_ring, params_.cq_off.head);
+  cq_tail_ = ring_ptr<unsigned int>(cq_ring, params_.cq_off.tail);
+  cq_mask_ = *ring_ptr<unsigned int>(cq_ring, params_.cq_off.ring_mask);
+  cqe_array_ = ring_ptr<io_uring_cqe>(cq_ring, params_.cq_off.cqes);
+}
+
+void URingPoller::register_event(const int fd,
+                                 const Flag flag,
+                                 const Callback callback)
+{
+  Interest & interest = roster_[fd];
+
+  if (interest.callbacks.count(flag)) {
+    throw runtime_error("attempted to register the same event");
+  }
+
+  interest.callbacks[flag] = callback;
+  interest.active |= flag;
+}
+
+void URingPoller::register_event(const FileDescriptor & fd,
+                                 const Flag flag,
+                                 const Callback callback)
+{
+  register_event(fd.fd_num(), flag, callback);
+}
+
+void URingPoller::activate(const int fd, const Flag flag)
+{
+  roster_.at(fd).active |= flag;
+}
+
+void URingPoller::activate(const FileDescriptor & fd, const Flag flag)
+{
+  activate(fd.fd_num(), flag);
+}
+
+void URingPoller::deactivate(const int fd, const Flag flag)
+{
+  roster_.at(fd).active &= ~flag;
+}
+
+void URingPoller::deactivate(const FileDescriptor & fd, const Flag flag)
+{
+  deactivate(fd.fd_num(), flag);
+}
+
+void URingPoller::deregister(const int fd)
+{
+  fds_to_deregister_.emplace(fd);
+}
+
+void URingPoller::deregister(const FileDescriptor & fd)
+{
+  deregister(fd.fd_num());
+}
+
+void URingPoller::do_deregister()
+{
+  for (const int fd : fds_to_deregister_) {
+    auto it = roster_.find(fd);
+    if (it == roster_.end()) {
+      continue;
+    }
+
+    // cancel the poll request in flight; its completion will be ignored
+    if (it->second.poll_request) {
+      io_uring_sqe sqe {};
+      sqe.opcode = IORING_OP_POLL_REMOVE;
+      sqe.fd = -1;
+      sqe.addr = *it->second.poll_request;
+      sqe.user_data = IGNORED;
+      push_sqe(sqe);
+    }
+
+    roster_.erase(it);
+  }
+
+  fds_to_deregister_.clear();
+}
+
+void URingPoller::submit_read(const int fd, void * buf, const size_t len,
+                              const uint64_t offset,
+                              const CompletionCallback callback)
+{
+  io_uring_sqe sqe {};
+  sqe.opcode = IORING_OP_READ;
+  sqe.fd = fd;
+  sqe.addr = reinterpret_cast<uint64_t>(buf);
+  sqe.len = len;
+  sqe.off = offset;
+  sqe.user_data = add_request({fd, false, callback});
+  push_sqe(sqe);
+}
+
+void URingPoller::submit_recvmsg(const int fd, msghdr * msg,
+                                 const CompletionCallback callback)
+{
+  io_uring_sqe sqe {};
+  sqe.opcode = IORING_OP_RECVMSG;
+  sqe.fd = fd;
+  sqe.addr = reinterpret_cast<uint64_t>(msg);
+  sqe.len = 1;
+  sqe.user_data = add_request({fd, false, callback});
+  push_sqe(sqe);
+}
+
+void URingPoller::submit_sendmsg(const int fd, const msghdr * msg,
+                                 const CompletionCallback callback)
+{
+  io_uring_sqe sqe {};
+  sqe.opcode = IORING_OP_SENDMSG;
+  sqe.fd = fd;
+  sqe.addr = reinterpret_cast<uint64_t>(msg);
+  sqe.len = 1;
+  sqe.user_data = add_request({fd, false, callback});
+  push_sqe(sqe);
+}
+
+uint64_t URingPoller::add_request(const Request & request)
+{
+  if (free_requests_.empty()) {
+    requests_.emplace_back(request);
+    return requests_.size() - 1;
+  }
+
+  const uint64_t id = free_requests_.back();
+  free_requests_.pop_back();
+  requests_[id] = request;
+  return id;
+}
+
+void URingPoller::push_sqe(const io_uring_sqe & sqe)
+{
+  // submit the queued SQEs without waiting if the SQ ring is full
+  if (num_unsubmitted_ == params_.sq_entries) {
+    enter(0);
+  }
+
+  // only this thread writes to the SQ tail
+  const unsigned int tail = *sq_tail_;
+  const unsigned int index = tail & sq_mask_;
+
+  sqe_array_[index] = sqe;
+  sq_array_[index] = index;
+
+  // make the SQE visible to the kernel before the tail update
+  __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+  num_unsubmitted_++;
+}
+
+void URingPoller::enter(const unsigned int min_complete, const int timeout_ms)
+{
+  unsigned int flags = 0;
+  __kernel_timespec ts {};
+  io_uring_getevents_arg arg {};
+
+  if (min_complete > 0) {
+    flags |= IORING_ENTER_GETEVENTS;
+
+    if (timeout_ms >= 0) {
+      ts.tv_sec = timeout_ms / 1000;
+      ts.tv_nsec = static_cast<long long>(timeout_ms % 1000) * 1000000;
+
+      arg.sigmask_sz = _NSIG / 8;
+      arg.ts = reinterpret_cast<uint64_t>(&ts);
+      flags |= IORING_ENTER_EXT_ARG;
+    }
+  }
+
+  const bool ext_arg = flags & IORING_ENTER_EXT_ARG;
+  const int ret = io_uring_enter(ring_fd_.fd_num(), num_unsubmitted_,
+                                 min_complete, flags,
+                                 ext_arg ? &arg : nullptr,
+                                 ext_arg ? sizeof(arg) : 0);
+  num_enter_calls_++;
+
+  if (ret < 0) {
+    // nothing was submitted and the wait timed out or was interrupted
+    if (errno == ETIME or errno == EINTR) {
+      return;
+    }
+
+    throw unix_error("io_uring_enter");
+  }
+
+  num_unsubmitted_ -= ret;
+}
+
+void URingPoller::arm_polls()
+{
+  for (auto & [fd, interest] : roster_) {
+    if (interest.armed == interest.active) {
+      continue;
+    }
+
+    // replace the poll request in flight that monitors outdated events
+    if (interest.poll_request) {
+      io_uring_sqe sqe {};
+      sqe.opcode = IORING_OP_POLL_REMOVE;
+      sqe.fd = -1;
+      sqe.addr = *interest.poll_request;
+      sqe.user_data = IGNORED;
+      push_sqe(sqe);
+
+      interest.poll_request.reset();
+    }
+
+    // one-shot poll request that is rearmed after it completes
+    if (interest.active) {
+      io_uring_sqe sqe {};
+      sqe.opcode = IORING_OP_POLL_ADD;
+      sqe.fd = fd;
+      sqe.poll32_events = interest.active;
+      sqe.user_data = add_request({fd, true, {}});
+      push_sqe(sqe);
+
+      interest.poll_request = sqe.user_data;
+    }
+
+    interest.armed = interest.active;
+  }
+}
+
+void URingPoller::reap_completions()
+{
+  // only this thread writes to the CQ head
+  unsigned int head = *cq_head_;
+  const unsigned int tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+
+  while (head != tail) {
+    const io_uring_cqe cqe = cqe_array_[head & cq_mask_];
+
+    // release the CQE to the kernel before executing any callbacks
+    head++;
+    __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+
+    if (cqe.user_data == IGNORED) {
+      continue;
+    }
+
+    // free the request slot (callbacks might submit new requests)
+    const Request request = move(requests_.at(cqe.user_data));
+    requests_[cqe.user_data] = {};
+    free_requests_.emplace_back(cqe.user_data);
+
+    if (not request.readiness) {
+      if (request.callback) {
+        request.callback(cqe.res);
+      }
+      continue;
+    }
+
+    // ignore the completion of a replaced or deregistered poll request
+    auto it = roster_.find(request.fd);
+    if (it == roster_.end() or it->second.poll_request != cqe.user_data) {
+      continue;
+    }
+
+    Interest & interest = it->second;
+    interest.poll_request.reset();
+    interest.armed = 0;
+
+    if (cqe.res < 0) {
+      throw system_error(-cqe.res, system_category(), "io_uring poll");
+    }
+
+    for (const auto & [flag, callback] : interest.callbacks) {
+      if ((cqe.res & flag) and (interest.active & flag)) {
+        callback(); // execute the callback function
+      }
+    }
+  }
+}
+
+void URingPoller::poll(const int timeout_ms)
+{
+  // first, deregister the fds that have been scheduled to deregister
+  do_deregister();
+
+  // (re)arm poll requests for the active events
+  arm_polls();
+
+  // don't wait if completions are already available
+  const bool ready = *cq_head_ != __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  const unsigned int min_complete = (timeout_ms == 0 or ready) ? 0 : 1;
+
+  // submit queued requests and wait for completions in one system call
+  if (min_complete > 0 or num_unsubmitted_ > 0) {
+    enter(min_complete, timeout_ms);
+  }
+
+  reap_completions();
+}
@@ -0,0 +1,158 @@
+#ifndef URING_POLLER_HH
+#define URING_POLLER_HH
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <functional>
+#include <optional>
+
+#include "file_descriptor.hh"
+#include "mmap.hh"
+
+// event loop built on io_uring that offers the same readiness-based
+// interface as Poller and Epoller (implemented with IORING_OP_POLL_ADD) and
+// completion-based I/O; requests are queued without system calls and
+// submitted in a batch by the io_uring_enter() in poll() that also waits
+class URingPoller
+{
+public:
+  // type definitions
+  enum Flag : short {
+    In = POLLIN,
+    Out = POLLOUT
+  };
+
+  using Callback = std::function<void()>;
+
+  // result of a completed request: bytes transferred or -errno
+  using CompletionCallback = std::function<void(const int result)>;
+
+  URingPoller(const unsigned int queue_depth = 256);
+
+  // register a single event (flag) on fd to monitor with a callback function
+  void register_event(const int fd,
+                      const Flag flag,
+                      const Callback callback);
+  void register_event(const FileDescriptor & fd,
+                      const Flag flag,
+                      const Callback callback);
+
+  // activate an event on fd (safe to be called repeatedly)
+  void activate(const int fd, const Flag flag);
+  void activate(const FileDescriptor & fd, const Flag flag);
+
+  // deactivate an event on fd (safe to be called repeatedly)
+  void deactivate(const int fd, const Flag flag);
+  void deactivate(const FileDescriptor & fd, const Flag flag);
+
+  // deregister a fd from the interest list
+  void deregister(const int fd);
+  void deregister(const FileDescriptor & fd);
+
+  // submit queued requests, wait for completions and execute the callbacks
+  void poll(const int timeout_ms = -1);
+
+  // queue completion-based requests; the buffers (and message headers) must
+  // remain valid until 'callback' is executed on completion
+  void submit_read(const int fd, void * buf, const size_t len,
+                   const uint64_t offset, const CompletionCallback callback);
+  void submit_recvmsg(const int fd, msghdr * msg,
+                      const CompletionCallback callback);
+  void submit_sendmsg(const int fd, const msghdr * msg,
+                      const CompletionCallback callback);
+
+  // io_uring_enter() calls made so far (for benchmarking)
+  uint64_t num_enter_calls() const { return num_enter_calls_; }
+
+  // file offset meaning "current file position" in submit_read()
+  static constexpr uint64_t CURRENT_POSITION = -1;
+
+  // forbid copying and moving (rings are mapped into this instance)
+  URingPoller(const URingPoller & other) = delete;
+  const URingPoller & operator=(const URingPoller & other) = delete;
+  URingPoller(URingPoller && other) = delete;
+  URingPoller & operator=(URingPoller && other) = delete;
+
+private:
+  // a request in flight (indexed by the user data of its SQE)
+  struct Request
+  {
+    int fd {-1};
+    bool readiness {false}; // IORING_OP_POLL_ADD for the readiness interface
+    CompletionCallback callback {};
+  };
+
+  // readiness-based state of a registered fd
+  struct Interest
+  {
+    // flag (bit value) -> callback
+    std::unordered_map<Flag, Callback> callbacks {};
+
+    short active {0}; // currently active events (bitmask)
+    short armed {0};  // events monitored by the poll request in flight
+
+    std::optional<uint64_t> poll_request {}; // poll request in flight
+  };
+
+  // user data of requests whose completions are ignored
+  static constexpr uint64_t IGNORED = -1;
+
+  // ring file descriptor and the memory mapped from it
+  io_uring_params params_;
+  FileDescriptor ring_fd_;
+  MMap sq_ring_;
+  std::optional<MMap> cq_ring_ {}; // unless it shares a mapping with SQ ring
+  MMap sqes_;
+
+  // pointers into the mapped rings
+  unsigned int * sq_head_ {nullptr};
+  unsigned int * sq_tail_ {nullptr};
+  unsigned int sq_mask_ {0};
+  unsigned int * sq_array_ {nullptr};
+  io_uring_sqe * sqe_array_ {nullptr};
+  unsigned int * cq_head_ {nullptr};
+  unsigned int * cq_tail_ {nullptr};
+  unsigned int cq_mask_ {0};
+  io_uring_cqe * cqe_array_ {nullptr};
+
+  // SQEs queued but not yet submitted to the kernel
+  unsigned int num_unsubmitted_ {0};
+
+  uint64_t num_enter_calls_ {0};
+
+  // requests in flight (slab allocated) and the free slots
+  std::vector<Request> requests_ {};
+  std::vector<uint64_t> free_requests_ {};
+
+  // fd -> readiness-based state
+  std::unordered_map<int, Interest> roster_ {};
+
+  // fds scheduled to deregister
+  std::unordered_set<int> fds_to_deregister_ {};
+
+  // allocate a request slot and return its index (SQE user data)
+  uint64_t add_request(const Request & request);
+
+  // queue an SQE to submit (submitting the queue first if it's full)
+  void push_sqe(const io_uring_sqe & sqe);
+
+  // submit queued SQEs, and wait for 'min_complete' completions at most
+  // 'timeout_ms' (negative for no timeout)
+  void enter(const unsigned int min_complete, const int timeout_ms = -1);
+
+  // update the poll requests for fds whose active events changed
+  void arm_polls();
+
+  // execute the callbacks of the completed requests
+  void reap_completions();
+
+  // *actually* deregister fds in fds_to_deregister_
+  void do_deregister();
+};
+
+#endif /* URING_POLLER_HH */
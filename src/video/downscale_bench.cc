@@ -0,0 +1,155 @@
+#include <getopt.h>
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <random>
+#include <cstring>
+
+#include "image.hh"
+#include "conversion.hh"
+
+using namespace std;
+using namespace chrono;
+
+void print_usage(const string & program_name)
+{
+  cerr <<
+  "Usage: " << program_name << " [options]\n\n"
+  "Reports the time to downscale a random I420 image to half its width and\n"
+  "height (as simulcast does for each stream below the first) with the\n"
+  "scalar code and with SSSE3 (if supported by the CPU), and checks that\n"
+  "both produce the same image.\n\n"
+  "Options:\n"
+  "--width <W>          width of the image to downscale (default: 1280)\n"
+  "--height <H>         height of the image to downscale (default: 720)\n"
+  "--rounds <N>         rounds of downscaling (default: 1000)"
+  << endl;
+}
+
+// whether the planes of 'a' and 'b' (of the same dimensions) are identical
+bool same_image(const RawImage & a, const RawImage & b)
+{
+  const auto same_plane = [](const uint8_t * pa, const int stride_a,
+                             const uint8_t * pb, const int stride_b,
+                             const unsigned int width,
+                             const unsigned int height)
+  {
+    for (unsigned int row = 0; row < height; row++) {
+      if (memcmp(pa + row * stride_a, pb + row * stride_b, width) != 0) {
+        return false;
+      }
+    }
+
+    return true;
+  };
+
+  const unsigned int w = a.display_width();
+  const unsigned int h = a.display_height();
+
+  return same_plane(a.y_plane(), a.y_stride(), b.y_plane(), b.y_stride(),
+                    w, h) and
+         same_plane(a.u_plane(), a.u_stride(), b.u_plane(), b.u_stride(),
+                    w / 2, h / 2) and
+         same_plane(a.v_plane(), a.v_stride(), b.v_plane(), b.v_stride(),
+                    w / 2, h / 2);
+}
+
+int main(int argc, char * argv[])
+{
+  unsigned int width = 1280;
+  unsigned int height = 720;
+  unsigned int num_rounds = 1000;
+
+  const option cmd_line_opts[] = {
+    {"width",  required_argument, nullptr, 'W'},
+    {"height", required_argument, nullptr, 'H'},
+    {"rounds", required_argument, nullptr, 'N'},
+    { nullptr, 0,                 nullptr,  0 },
+  };
+
+  while (true) {
+    const int opt = getopt_long(argc, argv, "", cmd_line_opts, nullptr);
+    if (opt == -1) {
+      break;
+    }
+
+    switch (opt) {
+      case 'W':
+        width = strict_stoi(optarg);
+        break;
+      case 'H':
+        height = strict_stoi(optarg);
+        break;
+      case 'N':
+        num_rounds = strict_stoi(optarg);
+        break;
+      default:
+        print_usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+  }
+
+  // the downscaled image's dimensions must be even as well (for I420)
+  if (optind != argc or width == 0 or height == 0 or width % 4 or
+      height % 4 or width > UINT16_MAX or height > UINT16_MAX or
+      num_rounds == 0) {
+    print_usage(argv[0]);
+    return EXIT_FAILURE;
+  }
+
+  // random source image
+  RawImage src(width, height);
+  mt19937 prng(0);
+
+  const auto fill_plane = [&prng](uint8_t * plane, const int stride,
+                                  const unsigned int w, const unsigned int h)
+  {
+    for (unsigned int row = 0; row < h; row++) {
+      for (unsigned int col = 0; col < w; col++) {
+        plane[row * stride + col] = prng();
+      }
+    }
+  };
+
+  fill_plane(src.y_plane(), src.y_stride(), width, height);
+  fill_plane(src.u_plane(), src.u_stride(), width / 2, height / 2);
+  fill_plane(src.v_plane(), src.v_stride(), width / 2, height / 2);
+
+  RawImage scalar_dst(width / 2, height / 2);
+  RawImage simd_dst(width / 2, height / 2);
+
+  cerr << "Downscaling " << width << "x" << height << " to " << width / 2
+       << "x" << height / 2 << "\n"
+       << "Avg time per image (us):" << endl;
+
+  const bool default_simd = RawImage::simd();
+
+  for (const bool simd : {false, true}) {
+    if (not RawImage::set_simd(simd)) {
+      cerr << "  - SSSE3: unsupported" << endl;
+      continue;
+    }
+
+    RawImage & dst = simd ? simd_dst : scalar_dst;
+
+    const auto start = steady_clock::now();
+    for (unsigned int round = 0; round < num_rounds; round++) {
+      dst.downscale_from(src);
+    }
+    const auto end = steady_clock::now();
+
+    cerr << "  - " << (simd ? "SSSE3" : "scalar")
+         << (simd == default_simd ? " (default)" : "") << ": "
+         << double_to_string(duration<double, micro>(end - start).count()
+                             / num_rounds) << endl;
+
+    if (simd and not same_image(scalar_dst, simd_dst)) {
+      cerr << "Error: SSSE3 and scalar downscaling differ" << endl;
+      return EXIT_FAILURE;
+    }
+  }
+
+  RawImage::set_simd(default_simd);
+
+  return EXIT_SUCCESS;
+}
@@ -1,10 +1,97 @@
 #include <cstring>
 #include <stdexcept>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define IMAGE_X86 1
+#endif
+
 #include "image.hh"
 
 using namespace std;
 
+namespace {
+  // dst[x] = rounded average of the 2x2 block at column 2x of rows 'src0'
+  // and 'src1', for x in [0, width)
+  void halve_row_scalar(const uint8_t * src0, const uint8_t * src1,
+                        uint8_t * dst, const size_t width)
+  {
+    for (size_t x = 0; x < width; x++) {
+      dst[x] = (src0[2 * x] + src0[2 * x + 1] +
+                src1[2 * x] + src1[2 * x + 1] + 2) >> 2;
+    }
+  }
+
+#ifdef IMAGE_X86
+  // sums of the 2x2 blocks of 16 pixels at 'p0' and 'p1' (16-bit)
+  __attribute__((target("ssse3")))
+  inline __m128i sum_blocks_ssse3(const uint8_t * p0, const uint8_t * p1)
+  {
+    const __m128i ones = _mm_set1_epi8(1);
+    const __m128i r0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p0));
+    const __m128i r1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p1));
+
+    return _mm_add_epi16(_mm_maddubs_epi16(r0, ones),
+                         _mm_maddubs_epi16(r1, ones));
+  }
+
+  __attribute__((target("ssse3")))
+  void halve_row_ssse3(const uint8_t * src0, const uint8_t * src1,
+                       uint8_t * dst, const size_t width)
+  {
+    const __m128i two = _mm_set1_epi16(2);
+
+    size_t x = 0;
+    for (; x + 16 <= width; x += 16) {
+      const __m128i lo = _mm_srli_epi16(_mm_add_epi16(
+          sum_blocks_ssse3(src0 + 2 * x, src1 + 2 * x), two), 2);
+      const __m128i hi = _mm_srli_epi16(_mm_add_epi16(
+          sum_blocks_ssse3(src0 + 2 * x + 16, src1 + 2 * x + 16), two), 2);
+
+      _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x),
+                       _mm_packus_epi16(lo, hi));
+    }
+
+    halve_row_scalar(src0 + 2 * x, src1 + 2 * x, dst + x, width - x);
+  }
+#endif
+
+  bool ssse3_supported()
+  {
+#ifdef IMAGE_X86
+    return __builtin_cpu_supports("ssse3");
+#else
+    return false;
+#endif
+  }
+
+  using HalveRow = void (*)(const uint8_t *, const uint8_t *, uint8_t *,
+                            const size_t);
+
+  // the fastest implementation supported by default
+  HalveRow & halve_row()
+  {
+#ifdef IMAGE_X86
+    static HalveRow f = ssse3_supported() ? halve_row_ssse3 : halve_row_scalar;
+#else
+    static HalveRow f = halve_row_scalar;
+#endif
+    return f;
+  }
+
+  void halve_plane(const uint8_t * src, const int src_stride,
+                   uint8_t * dst, const int dst_stride,
+                   const size_t width, const size_t height)
+  {
+    const HalveRow f = halve_row();
+
+    for (size_t y = 0; y < height; y++) {
+      f(src + 2 * y * src_stride, src + (2 * y + 1) * src_stride,
+        dst + y * dst_stride, width);
+    }
+  }
+}
+
 // constructor that allocates and owns the vpx_image
 RawImage::RawImage(const uint16_t display_width, const uint16_t display_height)
   : vpx_img_(vpx_img_alloc(nullptr, VPX_IMG_FMT_I420,
@@ -94,3 +181,40 @@ void RawImage::copy_v_from(const string_view src)
 
   memcpy(v_plane(), src.data(), src.size());
 }
+
+void RawImage::downscale_from(const RawImage & src)
+{
+  if (src.display_width() != 2 * display_width_ or
+      src.display_height() != 2 * display_height_) {
+    throw runtime_error("RawImage: can only downscale an image twice as large");
+  }
+
+  halve_plane(src.y_plane(), src.y_stride(), y_plane(), y_stride(),
+              display_width_, display_height_);
+  halve_plane(src.u_plane(), src.u_stride(), u_plane(), u_stride(),
+              display_width_ / 2, display_height_ / 2);
+  halve_plane(src.v_plane(), src.v_stride(), v_plane(), v_stride(),
+              display_width_ / 2, display_height_ / 2);
+}
+
+bool RawImage::set_simd(const bool simd)
+{
+  if (not simd) {
+    halve_row() = halve_row_scalar;
+    return true;
+  }
+
+#ifdef IMAGE_X86
+  if (ssse3_supported()) {
+    halve_row() = halve_row_ssse3;
+    return true;
+  }
+#endif
+
+  return false;
+}
+
+bool RawImage::simd()
+{
+  return halve_row() != halve_row_scalar;
+}
@@ -50,6 +50,16 @@ public:
   void copy_u_from(const std::string_view src);
   void copy_v_from(const std::string_view src);
 
+  // downscale 'src', twice as large in each dimension, into this image by
+  // averaging each 2x2 block of pixels (a box filter, which is also bilinear
+  // at this ratio); vectorized with SSSE3 if the CPU supports it
+  void downscale_from(const RawImage & src);
+
+  // whether downscale_from() uses SSSE3 (if supported by the CPU; e.g., to
+  // benchmark it against the scalar version); return false if unsupported
+  static bool set_simd(const bool simd);
+  static bool simd();
+
   // forbid copy and move operators
   RawImage(const RawImage & other) = delete;
   const RawImage & operator=(const RawImage & other) = delete;
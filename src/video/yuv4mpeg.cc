@@ -53,6 +53,10 @@ YUV4MPEG::YUV4MPEG(const string & video_file_path,
         break;
     }
   }
+
+  // frames start right after the header line
+  frames_offset_ = fd_.seek(0, SEEK_CUR);
+  num_frame_records_ = (fd_.file_size() - frames_offset_) / frame_record_size();
 }
 
 bool YUV4MPEG::read_frame(RawImage & raw_img)
@@ -89,3 +93,36 @@ bool YUV4MPEG::read_frame(RawImage & raw_img)
 
   return true;
 }
+
+uint64_t YUV4MPEG::frame_record_offset(const uint64_t frame_idx) const
+{
+  if (num_frame_records_ == 0) {
+    throw runtime_error("YUV4MPEG: no frames to read");
+  }
+
+  if (frame_idx >= num_frame_records_ and not loop_) {
+    throw runtime_error("YUV4MPEG: cannot read past end of file");
+  }
+
+  return frames_offset_ + (frame_idx % num_frame_records_) * frame_record_size();
+}
+
+void YUV4MPEG::parse_frame_record(const string_view record,
+                                  RawImage & raw_img) const
+{
+  if (raw_img.display_width() != display_width_ or
+      raw_img.display_height() != display_height_) {
+    throw runtime_error("YUV4MPEG: image dimensions don't match");
+  }
+
+  if (record.size() != frame_record_size() or
+      record.substr(0, FRAME_HEADER.size()) != FRAME_HEADER) {
+    throw runtime_error("invalid YUV4MPEG2 frame record");
+  }
+
+  // read Y, U, V planes in order
+  const string_view frame = record.substr(FRAME_HEADER.size());
+  raw_img.copy_y_from(frame.substr(0, y_size()));
+  raw_img.copy_u_from(frame.substr(y_size(), uv_size()));
+  raw_img.copy_v_from(frame.substr(y_size() + uv_size(), uv_size()));
+}
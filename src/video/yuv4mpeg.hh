@@ -2,6 +2,7 @@
 #define YUV4MPEG_HH
 
 #include <string>
+#include <string_view>
 
 #include "file_descriptor.hh"
 #include "video_input.hh"
@@ -21,6 +22,16 @@ public:
   // try to fetch a video frame from video file into raw_img
   bool read_frame(RawImage & raw_img) override;
 
+  // for reading frames at explicit offsets (e.g., with io_uring) instead:
+  // a frame record is a frame header without parameters and a frame, and
+  // the file offset of the frame_idx-th record wraps around in 'loop' mode
+  size_t frame_record_size() const { return FRAME_HEADER.size() + frame_size(); }
+  uint64_t frame_record_offset(const uint64_t frame_idx) const;
+
+  // copy a frame record read from the file into raw_img
+  void parse_frame_record(const std::string_view record,
+                          RawImage & raw_img) const;
+
   // accessors
   FileDescriptor & fd() { return fd_; }
   uint16_t display_width() const override { return display_width_; }
@@ -33,6 +44,12 @@ private:
 
   // loop over the file infinitely
   bool loop_;
+
+  // file offset of the first frame and the number of frame records
+  uint64_t frames_offset_ {0};
+  uint64_t num_frame_records_ {0};
+
+  static constexpr std::string_view FRAME_HEADER = "FRAME\n";
 };
 
 #endif /* YUV4MPEG_HH */